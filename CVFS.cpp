@@ -11,7 +11,11 @@
 //    Features:
 //        - Support for multiple open files via the UFDT (Universal File Descriptor Table).
 //        - Permissions for Read, Write, and Read+Write operations.
-//        - Efficient inode-based management for up to 50 files.
+//        - Inode-based management with an inode table that grows on demand, up to the
+//          maximum set with -N (DEFAULTMAXINODES by default).
+//        - Thread-safe core. Locks are always taken in this order:
+//          JOURNAL::ApplyLock, NAMEINDEX::Lock, descriptor stripe, INODE::Lock, then the leaf
+//          locks (UFDTTABLE::Lock, BLOCKPOOL::Lock, INODECOLUMNS::Lock, slab and journal locks).
 //
 //    Author: Gaurav Gavhane
 //    Date: 1 Jan 2025
@@ -22,1090 +26,12672 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
 #include <iostream>
 
-#define MAXINODE 50
+#define DEFAULTMAXINODES (1 << 22)
+#define INODELIMIT (1 << 28)
+#define INODECHUNK 4096
+#define NAMELENGTH 50
+#define PATHLENGTH 256
 
 #define READ 1
 #define WRITE 2
+#define APPEND 4
 
-#define MAXFILESIZE 2048
+#define MAXFILESIZE (64LL * 1024 * 1024 * 1024)
+
+#define BLOCKSIZE 4096
+#define BLOCKSPERCHUNK 256
+#define POOLLIMIT (1LL << 38)
+#define BLOCKMAPINITIAL 4
+#define MAPDIRECT 512
+#define MAPLEAF 512
+#define FILEVIEWSEGMENTS 64
+#define IOVMAX 1024
+#define APPENDAHEAD 16
+#define MAXFILEMAPS 256
+#define MAPENTRIES (BLOCKSIZE / 4 - 1)
+
+#define IMAGEMAGIC "CVFSIMG1"
+#define IMAGEVERSION 5
+#define IMAGEDEFAULTSIZE (1024LL * 1024 * 1024)
+#define IMAGEBYTESPERINODE 16384
+#define IMAGEMININODES 64
+
+#define JOURNALMAGIC 0x4C4E524A
+#define JOURNALBUFFERSIZE (256 * 1024)
+#define JOURNALCHECKPOINTSIZE (64LL * 1024 * 1024)
+#define JOURNALDEFAULTINTERVAL 10
+#define JOURNALDEFAULTBATCH 64
+
+#define JR_CREATE 1
+#define JR_REMOVE 2
+#define JR_WRITE 3
+#define JR_TRUNCATE 4
+#define JR_SETSIZE 5
+#define JR_MKDIR 6
 
 #define REGULAR 1
-#define SPECIAL 2
+#define DIRECTORY 2
 
 #define START 0
 #define CURRENT 1
 #define END 2
+#define DATA 3
+#define HOLE 4
+
+#define FDCHUNKSIZE 1024
+#define FDMAXCHUNKS 1024
+#define FDINDEXBITS 20
+#define FDINDEXMASK ((1 << FDINDEXBITS) - 1)
+#define FDLOCKSTRIPES 64
+
+#define SLABCHUNKOBJECTS 64
+#define SLABCACHESIZE 32
+#define SLABCOUNT 2
+
+#define TIERMINFRAMES 256
+#define READAHEADMIN 4
+#define READAHEADMAX 128
+
+#define ZHASHBITS 12
+#define ZMINMATCH 4
+#define ZMAXPACKED (BLOCKSIZE * 3 / 4)
+#define ZCACHEBLOCKS 256
+
+#define DEDUPINITIAL 1024
+
+#define SNAPSHOTROOT ".snapshots"
+
+#define NAMEINDEXSIZE 128
+#define NAMEFILTERPERSLOT 8
+
+#define PERFOPS 9
+#define PERFERRORS 8
+#define PERFSUBBITS 3
+#define PERFSUBBUCKETS (1 << PERFSUBBITS)
+#define PERFMAXEXP 40
+#define PERFBUCKETS ((PERFMAXEXP - PERFSUBBITS + 2) * PERFSUBBUCKETS)
+
+#define PERF_CREATE 0
+#define PERF_OPEN 1
+#define PERF_CLOSE 2
+#define PERF_READ 3
+#define PERF_WRITE 4
+#define PERF_LSEEK 5
+#define PERF_TRUNCATE 6
+#define PERF_RM 7
+#define PERF_LOOKUP 8
+
+#define TRACEEVENTS 8192
+#define TRACEMAXRINGS 128
+
+#define DCACHESIZE 1024
+#define DCACHELOCKS 64
+
+#define STRESSMAXTHREADS 32
+#define STRESSSHAREDSIZE (64 * 1024)
+#define STRESSWRITESIZE 1024
+#define STRESSWRITES 4
+
+#define STRESS_READ 1
+#define STRESS_MIXED 2
+
+#define SERVERMAXPAYLOAD (1024 * 1024)
+#define SERVERREADSIZE (64 * 1024)
+#define SERVEROUTLIMIT (4 * 1024 * 1024)
+#define SERVEREVENTS 256
+#define SERVERMAXLOOPS 64
+
+#define LOADREADSIZE 512
+#define LOADMAXDEPTH 64
+#define LOADDEFAULTCLIENTS 100
+#define LOADDEFAULTREQUESTS 1000
+#define LOADDEFAULTDEPTH 8
+
+#define BENCHMAXLIST 8
+#define BENCHMAXTHREADS 32
+#define BENCHMAXIOSIZE (1024 * 1024)
+#define BENCHMAXFILEBYTES (1024 * 1024)
+#define BENCHDEFAULTOPS 10000
+#define BENCHDEFAULTIOSIZE 4096
+
+#define BENCH_CREATE 0
+#define BENCH_WRITE 1
+#define BENCH_LSEEK 2
+#define BENCH_READ 3
+#define BENCH_APPEND 4
+#define BENCH_LOOKUP 5
+#define BENCH_OPEN 6
+#define BENCH_CLOSE 7
+#define BENCH_RM 8
+#define BENCHPHASES 9
+
+#define OP_CREATE 1
+#define OP_OPEN 2
+#define OP_CLOSE 3
+#define OP_READ 4
+#define OP_WRITE 5
+#define OP_LSEEK 6
+#define OP_STAT 7
+#define OP_FSTAT 8
+#define OP_RM 9
+#define OP_TRUNCATE 10
+#define OP_PREAD 11
+#define OP_PWRITE 12
+
+#define RINGMAXENTRIES 4096
+#define RINGMAXWORKERS 32
+#define RINGMAXCHAIN 16
+#define RINGWORKERBATCH 16
+#define RINGTESTENTRIES 256
+#define RINGTESTSIZE 1024
+
+#define SQE_LINK 1
+#define SQE_HARDLINK 2
+#define SQE_CHAINFD 4
+
+#define COMMANDSLOTS 128
+#define COMMANDMAXARGS 4
+#define SHELLLINESIZE 1024
+#define SCRIPTREADSIZE (64 * 1024)
+
+#define CMD_LS 1
+#define CMD_CLOSEALL 2
+#define CMD_CLEAR 3
+#define CMD_HELP 4
+#define CMD_SLABSTAT 5
+#define CMD_JOURNAL 6
+#define CMD_SYNC 7
+#define CMD_EXIT 8
+#define CMD_FIND 9
+#define CMD_STAT 10
+#define CMD_FSTAT 11
+#define CMD_CLOSE 12
+#define CMD_RM 13
+#define CMD_MAN 14
+#define CMD_WRITE 15
+#define CMD_TRUNCATE 16
+#define CMD_STRESS 17
+#define CMD_CREATE 18
+#define CMD_OPEN 19
+#define CMD_READ 20
+#define CMD_LSEEK 21
+#define CMD_RING 22
+#define CMD_MKDIR 23
+#define CMD_RMDIR 24
+#define CMD_CD 25
+#define CMD_PWD 26
+#define CMD_DCACHE 27
+#define CMD_TIERSTAT 28
+#define CMD_COMPRESS 29
+#define CMD_DEDUPSTAT 30
+#define CMD_SNAPSHOT 31
+#define CMD_CLONE 32
+#define CMD_PERFSTAT 33
+#define CMD_TRACE 34
+#define CMD_PREAD 35
+#define CMD_PWRITE 36
+#define CMD_MMAP 37
+
+#define FINDBATCH 8
+#define FINDMAXPREDICATES 3
+
+#define FIND_SIZE 1
+#define FIND_PERM 2
+#define FIND_TYPE 3
+#define FIND_LINKS 4
+
+#define FIND_LT 1
+#define FIND_LE 2
+#define FIND_EQ 3
+#define FIND_NE 4
+#define FIND_GE 5
+#define FIND_GT 6
+
+#define INODE_TYPE(p) (INODECOLUMNSobj.FileType[(p)->InodeNumber])
+#define INODE_SIZE(p) (INODECOLUMNSobj.FileActualSize[(p)->InodeNumber])
+#define INODE_COMMITTED(p) __atomic_load_n(&INODE_SIZE(p), __ATOMIC_ACQUIRE)
+#define INODE_PERMISSION(p) (INODECOLUMNSobj.Permission[(p)->InodeNumber])
+#define INODE_PARENT(p) (INODECOLUMNSobj.Parent[(p)->InodeNumber])
+#define INODE_LINKCOUNT(p) (INODECOLUMNSobj.LinkCount[(p)->InodeNumber])
+
+#define IMAGEBLOCK(n) (IMAGEobj.Data + (size_t)((n) - 1) * BLOCKSIZE)
+
+#define SLOT_EMPTY 0
+#define SLOT_USED 1
+#define SLOT_DELETED 2
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
 //    Structure Name : SUPERBLOCK
-//    Description    : States the availability of inodes.
-//    Fields         : int TotalInodes  - Total inodes in the file system.
-//                     int FreeInode    - Number of available inodes.
+//    Description    : States the availability of inodes. Inode numbers are handed out from a
+//                     free list of released inodes first, then in increasing order, and the
+//                     inode columns grow by INODECHUNK entries as the numbers reach their end.
+//                     The allocation fields are changed with the namespace lock held
+//                     exclusively.
+//    Fields         : int MaxInodes    - Most inodes the file system may hold.
+//                     int Capacity     - Entries currently backed in every inode column (index
+//                                        0 is the root).
+//                     int NextInode    - Lowest inode number never handed out; every inode in
+//                                        use is below it.
+//                     int FreeHead     - First inode of the free list (linked through
+//                                        INODECOLUMNS::NextFree), 0 when empty.
+//                     int FreeInode    - Number of available inodes. Only changed with atomic
+//                                        operations, so it can be read without any lock.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 typedef struct superblock
 {
-    int TotalInodes;
+    int MaxInodes;
+    int Capacity;
+    int NextInode;
+    int FreeHead;
     int FreeInode;
 } SUPERBLOCK, *PSUPERBLOCK;
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : BLOCK
+//    Description    : One fixed size data block handed out by the shared block pool.
+//    Fields         : char *Data            - BLOCKSIZE bytes of file data, NULL while the block
+//                                             is evicted under a memory budget.
+//                     unsigned int BlockNo  - Block number inside the mounted image, 0 for heap
+//                                             blocks.
+//                     unsigned int Slot     - Backing file slot holding a copy (1 based), 0 for
+//                                             none.
+//                     int Pins              - Accesses in progress; a pinned block stays resident.
+//                     unsigned char Referenced - CLOCK bit, set on every access.
+//                     unsigned char Dirty   - Data differs from the backing file copy.
+//                     unsigned char Busy    - Being written back or loaded, lock dropped.
+//                     unsigned char Prefetched - Loaded by readahead and not read since.
+//                     unsigned char Incompressible - Did not compress well; not retried until
+//                                             the block is written again.
+//                     char *Packed          - Compressed data, NULL for a plain block. Data is
+//                                             then NULL or a frame of the decompression cache.
+//                     unsigned int PackedSize - Bytes in Packed.
+//                     unsigned char Indexed - In the content index; its data must not change.
+//                     int Shares            - Files sharing the block besides the first one,
+//                                             through deduplication or clones. Changed
+//                                             atomically, so an owner can test it unlocked.
+//                     unsigned int Hash     - Hash of the contents while indexed.
+//                     struct block *HashNext - Next block in the same content index bucket.
+//                     struct block *next    - Next block in the pool free list.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct block
+{
+    char *Data;
+    unsigned int BlockNo;
+    unsigned int Slot;
+    int Pins;
+    unsigned char Referenced;
+    unsigned char Dirty;
+    unsigned char Busy;
+    unsigned char Prefetched;
+    unsigned char Incompressible;
+    char *Packed;
+    unsigned int PackedSize;
+    unsigned char Indexed;
+    int Shares;
+    unsigned int Hash;
+    struct block *HashNext;
+    struct block *next;
+} BLOCK, *PBLOCK;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : BLOCKPOOL
+//    Description    : Shared pool of data blocks. Blocks are carved out of chunks of
+//                     BLOCKSPERCHUNK blocks, so memory only grows with data actually written.
+//                     Block data lives in an anonymous memory file, so that MapFile can map any
+//                     block again at another address. When an image is mounted, block data lives
+//                     in the image instead and only the descriptors come from the pool.
+//    Fields         : PBLOCK FreeList        - Blocks available for reuse.
+//                     PBLOCK SpareDescriptors - Descriptors without data, used for image blocks.
+//                     long long TotalBlocks  - Blocks carved out so far.
+//                     long long FreeBlocks   - Blocks currently on the free list.
+//                     int fd                 - Memory file holding the block data.
+//                     char *Base             - POOLLIMIT byte mapping of the memory file, NULL
+//                                              until the first chunk is carved. The file grows
+//                                              by one chunk at a time behind it.
+//                     pthread_mutex_t Lock   - Protects the pool and the image block allocator.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct blockpool
+{
+    PBLOCK FreeList;
+    PBLOCK SpareDescriptors;
+    long long TotalBlocks;
+    long long FreeBlocks;
+    int fd;
+    char *Base;
+    pthread_mutex_t Lock;
+} BLOCKPOOL;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : TIER
+//    Description    : Memory budget for block data. When enabled, block data lives in a fixed
+//                     arena of frames instead of the block pool, and cold blocks are evicted by
+//                     a CLOCK sweep to a backing file, then faulted back in on access. Image
+//                     mode does not use it: the kernel already pages the mapped image.
+//    Fields         : long long Frames          - Frames in the arena, 0 when disabled.
+//                     char *Arena               - Frames * BLOCKSIZE bytes of block data.
+//                     int ArenaFd               - Anonymous memory file the arena is mapped from.
+//                     PBLOCK *Owner             - Block using each frame, NULL if none.
+//                     long long *FreeFrames     - Stack of unused frames.
+//                     long long FreeCount       - Entries in FreeFrames.
+//                     long long Hand            - CLOCK hand.
+//                     int fd                    - Unlinked backing file.
+//                     unsigned int NextSlot     - Backing file slots handed out so far.
+//                     unsigned int *FreeSlots   - Stack of released slots.
+//                     long long FreeSlotCount, SlotCapacity - Entries in and size of FreeSlots.
+//                     long long Hits, Misses    - Accesses that found the block resident or not.
+//                     long long Readahead       - Blocks loaded by readahead.
+//                     long long ReadaheadHits   - Prefetched blocks later read.
+//                     long long Evictions       - Blocks evicted.
+//                     long long Writebacks      - Evictions that wrote to the backing file.
+//                     int Compress              - Cold blocks may be compressed. Set once at
+//                                                 startup, like Frames.
+//                     char *Cache               - ZCACHEBLOCKS frames of decompressed data.
+//                     PBLOCK *CacheOwner        - Compressed block using each cache frame.
+//                     int CacheHand             - Next cache frame to reuse.
+//                     long long PackedBlocks, PackedBytes - Compressed blocks and their size.
+//                     long long Decompressions  - Reads that decompressed a block.
+//                     long long CacheHits       - Reads served from the decompression cache.
+//                     long long Inflations      - Writes that turned a block back into a plain
+//                                                 one.
+//                     pthread_mutex_t Lock      - Protects all of the above and the tier fields
+//                                                 of every BLOCK. Taken before BLOCKPOOL::Lock.
+//                     pthread_cond_t Done       - Signalled when a busy block becomes idle.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct tier
+{
+    long long Frames;
+    char *Arena;
+    int ArenaFd;
+    PBLOCK *Owner;
+    long long *FreeFrames;
+    long long FreeCount;
+    long long Hand;
+    int fd;
+    unsigned int NextSlot;
+    unsigned int *FreeSlots;
+    long long FreeSlotCount;
+    long long SlotCapacity;
+    long long Hits;
+    long long Misses;
+    long long Readahead;
+    long long ReadaheadHits;
+    long long Evictions;
+    long long Writebacks;
+    int Compress;
+    char *Cache;
+    PBLOCK *CacheOwner;
+    int CacheHand;
+    long long PackedBlocks;
+    long long PackedBytes;
+    long long Decompressions;
+    long long CacheHits;
+    long long Inflations;
+    pthread_mutex_t Lock;
+    pthread_cond_t Done;
+} TIER;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : DEDUP
+//    Description    : Content index of full data blocks. Files whose blocks hold the same bytes
+//                     share one block, which is copied again before any of them modifies it.
+//                     Clones and snapshots share blocks the same way. Image blocks are never
+//                     shared.
+//    Fields         : PBLOCK *Buckets       - Chains of indexed blocks by content hash.
+//                     long long Size        - Number of buckets, a power of two.
+//                     long long Count       - Indexed blocks.
+//                     long long Blocks      - Heap data blocks held by files.
+//                     long long Shared      - Sum of BLOCK::Shares, i.e. blocks saved.
+//                     long long Lookups     - Filled blocks looked up.
+//                     long long Matches     - Lookups that found an identical block.
+//                     long long Copies      - Shared blocks copied before a write.
+//                     pthread_mutex_t Lock  - Protects the index and the Indexed, Shares, Hash
+//                                             and HashNext fields of every BLOCK. Taken with the
+//                                             inode lock held, before TIER::Lock.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct dedup
+{
+    PBLOCK *Buckets;
+    long long Size;
+    long long Count;
+    long long Blocks;
+    long long Shared;
+    long long Lookups;
+    long long Matches;
+    long long Copies;
+    pthread_mutex_t Lock;
+} DEDUP;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
 //    Structure Name : INODE
 //    Description    : Represents a file in the file system, containing metadata and a data buffer.
-//    Fields         : char FileName[50]    - Name of the file.
+//                     The hot fields (type, size, permission, link count) are not stored here but
+//                     in INODECOLUMNS, indexed by InodeNumber; use the INODE_* accessors.
+//    Fields         : char *FileName       - Name of the file inside its directory, NAMELENGTH
+//                                            bytes inside INODECOLUMNS::FileName.
 //                     int InodeNumber      - Unique inode number.
-//                     int FileSize         - Maximum file size.
-//                     int FileActualSize   - Current size of the file.
-//                     int FileType         - Type of file (REGULAR or SPECIAL).
-//                     char *Buffer         - Data buffer.
-//                     int LinkCount        - Number of links to this file.
+//                     long long FileSize   - Maximum file size.
+//                     PBLOCK *BlockMap     - First MAPDIRECT data blocks of the file, indexed by
+//                                            offset / BLOCKSIZE. A NULL entry is a hole: it has
+//                                            never been written and reads as zeros.
+//                     long long MapSize    - Number of entries allocated in BlockMap.
+//                     PBLOCK **MapLeaves   - Later data blocks, MAPLEAF per leaf. A NULL leaf is a
+//                                            hole of MAPLEAF blocks that takes no memory.
+//                     long long LeafCount  - Number of entries allocated in MapLeaves.
+//                     unsigned int *MapChain - Image block numbers of the file's on-disk map
+//                                            blocks, in chain order (image mode only).
+//                     int MapChainCount    - Number of entries in MapChain.
 //                     int ReferenceCount   - Number of active references to this file.
-//                     int permission       - Permissions (READ, WRITE, or READ+WRITE).
-//                     struct inode *next   - Pointer to the next inode in the linked list.
+//                     int PinCount         - Number of FILEVIEWs and FILEMAPs borrowing the
+//                                            file's blocks.
+//                     int MapCount         - Number of FILEMAPs of the file.
+//                     long long AppendEnd  - End of the space reserved by appenders. Ahead of the
+//                                            size while appends are being copied; at or below it
+//                                            otherwise.
+//                     struct filetable *OpenList - Open file table entries referring to this inode.
+//                     pthread_rwlock_t Lock - Shared for reads, stat and appends into allocated
+//                                            blocks, exclusive for other changes to the data,
+//                                            size, block map or OpenList.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 typedef struct inode
 {
-    char FileName[50];
+    char *FileName;
     int InodeNumber;
-    int FileSize;
-    int FileActualSize;
-    int FileType;
-    char *Buffer;
-    int LinkCount;
+    long long FileSize;
+    PBLOCK *BlockMap;
+    long long MapSize;
+    PBLOCK **MapLeaves;
+    long long LeafCount;
+    unsigned int *MapChain;
+    int MapChainCount;
     int ReferenceCount;
-    int permission;
-    struct inode *next;
+    int PinCount;
+    int MapCount;
+    long long AppendEnd;
+    struct filetable *OpenList;
+    pthread_rwlock_t Lock;
 } INODE, *PINODE, **PPINODE;
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : INODECOLUMNS
+//    Description    : Struct-of-arrays table holding the hot inode metadata, indexed by inode
+//                     number. Scans such as ls and find read these contiguous columns instead of
+//                     chasing INODE::next across the heap. Index 0 stands for the root
+//                     directory, which has no inode object; only its entry count is kept.
+//    Fields         : int *FileType             - Type of file (0 when free, REGULAR or DIRECTORY).
+//                     long long *FileActualSize - Current size of the file, or number of
+//                                                 entries of a directory.
+//                     int *Permission           - Permissions (READ, WRITE, or READ+WRITE).
+//                     int *LinkCount            - Number of links to the file.
+//                     int *Parent               - Directory holding the inode, 0 for the root.
+//                     char *FileName            - NAMELENGTH bytes of file name per inode.
+//                     unsigned int *MapHead     - First on-disk map block of each file (image
+//                                                 mode only).
+//                     int *NextFree             - Next inode of the free list, for free inodes.
+//                     PINODE *Inode             - Inode object for each inode number, NULL until
+//                                                 the inode is first used.
+//                     int *FirstChild           - First entry of each directory, 0 when empty.
+//                     int *NextSibling          - Next entry of the same directory, 0 at the end.
+//                     int *PrevSibling          - Previous entry of the same directory; the
+//                                                 first entry's is the last one.
+//                     pthread_mutex_t Lock      - Serialises creating inode objects.
+//                     In memory, every column reserves address space for MaxInodes entries up
+//                     front and SUPERBLOCK::Capacity of them are usable; an image maps its
+//                     columns whole from the file. Only Inode is never stored: with an image
+//                     it is allocated at mount.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct inodecolumns
+{
+    int *FileType;
+    long long *FileActualSize;
+    int *Permission;
+    int *LinkCount;
+    int *Parent;
+    char *FileName;
+    unsigned int *MapHead;
+    int *NextFree;
+    PINODE *Inode;
+    int *FirstChild;
+    int *NextSibling;
+    int *PrevSibling;
+    pthread_mutex_t Lock;
+} INODECOLUMNS;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : FINDPREDICATE
+//    Description    : One parsed condition of the find command, for example size>1000.
+//    Fields         : int Field       - FIND_SIZE, FIND_PERM, FIND_TYPE or FIND_LINKS.
+//                     int Op          - FIND_LT, FIND_LE, FIND_EQ, FIND_NE, FIND_GE or FIND_GT.
+//                     long long Value - Value compared against.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct findpredicate
+{
+    int Field;
+    int Op;
+    long long Value;
+} FINDPREDICATE, *PFINDPREDICATE;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
 //    Structure Name : FILETABLE
 //    Description    : Represents an open file, maintaining its state and position.
-//    Fields         : int readoffset      - Current read offset in the file.
-//                     int writeoffset     - Current write offset in the file.
+//    Fields         : long long readoffset  - Current read offset in the file.
+//                     long long writeoffset - Current write offset in the file.
 //                     int count           - Count of active operations on this file.
 //                     int mode            - Mode of the file (READ, WRITE, or READ+WRITE).
+//                     int Append          - 1 if every write goes to the end of the file.
 //                     PINODE ptrinode     - Pointer to the inode associated with the file.
+//                     long long fd        - Descriptor (handle) that owns this entry.
+//                     struct filetable *nextopen, *prevopen - Links in the inode's OpenList, kept
+//                                           in open order. The first entry's prevopen is the last.
+//                     long long NextRead  - Offset a sequential read would start at.
+//                     long long ReadaheadEnd - End of the range already prefetched.
+//                     int Window          - Readahead window in blocks, 0 when not sequential.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 typedef struct filetable
 {
-    int readoffset;
-    int writeoffset;
+    long long readoffset;
+    long long writeoffset;
     int count;
     int mode;
+    int Append;
     PINODE ptrinode;
+    long long fd;
+    struct filetable *nextopen;
+    struct filetable *prevopen;
+    long long NextRead;
+    long long ReadaheadEnd;
+    int Window;
 } FILETABLE, *PFILETABLE;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Structure Name : UFDT
-//    Description    : Table to keep track of open files in the system.
-//    Fields         : PFILETABLE ptrfiletable - Pointer to the file table of the open file.
+//    Structure Name : FILESTAT
+//    Description    : Snapshot of a file's metadata, as returned by StatFile and FstatFile and
+//                     sent to server clients.
+//    Fields         : char FileName[]           - Name of the file.
+//                     int InodeNumber           - Inode number.
+//                     int FileType              - REGULAR or DIRECTORY.
+//                     long long FileSize        - Maximum file size.
+//                     long long FileActualSize  - Current size of the file.
+//                     long long AllocatedSize   - Bytes of the blocks written to the file; holes
+//                                                 are not counted.
+//                     long long PhysicalSize    - Bytes of block storage the file takes, less
+//                                                 than AllocatedSize when blocks are compressed.
+//                     int LinkCount             - Number of links to the file.
+//                     int ReferenceCount        - Number of open descriptors.
+//                     int Permission            - Permissions (READ, WRITE, or READ+WRITE).
+//                     int Reserved              - Always 0.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-typedef struct ufdt
+typedef struct filestat
 {
-    PFILETABLE ptrfiletable;
-} UFDT;
-
-UFDT UFDTArr[50];
-SUPERBLOCK SUPERBLOCKobj;
-PINODE head = NULL;
+    char FileName[NAMELENGTH];
+    int InodeNumber;
+    int FileType;
+    long long FileSize;
+    long long FileActualSize;
+    long long AllocatedSize;
+    long long PhysicalSize;
+    int LinkCount;
+    int ReferenceCount;
+    int Permission;
+    int Reserved;
+} FILESTAT, *PFILESTAT;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : man
-//    Description   : Provides command usage and descriptions for system operations.
-//    Input         : char* name - Command for which manual entry is required.
-//    Output        : None
+//    Structure Name : FILEVIEW
+//    Description    : Read-only view borrowed from a file's blocks by ReadFileView. The segments
+//                     point straight into block storage (or at a shared zero block for ranges
+//                     never written) and stay valid until ReleaseFileView unpins the inode.
+//    Fields         : struct iovec Segments[] - Borrowed byte ranges, in file order.
+//                     int Count               - Number of segments in use.
+//                     int Length              - Total bytes covered by the segments.
+//                     PINODE ptrinode         - Pinned inode.
+//                     PBLOCK Blocks[]         - Block behind each segment, NULL for zeros; kept
+//                                               resident until the view is released.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-void man(char *name)
+typedef struct fileview
 {
-    if (name == NULL)
-        return;
-
-    if (strcmp(name, "create") == 0)
-    {
-        printf("Description : Used to create new regular file\n");
-        printf("Usage : create File_name permission\n");
-    }
-    else if (strcmp(name, "read") == 0)
-    {
-        printf("Description : Used to read data from regular file\n");
-        printf("Usage : read File_name No_Of_Bytes_To_Read\n");
-    }
-    else if (strcmp(name, "write") == 0)
-    {
-        printf("Description : Used to write into regular file\n");
-        printf("Usage : write File_name\nAfter this write the data that we want to write\n");
-    }
-    else if (strcmp(name, "ls") == 0)
-    {
-        printf("Description : Used to list all the information of file\n");
-        printf("Usage : ls\n");
-    }
-    else if (strcmp(name, "stat") == 0)
-    {
-        printf("Description : Used to display information of file\n");
-        printf("Usage : stat File_name\n");
-    }
-    else if (strcmp(name, "fstat") == 0)
-    {
-        printf("Description : Used to display information of file\n");
-        printf("Usage : fstat File_Descriptor\n");
-    }
-    else if (strcmp(name, "truncate") == 0)
-    {
-        printf("Description : Used to remove data from file\n");
-        printf("Usage : truncate File_name\n");
-    }
-    else if (strcmp(name, "open") == 0)
-    {
-        printf("Description : Used to open existing file\n");
-        printf("Usage : open File_name mode\n");
-    }
-    else if (strcmp(name, "close") == 0)
-    {
-        printf("Description : Used to close opened file\n");
-        printf("Usage : close File_name\n");
-    }
-    else if (strcmp(name, "closeall") == 0)
-    {
-        printf("Description : Used to close all opened file\n");
-        printf("Usage : closeall\n");
-    }
-    else if (strcmp(name, "lseek") == 0)
-    {
-        printf("Description : Used to change file offset\n");
-        printf("Usage : lseek File_name ChangeinOffset StartPoint\n");
-    }
-    else if (strcmp(name, "rm") == 0)
-    {
-        printf("Description : Used to delete the file\n");
-        printf("Usage : rm File_name\n");
-    }
-    else
-    {
-        printf("Error : No manual entry available.\n");
-    }
-}
+    struct iovec Segments[FILEVIEWSEGMENTS];
+    PBLOCK Blocks[FILEVIEWSEGMENTS];
+    int Count;
+    int Length;
+    PINODE ptrinode;
+} FILEVIEW, *PFILEVIEW;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : DisplayHelp
-//    Description   : Displays the list of available commands and their brief descriptions.
-//    Input         : None
-//    Output        : None
+//    Structure Name : FILEMAP
+//    Description    : Memory mapping of a range of a file, created by MapFile. The file's blocks
+//                     are mapped at consecutive addresses, so the range can be used as one
+//                     array. Pages of a writable mapping start read-only; the first store to a
+//                     page faults, marks it dirty and opens it for writing.
+//    Fields         : char *Address          - Start of the mapping.
+//                     long long Offset       - File offset of the first byte, BLOCKSIZE aligned.
+//                     long long Length       - Bytes mapped from the file.
+//                     long long Pages        - BLOCKSIZE pages covering Length.
+//                     int Protection         - READ, or READ+WRITE.
+//                     int Slot               - Entry in MAPTABLE, -1 for a read-only mapping.
+//                     PBLOCK *Blocks         - Block behind each page, NULL for a hole; pinned
+//                                              until the mapping is removed.
+//                     unsigned long long *Dirty - One bit per page written since the last sync.
+//                     PINODE ptrinode        - Mapped inode.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-void DisplayHelp()
+typedef struct filemap
 {
-    printf("ls : To list out all the files\n");
-    printf("clear : To clear console\n");
-    printf("open : To open the file\n");
-    printf("close : To close the file\n");
-    printf("closeall : To close all opened file\n");
-    printf("read : To Read the contents from file\n");
-    printf("write : To write the contents into the file\n");
-    printf("exit : To Terminate the file system\n");
-    printf("stat : To Display information of file using name\n");
-    printf("fstat : To Display information of file using file descriptor\n");
-    printf("truncate : To remove all data the file\n");
-    printf("rm : To delete the file\n");
-}
+    char *Address;
+    long long Offset;
+    long long Length;
+    long long Pages;
+    int Protection;
+    int Slot;
+    PBLOCK *Blocks;
+    unsigned long long *Dirty;
+    PINODE ptrinode;
+} FILEMAP, *PFILEMAP;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : GetFDFromName
-//    Description   : Retrieves the file descriptor for a file given its name.
-//    Input         : char* name - Name of the file.
-//    Output        : int       - File descriptor if found, or -1 if not found.
+//    Structure Name : MAPTABLE
+//    Description    : Writable mappings looked up by the write fault handler. Slots are read
+//                     and cleared with atomics, since the handler cannot take locks.
+//    Fields         : PFILEMAP Maps[]        - Registered mappings, NULL for a free slot.
+//                     int Installed          - 1 once MapFault is the SIGSEGV handler.
+//                     int Active             - Number of MapFault calls in progress. A mapping
+//                                              is only freed once it is out of the table and
+//                                              this has dropped to zero.
+//                     struct sigaction Previous - Handler MapFault replaced, for faults outside
+//                                              the mappings.
+//                     pthread_mutex_t Lock   - Serialises taking and freeing slots.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int GetFDFromName(char *name)
+typedef struct maptable
 {
-    int i = 0;
+    PFILEMAP Maps[MAXFILEMAPS];
+    int Installed;
+    int Active;
+    struct sigaction Previous;
+    pthread_mutex_t Lock;
+} MAPTABLE;
 
-    while (i < 50)
-    {
-        if (UFDTArr[i].ptrfiletable != NULL)
-            if (strcmp((UFDTArr[i].ptrfiletable->ptrinode->FileName), name) == 0)
-                break;
-        i++;
-    }
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : UFDT
+//    Description    : Table to keep track of open files in the system.
+//    Fields         : PFILETABLE ptrfiletable - Pointer to the file table of the open file.
+//                     unsigned int Generation - Bumped every time the slot is released, so that
+//                                               a stale descriptor no longer matches. It only
+//                                               wraps after 2^32 releases of the same slot.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    if (i == 50)
-        return -1;
-    else
-        return i;
-}
+typedef struct ufdt
+{
+    PFILETABLE ptrfiletable;
+    unsigned int Generation;
+} UFDT, *PUFDT;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : Get_Inode
-//    Description   : Retrieves the inode structure for a given file name.
-//    Input         : char* name - Name of the file.
-//    Output        : PINODE    - Pointer to the inode if found, or NULL if not found.
+//    Structure Name : FDLOCK
+//    Description    : One stripe of descriptor locks, padded to its own cache line so threads
+//                    working on different descriptors never share a line.
+//    Fields         : pthread_mutex_t Lock - Held while a descriptor of this stripe is in use.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-PINODE Get_Inode(char *name)
+typedef struct fdlock
 {
-    PINODE temp = head;
-    int i = 0;
+    pthread_mutex_t Lock;
+} __attribute__((aligned(64))) FDLOCK;
 
-    if (name == NULL)
-        return NULL;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : UFDTTABLE
+//    Description    : Growable descriptor table. Slots live in fixed size chunks that are allocated
+//                     on demand and never move, and a two level bitmap gives find-first-zero
+//                     allocation of the lowest free slot.
+//                     A descriptor handed out to callers is the long long
+//                     (Generation << FDINDEXBITS) | slot.
+//    Fields         : PUFDT Chunks[]              - Chunks of FDCHUNKSIZE slots.
+//                     unsigned long long *Used[]  - Per chunk bitmap of allocated slots.
+//                     unsigned long long Full[]   - Bitmap of chunks that have no free slot.
+//                     int ChunkCount              - Number of chunks allocated so far. Chunks are
+//                                                   published before the count, so lookups read
+//                                                   it without a lock.
+//                     int OpenCount               - Number of descriptors in use.
+//                     pthread_mutex_t Lock        - Protects the bitmaps, chunk allocation and
+//                                                   OpenCount.
+//                     FDLOCK Stripes[]            - Descriptor locks; slot s uses stripe
+//                                                   s % FDLOCKSTRIPES. A descriptor's stripe is held
+//                                                   for the whole of every operation on it.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    while (temp != NULL)
-    {
-        if (strcmp(name, temp->FileName) == 0)
-            break;
-        temp = temp->next;
-    }
-    return temp;
-}
+typedef struct ufdttable
+{
+    PUFDT Chunks[FDMAXCHUNKS];
+    unsigned long long *Used[FDMAXCHUNKS];
+    unsigned long long Full[FDMAXCHUNKS / 64];
+    int ChunkCount;
+    int OpenCount;
+    pthread_mutex_t Lock;
+    FDLOCK Stripes[FDLOCKSTRIPES];
+} UFDTTABLE;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : CreateDILB
-//    Description   : Creates the Disk Inode List Block (DILB), initializing all inodes.
-//    Input         : None
-//    Output        : None
+//    Structure Name : NAMESLOT
+//    Description    : One slot of the open addressing directory entry index.
+//    Fields         : unsigned int Hash  - Cached hash of the entry's directory and name.
+//                     int State          - SLOT_EMPTY, SLOT_USED or SLOT_DELETED.
+//                     int InodeNumber    - Inode whose name is stored in this slot.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-void CreateDILB()
+typedef struct nameslot
 {
-    int i = 1;
-    PINODE newn = NULL;
-    PINODE temp = head;
-
-    while (i <= MAXINODE)
-    {
-        newn = (PINODE)malloc(sizeof(INODE));
+    unsigned int Hash;
+    int State;
+    int InodeNumber;
+} NAMESLOT, *PNAMESLOT;
 
-        newn->LinkCount = 0;
-        newn->ReferenceCount = 0;
-        newn->FileType = 0;
-        newn->FileSize = 0;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : NAMEINDEX
+//    Description    : Hash index of directory entries, from (directory, name) to inode, so each
+//                     path component costs one probe instead of a walk over the inode list.
+//                     A counting bloom filter in front of the table answers most negative lookups
+//                     without probing.
+//    Fields         : PNAMESLOT Slots        - Open addressing table (linear probing).
+//                     int Size               - Number of slots, always a power of two.
+//                     int Used               - Number of live entries.
+//                     int Deleted            - Number of tombstones.
+//                     unsigned char *Filter  - Counting bloom filter over the name hashes.
+//                     int FilterSize         - Counters in Filter, NAMEFILTERPERSLOT per slot, so
+//                                              the false positive rate stays low as the table
+//                                              grows. Rebuilt with the table.
+//                     int Fixed              - Non zero when Slots and Filter live in the mounted
+//                                              image; the table then never changes size.
+//                     int Cwd                - Current directory, 0 for the root.
+//                     char CwdPath[]         - Absolute path of Cwd, empty for the root.
+//                     pthread_rwlock_t Lock  - Namespace lock. Shared for name lookups and
+//                                              scans, exclusive to create or remove files and
+//                                              directories or change Cwd.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-        newn->Buffer = NULL;
-        newn->next = NULL;
+typedef struct nameindex
+{
+    PNAMESLOT Slots;
+    int Size;
+    int Used;
+    int Deleted;
+    unsigned char *Filter;
+    int FilterSize;
+    int Fixed;
+    int Cwd;
+    char CwdPath[PATHLENGTH];
+    pthread_rwlock_t Lock;
+} NAMEINDEX, *PNAMEINDEX;
 
-        newn->InodeNumber = i;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : DENTRY
+//    Description    : One entry of the path cache: the result of resolving an absolute path.
+//    Fields         : unsigned int Hash   - Hash of Path.
+//                     int InodeNumber     - Inode the path resolves to (0 for the root), or -1
+//                                           for a negative entry (the path does not exist).
+//                     int Valid           - Non zero if the entry is in use.
+//                     char Path[]         - Canonical absolute path.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-        if (temp == NULL)
-        {
-            head = newn;
-            temp = head;
-        }
-        else
-        {
-            temp->next = newn;
-            temp = temp->next;
-        }
-        i++;
-    }
-    printf("DILB created successfully\n");
-}
+typedef struct dentry
+{
+    unsigned int Hash;
+    int InodeNumber;
+    int Valid;
+    char Path[PATHLENGTH];
+} DENTRY, *PDENTRY;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : InitialiseSuperBlock
-//    Description   : Initializes the superblock structure, setting up the system's inode capacity
-//                    and marking all inodes as available.
-//    Input         : None
-//    Output        : None
+//    Structure Name : DCACHE
+//    Description    : Direct mapped cache of resolved multi-component paths, positive and
+//                     negative, so a deep lookup usually costs a single probe. Entries are
+//                     filled under the shared namespace lock and dropped, path by path, when a
+//                     name is created or removed under the exclusive one.
+//    Fields         : DENTRY Entries[]             - Cache slots, indexed by path hash.
+//                     int Count                    - Valid entries.
+//                     long long Hits, NegativeHits - Lookups answered by the cache.
+//                     long long Misses             - Lookups that walked the path.
+//                     long long Invalidations      - Entries dropped by namespace changes.
+//                     pthread_mutex_t Locks[]      - Striped slot locks.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-void InitialiseSuperBlock()
+typedef struct dcache
 {
-    int i = 0;
-    while (i < MAXINODE)
-    {
-        UFDTArr[i].ptrfiletable = NULL;
-        i++;
-    }
-
-    SUPERBLOCKobj.TotalInodes = MAXINODE;
-    SUPERBLOCKobj.FreeInode = MAXINODE;
-}
+    DENTRY Entries[DCACHESIZE];
+    int Count;
+    long long Hits;
+    long long NegativeHits;
+    long long Misses;
+    long long Invalidations;
+    pthread_mutex_t Locks[DCACHELOCKS];
+} DCACHE, *PDCACHE;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : CreateFile
-//    Description   : Creates a new file with the specified name and permissions.
-//    Input         : char* name      - The name of the file to create.
-//                    int permission  - Permission settings (1: Read, 2: Write, 3: Read+Write).
-//    Output        : int            - File descriptor on success, or error code:
-//                                      -1: Invalid parameters
-//                                      -2: No available inodes
-//                                      -3: File already exists
-//                                      -4: Memory allocation failure
+//    Structure Name : IMAGEHEADER
+//    Description    : First block of a file system image. Every other section is located through
+//                     the offsets recorded here, so mounting only has to validate this block.
+//                     Image layout : header | inode columns | directory entry index | data
+//                     blocks
+//    Fields         : char Magic[8]                 - IMAGEMAGIC.
+//                     int Version                   - IMAGEVERSION.
+//                     int BlockSize                 - BLOCKSIZE the image was formatted with.
+//                     int MaxInodes                 - Number of inodes in the image.
+//                     int Capacity                  - Entries per inode column.
+//                     int FreeInode                 - Free inode count (written on sync).
+//                     int NextInode, FreeInodeHead  - Inode allocation state (written on sync).
+//                     int NameIndexSize             - Slots in the on-disk name index.
+//                     int NameIndexUsed, NameIndexDeleted - Name index counters (written on sync).
+//                     int NameFilterSize            - Counters in the on-disk bloom filter.
+//                     int Clean                     - 1 if the image was unmounted cleanly.
+//                     unsigned int DataBlocks       - Number of data blocks.
+//                     unsigned int NextBlock        - Lowest block number never handed out.
+//                     unsigned int FreeBlockHead    - First block on the free block chain.
+//                     unsigned int FreeBlockCount   - Blocks on the free block chain.
+//                     long long ...Offset           - Byte offset of each section.
+//                     long long ImageSize           - Size of the image file.
+//                     long long CheckpointLSN       - Last journal record already contained in
+//                                                     the image.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int CreateFile(char *name, int permission)
+typedef struct imageheader
 {
-    int i = 0;
-    PINODE temp = head;
-
-    if ((name == NULL) || (permission == 0) || (permission > 3))
-        return -1;
-
-    if (SUPERBLOCKobj.FreeInode == 0)
-        return -2;
-
-    (SUPERBLOCKobj.FreeInode)--;
-
-    if (Get_Inode(name) != NULL)
-        return -3;
-
-    while (temp != NULL)
-    {
-        if (temp->FileType == 0)
-            break;
-        temp = temp->next;
-    }
-
-    while (i < 50)
-    {
-        if (UFDTArr[i].ptrfiletable == NULL)
-            break;
-        i++;
-    }
-
-    UFDTArr[i].ptrfiletable = (PFILETABLE)malloc(sizeof(FILETABLE));
-
-    UFDTArr[i].ptrfiletable->count = 1;
-    UFDTArr[i].ptrfiletable->mode = permission;
-    UFDTArr[i].ptrfiletable->readoffset = 0;
-    UFDTArr[i].ptrfiletable->writeoffset = 0;
-
-    UFDTArr[i].ptrfiletable->ptrinode = temp;
-
-    strcpy(UFDTArr[i].ptrfiletable->ptrinode->FileName, name);
-    UFDTArr[i].ptrfiletable->ptrinode->FileType = REGULAR;
-    UFDTArr[i].ptrfiletable->ptrinode->ReferenceCount = 1;
-    UFDTArr[i].ptrfiletable->ptrinode->LinkCount = 1;
-    UFDTArr[i].ptrfiletable->ptrinode->FileSize = MAXFILESIZE;
-    UFDTArr[i].ptrfiletable->ptrinode->FileActualSize = 0;
-    UFDTArr[i].ptrfiletable->ptrinode->permission = permission;
-    UFDTArr[i].ptrfiletable->ptrinode->Buffer = (char *)malloc(MAXFILESIZE);
-
-    return i;
-}
+    char Magic[8];
+    int Version;
+    int BlockSize;
+    int MaxInodes;
+    int Capacity;
+    int FreeInode;
+    int NextInode;
+    int FreeInodeHead;
+    int NameIndexSize;
+    int NameIndexUsed;
+    int NameIndexDeleted;
+    int NameFilterSize;
+    int Clean;
+    unsigned int DataBlocks;
+    unsigned int NextBlock;
+    unsigned int FreeBlockHead;
+    unsigned int FreeBlockCount;
+    long long FileTypeOffset;
+    long long FileActualSizeOffset;
+    long long PermissionOffset;
+    long long LinkCountOffset;
+    long long ParentOffset;
+    long long FirstChildOffset;
+    long long NextSiblingOffset;
+    long long PrevSiblingOffset;
+    long long FileNameOffset;
+    long long MapHeadOffset;
+    long long NextFreeOffset;
+    long long NameSlotsOffset;
+    long long NameFilterOffset;
+    long long DataOffset;
+    long long ImageSize;
+    long long CheckpointLSN;
+} IMAGEHEADER, *PIMAGEHEADER;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : rm_File
-//    Description   : Removes a file and frees its resources.
-//    Input         : char* name - Name of the file to remove.
-//    Output        : int       - 0 on success, or -1 if the file is not found.
+//    Structure Name : IMAGE
+//    Description    : The mounted file system image, if any.
+//    Fields         : int fd               - Descriptor of the image file.
+//                     char *Base           - Start of the shared mapping, NULL when running
+//                                            purely in memory.
+//                     PIMAGEHEADER Header  - Header at the start of the mapping.
+//                     char *Data           - First data block.
+//                     int Dirty            - 1 if the image was not unmounted cleanly and has to
+//                                            be recovered before use.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int rm_File(char *name)
+typedef struct image
 {
-    int fd = 0;
-
-    fd = GetFDFromName(name);
-    if (fd == -1)
-        return -1;
-
-    (UFDTArr[fd].ptrfiletable->ptrinode->LinkCount)--;
+    int fd;
+    char *Base;
+    PIMAGEHEADER Header;
+    char *Data;
+    int Dirty;
+} IMAGE;
 
-    if (UFDTArr[fd].ptrfiletable->ptrinode->LinkCount == 0)
-    {
-        UFDTArr[fd].ptrfiletable->ptrinode->FileType = 0;
-        free(UFDTArr[fd].ptrfiletable->ptrinode->Buffer);
-        free(UFDTArr[fd].ptrfiletable);
-    }
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : JOURNALRECORD
+//    Description    : Header of one write-ahead journal record. The record payload (a file name
+//                     or the written data) follows the header directly in the journal file.
+//    Fields         : unsigned int Magic     - JOURNALMAGIC.
+//                     unsigned int Checksum  - FNV-1a of the header (with Checksum 0) and payload.
+//                     long long LSN          - Log sequence number, increasing by one per record.
+//                     long long Offset       - Write offset, new file size or permission.
+//                     int Type               - JR_CREATE, JR_MKDIR, JR_REMOVE, JR_WRITE,
+//                                              JR_TRUNCATE or JR_SETSIZE.
+//                     int InodeNumber        - Inode the record applies to.
+//                     int Length             - Payload bytes following the header.
+//                     int Parent             - Directory of JR_CREATE and JR_MKDIR, else 0.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    UFDTArr[fd].ptrfiletable = NULL;
-    (SUPERBLOCKobj.FreeInode)++;
-    return 0;
-}
+typedef struct journalrecord
+{
+    unsigned int Magic;
+    unsigned int Checksum;
+    long long LSN;
+    long long Offset;
+    int Type;
+    int InodeNumber;
+    int Length;
+    int Parent;
+} JOURNALRECORD, *PJOURNALRECORD;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : ReadFile
-//    Description   : Reads data from a file into a buffer.
-//    Input         : int fd      - File descriptor of the file.
-//                    char* arr   - Buffer to store the read data.
-//                    int isize   - Number of bytes to read.
-//    Output        : int        - Number of bytes read on success, or error code:
-//                                  -1: File not open
-//                                  -2: Permission denied
-//                                  -3: End of file reached
-//                                  -4: Not a regular file
+//    Structure Name : JOURNAL
+//    Description    : Write-ahead journal of the mounted image. Records are appended to an
+//                     in-memory buffer and written out in groups: one write and one fdatasync
+//                     cover every record gathered since the previous commit.
+//    Fields         : int fd                   - Descriptor of the journal file.
+//                     int Enabled              - 1 while records are being journaled.
+//                     char *Buffer             - Records not yet handed to a commit.
+//                     char *Spare              - Buffer being written out by a commit.
+//                     size_t Used              - Bytes used in Buffer.
+//                     size_t Capacity          - Size of Buffer.
+//                     size_t SpareCapacity     - Size of Spare.
+//                     int Pending              - Records in Buffer.
+//                     int BatchSize            - Pending records that force a commit.
+//                     int Interval             - Milliseconds between timed commits, 0 for none.
+//                     long long NextLSN        - Sequence number of the next record.
+//                     long long Size           - Bytes in the journal file.
+//                     long long Records        - Records appended since mount.
+//                     long long Commits        - Group commits since mount.
+//                     long long Checkpoints    - Checkpoints since mount.
+//                     int Running              - 1 while the flusher thread should run.
+//                     pthread_t Flusher        - Thread committing on the timer.
+//                     pthread_mutex_t Lock     - Protects the buffers and counters.
+//                     pthread_mutex_t CommitLock - Serialises commits and checkpoints.
+//                     pthread_cond_t Wakeup    - Wakes the flusher thread.
+//                     pthread_rwlock_t ApplyLock - Shared while a change is journaled and
+//                                                applied, exclusive during a checkpoint.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int ReadFile(int fd, char *arr, int isize)
+typedef struct journal
 {
-    int read_size = 0;
-
-    if (UFDTArr[fd].ptrfiletable == NULL)
-        return -1;
+    int fd;
+    int Enabled;
+    char *Buffer;
+    char *Spare;
+    size_t Used;
+    size_t Capacity;
+    size_t SpareCapacity;
+    int Pending;
+    int BatchSize;
+    int Interval;
+    long long NextLSN;
+    long long Size;
+    long long Records;
+    long long Commits;
+    long long Checkpoints;
+    int Running;
+    pthread_t Flusher;
+    pthread_mutex_t Lock;
+    pthread_mutex_t CommitLock;
+    pthread_cond_t Wakeup;
+    pthread_rwlock_t ApplyLock;
+} JOURNAL;
 
-    if (UFDTArr[fd].ptrfiletable->mode != READ && UFDTArr[fd].ptrfiletable->mode != READ + WRITE)
-        return -2;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : STRESSWORKER
+//    Description    : One thread of the stress test and its results.
+//    Fields         : int Id                - Worker number, used to name its private file.
+//                     int Phase             - STRESS_READ or STRESS_MIXED.
+//                     int Iterations        - Loop count.
+//                     long long Operations  - File system calls made.
+//                     long long Errors      - Calls that failed or returned wrong data.
+//                     pthread_t Thread      - Thread running the worker.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    if (UFDTArr[fd].ptrfiletable->ptrinode->permission != READ && UFDTArr[fd].ptrfiletable->ptrinode->permission != READ + WRITE)
-        return -2;
+typedef struct stressworker
+{
+    int Id;
+    int Phase;
+    int Iterations;
+    long long Operations;
+    long long Errors;
+    pthread_t Thread;
+} STRESSWORKER, *PSTRESSWORKER;
 
-    if (UFDTArr[fd].ptrfiletable->readoffset == UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize)
-        return -3;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : BENCHWORKER
+//    Description    : One thread of the microbenchmark. Its files and descriptors live across
+//                     the phases of one configuration; every phase refills Latency.
+//    Fields         : int Id                - Worker number, used to name its files.
+//                     int Phase             - BENCH_CREATE to BENCH_RM.
+//                     int Files             - Files owned by the worker.
+//                     int IoSize            - Bytes per read and write.
+//                     int Random            - 1 for random offsets, 0 for sequential ones.
+//                     int Ops               - Calls per phase for write, lseek, read and lookup.
+//                     int Slots             - IoSize sized slots in every file.
+//                     char* Names           - File names, NAMELENGTH bytes apart.
+//                     long long* Fds        - READ+WRITE descriptors from the create phase.
+//                     long long* WriteFds   - WRITE descriptors used to position writes.
+//                     long long* OpenFds    - Descriptors of the open phase.
+//                     char* Buffer          - IoSize bytes of data.
+//                     long long* Latency    - Nanoseconds of every call of the phase.
+//                     int Samples           - Entries of Latency filled by the phase.
+//                     long long Errors      - Calls of the phase that failed.
+//                     unsigned int Seed     - rand_r state for file and offset choice.
+//                     pthread_t Thread      - Thread running the worker.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    if (UFDTArr[fd].ptrfiletable->ptrinode->FileType != REGULAR)
-        return -4;
+typedef struct benchworker
+{
+    int Id;
+    int Phase;
+    int Files;
+    int IoSize;
+    int Random;
+    int Ops;
+    int Slots;
+    char *Names;
+    long long *Fds;
+    long long *WriteFds;
+    long long *OpenFds;
+    char *Buffer;
+    long long *Latency;
+    int Samples;
+    long long Errors;
+    unsigned int Seed;
+    pthread_t Thread;
+} BENCHWORKER, *PBENCHWORKER;
 
-    read_size = (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) - (UFDTArr[fd].ptrfiletable->readoffset);
-    if (read_size < isize)
-    {
-        strncpy(arr, (UFDTArr[fd].ptrfiletable->ptrinode->Buffer) + (UFDTArr[fd].ptrfiletable->readoffset), read_size);
-        UFDTArr[fd].ptrfiletable->readoffset = UFDTArr[fd].ptrfiletable->readoffset + read_size;
-    }
-    else
-    {
-        strncpy(arr, (UFDTArr[fd].ptrfiletable->ptrinode->Buffer) + (UFDTArr[fd].ptrfiletable->readoffset), isize);
-        UFDTArr[fd].ptrfiletable->readoffset = UFDTArr[fd].ptrfiletable->readoffset + isize;
-    }
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : WIREHEADER
+//    Description    : Header of every request and response of the server protocol. A request
+//                     is a header followed by Length payload bytes (a NUL terminated file name,
+//                     or the data of OP_WRITE / OP_PWRITE). The response to it carries the same
+//                     Tag and Op, the result in Arg, and Length payload bytes (the data of
+//                     OP_READ / OP_PREAD or a FILESTAT). Responses are sent in request order, so clients may pipeline.
+//    Fields         : unsigned int Length  - Payload bytes following the header.
+//                     unsigned int Tag     - Chosen by the client, echoed in the response.
+//                     int Op               - OP_... operation.
+//                     int Fd               - Connection local descriptor.
+//                     int Arg              - Request: permission, mode, byte count or seek
+//                                            origin. Response: the shell function's return
+//                                            value (descriptor, byte count or error code).
+//                     int Reserved         - Always 0.
+//                     long long Offset     - Seek offset of OP_LSEEK, file offset of OP_PREAD
+//                                            and OP_PWRITE.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    return isize;
-}
+typedef struct wireheader
+{
+    unsigned int Length;
+    unsigned int Tag;
+    int Op;
+    int Fd;
+    int Arg;
+    int Reserved;
+    long long Offset;
+} WIREHEADER, *PWIREHEADER;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : WriteFile
-//    Description   : Writes data to a file from a buffer.
-//    Input         : int fd      - File descriptor of the file.
-//                    char* arr   - Buffer containing the data to write.
-//                    int isize   - Number of bytes to write.
-//    Output        : int        - Number of bytes written on success, or error code:
-//                                  -1: Permission denied
-//                                  -2: Insufficient memory
-//                                  -3: Not a regular file
+//    Structure Name : CONNECTION
+//    Description    : One client connection of the server. Each connection has its own
+//                     descriptor table, so clients only see descriptors they opened and
+//                     everything still open is closed when the client goes away.
+//    Fields         : int Socket            - Client socket (non blocking).
+//                     int Epoll             - Event loop the connection belongs to.
+//                     unsigned int Events   - Events currently registered with epoll.
+//                     char *In              - Received bytes not yet parsed.
+//                     size_t InUsed, InCapacity - Bytes in and size of In.
+//                     char *Out             - Responses not yet sent.
+//                     size_t OutUsed, OutSent, OutCapacity - Bytes in, already sent from and
+//                                             size of Out.
+//                     long long *Fds        - Global descriptor of each local one, -1 if free.
+//                     int FdCapacity        - Entries in Fds.
+//                     struct connection *next, *prev - Connections of the same event loop.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int WriteFile(int fd, char *arr, int isize)
+typedef struct connection
 {
-    if (((UFDTArr[fd].ptrfiletable->mode) != WRITE) && ((UFDTArr[fd].ptrfiletable->mode) != READ + WRITE))
-        return -1;
-
-    if (((UFDTArr[fd].ptrfiletable->ptrinode->permission) != WRITE) && ((UFDTArr[fd].ptrfiletable->ptrinode->permission) != READ + WRITE))
-        return -1;
+    int Socket;
+    int Epoll;
+    unsigned int Events;
+    char *In;
+    size_t InUsed;
+    size_t InCapacity;
+    char *Out;
+    size_t OutUsed;
+    size_t OutSent;
+    size_t OutCapacity;
+    long long *Fds;
+    int FdCapacity;
+    struct connection *next;
+    struct connection *prev;
+} CONNECTION, *PCONNECTION;
 
-    if ((UFDTArr[fd].ptrfiletable->writeoffset) == MAXFILESIZE)
-        return -2;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : SERVERLOOP
+//    Description    : One event loop thread of the server. Every loop waits on the listening
+//                     socket with EPOLLEXCLUSIVE and serves the connections it accepted.
+//    Fields         : int Epoll                - Event loop's epoll instance.
+//                     int Listener             - Listening socket.
+//                     PCONNECTION Connections  - Connections served by this loop.
+//                     long long Requests       - Requests served.
+//                     pthread_t Thread         - Thread running the loop.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    if ((UFDTArr[fd].ptrfiletable->ptrinode->FileType) != REGULAR)
-        return -3;
+typedef struct serverloop
+{
+    int Epoll;
+    int Listener;
+    PCONNECTION Connections;
+    long long Requests;
+    pthread_t Thread;
+} SERVERLOOP, *PSERVERLOOP;
 
-    strncpy((UFDTArr[fd].ptrfiletable->ptrinode->Buffer) + (UFDTArr[fd].ptrfiletable->writeoffset), arr, isize);
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : LOADCLIENT
+//    Description    : One simulated client of the load generator.
+//    Fields         : int Socket           - Connection to the server.
+//                     int Fd               - Remote descriptor of the test file, -1 until open.
+//                     int Sent             - Requests sent.
+//                     int Done             - Responses received.
+//                     long long SendTime[] - Send time (ns) of each outstanding request, by Tag.
+//                     char *In             - Partially received responses.
+//                     size_t InUsed        - Bytes in In.
+//                     char *Out            - Requests not yet sent.
+//                     size_t OutUsed, OutSent - Bytes in and already sent from Out.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    (UFDTArr[fd].ptrfiletable->writeoffset) = (UFDTArr[fd].ptrfiletable->writeoffset) + isize;
+typedef struct loadclient
+{
+    int Socket;
+    int Fd;
+    int Sent;
+    int Done;
+    long long SendTime[LOADMAXDEPTH];
+    char *In;
+    size_t InUsed;
+    char *Out;
+    size_t OutUsed;
+    size_t OutSent;
+} LOADCLIENT, *PLOADCLIENT;
 
-    (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) = (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) + isize;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : VFSSQE
+//    Description    : Submission queue entry: one operation posted to a VFSRING.
+//    Fields         : int Op                    - OP_... operation.
+//                     int Flags                 - SQE_... flags.
+//                     long long Fd              - Descriptor, unless SQE_CHAINFD is set.
+//                     int Arg                   - Permission, mode or lseek origin.
+//                     long long Offset          - lseek offset, or file offset of pread, pwrite.
+//                     char *Name                - File name of create, open, stat, rm, truncate.
+//                     char *Buffer              - Data of read and write, FILESTAT of stat.
+//                     int Length                - Bytes to read or write.
+//                     unsigned long long UserData - Returned unchanged in the completion.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    return isize;
-}
+typedef struct vfssqe
+{
+    int Op;
+    int Flags;
+    long long Fd;
+    int Arg;
+    long long Offset;
+    char *Name;
+    char *Buffer;
+    int Length;
+    unsigned long long UserData;
+} VFSSQE, *PVFSSQE;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : OpenFile
-//    Description   : Opens an existing file for reading or writing.
-//    Input         : char* name  - Name of the file to open.
-//                    int mode    - Mode to open the file in (READ, WRITE, or READ+WRITE).
-//    Output        : int        - File descriptor on success, or error code:
-//                                  -1: Invalid parameters
-//                                  -2: File not found
-//                                  -3: Permission denied
+//    Structure Name : VFSCQE
+//    Description    : Completion queue entry: the result of one VFSSQE.
+//    Fields         : unsigned long long UserData - UserData of the submission.
+//                     long long Result          - Return value of the operation, or
+//                                                 -ECANCELED if an earlier linked one failed.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int OpenFile(char *name, int mode)
+typedef struct vfscqe
 {
-    int i = 0;
-    PINODE temp = NULL;
+    unsigned long long UserData;
+    long long Result;
+} VFSCQE, *PVFSCQE;
 
-    if (name == NULL || mode <= 0)
-        return -1;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : VFSRING
+//    Description    : Asynchronous interface to the file system. The caller fills submission
+//                     entries and submits them in batches; worker threads take whole linked
+//                     chains off the submission ring, run them and post results to the
+//                     completion ring, which is twice as large.
+//    Fields         : PVFSSQE Sq                - Submission ring.
+//                     unsigned int SqEntries    - Its size, a power of two.
+//                     unsigned int SqHead       - Next entry a worker takes.
+//                     unsigned int SqTail       - End of the submitted entries.
+//                     unsigned int SqPending    - End of the entries filled, not yet submitted.
+//                     PVFSCQE Cq                - Completion ring.
+//                     unsigned int CqEntries    - Its size.
+//                     unsigned int CqHead       - Next completion to reap.
+//                     unsigned int CqTail       - End of the posted completions.
+//                     unsigned int Inflight     - Submitted entries not yet completed.
+//                     int EventFd               - eventfd signalled on completions, or -1.
+//                     int Workers               - Number of worker threads.
+//                     int Stop                  - Set to stop the workers.
+//                     long long Submitted       - Entries submitted so far.
+//                     long long Completed       - Entries completed so far.
+//                     pthread_t Threads[]       - Worker threads.
+//                     pthread_mutex_t SqLock    - Protects SqHead, SqTail and Stop.
+//                     pthread_cond_t SqReady    - Signalled on submission.
+//                     pthread_mutex_t CqLock    - Protects the completion ring and counters.
+//                     pthread_cond_t CqReady    - Signalled when completions are posted.
+//                     pthread_cond_t CqSpace    - Signalled when completions are reaped.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    temp = Get_Inode(name);
-    if (temp == NULL)
-        return -2;
+typedef struct vfsring
+{
+    PVFSSQE Sq;
+    unsigned int SqEntries;
+    unsigned int SqHead;
+    unsigned int SqTail;
+    unsigned int SqPending;
+    PVFSCQE Cq;
+    unsigned int CqEntries;
+    unsigned int CqHead;
+    unsigned int CqTail;
+    unsigned int Inflight;
+    int EventFd;
+    int Workers;
+    int Stop;
+    long long Submitted;
+    long long Completed;
+    pthread_t Threads[RINGMAXWORKERS];
+    pthread_mutex_t SqLock;
+    pthread_cond_t SqReady;
+    pthread_mutex_t CqLock;
+    pthread_cond_t CqReady;
+    pthread_cond_t CqSpace;
+} VFSRING, *PVFSRING;
 
-    if (temp->permission < mode)
-        return -3;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : COMMAND
+//    Description    : A shell command and the number of arguments it takes.
+//    Fields         : const char *Name  - Command word.
+//                     int Length        - Length of the command word.
+//                     int Id            - CMD_... identifier.
+//                     int MinArgs       - Fewest arguments accepted.
+//                     int MaxArgs       - Most arguments accepted.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    while (i < 50)
-    {
-        if (UFDTArr[i].ptrfiletable == NULL)
-            break;
-        i++;
-    }
+typedef struct command
+{
+    const char *Name;
+    int Length;
+    int Id;
+    int MinArgs;
+    int MaxArgs;
+} COMMAND, *PCOMMAND;
 
-    UFDTArr[i].ptrfiletable = (PFILETABLE)malloc(sizeof(FILETABLE));
-    if (UFDTArr[i].ptrfiletable == NULL)
-        return -1;
-    UFDTArr[i].ptrfiletable->count = 1;
-    UFDTArr[i].ptrfiletable->mode = mode;
-    if (mode == READ + WRITE)
-    {
-        UFDTArr[i].ptrfiletable->readoffset = 0;
-        UFDTArr[i].ptrfiletable->writeoffset = 0;
-    }
-    else if (mode == READ)
-    {
-        UFDTArr[i].ptrfiletable->readoffset = 0;
-    }
-    else if (mode == WRITE)
-    {
-        UFDTArr[i].ptrfiletable->writeoffset = 0;
-    }
-    UFDTArr[i].ptrfiletable->ptrinode = temp;
-    (UFDTArr[i].ptrfiletable->ptrinode->ReferenceCount)++;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : COMMANDTABLE
+//    Description    : Perfect hash of the shell commands, built once at startup.
+//    Fields         : unsigned int Seed               - Seed under which no commands collide.
+//                     PCOMMAND Slots[COMMANDSLOTS]    - Command of each slot, or NULL.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    return i;
-}
+typedef struct commandtable
+{
+    unsigned int Seed;
+    PCOMMAND Slots[COMMANDSLOTS];
+} COMMANDTABLE, *PCOMMANDTABLE;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : CloseFileByName
-//    Description   : Closes a specific file by its name.
-//    Input         : int fd  - File descriptor of the file to close.
-//    Output        : None
+//    Structure Name : SLABOBJECT
+//    Description    : Free list link stored inside a free slab object.
+//    Fields         : struct slabobject *next - Next free object.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-void CloseFileByName(int fd)
+typedef struct slabobject
 {
-    UFDTArr[fd].ptrfiletable->readoffset = 0;
-    UFDTArr[fd].ptrfiletable->writeoffset = 0;
-    (UFDTArr[fd].ptrfiletable->ptrinode->ReferenceCount)--;
-}
+    struct slabobject *next;
+} SLABOBJECT, *PSLABOBJECT;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : CloseFileByName
-//    Description   : Closes a specific file by its name.
-//    Input         : char* name  - Name of the file to close.
-//    Output        : int        - 0 on success, or -1 if the file is not found.
+//    Structure Name : SLAB
+//    Description    : Fixed size object pool. Objects are carved in chunks of SLABCHUNKOBJECTS and
+//                     never returned to the heap. Each thread keeps a small cache of free objects
+//                     in front of the shared free list (the depot), so alloc and free normally
+//                     touch neither the heap nor the depot lock.
+//    Fields         : const char *Name        - Name shown by slabstat.
+//                     int Id                  - Index of this slab's per thread cache.
+//                     size_t ObjectSize       - Size of one object.
+//                     PSLABOBJECT Depot       - Shared free list.
+//                     long long DepotCount    - Objects on the shared free list.
+//                     long long Chunks        - Chunks carved from the heap.
+//                     long long Total         - Objects carved from the heap.
+//                     long long InUse         - Objects currently handed out.
+//                     pthread_mutex_t Lock    - Protects Depot, DepotCount, Chunks and Total.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int CloseFileByName(char *name)
+typedef struct slab
 {
-    int i = 0;
-    i = GetFDFromName(name);
-    if (i == -1)
-        return -1;
+    const char *Name;
+    int Id;
+    size_t ObjectSize;
+    PSLABOBJECT Depot;
+    long long DepotCount;
+    long long Chunks;
+    long long Total;
+    long long InUse;
+    pthread_mutex_t Lock;
+} SLAB, *PSLAB;
 
-    UFDTArr[i].ptrfiletable->readoffset = 0;
-    UFDTArr[i].ptrfiletable->writeoffset = 0;
-    (UFDTArr[i].ptrfiletable->ptrinode->ReferenceCount)--;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : SLABCACHE
+//    Description    : Per thread cache of free objects for one slab.
+//    Fields         : PSLABOBJECT Objects - Cached free objects.
+//                     int Count           - Number of cached objects.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    return 0;
-}
+typedef struct slabcache
+{
+    PSLABOBJECT Objects;
+    int Count;
+} SLABCACHE;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : CloseAllFile
-//    Description   : Closes all currently open files.
-//    Input         : None
-//    Output        : None
+//    Structure Name : PERFSHARD
+//    Description    : Per thread counters of the core entry points, indexed by PERF_CREATE to
+//                     PERF_LOOKUP. Only the owning thread writes them.
+//    Fields         : long long Count[]      - Calls.
+//                     long long Bytes[]      - Bytes moved by successful calls.
+//                     long long Time[]       - Nanoseconds spent in the calls.
+//                     long long Errors[][]   - Failed calls by error code (-1 to -PERFERRORS, the
+//                                              last slot also counting lower codes).
+//                     long long Histogram[][] - Calls by latency bucket (see PerfBucket).
+//                     perfshard* Next        - Next registered shard.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-void CloseAllFile()
+typedef struct perfshard
 {
-    int i = 0;
-    while (i < 50)
-    {
-        if (UFDTArr[i].ptrfiletable != NULL)
-        {
-            UFDTArr[i].ptrfiletable->readoffset = 0;
-            UFDTArr[i].ptrfiletable->writeoffset = 0;
-            (UFDTArr[i].ptrfiletable->ptrinode->ReferenceCount)--;
-            break;
-        }
-        i++;
-    }
-}
+    long long Count[PERFOPS];
+    long long Bytes[PERFOPS];
+    long long Time[PERFOPS];
+    long long Errors[PERFOPS][PERFERRORS];
+    long long Histogram[PERFOPS][PERFBUCKETS];
+    struct perfshard *Next;
+} PERFSHARD, *PPERFSHARD;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : LseekFile
-//    Description   : Changes the file offset for reading or writing operations.
-//    Input         : int fd      - File descriptor of the file.
-//                    int size    - Offset value.
-//                    int from    - Reference point (START, CURRENT, END).
-//    Output        : int        - 0 on success, or error code:
-//                                  -1: Invalid parameters
+//    Structure Name : PERF
+//    Description    : Registry of the per thread counters, merged on demand by perfstat.
+//    Fields         : PPERFSHARD Shards      - Shards of live threads.
+//                     PERFSHARD Retired      - Counters of threads that have exited.
+//                     PERFSHARD Baseline     - Totals at the last reset, subtracted on display.
+//                     pthread_mutex_t Lock   - Protects the list, Retired and Baseline.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int LseekFile(int fd, int size, int from)
+typedef struct perf
 {
-    if ((fd < 0) || (from > 2))
-        return -1;
-    if (UFDTArr[fd].ptrfiletable == NULL)
-        return -1;
-
-    if ((UFDTArr[fd].ptrfiletable->mode == READ) || (UFDTArr[fd].ptrfiletable->mode == READ + WRITE))
-    {
-        if (from == CURRENT)
-        {
-            if (((UFDTArr[fd].ptrfiletable->readoffset) + size) > UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize)
-                return -1;
-            if (((UFDTArr[fd].ptrfiletable->readoffset) + size) < 0)
-                return -1;
-            (UFDTArr[fd].ptrfiletable->readoffset) = (UFDTArr[fd].ptrfiletable->readoffset) + size;
-        }
-        else if (from == START)
-        {
-            if (size > (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize))
-                return -1;
-            if (size < 0)
-                return -1;
-            (UFDTArr[fd].ptrfiletable->readoffset) = size;
-        }
-        else if (from == END)
-        {
-            if ((UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) + size > MAXFILESIZE)
-                return -1;
-            if (((UFDTArr[fd].ptrfiletable->readoffset) + size) < 0)
-                return -1;
-            (UFDTArr[fd].ptrfiletable->readoffset) = (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) + size;
-        }
-    }
-    else if (UFDTArr[fd].ptrfiletable->mode == WRITE)
-    {
-        if (from == CURRENT)
-        {
-            if (((UFDTArr[fd].ptrfiletable->writeoffset) + size) > MAXFILESIZE)
-                return -1;
-            if (((UFDTArr[fd].ptrfiletable->writeoffset) + size) < 0)
-                return -1;
-            if (((UFDTArr[fd].ptrfiletable->writeoffset) + size) > (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize))
-                (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) = (UFDTArr[fd].ptrfiletable->writeoffset) + size;
-            (UFDTArr[fd].ptrfiletable->writeoffset) = (UFDTArr[fd].ptrfiletable->writeoffset) + size;
-        }
-        else if (from == START)
-        {
-            if (size > MAXFILESIZE)
-                return -1;
-            if (size < 0)
-                return -1;
-            if (size > (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize))
-                (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) = size;
-            (UFDTArr[fd].ptrfiletable->writeoffset) = size;
-        }
-        else if (from == END)
-        {
-            if ((UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) + size > MAXFILESIZE)
-                return -1;
-            if (((UFDTArr[fd].ptrfiletable->writeoffset) + size) < 0)
-                return -1;
-            (UFDTArr[fd].ptrfiletable->writeoffset) = (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) + size;
-        }
-    }
-    return 0;
-}
+    PPERFSHARD Shards;
+    PERFSHARD Retired;
+    PERFSHARD Baseline;
+    pthread_mutex_t Lock;
+} PERF, *PPERF;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : ls_file
-//    Description   : Lists all files in the system, including their metadata.
-//    Input         : None
-//    Output        : None
+//    Structure Name : TRACEEVENT
+//    Description    : One traced call in a trace ring.
+//    Fields         : long long Seq       - Position in the ring plus one once written, 0 while
+//                                           being written.
+//                     long long Start     - NowNanoseconds() at entry.
+//                     long long Duration  - Nanoseconds spent in the call.
+//                     long long Offset    - File offset of the call.
+//                     long long Size      - Bytes asked for.
+//                     long long Fd        - Descriptor used, or -1.
+//                     long long Ret       - Return value.
+//                     int Op              - PERF_CREATE to PERF_LOOKUP.
+//                     int Inode           - Inode number involved, or 0.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-void ls_file()
+typedef struct traceevent
 {
-    int i = 0;
-    PINODE temp = head;
+    long long Seq;
+    long long Start;
+    long long Duration;
+    long long Offset;
+    long long Size;
+    long long Fd;
+    long long Ret;
+    int Op;
+    int Inode;
+} TRACEEVENT, *PTRACEEVENT;
 
-    if (SUPERBLOCKobj.FreeInode == MAXINODE)
-    {
-        printf("Error : There are no files\n");
-        return;
-    }
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Structure Name : TRACERING
+//    Description    : Per thread ring of the most recent TRACEEVENTS traced calls. Only the
+//                     owning thread writes it.
+//    Fields         : TRACEEVENT Events[]  - Event slots.
+//                     long long Head       - Events written in the session.
+//                     long long Session    - Trace session the events belong to.
+//                     int Thread           - Track number in the exported trace.
+//                     int Exited           - 1 once the owning thread has exited.
+//                     tracering* Next      - Next registered ring.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    printf("\nFile Name\tInode number\tFile size\tLink count\n");
-    printf("-------------------------------------------------------------------\n");
-    while (temp != NULL)
-    {
-        if (temp->FileType != 0)
-        {
-            printf("%s\t\t%d\t\t%d\t\t%d\n", temp->FileName, temp->InodeNumber, temp->FileActualSize, temp->LinkCount);
-        }
-        temp = temp->next;
-    }
-    printf("-------------------------------------------------------------------\n");
-}
+typedef struct tracering
+{
+    TRACEEVENT Events[TRACEEVENTS];
+    long long Head;
+    long long Session;
+    int Thread;
+    int Exited;
+    struct tracering *Next;
+} TRACERING, *PTRACERING;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : fstat_file
-//    Description   : Displays metadata for a file based on its file descriptor.
-//    Input         : int fd  - File descriptor of the file.
-//    Output        : int    - 0 on success, or error code:
-//                              -1: Invalid file descriptor
-//                              -2: File not found
+//    Structure Name : TRACE
+//    Description    : Registry of the trace rings.
+//    Fields         : int Enabled          - 1 while tracing; the only check on the fast path.
+//                     long long Session    - Current session, 0 before the first trace start.
+//                     long long Origin     - NowNanoseconds() at trace start, time zero of the
+//                                            export.
+//                     long long Dropped    - Calls not traced because no ring was available.
+//                     PTRACERING Rings     - Registered rings.
+//                     int Count            - Number of registered rings (at most TRACEMAXRINGS).
+//                     int Threads          - Track numbers handed out.
+//                     pthread_mutex_t Lock - Protects the ring list and Origin.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int fstat_file(int fd)
+typedef struct trace
 {
-    PINODE temp = head;
+    int Enabled;
+    long long Session;
+    long long Origin;
+    long long Dropped;
+    PTRACERING Rings;
+    int Count;
+    int Threads;
+    pthread_mutex_t Lock;
+} TRACE, *PTRACE;
 
-    if (fd < 0)
-        return -1;
+SLAB INODESLAB = {"inode", 0, sizeof(INODE), NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+SLAB FILETABLESLAB = {"filetable", 1, sizeof(FILETABLE), NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+PSLAB SlabList[SLABCOUNT] = {&INODESLAB, &FILETABLESLAB};
 
-    if (UFDTArr[fd].ptrfiletable == NULL)
-        return -2;
+__thread SLABCACHE SlabCaches[SLABCOUNT];
+pthread_key_t SlabCacheKey;
 
-    temp = UFDTArr[fd].ptrfiletable->ptrinode;
+PERF PERFobj;
+__thread PPERFSHARD PerfShard = NULL;
+pthread_key_t PerfKey;
+const char *PerfNames[PERFOPS] = {"create", "open", "close", "read", "write", "lseek", "truncate", "rm", "lookup"};
 
-    printf("\n---------------Statistical Information about file-------------\n");
-    printf("File name : %s\n", temp->FileName);
-    printf("Inode Number %d\n", temp->InodeNumber);
-    printf("File size : %d\n", temp->FileSize);
-    printf("Actual File size : %d\n", temp->FileActualSize);
-    printf("Link count : %d\n", temp->LinkCount);
-    printf("Reference count : %d\n", temp->ReferenceCount);
-
-    if (temp->permission == 1)
-        printf("File Permission : Read only\n");
-    else if (temp->permission == 2)
-        printf("File Permission : Write\n");
-    else if (temp->permission == 3)
-        printf("File Permission : Read & Write\n");
-    printf("--------------------------------------------------------------\n\n");
+TRACE TRACEobj;
+__thread PTRACERING TraceRing = NULL;
+pthread_key_t TraceKey;
 
-    return 0;
-}
+UFDTTABLE UFDTobj;
+SUPERBLOCK SUPERBLOCKobj;
+INODECOLUMNS INODECOLUMNSobj;
+BLOCKPOOL BLOCKPOOLobj;
+TIER TIERobj = {0, NULL, -1, NULL, NULL, 0, 0, -1, 0, NULL, 0, 0, 0, 0, 0, 0, 0, 0,
+                0, NULL, NULL, 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+DEDUP DEDUPobj = {NULL, 0, 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+const char ZeroBlock[BLOCKSIZE] = {0};
+NAMEINDEX NAMEINDEXobj;
+DCACHE DCACHEobj;
+IMAGE IMAGEobj;
+MAPTABLE MAPTABLEobj = {{NULL}, 0, 0, {}, PTHREAD_MUTEX_INITIALIZER};
+volatile sig_atomic_t ServerStop = 0;
+JOURNAL JOURNALobj = {-1, 0, NULL, NULL, 0, 0, 0, 0, JOURNALDEFAULTBATCH, JOURNALDEFAULTINTERVAL, 1, 0, 0, 0, 0, 0, 0,
+                      PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                      PTHREAD_RWLOCK_INITIALIZER};
+COMMAND Commands[] = {
+    {"ls", 2, CMD_LS, 0, 1}, {"closeall", 8, CMD_CLOSEALL, 0, 0}, {"clear", 5, CMD_CLEAR, 0, 0},
+    {"help", 4, CMD_HELP, 0, 0}, {"slabstat", 8, CMD_SLABSTAT, 0, 0}, {"journal", 7, CMD_JOURNAL, 0, 0},
+    {"sync", 4, CMD_SYNC, 0, 0}, {"exit", 4, CMD_EXIT, 0, 0}, {"find", 4, CMD_FIND, 0, 3},
+    {"stat", 4, CMD_STAT, 1, 1}, {"fstat", 5, CMD_FSTAT, 1, 1}, {"close", 5, CMD_CLOSE, 1, 1},
+    {"rm", 2, CMD_RM, 1, 1}, {"man", 3, CMD_MAN, 1, 1}, {"write", 5, CMD_WRITE, 1, 1},
+    {"truncate", 8, CMD_TRUNCATE, 1, 1}, {"stress", 6, CMD_STRESS, 2, 2}, {"create", 6, CMD_CREATE, 2, 2},
+    {"open", 4, CMD_OPEN, 2, 2}, {"read", 4, CMD_READ, 2, 2}, {"lseek", 5, CMD_LSEEK, 3, 3},
+    {"ring", 4, CMD_RING, 3, 3}, {"mkdir", 5, CMD_MKDIR, 1, 1}, {"rmdir", 5, CMD_RMDIR, 1, 1},
+    {"cd", 2, CMD_CD, 1, 1}, {"pwd", 3, CMD_PWD, 0, 0}, {"dcache", 6, CMD_DCACHE, 0, 0},
+    {"tierstat", 8, CMD_TIERSTAT, 0, 0}, {"compress", 8, CMD_COMPRESS, 1, 1},
+    {"dedupstat", 9, CMD_DEDUPSTAT, 0, 0}, {"snapshot", 8, CMD_SNAPSHOT, 1, 1}, {"clone", 5, CMD_CLONE, 2, 2},
+    {"perfstat", 8, CMD_PERFSTAT, 0, 1}, {"trace", 5, CMD_TRACE, 1, 2},
+    {"pread", 5, CMD_PREAD, 3, 3}, {"pwrite", 6, CMD_PWRITE, 2, 2}, {"mmap", 4, CMD_MMAP, 3, 4}};
+COMMANDTABLE COMMANDTABLEobj;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : stat_file
-//    Description   : Displays metadata for a file based on its name.
-//    Input         : char* name  - Name of the file.
-//    Output        : int        - 0 on success, or error code:
-//                                  -1: File not found
+//    Function Name : man
+//    Description   : Provides command usage and descriptions for system operations.
+//    Input         : char* name - Command for which manual entry is required.
+//    Output        : None
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int stat_file(char *name)
+void man(char *name)
 {
-    PINODE temp = head;
-
     if (name == NULL)
-        return -1;
+        return;
 
-    while (temp != NULL)
+    if (strcmp(name, "create") == 0)
     {
-        if (strcmp(name, temp->FileName) == 0)
-            break;
-        temp = temp->next;
-    }
+        printf("Description : Used to create new regular file\n");
+        printf("Usage : create File_name permission\n");
+    }
+    else if (strcmp(name, "read") == 0)
+    {
+        printf("Description : Used to read data from regular file\n");
+        printf("Usage : read File_name No_Of_Bytes_To_Read\n");
+    }
+    else if (strcmp(name, "write") == 0)
+    {
+        printf("Description : Used to write into regular file\n");
+        printf("Usage : write File_name [Data]\nWithout Data, write the data that we want to write on the next line\n");
+        printf("In a script, write File_name #Length takes exactly Length bytes following the line\n");
+    }
+    else if (strcmp(name, "pread") == 0)
+    {
+        printf("Description : Used to read data at an offset without moving the read offset of the file\n");
+        printf("Usage : pread File_name Offset Size\n");
+    }
+    else if (strcmp(name, "pwrite") == 0)
+    {
+        printf("Description : Used to write data at an offset without moving the write offset of the file\n");
+        printf("Usage : pwrite File_name Offset [Data]\nWithout Data, write the data that we want to write on the next line\n");
+        printf("In a script, pwrite File_name Offset #Length takes exactly Length bytes following the line\n");
+    }
+    else if (strcmp(name, "mmap") == 0)
+    {
+        printf("Description : Used to map a range of an open file into memory\n");
+        printf("Usage : mmap File_name Offset Length [Data]\n");
+        printf("Offset must be a multiple of %d and the range must lie inside the file\n", BLOCKSIZE);
+        printf("Without Data, the mapped bytes are displayed; with Data, the range is mapped for writing,\n");
+        printf("Data is stored at its start and the pages written are flushed to the journal\n");
+    }
+    else if (strcmp(name, "ls") == 0)
+    {
+        printf("Description : Used to list all the information of files in a directory\n");
+        printf("Usage : ls [Directory_path]\n");
+    }
+    else if (strcmp(name, "mkdir") == 0)
+    {
+        printf("Description : Used to create new directory\n");
+        printf("Usage : mkdir Directory_path\n");
+    }
+    else if (strcmp(name, "rmdir") == 0)
+    {
+        printf("Description : Used to delete an empty directory\n");
+        printf("Usage : rmdir Directory_path\n");
+    }
+    else if (strcmp(name, "cd") == 0)
+    {
+        printf("Description : Used to change the current directory\n");
+        printf("Usage : cd Directory_path\n");
+        printf("Paths are absolute (/a/b) or relative to the current directory and may use . and ..\n");
+    }
+    else if (strcmp(name, "pwd") == 0)
+    {
+        printf("Description : Used to display the current directory\n");
+        printf("Usage : pwd\n");
+    }
+    else if (strcmp(name, "tierstat") == 0)
+    {
+        printf("Description : Used to display memory budget usage, hit rate, readahead and evictions of file blocks\n");
+        printf("Usage : tierstat\n");
+        printf("The budget is set at start up with -m SizeInMB; without it all data stays in memory\n");
+        printf("With -z it also shows how many blocks are compressed and how often they are decompressed\n");
+    }
+    else if (strcmp(name, "dedupstat") == 0)
+    {
+        printf("Description : Used to display how many data blocks files share because their contents are identical\n");
+        printf("Usage : dedupstat\n");
+        printf("The dedup ratio is the number of file blocks divided by the number of distinct blocks stored\n");
+    }
+    else if (strcmp(name, "perfstat") == 0)
+    {
+        printf("Description : Used to display how often each file operation ran, the bytes it moved, its errors and latency percentiles\n");
+        printf("Usage : perfstat [reset | json]\n");
+        printf("reset starts the counters over, json prints them with the latency histograms (bucket upper bound in ns, calls)\n");
+    }
+    else if (strcmp(name, "trace") == 0)
+    {
+        printf("Description : Used to record every file operation with its descriptor, inode, offset, size and duration\n");
+        printf("Usage : trace start | stop | dump File\n");
+        printf("dump writes Chrome trace event JSON for chrome://tracing or Perfetto; each thread keeps its last %d calls\n", TRACEEVENTS);
+    }
+    else if (strcmp(name, "snapshot") == 0)
+    {
+        printf("Description : Used to capture every file and directory as they are now\n");
+        printf("Usage : snapshot Name\n");
+        printf("The copy appears under /%s/Name and shares the data of the files until either side is modified\n", SNAPSHOTROOT);
+    }
+    else if (strcmp(name, "clone") == 0)
+    {
+        printf("Description : Used to copy a file instantly, sharing its data until either copy is modified\n");
+        printf("Usage : clone Source_file Destination_file\n");
+    }
+    else if (strcmp(name, "compress") == 0)
+    {
+        printf("Description : Used to compress the data blocks of a file right away\n");
+        printf("Usage : compress File_name\n");
+        printf("Needs -z Seconds at start up, which also compresses cold blocks of every file in the background\n");
+        printf("stat then shows the physical size next to the actual size\n");
+    }
+    else if (strcmp(name, "dcache") == 0)
+    {
+        printf("Description : Used to display hit and miss counters of the path lookup cache\n");
+        printf("Usage : dcache\n");
+    }
+    else if (strcmp(name, "stat") == 0)
+    {
+        printf("Description : Used to display information of file\n");
+        printf("Usage : stat File_name\n");
+    }
+    else if (strcmp(name, "fstat") == 0)
+    {
+        printf("Description : Used to display information of file\n");
+        printf("Usage : fstat File_Descriptor\n");
+    }
+    else if (strcmp(name, "truncate") == 0)
+    {
+        printf("Description : Used to remove data from file\n");
+        printf("Usage : truncate File_name\n");
+    }
+    else if (strcmp(name, "open") == 0)
+    {
+        printf("Description : Used to open existing file\n");
+        printf("Usage : open File_name mode\n");
+        printf("Mode is 1 (Read), 2 (Write) or 3 (Read+Write); add 4 to a write mode (6 or 7) to append\n");
+        printf("every write to the end of the file, even with other writers on the file\n");
+    }
+    else if (strcmp(name, "close") == 0)
+    {
+        printf("Description : Used to close opened file\n");
+        printf("Usage : close File_name\n");
+    }
+    else if (strcmp(name, "closeall") == 0)
+    {
+        printf("Description : Used to close all opened file\n");
+        printf("Usage : closeall\n");
+    }
+    else if (strcmp(name, "lseek") == 0)
+    {
+        printf("Description : Used to change file offset\n");
+        printf("Usage : lseek File_name ChangeinOffset StartPoint\n");
+        printf("StartPoint : 0 start, 1 current, 2 end, 3 next data, 4 next hole at or after the offset\n");
+    }
+    else if (strcmp(name, "rm") == 0)
+    {
+        printf("Description : Used to delete the file\n");
+        printf("Usage : rm File_name\n");
+    }
+    else if (strcmp(name, "sync") == 0)
+    {
+        printf("Description : Used to flush all changes to the mounted image file and empty its journal\n");
+        printf("Usage : sync\n");
+    }
+    else if (strcmp(name, "stress") == 0)
+    {
+        printf("Description : Used to run a multithreaded stress test of the file system and report its throughput\n");
+        printf("Usage : stress Number_of_threads Iterations\n");
+        printf("Example : stress 8 1000\n");
+    }
+    else if (strcmp(name, "ring") == 0)
+    {
+        printf("Description : Used to test the asynchronous submission/completion ring against synchronous calls\n");
+        printf("Usage : ring Number_of_files Rounds Number_of_workers\n");
+        printf("Example : ring 40 100 4\n");
+    }
+    else if (strcmp(name, "journal") == 0)
+    {
+        printf("Description : Used to display write-ahead journal activity of the mounted image\n");
+        printf("Usage : journal\n");
+    }
+    else if (strcmp(name, "find") == 0)
+    {
+        printf("Description : Used to list files whose metadata satisfies all given conditions\n");
+        printf("Usage : find [size|perm|type|links][<|<=|=|!=|>=|>]Value ...\n");
+        printf("Example : find size>1000 perm=3\n");
+    }
+    else if (strcmp(name, "slabstat") == 0)
+    {
+        printf("Description : Used to display how full the inode, file table and block pools are\n");
+        printf("Usage : slabstat\n");
+    }
+    else
+    {
+        printf("Error : No manual entry available.\n");
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : DisplayHelp
+//    Description   : Displays the list of available commands and their brief descriptions.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DisplayHelp()
+{
+    printf("ls : To list out all the files of a directory\n");
+    printf("mkdir : To create a directory\n");
+    printf("rmdir : To delete an empty directory\n");
+    printf("cd : To change the current directory\n");
+    printf("pwd : To display the current directory\n");
+    printf("dcache : To display path lookup cache statistics\n");
+    printf("tierstat : To display memory budget and block eviction statistics\n");
+    printf("compress : To compress the data blocks of a file\n");
+    printf("dedupstat : To display block deduplication statistics\n");
+    printf("snapshot : To capture the whole file system under /%s\n", SNAPSHOTROOT);
+    printf("clone : To copy a file without copying its data\n");
+    printf("perfstat : To display call counts, errors and latency of the file operations\n");
+    printf("trace : To record individual file operations and export them for a trace viewer\n");
+    printf("clear : To clear console\n");
+    printf("open : To open the file\n");
+    printf("close : To close the file\n");
+    printf("closeall : To close all opened file\n");
+    printf("read : To Read the contents from file\n");
+    printf("write : To write the contents into the file\n");
+    printf("pread : To read from a given offset without moving the file offset\n");
+    printf("pwrite : To write at a given offset without moving the file offset\n");
+    printf("mmap : To access a range of a file through a memory mapping\n");
+    printf("exit : To Terminate the file system\n");
+    printf("stat : To Display information of file using name\n");
+    printf("fstat : To Display information of file using file descriptor\n");
+    printf("truncate : To remove all data the file\n");
+    printf("rm : To delete the file\n");
+    printf("slabstat : To display inode, file table and block pool usage\n");
+    printf("sync : To flush the mounted image to disk\n");
+    printf("journal : To display write-ahead journal activity\n");
+    printf("stress : To run a multithreaded stress test\n");
+    printf("ring : To test the asynchronous submission/completion ring\n");
+    printf("find : To list files matching conditions on size, permission, type or links\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : SlabFlushCache
+//    Description   : Moves objects from the calling thread's cache back to the slab depot until
+//                    only keep objects remain cached.
+//    Input         : PSLAB slab  - Slab whose cache is flushed.
+//                    int keep    - Number of objects to leave in the cache.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SlabFlushCache(PSLAB slab, int keep)
+{
+    PSLABOBJECT obj = NULL;
+    SLABCACHE *cache = &SlabCaches[slab->Id];
+
+    pthread_mutex_lock(&slab->Lock);
+    while (cache->Count > keep)
+    {
+        obj = cache->Objects;
+        cache->Objects = obj->next;
+        (cache->Count)--;
+
+        obj->next = slab->Depot;
+        slab->Depot = obj;
+        (slab->DepotCount)++;
+    }
+    pthread_mutex_unlock(&slab->Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : SlabThreadExit
+//    Description   : Thread exit hook that hands the exiting thread's cached objects back to
+//                    the depots, so they are not lost with the thread.
+//    Input         : void* arg - Unused.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SlabThreadExit(void *arg)
+{
+    int i = 0;
+
+    (void)arg;
+    for (i = 0; i < SLABCOUNT; i++)
+        SlabFlushCache(SlabList[i], 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InitialiseSlabs
+//    Description   : Registers the thread exit hook for the per thread slab caches.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InitialiseSlabs()
+{
+    pthread_key_create(&SlabCacheKey, SlabThreadExit);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : SlabAlloc
+//    Description   : Allocates one object from a slab. The thread cache is tried first, then it
+//                    is refilled with half a cache worth from the depot, and only when the depot
+//                    is empty is a new chunk carved from the heap.
+//    Input         : PSLAB slab - Slab to allocate from.
+//    Output        : void*     - Uninitialised object, or NULL on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void *SlabAlloc(PSLAB slab)
+{
+    int i = 0;
+    char *chunk = NULL;
+    PSLABOBJECT obj = NULL;
+    SLABCACHE *cache = &SlabCaches[slab->Id];
+
+    if (cache->Count == 0)
+    {
+        pthread_setspecific(SlabCacheKey, (void *)1);
+
+        pthread_mutex_lock(&slab->Lock);
+        if (slab->Depot == NULL)
+        {
+            chunk = (char *)malloc(SLABCHUNKOBJECTS * slab->ObjectSize);
+            if (chunk == NULL)
+            {
+                pthread_mutex_unlock(&slab->Lock);
+                return NULL;
+            }
+            for (i = 0; i < SLABCHUNKOBJECTS; i++)
+            {
+                obj = (PSLABOBJECT)(chunk + i * slab->ObjectSize);
+                obj->next = slab->Depot;
+                slab->Depot = obj;
+            }
+            slab->DepotCount = slab->DepotCount + SLABCHUNKOBJECTS;
+            slab->Total = slab->Total + SLABCHUNKOBJECTS;
+            (slab->Chunks)++;
+        }
+
+        while ((slab->Depot != NULL) && (cache->Count < SLABCACHESIZE / 2))
+        {
+            obj = slab->Depot;
+            slab->Depot = obj->next;
+            (slab->DepotCount)--;
+
+            obj->next = cache->Objects;
+            cache->Objects = obj;
+            (cache->Count)++;
+        }
+        pthread_mutex_unlock(&slab->Lock);
+    }
+
+    obj = cache->Objects;
+    cache->Objects = obj->next;
+    (cache->Count)--;
+    __atomic_add_fetch(&slab->InUse, 1, __ATOMIC_RELAXED);
+
+    return obj;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : SlabFree
+//    Description   : Returns an object to the calling thread's cache for reuse. When the cache
+//                    overflows, half of it is handed back to the depot. A thread that only
+//                    frees registers the exit hook here, so its cache is flushed when it exits.
+//    Input         : PSLAB slab  - Slab the object came from.
+//                    void* ptr   - Object to release.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SlabFree(PSLAB slab, void *ptr)
+{
+    PSLABOBJECT obj = (PSLABOBJECT)ptr;
+    SLABCACHE *cache = &SlabCaches[slab->Id];
+
+    if (cache->Count == 0)
+        pthread_setspecific(SlabCacheKey, (void *)1);
+
+    obj->next = cache->Objects;
+    cache->Objects = obj;
+    (cache->Count)++;
+    __atomic_sub_fetch(&slab->InUse, 1, __ATOMIC_RELAXED);
+
+    if (cache->Count > SLABCACHESIZE)
+        SlabFlushCache(slab, SLABCACHESIZE / 2);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : slabstat
+//    Description   : Displays how full each object slab and the data block pool are.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void slabstat()
+{
+    int i = 0;
+    long long inuse = 0;
+    PSLAB slab = NULL;
+
+    printf("\nSlab\t\tObject size\tChunks\tTotal\tIn use\tFree\tUsage\n");
+    printf("-------------------------------------------------------------------\n");
+    for (i = 0; i < SLABCOUNT; i++)
+    {
+        slab = SlabList[i];
+        pthread_mutex_lock(&slab->Lock);
+        inuse = __atomic_load_n(&slab->InUse, __ATOMIC_RELAXED);
+        printf("%-10s\t%d\t\t%lld\t%lld\t%lld\t%lld\t%.1f%%\n", slab->Name, (int)slab->ObjectSize, slab->Chunks,
+               slab->Total, inuse, slab->Total - inuse, (slab->Total == 0) ? 0.0 : (100.0 * inuse) / slab->Total);
+        pthread_mutex_unlock(&slab->Lock);
+    }
+    if (IMAGEobj.Base != NULL)
+    {
+        printf("%-10s\t%d\t\t-\t%u\t%u\t%u\t%.1f%%\n", "image", BLOCKSIZE, IMAGEobj.Header->DataBlocks,
+               IMAGEobj.Header->NextBlock - 1 - IMAGEobj.Header->FreeBlockCount,
+               IMAGEobj.Header->DataBlocks - (IMAGEobj.Header->NextBlock - 1 - IMAGEobj.Header->FreeBlockCount),
+               (100.0 * (IMAGEobj.Header->NextBlock - 1 - IMAGEobj.Header->FreeBlockCount)) / IMAGEobj.Header->DataBlocks);
+    }
+    inuse = BLOCKPOOLobj.TotalBlocks - BLOCKPOOLobj.FreeBlocks;
+    printf("%-10s\t%d\t\t%lld\t%lld\t%lld\t%lld\t%.1f%%\n", "block", BLOCKSIZE, BLOCKPOOLobj.TotalBlocks / BLOCKSPERCHUNK,
+           BLOCKPOOLobj.TotalBlocks, inuse, BLOCKPOOLobj.FreeBlocks,
+           (BLOCKPOOLobj.TotalBlocks == 0) ? 0.0 : (100.0 * inuse) / BLOCKPOOLobj.TotalBlocks);
+    printf("-------------------------------------------------------------------\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : NowNanoseconds
+//    Description   : Reads the monotonic clock.
+//    Input         : None
+//    Output        : long long - Current time in nanoseconds.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long NowNanoseconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PerfMerge
+//    Description   : Adds (or subtracts) one set of counters to another.
+//    Input         : PPERFSHARD total - Receives the sum.
+//                    PPERFSHARD shard - Counters to add, possibly being updated by their owner.
+//                    int sign         - 1 to add, -1 to subtract.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PerfMerge(PPERFSHARD total, PPERFSHARD shard, int sign)
+{
+    int op = 0, i = 0;
+
+    for (op = 0; op < PERFOPS; op++)
+    {
+        total->Count[op] += sign * __atomic_load_n(&shard->Count[op], __ATOMIC_RELAXED);
+        total->Bytes[op] += sign * __atomic_load_n(&shard->Bytes[op], __ATOMIC_RELAXED);
+        total->Time[op] += sign * __atomic_load_n(&shard->Time[op], __ATOMIC_RELAXED);
+        for (i = 0; i < PERFERRORS; i++)
+            total->Errors[op][i] += sign * __atomic_load_n(&shard->Errors[op][i], __ATOMIC_RELAXED);
+        for (i = 0; i < PERFBUCKETS; i++)
+            total->Histogram[op][i] += sign * __atomic_load_n(&shard->Histogram[op][i], __ATOMIC_RELAXED);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PerfThreadExit
+//    Description   : Thread exit hook that folds the exiting thread's counters into the retired
+//                    totals and frees its shard.
+//    Input         : void* arg - PPERFSHARD of the thread.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PerfThreadExit(void *arg)
+{
+    PPERFSHARD shard = (PPERFSHARD)arg, *link = NULL;
+
+    pthread_mutex_lock(&PERFobj.Lock);
+    PerfMerge(&PERFobj.Retired, shard, 1);
+    for (link = &PERFobj.Shards; *link != NULL; link = &(*link)->Next)
+    {
+        if (*link == shard)
+        {
+            *link = shard->Next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&PERFobj.Lock);
+    free(shard);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InitialisePerf
+//    Description   : Prepares the operation counters and registers their thread exit hook.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InitialisePerf()
+{
+    memset(&PERFobj, 0, sizeof(PERFobj));
+    pthread_mutex_init(&PERFobj.Lock, NULL);
+    pthread_key_create(&PerfKey, PerfThreadExit);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PerfBucket
+//    Description   : Maps a latency to its histogram bucket. Every power of two is split into
+//                    PERFSUBBUCKETS linear buckets, so a bucket is within 1 / PERFSUBBUCKETS of
+//                    the values it holds.
+//    Input         : long long ns - Latency in nanoseconds.
+//    Output        : int         - Bucket index, 0 to PERFBUCKETS - 1.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PerfBucket(long long ns)
+{
+    int exponent = 0;
+
+    if (ns < PERFSUBBUCKETS)
+        return (ns < 0) ? 0 : (int)ns;
+
+    exponent = 63 - __builtin_clzll((unsigned long long)ns);
+    if (exponent > PERFMAXEXP)
+        return PERFBUCKETS - 1;
+
+    return (exponent - PERFSUBBITS + 1) * PERFSUBBUCKETS + (int)((ns >> (exponent - PERFSUBBITS)) & (PERFSUBBUCKETS - 1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PerfBucketLimit
+//    Description   : Returns the largest latency a histogram bucket holds.
+//    Input         : int index   - Bucket index.
+//    Output        : long long  - Upper bound in nanoseconds.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long PerfBucketLimit(int index)
+{
+    int exponent = 0;
+
+    index++;
+    if (index < PERFSUBBUCKETS)
+        return index - 1;
+
+    exponent = index / PERFSUBBUCKETS + PERFSUBBITS - 1;
+    return ((long long)(PERFSUBBUCKETS + index % PERFSUBBUCKETS) << (exponent - PERFSUBBITS)) - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PerfAdd
+//    Description   : Adds to a counter of the calling thread's shard. Only the owner writes
+//                    the shard, so no read-modify-write is needed; the atomic accesses let
+//                    perfstat read it concurrently.
+//    Input         : long long* counter - Counter to update.
+//                    long long value    - Amount to add.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PerfAdd(long long *counter, long long value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TraceThreadExit
+//    Description   : Thread exit hook for trace rings. A ring holding events of the current
+//                    session is kept for trace dump and freed by the next trace start; any other
+//                    ring is freed now.
+//    Input         : void* arg - PTRACERING of the thread.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TraceThreadExit(void *arg)
+{
+    PTRACERING ring = (PTRACERING)arg, *link = NULL;
+
+    pthread_mutex_lock(&TRACEobj.Lock);
+    if (__atomic_load_n(&ring->Session, __ATOMIC_RELAXED) == TRACEobj.Session)
+        ring->Exited = 1;
+    else
+    {
+        for (link = &TRACEobj.Rings; *link != NULL; link = &(*link)->Next)
+        {
+            if (*link == ring)
+            {
+                *link = ring->Next;
+                break;
+            }
+        }
+        TRACEobj.Count--;
+        free(ring);
+    }
+    pthread_mutex_unlock(&TRACEobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InitialiseTrace
+//    Description   : Prepares the trace registry and registers the thread exit hook of the
+//                    trace rings. Tracing starts disabled.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InitialiseTrace()
+{
+    memset(&TRACEobj, 0, sizeof(TRACEobj));
+    pthread_mutex_init(&TRACEobj.Lock, NULL);
+    pthread_key_create(&TraceKey, TraceThreadExit);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TraceEvent
+//    Description   : Appends one call to the calling thread's trace ring, creating the ring on
+//                    the thread's first traced call. Only the owner writes a ring; each slot
+//                    carries a sequence number so trace dump can skip slots being rewritten.
+//                    When the ring is full the oldest events are overwritten.
+//    Input         : int op           - PERF_CREATE to PERF_LOOKUP.
+//                    long long start  - NowNanoseconds() at entry.
+//                    long long end    - NowNanoseconds() at exit.
+//                    long long ret    - Return value of the call.
+//                    long long fd     - Descriptor used, or -1.
+//                    int ino          - Inode number involved, or 0.
+//                    long long offset - File offset of the call.
+//                    long long size   - Bytes asked for.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TraceEvent(int op, long long start, long long end, long long ret, long long fd, int ino, long long offset,
+                long long size)
+{
+    PTRACERING ring = TraceRing;
+    PTRACEEVENT event = NULL;
+    long long session = __atomic_load_n(&TRACEobj.Session, __ATOMIC_RELAXED), head = 0;
+
+    if (ring == NULL)
+    {
+        pthread_mutex_lock(&TRACEobj.Lock);
+        if (TRACEobj.Count < TRACEMAXRINGS)
+            ring = (PTRACERING)calloc(1, sizeof(TRACERING));
+        if (ring != NULL)
+        {
+            ring->Thread = ++(TRACEobj.Threads);
+            ring->Next = TRACEobj.Rings;
+            TRACEobj.Rings = ring;
+            TRACEobj.Count++;
+        }
+        pthread_mutex_unlock(&TRACEobj.Lock);
+
+        if (ring == NULL)
+        {
+            __atomic_fetch_add(&TRACEobj.Dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        pthread_setspecific(TraceKey, ring);
+        TraceRing = ring;
+    }
+
+    if (__atomic_load_n(&ring->Session, __ATOMIC_RELAXED) != session)
+    {
+        __atomic_store_n(&ring->Head, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->Session, session, __ATOMIC_RELEASE);
+    }
+
+    head = __atomic_load_n(&ring->Head, __ATOMIC_RELAXED);
+    event = &ring->Events[head & (TRACEEVENTS - 1)];
+    __atomic_store_n(&event->Seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&event->Start, start, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->Duration, end - start, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->Offset, offset, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->Size, size, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->Op, op, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->Fd, fd, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->Inode, ino, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->Ret, ret, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->Seq, head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->Head, head + 1, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TraceStart
+//    Description   : Starts a new trace session. Rings of exited threads are freed and live
+//                    rings start over on their next event.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TraceStart()
+{
+    PTRACERING *link = NULL, ring = NULL;
+
+    pthread_mutex_lock(&TRACEobj.Lock);
+    link = &TRACEobj.Rings;
+    while (*link != NULL)
+    {
+        ring = *link;
+        if (ring->Exited != 0)
+        {
+            *link = ring->Next;
+            TRACEobj.Count--;
+            free(ring);
+        }
+        else
+            link = &ring->Next;
+    }
+    TRACEobj.Origin = NowNanoseconds();
+    __atomic_store_n(&TRACEobj.Dropped, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&TRACEobj.Session, TRACEobj.Session + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&TRACEobj.Enabled, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&TRACEobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TraceStop
+//    Description   : Stops tracing. The events of the session stay available to trace dump.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TraceStop()
+{
+    __atomic_store_n(&TRACEobj.Enabled, 0, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TraceDump
+//    Description   : Writes the events of the current (or last) trace session as Chrome trace
+//                    event JSON, loadable in chrome://tracing and Perfetto. Every call becomes
+//                    a complete event on its thread's track, with its descriptor, inode,
+//                    offset, size and return value as arguments. Works while tracing is on.
+//    Input         : char* path - Path of the JSON file to write.
+//    Output        : int       - Number of events written, or error code:
+//                                 -1: File could not be created
+//                                 -2: Tracing was never started
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int TraceDump(char *path)
+{
+    TRACEEVENT copy;
+    PTRACEEVENT event = NULL;
+    PTRACERING ring = NULL;
+    FILE *out = NULL;
+    long long head = 0, i = 0, seq = 0, overwritten = 0;
+    int count = 0, pid = (int)getpid();
+
+    if (__atomic_load_n(&TRACEobj.Session, __ATOMIC_RELAXED) == 0)
+        return -2;
+
+    out = fopen(path, "w");
+    if (out == NULL)
+        return -1;
+
+    fprintf(out, "{\"traceEvents\": [\n");
+    fprintf(out, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"cvfs\"}}", pid);
+
+    pthread_mutex_lock(&TRACEobj.Lock);
+    for (ring = TRACEobj.Rings; ring != NULL; ring = ring->Next)
+    {
+        if (__atomic_load_n(&ring->Session, __ATOMIC_ACQUIRE) != TRACEobj.Session)
+            continue;
+
+        fprintf(out, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+                pid, ring->Thread, ring->Thread);
+        head = __atomic_load_n(&ring->Head, __ATOMIC_ACQUIRE);
+        i = (head > TRACEEVENTS) ? head - TRACEEVENTS : 0;
+        overwritten = overwritten + i;
+        for (; i < head; i++)
+        {
+            event = &ring->Events[i & (TRACEEVENTS - 1)];
+            seq = __atomic_load_n(&event->Seq, __ATOMIC_ACQUIRE);
+            copy.Start = __atomic_load_n(&event->Start, __ATOMIC_RELAXED);
+            copy.Duration = __atomic_load_n(&event->Duration, __ATOMIC_RELAXED);
+            copy.Offset = __atomic_load_n(&event->Offset, __ATOMIC_RELAXED);
+            copy.Size = __atomic_load_n(&event->Size, __ATOMIC_RELAXED);
+            copy.Op = __atomic_load_n(&event->Op, __ATOMIC_RELAXED);
+            copy.Fd = __atomic_load_n(&event->Fd, __ATOMIC_RELAXED);
+            copy.Inode = __atomic_load_n(&event->Inode, __ATOMIC_RELAXED);
+            copy.Ret = __atomic_load_n(&event->Ret, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if ((seq != i + 1) || (__atomic_load_n(&event->Seq, __ATOMIC_RELAXED) != seq))
+            {
+                overwritten++;
+                continue;
+            }
+
+            fprintf(out, ",\n  {\"name\": \"%s\", \"cat\": \"vfs\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, "
+                         "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"fd\": %lld, \"inode\": %d, \"offset\": %lld, "
+                         "\"size\": %lld, \"ret\": %lld}}",
+                    PerfNames[copy.Op], pid, ring->Thread, (copy.Start - TRACEobj.Origin) / 1e3, copy.Duration / 1e3,
+                    copy.Fd, copy.Inode, copy.Offset, copy.Size, copy.Ret);
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&TRACEobj.Lock);
+
+    fprintf(out, "\n], \"displayTimeUnit\": \"ns\", \"otherData\": {\"overwritten\": %lld, \"dropped\": %lld}}\n",
+            overwritten, __atomic_load_n(&TRACEobj.Dropped, __ATOMIC_RELAXED));
+    fclose(out);
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PerfRecord
+//    Description   : Accounts one call of a core entry point in the calling thread's shard,
+//                    which is created and registered on the thread's first call, and traces it
+//                    when tracing is on. Reads and writes count their return value as bytes
+//                    moved.
+//    Input         : int op           - PERF_CREATE to PERF_LOOKUP.
+//                    long long start  - NowNanoseconds() at entry.
+//                    long long ret    - Return value of the call; negative values are errors.
+//                    long long fd     - Descriptor used, or -1.
+//                    int ino          - Inode number involved, or 0.
+//                    long long offset - File offset of the call.
+//                    long long size   - Bytes asked for.
+//    Output        : long long       - ret, so callers can return through it.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long PerfRecord(int op, long long start, long long ret, long long fd, int ino, long long offset, long long size)
+{
+    PPERFSHARD shard = PerfShard;
+    long long end = NowNanoseconds(), elapsed = end - start;
+
+    if (__atomic_load_n(&TRACEobj.Enabled, __ATOMIC_RELAXED) != 0)
+        TraceEvent(op, start, end, ret, fd, ino, offset, size);
+
+    if (shard == NULL)
+    {
+        shard = (PPERFSHARD)calloc(1, sizeof(PERFSHARD));
+        if (shard == NULL)
+            return ret;
+
+        pthread_mutex_lock(&PERFobj.Lock);
+        shard->Next = PERFobj.Shards;
+        PERFobj.Shards = shard;
+        pthread_mutex_unlock(&PERFobj.Lock);
+        pthread_setspecific(PerfKey, shard);
+        PerfShard = shard;
+    }
+
+    PerfAdd(&shard->Count[op], 1);
+    PerfAdd(&shard->Time[op], elapsed);
+    PerfAdd(&shard->Histogram[op][PerfBucket(elapsed)], 1);
+    if (ret < 0)
+        PerfAdd(&shard->Errors[op][((-ret > PERFERRORS) ? PERFERRORS : -ret) - 1], 1);
+    else if ((ret > 0) && ((op == PERF_READ) || (op == PERF_WRITE)))
+        PerfAdd(&shard->Bytes[op], ret);
+
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PerfCollect
+//    Description   : Merges the counters of live and exited threads, less the baseline taken
+//                    by the last reset.
+//    Input         : PPERFSHARD total - Receives the merged counters.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PerfCollect(PPERFSHARD total)
+{
+    PPERFSHARD shard = NULL;
+
+    memset(total, 0, sizeof(PERFSHARD));
+    pthread_mutex_lock(&PERFobj.Lock);
+    PerfMerge(total, &PERFobj.Retired, 1);
+    for (shard = PERFobj.Shards; shard != NULL; shard = shard->Next)
+        PerfMerge(total, shard, 1);
+    PerfMerge(total, &PERFobj.Baseline, -1);
+    pthread_mutex_unlock(&PERFobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PerfReset
+//    Description   : Starts the counters over. The current totals become the baseline that
+//                    PerfCollect subtracts, so no thread's shard is written by another thread.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PerfReset()
+{
+    PPERFSHARD shard = NULL;
+
+    pthread_mutex_lock(&PERFobj.Lock);
+    memset(&PERFobj.Baseline, 0, sizeof(PERFSHARD));
+    PerfMerge(&PERFobj.Baseline, &PERFobj.Retired, 1);
+    for (shard = PERFobj.Shards; shard != NULL; shard = shard->Next)
+        PerfMerge(&PERFobj.Baseline, shard, 1);
+    pthread_mutex_unlock(&PERFobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PerfPercentile
+//    Description   : Reads a latency percentile of one operation from its histogram.
+//    Input         : PPERFSHARD total - Merged counters.
+//                    int op           - Operation.
+//                    double fraction  - Percentile as a fraction (0.5 for p50, 1 for the max).
+//    Output        : double          - Upper bound of the percentile's bucket in microseconds.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+double PerfPercentile(PPERFSHARD total, int op, double fraction)
+{
+    long long rank = (long long)(total->Count[op] * fraction), seen = 0;
+    int i = 0;
+
+    if (rank >= total->Count[op])
+        rank = total->Count[op] - 1;
+
+    for (i = 0; i < PERFBUCKETS; i++)
+    {
+        seen = seen + total->Histogram[op][i];
+        if (seen > rank)
+            return PerfBucketLimit(i) / 1e3;
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : perfstat
+//    Description   : Displays call counts, bytes moved, errors by code and latency percentiles
+//                    of every core entry point since start up or the last reset, as a table or
+//                    as JSON with the non-empty histogram buckets.
+//    Input         : int json - 1 for JSON, 0 for the table.
+//    Output        : int     - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int perfstat(int json)
+{
+    PPERFSHARD total = (PPERFSHARD)malloc(sizeof(PERFSHARD));
+    long long errors = 0;
+    int op = 0, i = 0, first = 0;
+
+    if (total == NULL)
+        return -1;
+    PerfCollect(total);
+
+    if (json != 0)
+    {
+        printf("{\"operations\": [\n");
+        for (op = 0; op < PERFOPS; op++)
+        {
+            printf("  {\"op\": \"%s\", \"count\": %lld, \"bytes\": %lld, \"total_us\": %.3f, \"mean_us\": %.3f, "
+                   "\"p50_us\": %.3f, \"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f, \"errors\": {",
+                   PerfNames[op], total->Count[op], total->Bytes[op], total->Time[op] / 1e3,
+                   (total->Count[op] == 0) ? 0.0 : total->Time[op] / 1e3 / total->Count[op],
+                   (total->Count[op] == 0) ? 0.0 : PerfPercentile(total, op, 0.5),
+                   (total->Count[op] == 0) ? 0.0 : PerfPercentile(total, op, 0.99),
+                   (total->Count[op] == 0) ? 0.0 : PerfPercentile(total, op, 0.999),
+                   (total->Count[op] == 0) ? 0.0 : PerfPercentile(total, op, 1));
+            for (i = 0, first = 1; i < PERFERRORS; i++)
+            {
+                if (total->Errors[op][i] == 0)
+                    continue;
+                printf("%s\"-%d\": %lld", (first != 0) ? "" : ", ", i + 1, total->Errors[op][i]);
+                first = 0;
+            }
+            printf("}, \"histogram\": [");
+            for (i = 0, first = 1; i < PERFBUCKETS; i++)
+            {
+                if (total->Histogram[op][i] == 0)
+                    continue;
+                printf("%s[%lld, %lld]", (first != 0) ? "" : ", ", PerfBucketLimit(i), total->Histogram[op][i]);
+                first = 0;
+            }
+            printf("]}%s\n", (op + 1 == PERFOPS) ? "" : ",");
+        }
+        printf("], \"histogram_unit\": \"ns\"}\n");
+        free(total);
+        return 0;
+    }
+
+    printf("\nOperation\tCount\t\tErrors\tBytes\t\tMean(us)\tp50(us)\tp99(us)\tp999(us)\tMax(us)\n");
+    printf("--------------------------------------------------------------------------------------------------------\n");
+    for (op = 0; op < PERFOPS; op++)
+    {
+        for (i = 0, errors = 0; i < PERFERRORS; i++)
+            errors = errors + total->Errors[op][i];
+        if (total->Count[op] == 0)
+        {
+            printf("%-10s\t%-10lld\t%lld\t%-10lld\t%s\t\t%s\t%s\t%s\t\t%s\n", PerfNames[op], total->Count[op], errors,
+                   total->Bytes[op], "-", "-", "-", "-", "-");
+            continue;
+        }
+        printf("%-10s\t%-10lld\t%lld\t%-10lld\t%.2f\t\t%.2f\t%.2f\t%.2f\t\t%.2f\n", PerfNames[op], total->Count[op], errors,
+               total->Bytes[op], total->Time[op] / 1e3 / total->Count[op], PerfPercentile(total, op, 0.5),
+               PerfPercentile(total, op, 0.99), PerfPercentile(total, op, 0.999), PerfPercentile(total, op, 1));
+    }
+    printf("--------------------------------------------------------------------------------------------------------\n");
+    for (op = 0; op < PERFOPS; op++)
+    {
+        for (i = 0, first = 1; i < PERFERRORS; i++)
+        {
+            if (total->Errors[op][i] == 0)
+                continue;
+            if (first != 0)
+                printf("Error codes of %s : ", PerfNames[op]);
+            printf("%s%d x %lld", (first != 0) ? "" : ", ", -(i + 1), total->Errors[op][i]);
+            first = 0;
+        }
+        if (first == 0)
+            printf("\n");
+    }
+
+    free(total);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AllocateImageBlockNumber
+//    Description   : Takes a block from the mounted image, reusing the free block chain before
+//                    touching blocks that were never handed out.
+//    Input         : None
+//    Output        : unsigned int - Block number, or 0 if the image is full.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int AllocateImageBlockNumber()
+{
+    unsigned int blockno = 0;
+    PIMAGEHEADER hdr = IMAGEobj.Header;
+
+    pthread_mutex_lock(&BLOCKPOOLobj.Lock);
+    if (hdr->FreeBlockHead != 0)
+    {
+        blockno = hdr->FreeBlockHead;
+        hdr->FreeBlockHead = *(unsigned int *)IMAGEBLOCK(blockno);
+        (hdr->FreeBlockCount)--;
+    }
+    else if (hdr->NextBlock <= hdr->DataBlocks)
+    {
+        blockno = hdr->NextBlock;
+        (hdr->NextBlock)++;
+    }
+    pthread_mutex_unlock(&BLOCKPOOLobj.Lock);
+    return blockno;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FreeImageBlockNumber
+//    Description   : Pushes an image block onto the free block chain. The link to the next free
+//                    block is stored in the first word of the freed block itself.
+//    Input         : unsigned int blockno - Block to release.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeImageBlockNumber(unsigned int blockno)
+{
+    PIMAGEHEADER hdr = IMAGEobj.Header;
+
+    pthread_mutex_lock(&BLOCKPOOLobj.Lock);
+    *(unsigned int *)IMAGEBLOCK(blockno) = hdr->FreeBlockHead;
+    hdr->FreeBlockHead = blockno;
+    (hdr->FreeBlockCount)++;
+    pthread_mutex_unlock(&BLOCKPOOLobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AllocateDescriptor
+//    Description   : Takes a block descriptor without data. Descriptors are carved in chunks of
+//                    BLOCKSPERCHUNK and recycled through BLOCKPOOL::SpareDescriptors.
+//    Input         : None
+//    Output        : PBLOCK - Cleared descriptor, or NULL on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PBLOCK AllocateDescriptor()
+{
+    int i = 0;
+    PBLOCK chunk = NULL, newb = NULL;
+
+    pthread_mutex_lock(&BLOCKPOOLobj.Lock);
+    if (BLOCKPOOLobj.SpareDescriptors == NULL)
+    {
+        chunk = (PBLOCK)malloc(BLOCKSPERCHUNK * sizeof(BLOCK));
+        if (chunk == NULL)
+        {
+            pthread_mutex_unlock(&BLOCKPOOLobj.Lock);
+            return NULL;
+        }
+
+        for (i = 0; i < BLOCKSPERCHUNK; i++)
+        {
+            chunk[i].next = BLOCKPOOLobj.SpareDescriptors;
+            BLOCKPOOLobj.SpareDescriptors = &chunk[i];
+        }
+    }
+
+    newb = BLOCKPOOLobj.SpareDescriptors;
+    BLOCKPOOLobj.SpareDescriptors = newb->next;
+    pthread_mutex_unlock(&BLOCKPOOLobj.Lock);
+
+    memset(newb, 0, sizeof(BLOCK));
+    return newb;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FreeDescriptor
+//    Description   : Returns a block descriptor without data to the pool.
+//    Input         : PBLOCK block - Descriptor to release.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeDescriptor(PBLOCK block)
+{
+    pthread_mutex_lock(&BLOCKPOOLobj.Lock);
+    block->next = BLOCKPOOLobj.SpareDescriptors;
+    BLOCKPOOLobj.SpareDescriptors = block;
+    pthread_mutex_unlock(&BLOCKPOOLobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ImageBlock
+//    Description   : Wraps an image block in a block descriptor.
+//    Input         : unsigned int blockno - Image block number.
+//    Output        : PBLOCK              - Descriptor, or NULL on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PBLOCK ImageBlock(unsigned int blockno)
+{
+    PBLOCK newb = AllocateDescriptor();
+
+    if (newb == NULL)
+        return NULL;
+
+    newb->Data = IMAGEBLOCK(blockno);
+    newb->BlockNo = blockno;
+    return newb;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AllocateImageBlock
+//    Description   : Takes a data block from the mounted image.
+//    Input         : None
+//    Output        : PBLOCK - New block, or NULL if the image is full.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PBLOCK AllocateImageBlock()
+{
+    unsigned int blockno = AllocateImageBlockNumber();
+    PBLOCK newb = NULL;
+
+    if (blockno == 0)
+        return NULL;
+
+    newb = ImageBlock(blockno);
+    if (newb == NULL)
+        FreeImageBlockNumber(blockno);
+
+    return newb;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FreeImageBlock
+//    Description   : Returns an image block to the image and its descriptor to the pool.
+//    Input         : PBLOCK block - Block to release.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeImageBlock(PBLOCK block)
+{
+    FreeImageBlockNumber(block->BlockNo);
+
+    block->Data = NULL;
+    block->BlockNo = 0;
+    FreeDescriptor(block);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : GrowPoolStorage
+//    Description   : Extends the pool's memory file by one chunk of blocks, creating the file
+//                    and its mapping on first use. Called with BLOCKPOOL::Lock held.
+//    Input         : None
+//    Output        : char* - Data of the new chunk, or NULL if the file could not be created
+//                            or grown.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+char *GrowPoolStorage()
+{
+    char *base = NULL;
+    long long size = (BLOCKPOOLobj.TotalBlocks + BLOCKSPERCHUNK) * BLOCKSIZE;
+
+    if (size > POOLLIMIT)
+        return NULL;
+
+    if (BLOCKPOOLobj.Base == NULL)
+    {
+        BLOCKPOOLobj.fd = memfd_create("cvfs.pool", MFD_CLOEXEC);
+        if (BLOCKPOOLobj.fd == -1)
+            return NULL;
+        base = (char *)mmap(NULL, POOLLIMIT, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, BLOCKPOOLobj.fd, 0);
+        if (base == MAP_FAILED)
+        {
+            close(BLOCKPOOLobj.fd);
+            return NULL;
+        }
+        BLOCKPOOLobj.Base = base;
+    }
+
+    if (ftruncate(BLOCKPOOLobj.fd, size) == -1)
+        return NULL;
+    return BLOCKPOOLobj.Base + BLOCKPOOLobj.TotalBlocks * BLOCKSIZE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AllocatePoolBlock
+//    Description   : Takes a data block from the shared pool, carving a new chunk of blocks when
+//                    the free list is empty. The block contents are not cleared.
+//    Input         : None
+//    Output        : PBLOCK - New block, or NULL on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PBLOCK AllocatePoolBlock()
+{
+    int i = 0;
+    char *data = NULL;
+    PBLOCK chunk = NULL, newb = NULL;
+
+    pthread_mutex_lock(&BLOCKPOOLobj.Lock);
+    if (BLOCKPOOLobj.FreeList == NULL)
+    {
+        chunk = (PBLOCK)malloc(BLOCKSPERCHUNK * sizeof(BLOCK));
+        data = (chunk == NULL) ? NULL : GrowPoolStorage();
+        if (data == NULL)
+        {
+            pthread_mutex_unlock(&BLOCKPOOLobj.Lock);
+            free(chunk);
+            return NULL;
+        }
+
+        for (i = 0; i < BLOCKSPERCHUNK; i++)
+        {
+            chunk[i].Data = data + (size_t)i * BLOCKSIZE;
+            chunk[i].next = BLOCKPOOLobj.FreeList;
+            BLOCKPOOLobj.FreeList = &chunk[i];
+        }
+        BLOCKPOOLobj.TotalBlocks = BLOCKPOOLobj.TotalBlocks + BLOCKSPERCHUNK;
+        BLOCKPOOLobj.FreeBlocks = BLOCKPOOLobj.FreeBlocks + BLOCKSPERCHUNK;
+    }
+
+    newb = BLOCKPOOLobj.FreeList;
+    BLOCKPOOLobj.FreeList = newb->next;
+    (BLOCKPOOLobj.FreeBlocks)--;
+    pthread_mutex_unlock(&BLOCKPOOLobj.Lock);
+
+    data = newb->Data;
+    memset(newb, 0, sizeof(BLOCK));
+    newb->Data = data;
+
+    return newb;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FreePoolBlock
+//    Description   : Returns a data block to the shared pool.
+//    Input         : PBLOCK block - Block whose Data came from the pool.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreePoolBlock(PBLOCK block)
+{
+    pthread_mutex_lock(&BLOCKPOOLobj.Lock);
+    block->next = BLOCKPOOLobj.FreeList;
+    BLOCKPOOLobj.FreeList = block;
+    (BLOCKPOOLobj.FreeBlocks)++;
+    pthread_mutex_unlock(&BLOCKPOOLobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InitialiseTier
+//    Description   : Enables the memory budget. Block data is then kept in a fixed arena of
+//                    frames, mapped from a memory file so MapFile can map frames again, and
+//                    cold blocks are written to an unlinked backing file when the arena is
+//                    full. Must be called before any block is allocated.
+//    Input         : long long megabytes - Memory budget for block data.
+//    Output        : int                - 0 on success, or error code:
+//                                          -1: Budget below TIERMINFRAMES blocks
+//                                          -2: Memory allocation failure
+//                                          -3: Backing file could not be created
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int InitialiseTier(long long megabytes)
+{
+    char path[] = "/tmp/cvfs.spill.XXXXXX";
+    long long frames = megabytes * 1024 * 1024 / BLOCKSIZE, i = 0;
+
+    if (frames < TIERMINFRAMES)
+        return -1;
+
+    TIERobj.ArenaFd = memfd_create("cvfs.arena", MFD_CLOEXEC);
+    if ((TIERobj.ArenaFd == -1) || (ftruncate(TIERobj.ArenaFd, frames * BLOCKSIZE) == -1))
+        return -2;
+    TIERobj.Arena = (char *)mmap(NULL, (size_t)frames * BLOCKSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, TIERobj.ArenaFd, 0);
+    TIERobj.Owner = (PBLOCK *)calloc(frames, sizeof(PBLOCK));
+    TIERobj.FreeFrames = (long long *)malloc(frames * sizeof(long long));
+    if ((TIERobj.Arena == MAP_FAILED) || (TIERobj.Owner == NULL) || (TIERobj.FreeFrames == NULL))
+        return -2;
+
+    TIERobj.fd = mkstemp(path);
+    if (TIERobj.fd == -1)
+        return -3;
+    unlink(path);
+
+    for (i = 0; i < frames; i++)
+        TIERobj.FreeFrames[i] = frames - 1 - i;
+    TIERobj.FreeCount = frames;
+    TIERobj.Frames = frames;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TierSlot
+//    Description   : Takes a free block sized slot of the backing file. Called with
+//                    TIER::Lock held.
+//    Input         : None
+//    Output        : unsigned int - Slot number (1 based), or 0 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int TierSlot()
+{
+    if (TIERobj.FreeSlotCount != 0)
+        return TIERobj.FreeSlots[--(TIERobj.FreeSlotCount)];
+
+    if (TIERobj.NextSlot == 0xFFFFFFFFu)
+        return 0;
+    return ++(TIERobj.NextSlot);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TierReleaseSlot
+//    Description   : Returns a backing file slot for reuse. Called with TIER::Lock held.
+//    Input         : unsigned int slot - Slot number (1 based).
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TierReleaseSlot(unsigned int slot)
+{
+    unsigned int *slots = NULL;
+    long long capacity = 0;
+
+    if (TIERobj.FreeSlotCount == TIERobj.SlotCapacity)
+    {
+        capacity = (TIERobj.SlotCapacity == 0) ? BLOCKSPERCHUNK : TIERobj.SlotCapacity * 2;
+        slots = (unsigned int *)realloc(TIERobj.FreeSlots, capacity * sizeof(unsigned int));
+        if (slots == NULL)
+            return;
+        TIERobj.FreeSlots = slots;
+        TIERobj.SlotCapacity = capacity;
+    }
+    TIERobj.FreeSlots[(TIERobj.FreeSlotCount)++] = slot;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TierFrame
+//    Description   : Takes a frame for block data. When none is free, the CLOCK hand sweeps the
+//                    frames: a referenced block gets a second chance, and the first unpinned,
+//                    unreferenced block is evicted. Its data is written to the backing file
+//                    first unless an identical copy is already there; the lock is dropped
+//                    during that write. Called with TIER::Lock held.
+//    Input         : None
+//    Output        : long long - Frame number, or -1 if every frame is pinned or the write
+//                                failed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long TierFrame()
+{
+    long long frame = 0, steps = 0;
+    unsigned int slot = 0;
+    PBLOCK victim = NULL;
+    int ret = 0;
+
+    if (TIERobj.FreeCount != 0)
+        return TIERobj.FreeFrames[--(TIERobj.FreeCount)];
+
+    for (steps = 0; steps < 2 * TIERobj.Frames; steps++)
+    {
+        frame = TIERobj.Hand;
+        TIERobj.Hand = (TIERobj.Hand + 1) % TIERobj.Frames;
+
+        victim = TIERobj.Owner[frame];
+        if ((victim == NULL) || (victim->Pins != 0) || (victim->Busy != 0))
+            continue;
+        if (victim->Referenced != 0)
+        {
+            victim->Referenced = 0;
+            continue;
+        }
+        break;
+    }
+    if (steps == 2 * TIERobj.Frames)
+        return -1;
+
+    TIERobj.Owner[frame] = NULL;
+    victim->Data = NULL;
+    victim->Prefetched = 0;
+    (TIERobj.Evictions)++;
+
+    if ((victim->Dirty == 0) && (victim->Slot != 0))
+        return frame;
+
+    slot = (victim->Slot != 0) ? victim->Slot : TierSlot();
+    victim->Busy = 1;
+    pthread_mutex_unlock(&TIERobj.Lock);
+    ret = (slot != 0) && (pwrite(TIERobj.fd, TIERobj.Arena + (size_t)frame * BLOCKSIZE, BLOCKSIZE,
+                                 (off_t)(slot - 1) * BLOCKSIZE) == BLOCKSIZE);
+    pthread_mutex_lock(&TIERobj.Lock);
+    victim->Busy = 0;
+    pthread_cond_broadcast(&TIERobj.Done);
+
+    if (ret == 0)
+    {
+        if ((slot != 0) && (victim->Slot == 0))
+            TierReleaseSlot(slot);
+        victim->Data = TIERobj.Arena + (size_t)frame * BLOCKSIZE;
+        TIERobj.Owner[frame] = victim;
+        return -1;
+    }
+
+    victim->Slot = slot;
+    victim->Dirty = 0;
+    (TIERobj.Writebacks)++;
+    return frame;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TierLoad
+//    Description   : Faults an evicted block back into a frame from the backing file. The lock
+//                    is dropped during the read; the block is marked busy meanwhile so it is
+//                    neither loaded twice nor freed. Called with TIER::Lock held by a thread
+//                    holding the owning inode's lock.
+//    Input         : PBLOCK block - Block whose Data is NULL.
+//    Output        : int         - 0 on success (the block is resident), or -1 if no frame
+//                                  could be found or the read failed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int TierLoad(PBLOCK block)
+{
+    long long frame = TierFrame();
+    int ret = 0;
+
+    if (frame == -1)
+        return -1;
+
+    while (block->Busy != 0)
+        pthread_cond_wait(&TIERobj.Done, &TIERobj.Lock);
+    if (block->Data != NULL)
+    {
+        TIERobj.FreeFrames[(TIERobj.FreeCount)++] = frame;
+        return 0;
+    }
+
+    block->Busy = 1;
+    pthread_mutex_unlock(&TIERobj.Lock);
+    ret = (pread(TIERobj.fd, TIERobj.Arena + (size_t)frame * BLOCKSIZE, BLOCKSIZE,
+                 (off_t)(block->Slot - 1) * BLOCKSIZE) == BLOCKSIZE);
+    pthread_mutex_lock(&TIERobj.Lock);
+    block->Busy = 0;
+    pthread_cond_broadcast(&TIERobj.Done);
+
+    if (ret == 0)
+    {
+        TIERobj.FreeFrames[(TIERobj.FreeCount)++] = frame;
+        return -1;
+    }
+
+    block->Data = TIERobj.Arena + (size_t)frame * BLOCKSIZE;
+    TIERobj.Owner[frame] = block;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InitialiseCompression
+//    Description   : Enables compression of cold blocks and allocates the decompression cache.
+//                    Must be called before any thread accesses a file.
+//    Input         : None
+//    Output        : int - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int InitialiseCompression()
+{
+    TIERobj.Cache = (char *)malloc((size_t)ZCACHEBLOCKS * BLOCKSIZE);
+    TIERobj.CacheOwner = (PBLOCK *)calloc(ZCACHEBLOCKS, sizeof(PBLOCK));
+    if ((TIERobj.Cache == NULL) || (TIERobj.CacheOwner == NULL))
+        return -1;
+
+    TIERobj.Compress = 1;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CompressBlock
+//    Description   : Compresses one block with a small LZ77 codec. The output is a series of
+//                    sequences: a token (literal count in the high nibble, match length - 4 in
+//                    the low nibble, 15 meaning more length bytes follow), the literals, and a
+//                    two byte match offset; the last sequence has literals only. Matches are
+//                    found through a hash table of 4 byte prefixes.
+//    Input         : unsigned char* src  - BLOCKSIZE bytes to compress.
+//                    unsigned char* dst  - Receives the compressed bytes.
+//                    int limit           - Size of dst; compression is abandoned past it.
+//    Output        : int                - Compressed length, or -1 if it would exceed limit.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int CompressBlock(unsigned char *src, unsigned char *dst, int limit)
+{
+    unsigned short table[1 << ZHASHBITS];
+    unsigned int seq = 0, hash = 0;
+    int ip = 0, anchor = 0, op = 0, ref = 0, length = 0, literals = 0, n = 0;
+
+    memset(table, 0, sizeof(table));
+
+    while (1)
+    {
+        length = 0;
+        while (ip + ZMINMATCH <= BLOCKSIZE)
+        {
+            memcpy(&seq, src + ip, 4);
+            hash = (seq * 2654435761u) >> (32 - ZHASHBITS);
+            ref = table[hash];
+            table[hash] = (unsigned short)ip;
+            if ((ref < ip) && (memcmp(src + ref, src + ip, ZMINMATCH) == 0))
+            {
+                length = ZMINMATCH;
+                while ((ip + length < BLOCKSIZE) && (src[ref + length] == src[ip + length]))
+                    length++;
+                break;
+            }
+            ip++;
+        }
+        if (length == 0)
+            ip = BLOCKSIZE;
+
+        literals = ip - anchor;
+        if (op + 1 + literals / 255 + 1 + literals + 2 + (length / 255) + 1 > limit)
+            return -1;
+
+        dst[op++] = (unsigned char)(((literals < 15) ? literals : 15) << 4);
+        if (length != 0)
+            dst[op - 1] = dst[op - 1] | (unsigned char)(((length - ZMINMATCH) < 15) ? (length - ZMINMATCH) : 15);
+
+        if (literals >= 15)
+        {
+            for (n = literals - 15; n >= 255; n = n - 255)
+                dst[op++] = 255;
+            dst[op++] = (unsigned char)n;
+        }
+        memcpy(dst + op, src + anchor, literals);
+        op = op + literals;
+
+        if (length == 0)
+            return op;
+
+        dst[op++] = (unsigned char)((ip - ref) & 0xFF);
+        dst[op++] = (unsigned char)((ip - ref) >> 8);
+        if (length - ZMINMATCH >= 15)
+        {
+            for (n = length - ZMINMATCH - 15; n >= 255; n = n - 255)
+                dst[op++] = 255;
+            dst[op++] = (unsigned char)n;
+        }
+
+        ip = ip + length;
+        anchor = ip;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : DecompressBlock
+//    Description   : Expands data produced by CompressBlock, checking every length and offset
+//                    against both buffers.
+//    Input         : unsigned char* src  - Compressed bytes.
+//                    int length          - Number of compressed bytes.
+//                    unsigned char* dst  - Receives BLOCKSIZE bytes.
+//    Output        : int                - 0 on success, or -1 if the input is corrupt.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int DecompressBlock(unsigned char *src, int length, unsigned char *dst)
+{
+    int ip = 0, op = 0, token = 0, n = 0, offset = 0, i = 0;
+
+    while (ip < length)
+    {
+        token = src[ip++];
+
+        n = token >> 4;
+        if (n == 15)
+        {
+            do
+            {
+                if (ip >= length)
+                    return -1;
+                n = n + src[ip];
+            } while (src[ip++] == 255);
+        }
+        if ((ip + n > length) || (op + n > BLOCKSIZE))
+            return -1;
+        memcpy(dst + op, src + ip, n);
+        ip = ip + n;
+        op = op + n;
+
+        if (ip == length)
+            break;
+
+        if (ip + 2 > length)
+            return -1;
+        offset = src[ip] | (src[ip + 1] << 8);
+        ip = ip + 2;
+
+        n = (token & 15) + ZMINMATCH;
+        if ((token & 15) == 15)
+        {
+            do
+            {
+                if (ip >= length)
+                    return -1;
+                n = n + src[ip];
+            } while (src[ip++] == 255);
+        }
+        if ((offset == 0) || (offset > op) || (op + n > BLOCKSIZE))
+            return -1;
+        for (i = 0; i < n; i++)
+            dst[op + i] = dst[op - offset + i];
+        op = op + n;
+    }
+
+    return (op == BLOCKSIZE) ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TakeData
+//    Description   : Finds BLOCKSIZE bytes of data storage for a block: a frame under a memory
+//                    budget, otherwise a buffer from the block pool. Called with TIER::Lock
+//                    held, which TierFrame may drop while writing back.
+//    Input         : PBLOCK block - Block the storage is for.
+//    Output        : char*       - Storage, or NULL if none could be found.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+char *TakeData(PBLOCK block)
+{
+    long long frame = 0;
+    char *data = NULL;
+    PBLOCK spare = NULL;
+
+    if (TIERobj.Frames != 0)
+    {
+        frame = TierFrame();
+        if (frame == -1)
+            return NULL;
+        TIERobj.Owner[frame] = block;
+        return TIERobj.Arena + (size_t)frame * BLOCKSIZE;
+    }
+
+    spare = AllocatePoolBlock();
+    if (spare == NULL)
+        return NULL;
+    data = spare->Data;
+    FreeDescriptor(spare);
+    return data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReturnData
+//    Description   : Gives a block's data storage back to the tier or the block pool, leaving
+//                    the block without data. Called with TIER::Lock held.
+//    Input         : PBLOCK block - Unpinned block with resident (not cached) data.
+//    Output        : int         - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ReturnData(PBLOCK block)
+{
+    long long frame = 0;
+    PBLOCK spare = NULL;
+
+    if (TIERobj.Frames != 0)
+    {
+        frame = (block->Data - TIERobj.Arena) / BLOCKSIZE;
+        TIERobj.Owner[frame] = NULL;
+        TIERobj.FreeFrames[(TIERobj.FreeCount)++] = frame;
+    }
+    else
+    {
+        spare = AllocateDescriptor();
+        if (spare == NULL)
+            return -1;
+        spare->Data = block->Data;
+        FreePoolBlock(spare);
+    }
+
+    block->Data = NULL;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CacheUnpacked
+//    Description   : Decompresses a compressed block into a frame of the small decompression
+//                    cache, so reads do not inflate the block for good. The cache frame of an
+//                    unpinned block is reused round robin. Called with TIER::Lock held.
+//    Input         : PBLOCK block - Compressed block without cached data.
+//    Output        : int         - 0 on success, or -1 if every cache frame is pinned or the
+//                                  compressed data is corrupt.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int CacheUnpacked(PBLOCK block)
+{
+    int i = 0, frame = 0;
+    PBLOCK owner = NULL;
+    char *data = NULL;
+
+    for (i = 0; i < ZCACHEBLOCKS; i++)
+    {
+        frame = TIERobj.CacheHand;
+        TIERobj.CacheHand = (TIERobj.CacheHand + 1) % ZCACHEBLOCKS;
+        owner = TIERobj.CacheOwner[frame];
+        if ((owner == NULL) || (owner->Pins == 0))
+            break;
+    }
+    if (i == ZCACHEBLOCKS)
+        return -1;
+
+    if (owner != NULL)
+        owner->Data = NULL;
+    TIERobj.CacheOwner[frame] = NULL;
+
+    data = TIERobj.Cache + (size_t)frame * BLOCKSIZE;
+    if (DecompressBlock((unsigned char *)block->Packed, block->PackedSize, (unsigned char *)data) == -1)
+        return -1;
+
+    block->Data = data;
+    TIERobj.CacheOwner[frame] = block;
+    (TIERobj.Decompressions)++;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : DropUnpacked
+//    Description   : Releases the decompression cache frame of a compressed block, if any.
+//                    Called with TIER::Lock held.
+//    Input         : PBLOCK block - Compressed block.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DropUnpacked(PBLOCK block)
+{
+    if (block->Data == NULL)
+        return;
+
+    TIERobj.CacheOwner[(block->Data - TIERobj.Cache) / BLOCKSIZE] = NULL;
+    block->Data = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : Unpack
+//    Description   : Turns a compressed block back into a plain one before it is modified.
+//                    Called with TIER::Lock held by a writer holding the inode lock
+//                    exclusively; blocks are unshared before writing, so no one else can touch
+//                    the block meanwhile.
+//    Input         : PBLOCK block - Compressed block.
+//    Output        : int         - 0 on success, or -1 if no storage could be found or the
+//                                  compressed data is corrupt.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int Unpack(PBLOCK block)
+{
+    char *data = TakeData(block);
+
+    if (data == NULL)
+        return -1;
+
+    if (block->Data != NULL)
+        memcpy(data, block->Data, BLOCKSIZE);
+    else if (DecompressBlock((unsigned char *)block->Packed, block->PackedSize, (unsigned char *)data) == -1)
+    {
+        block->Data = data;
+        ReturnData(block);
+        return -1;
+    }
+
+    DropUnpacked(block);
+    TIERobj.PackedBytes = TIERobj.PackedBytes - block->PackedSize;
+    (TIERobj.PackedBlocks)--;
+    free(block->Packed);
+    block->Packed = NULL;
+    block->PackedSize = 0;
+    block->Data = data;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PackBlock
+//    Description   : Compresses a block that has not been accessed since the last sweep and
+//                    releases its storage. A block that was accessed only loses its referenced
+//                    bit, so it is compressed on the next sweep if it stays cold. The caller
+//                    holds the inode lock exclusively and the inode is not pinned by a view;
+//                    readers of other files sharing the block may pin it meanwhile, in which
+//                    case the compressed copy is dropped.
+//    Input         : PBLOCK block - Block of the file.
+//                    int force    - Non zero to compress even a recently accessed block.
+//    Output        : int         - 1 if the block was compressed, else 0.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PackBlock(PBLOCK block, int force)
+{
+    unsigned char buffer[BLOCKSIZE];
+    char *packed = NULL;
+    int length = 0;
+
+    pthread_mutex_lock(&TIERobj.Lock);
+    while (block->Busy != 0)
+        pthread_cond_wait(&TIERobj.Done, &TIERobj.Lock);
+
+    if ((block->BlockNo != 0) || (block->Packed != NULL) || (block->Incompressible != 0) || (block->Pins != 0))
+    {
+        pthread_mutex_unlock(&TIERobj.Lock);
+        return 0;
+    }
+    if ((block->Referenced != 0) && (force == 0))
+    {
+        block->Referenced = 0;
+        pthread_mutex_unlock(&TIERobj.Lock);
+        return 0;
+    }
+    if ((block->Data == NULL) && (TierLoad(block) == -1))
+    {
+        pthread_mutex_unlock(&TIERobj.Lock);
+        return 0;
+    }
+
+    (block->Pins)++;
+    pthread_mutex_unlock(&TIERobj.Lock);
+
+    length = CompressBlock((unsigned char *)block->Data, buffer, ZMAXPACKED);
+    if (length != -1)
+    {
+        packed = (char *)malloc(length);
+        if (packed != NULL)
+            memcpy(packed, buffer, length);
+    }
+
+    pthread_mutex_lock(&TIERobj.Lock);
+    (block->Pins)--;
+    if (length == -1)
+        block->Incompressible = 1;
+    else if ((packed != NULL) && (block->Pins == 0) && (ReturnData(block) == 0))
+    {
+        if (block->Slot != 0)
+            TierReleaseSlot(block->Slot);
+        block->Slot = 0;
+        block->Dirty = 0;
+        block->Packed = packed;
+        block->PackedSize = length;
+        TIERobj.PackedBytes = TIERobj.PackedBytes + length;
+        (TIERobj.PackedBlocks)++;
+        packed = NULL;
+    }
+    pthread_mutex_unlock(&TIERobj.Lock);
+
+    if (packed != NULL)
+    {
+        free(packed);
+        return 0;
+    }
+    return (length != -1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PinBlock
+//    Description   : Makes a block's data resident and keeps it from being evicted until
+//                    UnpinBlock. A compressed block is decompressed into the cache for a read,
+//                    and turned back into a plain block for a write. Without a memory budget
+//                    or compression this just returns the data. The caller holds the owning
+//                    inode's lock, exclusively when writing unless the block is a private plain
+//                    block being appended to.
+//    Input         : PBLOCK block - Block to access.
+//                    int write    - Non zero if the data is going to be modified.
+//    Output        : char*       - Block data, or NULL if it could not be made resident.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+char *PinBlock(PBLOCK block, int write)
+{
+    char *data = NULL;
+
+    if ((TIERobj.Frames == 0) && (TIERobj.Compress == 0))
+        return block->Data;
+
+    pthread_mutex_lock(&TIERobj.Lock);
+    while (block->Busy != 0)
+        pthread_cond_wait(&TIERobj.Done, &TIERobj.Lock);
+
+    if (block->Packed != NULL)
+    {
+        if (write)
+        {
+            if (Unpack(block) == -1)
+            {
+                pthread_mutex_unlock(&TIERobj.Lock);
+                return NULL;
+            }
+            (TIERobj.Inflations)++;
+        }
+        else if (block->Data != NULL)
+            (TIERobj.CacheHits)++;
+        else if (CacheUnpacked(block) == -1)
+        {
+            pthread_mutex_unlock(&TIERobj.Lock);
+            return NULL;
+        }
+    }
+    else if ((TIERobj.Frames != 0) && (block->Data != NULL))
+    {
+        (TIERobj.Hits)++;
+        if (block->Prefetched != 0)
+        {
+            (TIERobj.ReadaheadHits)++;
+            block->Prefetched = 0;
+        }
+    }
+    else if (TIERobj.Frames != 0)
+    {
+        (TIERobj.Misses)++;
+        if (TierLoad(block) == -1)
+        {
+            pthread_mutex_unlock(&TIERobj.Lock);
+            return NULL;
+        }
+    }
+
+    (block->Pins)++;
+    block->Referenced = 1;
+    if (write)
+    {
+        block->Dirty = 1;
+        block->Incompressible = 0;
+    }
+    data = block->Data;
+    pthread_mutex_unlock(&TIERobj.Lock);
+
+    return data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : UnpinBlock
+//    Description   : Releases a pin taken by PinBlock, making the block evictable again.
+//    Input         : PBLOCK block - Pinned block.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void UnpinBlock(PBLOCK block)
+{
+    if ((TIERobj.Frames == 0) && (TIERobj.Compress == 0))
+        return;
+
+    pthread_mutex_lock(&TIERobj.Lock);
+    (block->Pins)--;
+    pthread_mutex_unlock(&TIERobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PrefetchBlock
+//    Description   : Brings an evicted block back ahead of a sequential reader. The block is
+//                    left unpinned but referenced, so it survives one CLOCK sweep.
+//    Input         : PBLOCK block - Block of a file whose lock the caller holds.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrefetchBlock(PBLOCK block)
+{
+    pthread_mutex_lock(&TIERobj.Lock);
+    if ((block->Data == NULL) && (block->Packed == NULL) && (block->Busy == 0) && (TierLoad(block) == 0))
+    {
+        block->Referenced = 1;
+        block->Prefetched = 1;
+        (TIERobj.Readahead)++;
+    }
+    pthread_mutex_unlock(&TIERobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AllocateTierBlock
+//    Description   : Takes a block descriptor and a frame for it, evicting a cold block if the
+//                    budget is used up.
+//    Input         : None
+//    Output        : PBLOCK - New block, or NULL if no frame could be found.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PBLOCK AllocateTierBlock()
+{
+    long long frame = 0;
+    PBLOCK newb = AllocateDescriptor();
+
+    if (newb == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&TIERobj.Lock);
+    frame = TierFrame();
+    if (frame != -1)
+    {
+        newb->Data = TIERobj.Arena + (size_t)frame * BLOCKSIZE;
+        newb->Referenced = 1;
+        newb->Dirty = 1;
+        TIERobj.Owner[frame] = newb;
+    }
+    pthread_mutex_unlock(&TIERobj.Lock);
+
+    if (frame == -1)
+    {
+        FreeDescriptor(newb);
+        return NULL;
+    }
+    return newb;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FreeTierBlock
+//    Description   : Returns a block's frame and backing file slot, then its descriptor.
+//    Input         : PBLOCK block - Unpinned block of a file being truncated or removed.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeTierBlock(PBLOCK block)
+{
+    long long frame = 0;
+
+    pthread_mutex_lock(&TIERobj.Lock);
+    while (block->Busy != 0)
+        pthread_cond_wait(&TIERobj.Done, &TIERobj.Lock);
+
+    if (block->Data != NULL)
+    {
+        frame = (block->Data - TIERobj.Arena) / BLOCKSIZE;
+        TIERobj.Owner[frame] = NULL;
+        TIERobj.FreeFrames[(TIERobj.FreeCount)++] = frame;
+    }
+    if (block->Slot != 0)
+        TierReleaseSlot(block->Slot);
+    pthread_mutex_unlock(&TIERobj.Lock);
+
+    FreeDescriptor(block);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : tierstat
+//    Description   : Displays the memory budget usage and the hit, miss, readahead and
+//                    eviction counters of the block tier, and the compression counters.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void tierstat()
+{
+    long long total = 0;
+
+    pthread_mutex_lock(&TIERobj.Lock);
+    total = TIERobj.Hits + TIERobj.Misses;
+    printf("\n---------------------- Block tier ----------------------\n");
+    if (TIERobj.Frames != 0)
+    {
+        printf("Memory budget : %lld KB (%lld blocks)\n", TIERobj.Frames * BLOCKSIZE / 1024, TIERobj.Frames);
+        printf("Resident blocks : %lld\n", TIERobj.Frames - TIERobj.FreeCount);
+        printf("Backing file blocks : %lld\n", (long long)TIERobj.NextSlot - TIERobj.FreeSlotCount);
+        printf("Hits : %lld\n", TIERobj.Hits);
+        printf("Misses : %lld\n", TIERobj.Misses);
+        printf("Hit ratio : %.1f%%\n", (total == 0) ? 0.0 : 100.0 * TIERobj.Hits / total);
+        printf("Readahead blocks : %lld (%lld used)\n", TIERobj.Readahead, TIERobj.ReadaheadHits);
+        printf("Evictions : %lld\n", TIERobj.Evictions);
+        printf("Write backs : %lld\n", TIERobj.Writebacks);
+    }
+    if (TIERobj.Compress != 0)
+    {
+        printf("Compressed blocks : %lld\n", TIERobj.PackedBlocks);
+        printf("Compressed size : %lld KB of %lld KB\n", TIERobj.PackedBytes / 1024,
+               TIERobj.PackedBlocks * BLOCKSIZE / 1024);
+        printf("Decompressions : %lld\n", TIERobj.Decompressions);
+        printf("Decompression cache hits : %lld\n", TIERobj.CacheHits);
+        printf("Inflated by writes : %lld\n", TIERobj.Inflations);
+    }
+    printf("--------------------------------------------------------\n\n");
+    pthread_mutex_unlock(&TIERobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : DedupHash
+//    Description   : Computes the hash of a block's contents, FNV-1a over 8 byte words.
+//    Input         : char* data     - BLOCKSIZE bytes.
+//    Output        : unsigned int  - Hash value of the contents.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int DedupHash(char *data)
+{
+    unsigned long long hash = 14695981039346656037ULL, word = 0;
+    int i = 0;
+
+    for (i = 0; i < BLOCKSIZE; i = i + 8)
+    {
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    return (unsigned int)(hash ^ (hash >> 32));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : DedupInsert
+//    Description   : Adds a block to the content index, doubling the bucket array once it holds
+//                    as many blocks as buckets. Called with DEDUP::Lock held.
+//    Input         : PBLOCK block - Unindexed block whose Hash is set.
+//    Output        : int         - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int DedupInsert(PBLOCK block)
+{
+    long long size = 0, i = 0;
+    PBLOCK *buckets = NULL, entry = NULL, next = NULL;
+
+    if (DEDUPobj.Count >= DEDUPobj.Size)
+    {
+        size = (DEDUPobj.Size == 0) ? DEDUPINITIAL : DEDUPobj.Size * 2;
+        buckets = (PBLOCK *)calloc(size, sizeof(PBLOCK));
+        if (buckets == NULL)
+            return -1;
+
+        for (i = 0; i < DEDUPobj.Size; i++)
+        {
+            for (entry = DEDUPobj.Buckets[i]; entry != NULL; entry = next)
+            {
+                next = entry->HashNext;
+                entry->HashNext = buckets[entry->Hash & (size - 1)];
+                buckets[entry->Hash & (size - 1)] = entry;
+            }
+        }
+        free(DEDUPobj.Buckets);
+        DEDUPobj.Buckets = buckets;
+        DEDUPobj.Size = size;
+    }
+
+    block->HashNext = DEDUPobj.Buckets[block->Hash & (DEDUPobj.Size - 1)];
+    DEDUPobj.Buckets[block->Hash & (DEDUPobj.Size - 1)] = block;
+    block->Indexed = 1;
+    (DEDUPobj.Count)++;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : DedupRemove
+//    Description   : Removes a block from the content index, so its contents may change or it
+//                    may be freed. Called with DEDUP::Lock held.
+//    Input         : PBLOCK block - Indexed block no other file shares.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DedupRemove(PBLOCK block)
+{
+    PBLOCK *link = &DEDUPobj.Buckets[block->Hash & (DEDUPobj.Size - 1)];
+
+    while (*link != block)
+        link = &(*link)->HashNext;
+    *link = block->HashNext;
+
+    block->HashNext = NULL;
+    block->Indexed = 0;
+    (DEDUPobj.Count)--;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AllocateBlock
+//    Description   : Takes a data block from the image when one is mounted, from the tier under
+//                    a memory budget, or else from the shared pool. The block contents are not
+//                    cleared.
+//    Input         : None
+//    Output        : PBLOCK - New block, or NULL on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PBLOCK AllocateBlock()
+{
+    PBLOCK newb = NULL;
+
+    if (IMAGEobj.Base != NULL)
+        return AllocateImageBlock();
+    newb = (TIERobj.Frames != 0) ? AllocateTierBlock() : AllocatePoolBlock();
+    if (newb != NULL)
+        __atomic_fetch_add(&DEDUPobj.Blocks, 1, __ATOMIC_RELAXED);
+
+    return newb;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FreePackedBlock
+//    Description   : Releases a compressed block: its compressed data, its decompression cache
+//                    frame and its descriptor.
+//    Input         : PBLOCK block - Unpinned compressed block.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreePackedBlock(PBLOCK block)
+{
+    pthread_mutex_lock(&TIERobj.Lock);
+    DropUnpacked(block);
+    TIERobj.PackedBytes = TIERobj.PackedBytes - block->PackedSize;
+    (TIERobj.PackedBlocks)--;
+    pthread_mutex_unlock(&TIERobj.Lock);
+
+    free(block->Packed);
+    block->Packed = NULL;
+    FreeDescriptor(block);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FreeBlock
+//    Description   : Drops a file's reference to a data block. A block shared with other files
+//                    stays; otherwise it goes back to wherever AllocateBlock took it from.
+//    Input         : PBLOCK block - Block to release.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeBlock(PBLOCK block)
+{
+    if ((block->Indexed != 0) || (__atomic_load_n(&block->Shares, __ATOMIC_ACQUIRE) != 0))
+    {
+        pthread_mutex_lock(&DEDUPobj.Lock);
+        if (block->Shares != 0)
+        {
+            __atomic_fetch_sub(&block->Shares, 1, __ATOMIC_RELEASE);
+            (DEDUPobj.Shared)--;
+            pthread_mutex_unlock(&DEDUPobj.Lock);
+            return;
+        }
+        if (block->Indexed != 0)
+            DedupRemove(block);
+        pthread_mutex_unlock(&DEDUPobj.Lock);
+    }
+    if (block->BlockNo == 0)
+        __atomic_fetch_sub(&DEDUPobj.Blocks, 1, __ATOMIC_RELAXED);
+
+    if (block->BlockNo != 0)
+        FreeImageBlock(block);
+    else if (block->Packed != NULL)
+        FreePackedBlock(block);
+    else if (TIERobj.Frames != 0)
+        FreeTierBlock(block);
+    else
+        FreePoolBlock(block);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : GrowBlockMap
+//    Description   : Makes sure a file's block map has an entry for a block number. The first
+//                    MAPDIRECT entries grow by doubling; later ones live in leaves of MAPLEAF
+//                    entries that are only allocated once a block inside them is written, so
+//                    holes take no memory. The map only holds pointers, so growing a file never
+//                    copies its data.
+//    Input         : PINODE inode       - Inode of the file.
+//                    long long blockno  - Block number that must fit in the map.
+//    Output        : int               - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GrowBlockMap(PINODE inode, long long blockno)
+{
+    long long newsize = 0, leaf = 0;
+    PBLOCK *newmap = NULL;
+    PBLOCK **newleaves = NULL;
+
+    if (blockno < MAPDIRECT)
+    {
+        if (blockno < inode->MapSize)
+            return 0;
+
+        newsize = (inode->MapSize == 0) ? BLOCKMAPINITIAL : inode->MapSize;
+        while (newsize <= blockno)
+            newsize = newsize * 2;
+
+        newmap = (PBLOCK *)realloc(inode->BlockMap, newsize * sizeof(PBLOCK));
+        if (newmap == NULL)
+            return -1;
+        memset(newmap + inode->MapSize, 0, (newsize - inode->MapSize) * sizeof(PBLOCK));
+        inode->BlockMap = newmap;
+        inode->MapSize = newsize;
+        return 0;
+    }
+
+    leaf = (blockno - MAPDIRECT) / MAPLEAF;
+    if (leaf >= inode->LeafCount)
+    {
+        newsize = (inode->LeafCount == 0) ? BLOCKMAPINITIAL : inode->LeafCount;
+        while (newsize <= leaf)
+            newsize = newsize * 2;
+
+        newleaves = (PBLOCK **)realloc(inode->MapLeaves, newsize * sizeof(PBLOCK *));
+        if (newleaves == NULL)
+            return -1;
+        memset(newleaves + inode->LeafCount, 0, (newsize - inode->LeafCount) * sizeof(PBLOCK *));
+        inode->MapLeaves = newleaves;
+        inode->LeafCount = newsize;
+    }
+
+    if (inode->MapLeaves[leaf] == NULL)
+        inode->MapLeaves[leaf] = (PBLOCK *)calloc(MAPLEAF, sizeof(PBLOCK));
+
+    return (inode->MapLeaves[leaf] == NULL) ? -1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : BlockSlot
+//    Description   : Returns the block map entry of a block number, optionally growing the map
+//                    to hold it.
+//    Input         : PINODE inode       - Inode of the file.
+//                    long long blockno  - Block number within the file.
+//                    int create         - Non zero to grow the map if needed.
+//    Output        : PBLOCK*           - Map entry, or NULL if the map has no entry for the
+//                                         block (or could not be grown).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PBLOCK *BlockSlot(PINODE inode, long long blockno, int create)
+{
+    long long leaf = 0;
+
+    if ((create != 0) && (GrowBlockMap(inode, blockno) == -1))
+        return NULL;
+
+    if (blockno < MAPDIRECT)
+        return (blockno < inode->MapSize) ? &(inode->BlockMap[blockno]) : NULL;
+
+    leaf = (blockno - MAPDIRECT) / MAPLEAF;
+    if ((leaf >= inode->LeafCount) || (inode->MapLeaves[leaf] == NULL))
+        return NULL;
+    return &(inode->MapLeaves[leaf][(blockno - MAPDIRECT) % MAPLEAF]);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : NextFileBlock
+//    Description   : Finds the first written block of a file at or after a block number.
+//                    Unallocated leaves are skipped whole, so walking a sparse file costs time
+//                    in proportion to its data, not its size.
+//    Input         : PINODE inode       - Inode of the file.
+//                    long long blockno  - Block number to start at.
+//    Output        : long long         - Block number, or -1 if no block follows.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long NextFileBlock(PINODE inode, long long blockno)
+{
+    long long leaf = 0, i = 0;
+
+    for (; blockno < inode->MapSize; blockno++)
+        if (inode->BlockMap[blockno] != NULL)
+            return blockno;
+
+    if (blockno < MAPDIRECT)
+        blockno = MAPDIRECT;
+
+    for (leaf = (blockno - MAPDIRECT) / MAPLEAF; leaf < inode->LeafCount; leaf++)
+    {
+        if (inode->MapLeaves[leaf] != NULL)
+        {
+            for (i = (blockno - MAPDIRECT) % MAPLEAF; i < MAPLEAF; i++)
+                if (inode->MapLeaves[leaf][i] != NULL)
+                    return MAPDIRECT + leaf * MAPLEAF + i;
+        }
+        blockno = MAPDIRECT + (leaf + 1) * MAPLEAF;
+    }
+    return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FreeBlockMap
+//    Description   : Frees a file's block map. The blocks it points to are left alone.
+//    Input         : PINODE inode - Inode of the file.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeBlockMap(PINODE inode)
+{
+    long long i = 0;
+
+    for (i = 0; i < inode->LeafCount; i++)
+        free(inode->MapLeaves[i]);
+    free(inode->MapLeaves);
+    inode->MapLeaves = NULL;
+    inode->LeafCount = 0;
+
+    free(inode->BlockMap);
+    inode->BlockMap = NULL;
+    inode->MapSize = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ImageMapSet
+//    Description   : Records a block number in a file's on-disk block map. The map is a chain of
+//                    map blocks, each holding the number of the next map block followed by
+//                    MAPENTRIES block numbers, and is extended as the file grows.
+//    Input         : PINODE inode        - Inode of the file.
+//                    long long blockno   - Block number within the file.
+//                    unsigned int value  - Image block number holding that block.
+//    Output        : int                - 0 on success, or -1 if the image is full.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ImageMapSet(PINODE inode, long long blockno, unsigned int value)
+{
+    long long link = blockno / MAPENTRIES;
+    unsigned int mapno = 0;
+    unsigned int *chain = NULL;
+
+    while (inode->MapChainCount <= link)
+    {
+        if ((inode->MapChainCount & (inode->MapChainCount - 1)) == 0)
+        {
+            chain = (unsigned int *)realloc(inode->MapChain, (inode->MapChainCount == 0 ? 1 : inode->MapChainCount * 2) * sizeof(unsigned int));
+            if (chain == NULL)
+                return -1;
+            inode->MapChain = chain;
+        }
+
+        mapno = AllocateImageBlockNumber();
+        if (mapno == 0)
+            return -1;
+        memset(IMAGEBLOCK(mapno), 0, BLOCKSIZE);
+
+        if (inode->MapChainCount == 0)
+            INODECOLUMNSobj.MapHead[inode->InodeNumber] = mapno;
+        else
+            ((unsigned int *)IMAGEBLOCK(inode->MapChain[inode->MapChainCount - 1]))[0] = mapno;
+
+        inode->MapChain[inode->MapChainCount] = mapno;
+        (inode->MapChainCount)++;
+    }
+
+    ((unsigned int *)IMAGEBLOCK(inode->MapChain[link]))[1 + blockno % MAPENTRIES] = value;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : LoadImageBlockMap
+//    Description   : Builds the in-memory block map of a file from its on-disk map chain. This
+//                    runs the first time the file is used, not at mount time.
+//    Input         : PINODE inode - Inode of the file.
+//    Output        : int         - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int LoadImageBlockMap(PINODE inode)
+{
+    long long i = 0, blocks = 0;
+    unsigned int mapno = INODECOLUMNSobj.MapHead[inode->InodeNumber];
+    unsigned int *map = NULL, *chain = NULL;
+    PBLOCK *slot = NULL;
+
+    blocks = (INODE_SIZE(inode) + BLOCKSIZE - 1) / BLOCKSIZE;
+
+    while (mapno != 0)
+    {
+        if ((inode->MapChainCount & (inode->MapChainCount - 1)) == 0)
+        {
+            chain = (unsigned int *)realloc(inode->MapChain, (inode->MapChainCount == 0 ? 1 : inode->MapChainCount * 2) * sizeof(unsigned int));
+            if (chain == NULL)
+                return -1;
+            inode->MapChain = chain;
+        }
+        inode->MapChain[inode->MapChainCount] = mapno;
+        (inode->MapChainCount)++;
+
+        map = (unsigned int *)IMAGEBLOCK(mapno);
+        for (i = 0; (i < MAPENTRIES) && (i + (inode->MapChainCount - 1) * (long long)MAPENTRIES < blocks); i++)
+        {
+            if (map[1 + i] == 0)
+                continue;
+            slot = BlockSlot(inode, i + (inode->MapChainCount - 1) * (long long)MAPENTRIES, 1);
+            if (slot == NULL)
+                return -1;
+            *slot = ImageBlock(map[1 + i]);
+        }
+        mapno = map[0];
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : GetFileBlock
+//    Description   : Returns the block holding a given block number of a file, optionally
+//                    allocating it. In image mode a new block is also recorded in the file's
+//                    on-disk map.
+//    Input         : PINODE inode       - Inode of the file.
+//                    long long blockno  - Block number within the file (offset / BLOCKSIZE).
+//                    int create         - Non zero to allocate a missing block.
+//    Output        : PBLOCK            - Block, or NULL if it is missing (or allocation failed).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PBLOCK GetFileBlock(PINODE inode, long long blockno, int create)
+{
+    PBLOCK *slot = BlockSlot(inode, blockno, create);
+    PBLOCK block = NULL;
+
+    if ((slot == NULL) || (*slot != NULL) || (create == 0))
+        return (slot == NULL) ? NULL : *slot;
+
+    block = AllocateBlock();
+    if ((block != NULL) && (block->BlockNo != 0) && (ImageMapSet(inode, blockno, block->BlockNo) == -1))
+    {
+        FreeBlock(block);
+        block = NULL;
+    }
+
+    *slot = block;
+    return block;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PackFile
+//    Description   : Compresses the cold blocks of a file.
+//    Input         : PINODE inode - Regular file whose lock the caller holds exclusively.
+//                    int force    - Non zero to compress every block, hot or not.
+//    Output        : int         - Number of blocks compressed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PackFile(PINODE inode, int force)
+{
+    long long i = 0;
+    int count = 0;
+
+    if (__atomic_load_n(&inode->PinCount, __ATOMIC_ACQUIRE) != 0)
+        return 0;
+
+    for (i = NextFileBlock(inode, 0); i != -1; i = NextFileBlock(inode, i + 1))
+        count = count + PackBlock(GetFileBlock(inode, i, 0), force);
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FreeFileBlocks
+//    Description   : Releases every block of a file and its block map, including the on-disk map
+//                    blocks in image mode.
+//    Input         : PINODE inode - Inode of the file.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeFileBlocks(PINODE inode)
+{
+    long long i = 0;
+
+    for (i = NextFileBlock(inode, 0); i != -1; i = NextFileBlock(inode, i + 1))
+        FreeBlock(GetFileBlock(inode, i, 0));
+    FreeBlockMap(inode);
+
+    if (IMAGEobj.Base != NULL)
+    {
+        for (i = 0; i < inode->MapChainCount; i++)
+            FreeImageBlockNumber(inode->MapChain[i]);
+        INODECOLUMNSobj.MapHead[inode->InodeNumber] = 0;
+    }
+    free(inode->MapChain);
+    inode->MapChain = NULL;
+    inode->MapChainCount = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : UnshareBlock
+//    Description   : Makes a block of a file private before it is modified. A block shared with
+//                    other files (by deduplication, a clone or a snapshot) is copied and the
+//                    file's map pointed at the copy; a block only this file uses is just taken
+//                    out of the content index. The caller holds the inode lock exclusively.
+//    Input         : PINODE inode       - Inode of the file.
+//                    long long blockno  - Block number of an existing block of the file.
+//    Output        : PBLOCK            - Private block, or NULL if the copy could not be made.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PBLOCK UnshareBlock(PINODE inode, long long blockno)
+{
+    PBLOCK block = GetFileBlock(inode, blockno, 0), copy = NULL;
+    char *from = NULL, *to = NULL;
+
+    if ((block->Indexed == 0) && (__atomic_load_n(&block->Shares, __ATOMIC_ACQUIRE) == 0))
+        return block;
+
+    pthread_mutex_lock(&DEDUPobj.Lock);
+    if (block->Shares == 0)
+    {
+        if (block->Indexed != 0)
+            DedupRemove(block);
+        pthread_mutex_unlock(&DEDUPobj.Lock);
+        return block;
+    }
+    pthread_mutex_unlock(&DEDUPobj.Lock);
+
+    copy = AllocateBlock();
+    if (copy == NULL)
+        return NULL;
+    from = PinBlock(block, 0);
+    to = PinBlock(copy, 1);
+    if ((from != NULL) && (to != NULL))
+        memcpy(to, from, BLOCKSIZE);
+    if (from != NULL)
+        UnpinBlock(block);
+    if (to != NULL)
+        UnpinBlock(copy);
+    if ((from == NULL) || (to == NULL))
+    {
+        FreeBlock(copy);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&DEDUPobj.Lock);
+    if (block->Shares == 0)
+    {
+        if (block->Indexed != 0)
+            DedupRemove(block);
+        pthread_mutex_unlock(&DEDUPobj.Lock);
+        FreeBlock(copy);
+        return block;
+    }
+    __atomic_fetch_sub(&block->Shares, 1, __ATOMIC_RELEASE);
+    (DEDUPobj.Shared)--;
+    (DEDUPobj.Copies)++;
+    pthread_mutex_unlock(&DEDUPobj.Lock);
+
+    *BlockSlot(inode, blockno, 0) = copy;
+    return copy;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : DedupBlock
+//    Description   : Looks a block that was just filled up in the content index. If another
+//                    block holds the same bytes, the file shares that block and its own is
+//                    freed; otherwise the block is indexed for later writers. Files pinned by a
+//                    FILEVIEW and image blocks are left alone. The caller holds the inode lock
+//                    exclusively.
+//    Input         : PINODE inode       - Inode of the file.
+//                    long long blockno  - Block number of a private block of the file.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DedupBlock(PINODE inode, long long blockno)
+{
+    PBLOCK block = GetFileBlock(inode, blockno, 0), entry = NULL;
+    unsigned int hash = 0;
+    char *data = NULL, *other = NULL;
+    int same = 0;
+
+    if ((block->BlockNo != 0) || (__atomic_load_n(&inode->PinCount, __ATOMIC_ACQUIRE) != 0))
+        return;
+
+    data = PinBlock(block, 0);
+    if (data == NULL)
+        return;
+    hash = DedupHash(data);
+
+    pthread_mutex_lock(&DEDUPobj.Lock);
+    (DEDUPobj.Lookups)++;
+    entry = (DEDUPobj.Size == 0) ? NULL : DEDUPobj.Buckets[hash & (DEDUPobj.Size - 1)];
+    for (; entry != NULL; entry = entry->HashNext)
+    {
+        if (entry->Hash != hash)
+            continue;
+        other = PinBlock(entry, 0);
+        same = (other != NULL) && (memcmp(other, data, BLOCKSIZE) == 0);
+        if (other != NULL)
+            UnpinBlock(entry);
+        if (same)
+            break;
+    }
+
+    if (entry != NULL)
+    {
+        __atomic_fetch_add(&entry->Shares, 1, __ATOMIC_RELEASE);
+        (DEDUPobj.Shared)++;
+        (DEDUPobj.Matches)++;
+    }
+    else
+    {
+        block->Hash = hash;
+        DedupInsert(block);
+    }
+    pthread_mutex_unlock(&DEDUPobj.Lock);
+    UnpinBlock(block);
+
+    if (entry != NULL)
+    {
+        *BlockSlot(inode, blockno, 0) = entry;
+        FreeBlock(block);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ShareFileBlocks
+//    Description   : Gives an empty file the contents of another one by sharing its blocks;
+//                    only the block map is copied. Blocks past the end of the source, which
+//                    appenders may have allocated ahead, are left out. Either file copies a
+//                    block before modifying it. The caller holds both inode locks exclusively,
+//                    so no append into the source is in progress.
+//    Input         : PINODE src  - Regular file to share.
+//                    PINODE dst  - Regular file without blocks.
+//    Output        : int        - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ShareFileBlocks(PINODE src, PINODE dst)
+{
+    long long i = 0;
+    PBLOCK *slot = NULL;
+
+    for (i = NextFileBlock(src, 0); (i != -1) && (i * BLOCKSIZE < INODE_SIZE(src)); i = NextFileBlock(src, i + 1))
+    {
+        slot = BlockSlot(dst, i, 1);
+        if (slot == NULL)
+        {
+            FreeBlockMap(dst);
+            return -1;
+        }
+        *slot = GetFileBlock(src, i, 0);
+    }
+
+    pthread_mutex_lock(&DEDUPobj.Lock);
+    for (i = NextFileBlock(dst, 0); i != -1; i = NextFileBlock(dst, i + 1))
+    {
+        __atomic_fetch_add(&GetFileBlock(dst, i, 0)->Shares, 1, __ATOMIC_RELEASE);
+        (DEDUPobj.Shared)++;
+    }
+    pthread_mutex_unlock(&DEDUPobj.Lock);
+
+    INODE_SIZE(dst) = INODE_SIZE(src);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : dedupstat
+//    Description   : Displays how many data blocks are stored and indexed by content, how many
+//                    file blocks share them and the resulting deduplication ratio.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void dedupstat()
+{
+    pthread_mutex_lock(&DEDUPobj.Lock);
+    printf("\n------------------- Deduplication -------------------\n");
+    printf("Indexed blocks : %lld\n", DEDUPobj.Count);
+    printf("Shared references : %lld\n", DEDUPobj.Shared);
+    printf("Stored blocks : %lld\n", DEDUPobj.Blocks);
+    printf("Dedup ratio : %.2f\n", (DEDUPobj.Blocks == 0) ? 1.0 : (double)(DEDUPobj.Blocks + DEDUPobj.Shared) / DEDUPobj.Blocks);
+    printf("Memory saved : %lld KB\n", DEDUPobj.Shared * BLOCKSIZE / 1024);
+    printf("Lookups : %lld (%lld matched)\n", DEDUPobj.Lookups, DEDUPobj.Matches);
+    printf("Copies on write : %lld\n", DEDUPobj.Copies);
+    printf("-----------------------------------------------------\n\n");
+    pthread_mutex_unlock(&DEDUPobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReserveColumn
+//    Description   : Reserves address space for an inode column without committing any memory.
+//                    Pages become usable when GrowInodeColumns commits them.
+//    Input         : int entries    - Number of entries to reserve.
+//                    size_t width   - Size of one entry in bytes.
+//    Output        : void*         - Start of the reservation, or NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void *ReserveColumn(int entries, size_t width)
+{
+    void *column = mmap(NULL, (size_t)entries * width, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    return (column == MAP_FAILED) ? NULL : column;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : GrowInodeColumns
+//    Description   : Commits the next INODECHUNK entries of every inode column. New pages read
+//                    as zero, which is a free inode. Called with NAMEINDEX::Lock held
+//                    exclusively (or before any other thread runs); entries below the old
+//                    capacity never move, so readers are not disturbed.
+//    Input         : None
+//    Output        : int - 0 on success, or -1 if the table is full or memory ran out.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GrowInodeColumns()
+{
+    size_t at = (size_t)SUPERBLOCKobj.Capacity;
+
+    if ((IMAGEobj.Base != NULL) || (SUPERBLOCKobj.Capacity > SUPERBLOCKobj.MaxInodes))
+        return -1;
+
+    if ((mprotect(INODECOLUMNSobj.FileType + at, INODECHUNK * sizeof(int), PROT_READ | PROT_WRITE) == -1) ||
+        (mprotect(INODECOLUMNSobj.FileActualSize + at, INODECHUNK * sizeof(long long), PROT_READ | PROT_WRITE) == -1) ||
+        (mprotect(INODECOLUMNSobj.Permission + at, INODECHUNK * sizeof(int), PROT_READ | PROT_WRITE) == -1) ||
+        (mprotect(INODECOLUMNSobj.LinkCount + at, INODECHUNK * sizeof(int), PROT_READ | PROT_WRITE) == -1) ||
+        (mprotect(INODECOLUMNSobj.Parent + at, INODECHUNK * sizeof(int), PROT_READ | PROT_WRITE) == -1) ||
+        (mprotect(INODECOLUMNSobj.FileName + at * NAMELENGTH, (size_t)INODECHUNK * NAMELENGTH, PROT_READ | PROT_WRITE) == -1) ||
+        (mprotect(INODECOLUMNSobj.NextFree + at, INODECHUNK * sizeof(int), PROT_READ | PROT_WRITE) == -1) ||
+        (mprotect(INODECOLUMNSobj.Inode + at, INODECHUNK * sizeof(PINODE), PROT_READ | PROT_WRITE) == -1) ||
+        (mprotect(INODECOLUMNSobj.FirstChild + at, INODECHUNK * sizeof(int), PROT_READ | PROT_WRITE) == -1) ||
+        (mprotect(INODECOLUMNSobj.NextSibling + at, INODECHUNK * sizeof(int), PROT_READ | PROT_WRITE) == -1) ||
+        (mprotect(INODECOLUMNSobj.PrevSibling + at, INODECHUNK * sizeof(int), PROT_READ | PROT_WRITE) == -1))
+        return -1;
+
+    __atomic_store_n(&SUPERBLOCKobj.Capacity, SUPERBLOCKobj.Capacity + INODECHUNK, __ATOMIC_RELEASE);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InitialiseInodeColumns
+//    Description   : Sets up the columnar inode metadata table for up to maxinodes inodes. Each
+//                    column only reserves its address space, so columns never move and lookups
+//                    stay a plain index, and the first chunk of entries is committed. Startup
+//                    cost does not depend on maxinodes.
+//    Input         : int maxinodes  - Most inodes the file system may hold.
+//    Output        : int           - 0 on success, or -1 on failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int InitialiseInodeColumns(int maxinodes)
+{
+    int entries = ((maxinodes + 1) + INODECHUNK - 1) / INODECHUNK * INODECHUNK;
+
+    INODECOLUMNSobj.FileType = (int *)ReserveColumn(entries, sizeof(int));
+    INODECOLUMNSobj.FileActualSize = (long long *)ReserveColumn(entries, sizeof(long long));
+    INODECOLUMNSobj.Permission = (int *)ReserveColumn(entries, sizeof(int));
+    INODECOLUMNSobj.LinkCount = (int *)ReserveColumn(entries, sizeof(int));
+    INODECOLUMNSobj.Parent = (int *)ReserveColumn(entries, sizeof(int));
+    INODECOLUMNSobj.FileName = (char *)ReserveColumn(entries, NAMELENGTH);
+    INODECOLUMNSobj.MapHead = NULL;
+    INODECOLUMNSobj.NextFree = (int *)ReserveColumn(entries, sizeof(int));
+    INODECOLUMNSobj.Inode = (PINODE *)ReserveColumn(entries, sizeof(PINODE));
+    INODECOLUMNSobj.FirstChild = (int *)ReserveColumn(entries, sizeof(int));
+    INODECOLUMNSobj.NextSibling = (int *)ReserveColumn(entries, sizeof(int));
+    INODECOLUMNSobj.PrevSibling = (int *)ReserveColumn(entries, sizeof(int));
+
+    if ((INODECOLUMNSobj.FileType == NULL) || (INODECOLUMNSobj.FileActualSize == NULL) ||
+        (INODECOLUMNSobj.Permission == NULL) || (INODECOLUMNSobj.LinkCount == NULL) ||
+        (INODECOLUMNSobj.Parent == NULL) || (INODECOLUMNSobj.FileName == NULL) ||
+        (INODECOLUMNSobj.NextFree == NULL) || (INODECOLUMNSobj.Inode == NULL) ||
+        (INODECOLUMNSobj.FirstChild == NULL) || (INODECOLUMNSobj.NextSibling == NULL) ||
+        (INODECOLUMNSobj.PrevSibling == NULL))
+        return -1;
+
+    SUPERBLOCKobj.MaxInodes = maxinodes;
+    SUPERBLOCKobj.FreeInode = maxinodes;
+    SUPERBLOCKobj.Capacity = 0;
+    SUPERBLOCKobj.NextInode = 1;
+    SUPERBLOCKobj.FreeHead = 0;
+
+    return GrowInodeColumns();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : NextFreeInode
+//    Description   : Picks the inode number the next new file gets: the most recently released
+//                    inode, or else the lowest number never used, growing the columns when it
+//                    reaches their end. The number stays free until TakeFreeInode claims it.
+//                    Called with NAMEINDEX::Lock held exclusively.
+//    Input         : None
+//    Output        : int - Free inode number, or 0 if there is none or memory ran out.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int NextFreeInode()
+{
+    if (SUPERBLOCKobj.FreeHead != 0)
+        return SUPERBLOCKobj.FreeHead;
+    if (SUPERBLOCKobj.NextInode > SUPERBLOCKobj.MaxInodes)
+        return 0;
+    if ((SUPERBLOCKobj.NextInode == SUPERBLOCKobj.Capacity) && (GrowInodeColumns() == -1))
+        return 0;
+    return SUPERBLOCKobj.NextInode;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TakeFreeInode
+//    Description   : Removes an inode number from the free pool as it comes into use. Numbers
+//                    from NextFreeInode are always the free list head or NextInode; journal
+//                    replay may claim any number, and is followed by RebuildInodeFreeList.
+//                    Called with NAMEINDEX::Lock held exclusively.
+//    Input         : int ino  - Inode number being used.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TakeFreeInode(int ino)
+{
+    if (ino == SUPERBLOCKobj.FreeHead)
+        SUPERBLOCKobj.FreeHead = INODECOLUMNSobj.NextFree[ino];
+    else if (ino >= SUPERBLOCKobj.NextInode)
+        __atomic_store_n(&SUPERBLOCKobj.NextInode, ino + 1, __ATOMIC_RELEASE);
+    INODECOLUMNSobj.NextFree[ino] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PutFreeInode
+//    Description   : Returns a released inode number to the head of the free list. Called with
+//                    NAMEINDEX::Lock held exclusively.
+//    Input         : int ino  - Inode number released.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PutFreeInode(int ino)
+{
+    INODECOLUMNSobj.NextFree[ino] = SUPERBLOCKobj.FreeHead;
+    SUPERBLOCKobj.FreeHead = ino;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RebuildInodeFreeList
+//    Description   : Recomputes NextInode and the free list from the FileType column, so the
+//                    lowest free numbers are handed out first. Used after journal replay or a
+//                    crash, when the list on the image cannot be trusted.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RebuildInodeFreeList()
+{
+    int ino = 0, next = 1;
+
+    for (ino = SUPERBLOCKobj.Capacity - 1; ino >= 1; ino--)
+    {
+        if (INODECOLUMNSobj.FileType[ino] != 0)
+        {
+            next = ino + 1;
+            break;
+        }
+    }
+
+    SUPERBLOCKobj.FreeHead = 0;
+    for (ino = next - 1; ino >= 1; ino--)
+        if (INODECOLUMNSobj.FileType[ino] == 0)
+            PutFreeInode(ino);
+    __atomic_store_n(&SUPERBLOCKobj.NextInode, next, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InodeFromNumber
+//    Description   : Returns the inode object for an inode number, creating it on first use.
+//                    Inodes of a mounted image are materialized lazily, one at a time, so mounting
+//                    never walks the inode table.
+//    Input         : int ino  - Inode number.
+//    Output        : PINODE  - Inode object, or NULL on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PINODE InodeFromNumber(int ino)
+{
+    long long i = 0;
+    PBLOCK block = NULL;
+    PINODE newn = __atomic_load_n(&INODECOLUMNSobj.Inode[ino], __ATOMIC_ACQUIRE);
+
+    if (newn != NULL)
+        return newn;
+
+    pthread_mutex_lock(&INODECOLUMNSobj.Lock);
+    newn = INODECOLUMNSobj.Inode[ino];
+    if (newn != NULL)
+    {
+        pthread_mutex_unlock(&INODECOLUMNSobj.Lock);
+        return newn;
+    }
+
+    newn = (PINODE)SlabAlloc(&INODESLAB);
+    if (newn == NULL)
+    {
+        pthread_mutex_unlock(&INODECOLUMNSobj.Lock);
+        return NULL;
+    }
+
+    newn->InodeNumber = ino;
+    newn->FileName = INODECOLUMNSobj.FileName + (size_t)ino * NAMELENGTH;
+    newn->FileSize = (INODE_TYPE(newn) == 0) ? 0 : MAXFILESIZE;
+    newn->BlockMap = NULL;
+    newn->MapSize = 0;
+    newn->MapLeaves = NULL;
+    newn->LeafCount = 0;
+    newn->MapChain = NULL;
+    newn->MapChainCount = 0;
+    newn->ReferenceCount = 0;
+    newn->PinCount = 0;
+    newn->MapCount = 0;
+    newn->AppendEnd = 0;
+    newn->OpenList = NULL;
+
+    if ((IMAGEobj.Base != NULL) && (INODE_TYPE(newn) != 0) && (LoadImageBlockMap(newn) == -1))
+    {
+        pthread_mutex_lock(&BLOCKPOOLobj.Lock);
+        for (i = NextFileBlock(newn, 0); i != -1; i = NextFileBlock(newn, i + 1))
+        {
+            block = GetFileBlock(newn, i, 0);
+            block->next = BLOCKPOOLobj.SpareDescriptors;
+            BLOCKPOOLobj.SpareDescriptors = block;
+        }
+        pthread_mutex_unlock(&BLOCKPOOLobj.Lock);
+        FreeBlockMap(newn);
+        free(newn->MapChain);
+        SlabFree(&INODESLAB, newn);
+        pthread_mutex_unlock(&INODECOLUMNSobj.Lock);
+        return NULL;
+    }
+
+    pthread_rwlock_init(&newn->Lock, NULL);
+    __atomic_store_n(&INODECOLUMNSobj.Inode[ino], newn, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&INODECOLUMNSobj.Lock);
+    return newn;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : HashName
+//    Description   : Computes the FNV-1a hash of a file name.
+//    Input         : char* name    - Name of the file.
+//    Output        : unsigned int  - Hash value of the name.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int HashName(char *name)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*name != '\0')
+    {
+        hash = hash ^ (unsigned char)(*name);
+        hash = hash * 16777619u;
+        name++;
+    }
+    return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : HashDentry
+//    Description   : Computes the FNV-1a hash of a directory entry: the directory's inode number
+//                    followed by the entry name.
+//    Input         : int parent    - Directory inode number, 0 for the root.
+//                    char* name    - Name of the entry.
+//    Output        : unsigned int  - Hash value of the entry.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int HashDentry(int parent, char *name)
+{
+    unsigned int hash = 2166136261u;
+    int i = 0;
+
+    for (i = 0; i < 4; i++)
+    {
+        hash = hash ^ ((unsigned int)parent & 0xFF);
+        hash = hash * 16777619u;
+        parent = (int)((unsigned int)parent >> 8);
+    }
+
+    while (*name != '\0')
+    {
+        hash = hash ^ (unsigned char)(*name);
+        hash = hash * 16777619u;
+        name++;
+    }
+    return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FilterBucket
+//    Description   : Maps an entry hash to one of the three counting bloom filter buckets.
+//    Input         : unsigned int hash  - Hash of the directory entry.
+//                    int k              - Which of the three buckets (0, 1 or 2).
+//                    int size           - Counters in the filter (power of two).
+//    Output        : int               - Index into the filter.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int FilterBucket(unsigned int hash, int k, int size)
+{
+    unsigned int h2 = (hash >> 16) | (hash << 16);
+
+    return (int)((hash + k * (h2 | 1)) & (size - 1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InitialiseNameIndex
+//    Description   : Allocates an empty directory entry index, clears the bloom filter and
+//                    makes the root the current directory.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InitialiseNameIndex()
+{
+    int i = 0;
+
+    NAMEINDEXobj.Size = NAMEINDEXSIZE;
+    NAMEINDEXobj.Used = 0;
+    NAMEINDEXobj.Deleted = 0;
+    NAMEINDEXobj.Slots = (PNAMESLOT)calloc(NAMEINDEXSIZE, sizeof(NAMESLOT));
+    NAMEINDEXobj.Filter = (unsigned char *)calloc(NAMEINDEXSIZE * NAMEFILTERPERSLOT, 1);
+    NAMEINDEXobj.FilterSize = NAMEINDEXSIZE * NAMEFILTERPERSLOT;
+    NAMEINDEXobj.Fixed = 0;
+    NAMEINDEXobj.Cwd = 0;
+    NAMEINDEXobj.CwdPath[0] = '\0';
+
+    for (i = 0; i < DCACHELOCKS; i++)
+        pthread_mutex_init(&DCACHEobj.Locks[i], NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : NameIndexRehash
+//    Description   : Rebuilds the index with the given number of slots, dropping all tombstones,
+//                    and rebuilds the bloom filter at NAMEFILTERPERSLOT counters per slot, which
+//                    also clears counters left saturated by removals. A fixed (image resident)
+//                    index and filter are rebuilt in place at their current size.
+//    Input         : int size  - New number of slots (power of two).
+//    Output        : int      - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int NameIndexRehash(int size)
+{
+    int i = 0, j = 0, k = 0, filtersize = size * NAMEFILTERPERSLOT;
+    PNAMESLOT newslots = NULL;
+    unsigned char *filter = NULL;
+
+    if (NAMEINDEXobj.Fixed != 0)
+        filtersize = NAMEINDEXobj.FilterSize;
+
+    newslots = (PNAMESLOT)calloc(size, sizeof(NAMESLOT));
+    filter = (unsigned char *)calloc(filtersize, 1);
+    if ((newslots == NULL) || (filter == NULL))
+    {
+        free(newslots);
+        free(filter);
+        return -1;
+    }
+
+    for (i = 0; i < NAMEINDEXobj.Size; i++)
+    {
+        if (NAMEINDEXobj.Slots[i].State != SLOT_USED)
+            continue;
+
+        j = NAMEINDEXobj.Slots[i].Hash & (size - 1);
+        while (newslots[j].State == SLOT_USED)
+            j = (j + 1) & (size - 1);
+        newslots[j] = NAMEINDEXobj.Slots[i];
+
+        for (k = 0; k < 3; k++)
+            if (filter[FilterBucket(newslots[j].Hash, k, filtersize)] < 255)
+                (filter[FilterBucket(newslots[j].Hash, k, filtersize)])++;
+    }
+
+    if (NAMEINDEXobj.Fixed != 0)
+    {
+        memcpy(NAMEINDEXobj.Slots, newslots, size * sizeof(NAMESLOT));
+        memcpy(NAMEINDEXobj.Filter, filter, filtersize);
+        free(newslots);
+        free(filter);
+        NAMEINDEXobj.Deleted = 0;
+        return 0;
+    }
+
+    free(NAMEINDEXobj.Slots);
+    free(NAMEINDEXobj.Filter);
+    NAMEINDEXobj.Slots = newslots;
+    NAMEINDEXobj.Size = size;
+    NAMEINDEXobj.Filter = filter;
+    NAMEINDEXobj.FilterSize = filtersize;
+    NAMEINDEXobj.Deleted = 0;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : NameIndexFind
+//    Description   : Finds a directory entry using the bloom filter and the hash index.
+//    Input         : int parent   - Directory inode number, 0 for the root.
+//                    char* name   - Name of the entry.
+//    Output        : int         - Inode number of the entry, or 0 if not found.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int NameIndexFind(int parent, char *name)
+{
+    unsigned int hash = HashDentry(parent, name);
+    int i = 0, ino = 0, mask = NAMEINDEXobj.Size - 1;
+
+    if ((NAMEINDEXobj.Filter[FilterBucket(hash, 0, NAMEINDEXobj.FilterSize)] == 0) ||
+        (NAMEINDEXobj.Filter[FilterBucket(hash, 1, NAMEINDEXobj.FilterSize)] == 0) ||
+        (NAMEINDEXobj.Filter[FilterBucket(hash, 2, NAMEINDEXobj.FilterSize)] == 0))
+        return 0;
+
+    i = hash & mask;
+    while (NAMEINDEXobj.Slots[i].State != SLOT_EMPTY)
+    {
+        if ((NAMEINDEXobj.Slots[i].State == SLOT_USED) && (NAMEINDEXobj.Slots[i].Hash == hash))
+        {
+            ino = NAMEINDEXobj.Slots[i].InodeNumber;
+            if ((INODECOLUMNSobj.Parent[ino] == parent) &&
+                (strcmp(INODECOLUMNSobj.FileName + (size_t)ino * NAMELENGTH, name) == 0))
+                return ino;
+        }
+        i = (i + 1) & mask;
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : NameIndexLookup
+//    Description   : Finds the inode of a directory entry.
+//    Input         : int parent   - Directory inode number, 0 for the root.
+//                    char* name   - Name of the entry.
+//    Output        : PINODE      - Pointer to the inode if found, or NULL if not found.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PINODE NameIndexLookup(int parent, char *name)
+{
+    int ino = NameIndexFind(parent, name);
+
+    return (ino == 0) ? NULL : InodeFromNumber(ino);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InodePath
+//    Description   : Builds the absolute path of an inode by following the Parent column up to
+//                    the root.
+//    Input         : int ino        - Inode number, 0 for the root.
+//                    char* buffer   - Receives the path (PATHLENGTH bytes), empty for the root.
+//    Output        : int           - Length of the path, or -1 if it does not fit.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int InodePath(int ino, char *buffer)
+{
+    char temp[PATHLENGTH];
+    char *name = NULL;
+    int pos = PATHLENGTH - 1, length = 0, depth = 0;
+
+    temp[pos] = '\0';
+    while (ino != 0)
+    {
+        name = INODECOLUMNSobj.FileName + (size_t)ino * NAMELENGTH;
+        length = strlen(name);
+        if ((pos - length - 1 < 0) || (++depth > SUPERBLOCKobj.MaxInodes))
+            return -1;
+
+        pos = pos - length;
+        memcpy(temp + pos, name, length);
+        pos--;
+        temp[pos] = '/';
+        ino = INODECOLUMNSobj.Parent[ino];
+    }
+
+    memcpy(buffer, temp + pos, PATHLENGTH - pos);
+    return PATHLENGTH - 1 - pos;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : DcacheInvalidate
+//    Description   : Drops the cached resolution of one directory entry's path. Called with the
+//                    namespace lock held exclusively whenever an entry is created or removed.
+//    Input         : int parent   - Directory of the entry.
+//                    char* name   - Name of the entry.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DcacheInvalidate(int parent, char *name)
+{
+    char path[PATHLENGTH];
+    unsigned int hash = 0;
+    int length = 0;
+    PDENTRY entry = NULL;
+
+    if (__atomic_load_n(&DCACHEobj.Count, __ATOMIC_RELAXED) == 0)
+        return;
+
+    length = InodePath(parent, path);
+    if ((length < 0) || (length + 1 + strlen(name) >= PATHLENGTH))
+        return;
+    path[length] = '/';
+    strcpy(path + length + 1, name);
+
+    hash = HashName(path);
+    entry = &DCACHEobj.Entries[hash & (DCACHESIZE - 1)];
+    if ((entry->Valid != 0) && (entry->Hash == hash) && (strcmp(entry->Path, path) == 0))
+    {
+        entry->Valid = 0;
+        __atomic_fetch_sub(&DCACHEobj.Count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&DCACHEobj.Invalidations, 1, __ATOMIC_RELAXED);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CanonicalPath
+//    Description   : Turns a path into the absolute form used as path cache key, dropping empty
+//                    and "." components. Paths with ".." are not cached, since they can only
+//                    be resolved by walking.
+//    Input         : char* path  - Path, absolute or relative to the current directory.
+//                    char* key   - Receives the canonical path (PATHLENGTH bytes).
+//    Output        : int        - Length of the key, or -1 if the path cannot be cached.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int CanonicalPath(char *path, char *key)
+{
+    char *p = path, *comp = NULL;
+    int length = 0, n = 0;
+
+    if (*p != '/')
+    {
+        length = strlen(NAMEINDEXobj.CwdPath);
+        memcpy(key, NAMEINDEXobj.CwdPath, length);
+    }
+
+    while (1)
+    {
+        while (*p == '/')
+            p++;
+        if (*p == '\0')
+            break;
+
+        comp = p;
+        while ((*p != '\0') && (*p != '/'))
+            p++;
+        n = p - comp;
+
+        if ((n == 1) && (comp[0] == '.'))
+            continue;
+        if (((n == 2) && (comp[0] == '.') && (comp[1] == '.')) || (length + 1 + n >= PATHLENGTH))
+            return -1;
+
+        key[length++] = '/';
+        memcpy(key + length, comp, n);
+        length = length + n;
+    }
+
+    key[length] = '\0';
+    return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : WalkPath
+//    Description   : Resolves a path one component at a time, with one index probe per
+//                    component.
+//    Input         : char* path - Path shorter than PATHLENGTH, absolute or relative to the
+//                                 current directory.
+//    Output        : int       - Inode number (0 for the root), or error code:
+//                                 -1: A component does not exist
+//                                 -2: A component other than the last is not a directory
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int WalkPath(char *path)
+{
+    char buffer[PATHLENGTH];
+    char *p = buffer, *comp = NULL;
+    int cur = 0, next = 0;
+
+    strcpy(buffer, path);
+    cur = (buffer[0] == '/') ? 0 : NAMEINDEXobj.Cwd;
+
+    while (1)
+    {
+        while (*p == '/')
+            p++;
+        if (*p == '\0')
+            return cur;
+
+        comp = p;
+        while ((*p != '\0') && (*p != '/'))
+            p++;
+        if (*p != '\0')
+        {
+            *p = '\0';
+            p++;
+        }
+
+        if ((cur != 0) && (INODECOLUMNSobj.FileType[cur] != DIRECTORY))
+            return -2;
+
+        if (strcmp(comp, ".") == 0)
+            continue;
+        if (strcmp(comp, "..") == 0)
+        {
+            cur = INODECOLUMNSobj.Parent[cur];
+            continue;
+        }
+
+        next = NameIndexFind(cur, comp);
+        if (next == 0)
+            return -1;
+        cur = next;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ResolvePath
+//    Description   : Resolves a path to an inode number. Single names are looked up directly
+//                    in the current directory; longer paths go through the path cache, which
+//                    also remembers paths that do not exist. The caller holds the namespace
+//                    lock.
+//    Input         : char* path - Path, absolute or relative to the current directory.
+//    Output        : int       - Inode number (0 for the root), or error code:
+//                                 -1: Path does not exist or is malformed
+//                                 -2: A component other than the last is not a directory
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ResolvePath(char *path)
+{
+    char key[PATHLENGTH];
+    unsigned int hash = 0;
+    int length = 0, ino = 0;
+    PDENTRY entry = NULL;
+    pthread_mutex_t *lock = NULL;
+
+    if ((path == NULL) || (path[0] == '\0') || (strlen(path) >= PATHLENGTH))
+        return -1;
+
+    if (strchr(path, '/') == NULL)
+    {
+        if (strcmp(path, ".") == 0)
+            return NAMEINDEXobj.Cwd;
+        if (strcmp(path, "..") == 0)
+            return INODECOLUMNSobj.Parent[NAMEINDEXobj.Cwd];
+
+        ino = NameIndexFind(NAMEINDEXobj.Cwd, path);
+        return (ino == 0) ? -1 : ino;
+    }
+
+    length = CanonicalPath(path, key);
+    if (length < 0)
+        return WalkPath(path);
+
+    hash = HashName(key);
+    entry = &DCACHEobj.Entries[hash & (DCACHESIZE - 1)];
+    lock = &DCACHEobj.Locks[(hash & (DCACHESIZE - 1)) % DCACHELOCKS];
+
+    pthread_mutex_lock(lock);
+    if ((entry->Valid != 0) && (entry->Hash == hash) && (strcmp(entry->Path, key) == 0))
+    {
+        ino = entry->InodeNumber;
+        pthread_mutex_unlock(lock);
+        __atomic_fetch_add((ino < 0) ? &DCACHEobj.NegativeHits : &DCACHEobj.Hits, 1, __ATOMIC_RELAXED);
+        return ino;
+    }
+    pthread_mutex_unlock(lock);
+
+    __atomic_fetch_add(&DCACHEobj.Misses, 1, __ATOMIC_RELAXED);
+    ino = WalkPath(path);
+    if (ino == -2)
+        return ino;
+
+    pthread_mutex_lock(lock);
+    if (entry->Valid == 0)
+        __atomic_fetch_add(&DCACHEobj.Count, 1, __ATOMIC_RELAXED);
+    entry->Hash = hash;
+    entry->InodeNumber = ino;
+    entry->Valid = 1;
+    memcpy(entry->Path, key, length + 1);
+    pthread_mutex_unlock(lock);
+
+    return ino;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ResolveParent
+//    Description   : Splits a path into the directory that holds its last component and the
+//                    last component itself, for creating or removing an entry.
+//    Input         : char* path     - Path, absolute or relative to the current directory.
+//                    char* buffer   - PATHLENGTH bytes of scratch space, holding *leaf.
+//                    int* parent    - Receives the directory inode number.
+//                    char** leaf    - Receives the last component.
+//    Output        : int           - 0 on success, or error code:
+//                                     -1: Malformed path or name
+//                                     -2: Directory does not exist
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ResolveParent(char *path, char *buffer, int *parent, char **leaf)
+{
+    char *slash = NULL;
+    int length = 0;
+
+    if ((path == NULL) || ((length = strlen(path)) == 0) || (length >= PATHLENGTH))
+        return -1;
+
+    strcpy(buffer, path);
+    while ((length > 1) && (buffer[length - 1] == '/'))
+        buffer[--length] = '\0';
+
+    slash = strrchr(buffer, '/');
+    if (slash == NULL)
+    {
+        *parent = NAMEINDEXobj.Cwd;
+        *leaf = buffer;
+    }
+    else
+    {
+        *leaf = slash + 1;
+        *slash = '\0';
+        *parent = (slash == buffer) ? 0 : ResolvePath(buffer);
+        if ((*parent < 0) || ((*parent != 0) && (INODECOLUMNSobj.FileType[*parent] != DIRECTORY)))
+            return -2;
+    }
+
+    if (((*leaf)[0] == '\0') || (strcmp(*leaf, ".") == 0) || (strcmp(*leaf, "..") == 0) ||
+        (strlen(*leaf) >= NAMELENGTH))
+        return -1;
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : LinkChild
+//    Description   : Adds an inode at the end of its directory's entry list. Called with
+//                    NAMEINDEX::Lock held exclusively.
+//    Input         : int ino  - Inode whose Parent column is set.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void LinkChild(int ino)
+{
+    int dir = INODECOLUMNSobj.Parent[ino], first = INODECOLUMNSobj.FirstChild[dir];
+
+    INODECOLUMNSobj.NextSibling[ino] = 0;
+    if (first == 0)
+    {
+        INODECOLUMNSobj.FirstChild[dir] = ino;
+        INODECOLUMNSobj.PrevSibling[ino] = ino;
+    }
+    else
+    {
+        INODECOLUMNSobj.PrevSibling[ino] = INODECOLUMNSobj.PrevSibling[first];
+        INODECOLUMNSobj.NextSibling[INODECOLUMNSobj.PrevSibling[first]] = ino;
+        INODECOLUMNSobj.PrevSibling[first] = ino;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : UnlinkChild
+//    Description   : Takes an inode out of its directory's entry list. Called with
+//                    NAMEINDEX::Lock held exclusively.
+//    Input         : int ino  - Inode linked by LinkChild, with its Parent column unchanged.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void UnlinkChild(int ino)
+{
+    int dir = INODECOLUMNSobj.Parent[ino], first = INODECOLUMNSobj.FirstChild[dir];
+    int next = INODECOLUMNSobj.NextSibling[ino], prev = INODECOLUMNSobj.PrevSibling[ino];
+
+    if (ino == first)
+        INODECOLUMNSobj.FirstChild[dir] = next;
+    else
+        INODECOLUMNSobj.NextSibling[prev] = next;
+
+    if (next != 0)
+        INODECOLUMNSobj.PrevSibling[next] = prev;
+    else if (ino != first)
+        INODECOLUMNSobj.PrevSibling[first] = prev;
+
+    INODECOLUMNSobj.NextSibling[ino] = 0;
+    INODECOLUMNSobj.PrevSibling[ino] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : NameIndexInsert
+//    Description   : Adds a directory entry to the hash index and to the bloom filter.
+//    Input         : PINODE inode  - Inode whose FileName and Parent are already set.
+//    Output        : int          - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int NameIndexInsert(PINODE inode)
+{
+    unsigned int hash = HashDentry(INODE_PARENT(inode), inode->FileName);
+    int i = 0, k = 0, mask = 0;
+
+    if ((NAMEINDEXobj.Used + NAMEINDEXobj.Deleted + 1) * 10 > NAMEINDEXobj.Size * 7)
+    {
+        if (NameIndexRehash(((NAMEINDEXobj.Fixed == 0) && ((NAMEINDEXobj.Used + 1) * 10 > NAMEINDEXobj.Size * 5)) ? NAMEINDEXobj.Size * 2 : NAMEINDEXobj.Size) == -1)
+            return -1;
+    }
+
+    mask = NAMEINDEXobj.Size - 1;
+    i = hash & mask;
+    while (NAMEINDEXobj.Slots[i].State == SLOT_USED)
+        i = (i + 1) & mask;
+
+    if (NAMEINDEXobj.Slots[i].State == SLOT_DELETED)
+        (NAMEINDEXobj.Deleted)--;
+
+    NAMEINDEXobj.Slots[i].Hash = hash;
+    NAMEINDEXobj.Slots[i].State = SLOT_USED;
+    NAMEINDEXobj.Slots[i].InodeNumber = inode->InodeNumber;
+    (NAMEINDEXobj.Used)++;
+    LinkChild(inode->InodeNumber);
+
+    for (k = 0; k < 3; k++)
+        if (NAMEINDEXobj.Filter[FilterBucket(hash, k, NAMEINDEXobj.FilterSize)] < 255)
+            (NAMEINDEXobj.Filter[FilterBucket(hash, k, NAMEINDEXobj.FilterSize)])++;
+
+    DcacheInvalidate(INODE_PARENT(inode), inode->FileName);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : NameIndexRemove
+//    Description   : Removes an inode from the hash index and from the bloom filter.
+//                    Saturated filter counters are left untouched so they never underflow;
+//                    the next rehash, which the tombstone brings closer, recounts them.
+//    Input         : PINODE inode  - Inode to remove.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void NameIndexRemove(PINODE inode)
+{
+    unsigned int hash = HashDentry(INODE_PARENT(inode), inode->FileName);
+    int i = 0, k = 0, mask = NAMEINDEXobj.Size - 1;
+
+    i = hash & mask;
+    while (NAMEINDEXobj.Slots[i].State != SLOT_EMPTY)
+    {
+        if ((NAMEINDEXobj.Slots[i].State == SLOT_USED) && (NAMEINDEXobj.Slots[i].InodeNumber == inode->InodeNumber))
+        {
+            NAMEINDEXobj.Slots[i].State = SLOT_DELETED;
+            NAMEINDEXobj.Slots[i].InodeNumber = 0;
+            (NAMEINDEXobj.Used)--;
+            (NAMEINDEXobj.Deleted)++;
+            UnlinkChild(inode->InodeNumber);
+
+            for (k = 0; k < 3; k++)
+                if (NAMEINDEXobj.Filter[FilterBucket(hash, k, NAMEINDEXobj.FilterSize)] < 255)
+                    (NAMEINDEXobj.Filter[FilterBucket(hash, k, NAMEINDEXobj.FilterSize)])--;
+
+            DcacheInvalidate(INODE_PARENT(inode), inode->FileName);
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : Get_Inode
+//    Description   : Retrieves the inode structure for a given path.
+//    Input         : char* name - Path of the file, absolute or relative to the current
+//                                 directory.
+//    Output        : PINODE    - Pointer to the inode if found, or NULL if not found (the root
+//                                 has no inode object).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PINODE Get_Inode(char *name)
+{
+    long long start = NowNanoseconds();
+    int ino = ResolvePath(name);
+
+    PerfRecord(PERF_LOOKUP, start, (ino < 0) ? ino : 0, -1, (ino < 0) ? 0 : ino, 0, 0);
+    if (ino <= 0)
+        return NULL;
+
+    return InodeFromNumber(ino);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : GetFileTable
+//    Description   : Validates a descriptor and returns its file table entry. A descriptor whose
+//                    generation no longer matches the slot (closed and possibly reused) is
+//                    rejected without any scan. The caller holds the descriptor's stripe lock.
+//    Input         : long long fd - File descriptor.
+//    Output        : PFILETABLE  - File table entry, or NULL if the descriptor is not valid.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PFILETABLE GetFileTable(long long fd)
+{
+    int slot = 0;
+    PUFDT entry = NULL;
+    PFILETABLE ft = NULL;
+
+    if (fd < 0)
+        return NULL;
+
+    slot = fd & FDINDEXMASK;
+    if ((slot / FDCHUNKSIZE) >= __atomic_load_n(&UFDTobj.ChunkCount, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    entry = &(UFDTobj.Chunks[slot / FDCHUNKSIZE][slot % FDCHUNKSIZE]);
+    ft = __atomic_load_n(&entry->ptrfiletable, __ATOMIC_ACQUIRE);
+    if ((ft == NULL) || ((long long)entry->Generation != (fd >> FDINDEXBITS)))
+        return NULL;
+
+    return ft;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AcquireFileTable
+//    Description   : Locks a descriptor's stripe and returns its file table entry. The entry
+//                    cannot be closed or freed until ReleaseFileTable is called.
+//    Input         : long long fd - File descriptor.
+//    Output        : PFILETABLE  - File table entry (stripe locked), or NULL if the descriptor
+//                                  is not valid (stripe not locked).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PFILETABLE AcquireFileTable(long long fd)
+{
+    PFILETABLE ft = NULL;
+
+    if (fd < 0)
+        return NULL;
+
+    pthread_mutex_lock(&UFDTobj.Stripes[(fd & FDINDEXMASK) % FDLOCKSTRIPES].Lock);
+    ft = GetFileTable(fd);
+    if (ft == NULL)
+        pthread_mutex_unlock(&UFDTobj.Stripes[(fd & FDINDEXMASK) % FDLOCKSTRIPES].Lock);
+
+    return ft;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReleaseFileTable
+//    Description   : Unlocks the stripe taken by a successful AcquireFileTable.
+//    Input         : long long fd - File descriptor passed to AcquireFileTable.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ReleaseFileTable(long long fd)
+{
+    pthread_mutex_unlock(&UFDTobj.Stripes[(fd & FDINDEXMASK) % FDLOCKSTRIPES].Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AllocateFD
+//    Description   : Takes the lowest free descriptor slot, growing the table by one chunk when
+//                    every allocated chunk is full, and links the file table entry into its
+//                    inode's OpenList. The caller holds the inode lock exclusively.
+//    Input         : PFILETABLE ptrfiletable - File table entry with ptrinode already set.
+//    Output        : long long              - New descriptor, or -1 if the table is full or
+//                                              memory allocation failed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long AllocateFD(PFILETABLE ptrfiletable)
+{
+    int w = 0, c = 0, j = 0, bit = 0, slot = 0;
+    PUFDT entry = NULL;
+
+    pthread_mutex_lock(&UFDTobj.Lock);
+    for (w = 0; w < FDMAXCHUNKS / 64; w++)
+        if (~(UFDTobj.Full[w]) != 0)
+            break;
+    if (w == FDMAXCHUNKS / 64)
+    {
+        pthread_mutex_unlock(&UFDTobj.Lock);
+        return -1;
+    }
+
+    c = w * 64 + __builtin_ctzll(~(UFDTobj.Full[w]));
+    if (c >= UFDTobj.ChunkCount)
+    {
+        UFDTobj.Chunks[c] = (PUFDT)calloc(FDCHUNKSIZE, sizeof(UFDT));
+        UFDTobj.Used[c] = (unsigned long long *)calloc(FDCHUNKSIZE / 64, sizeof(unsigned long long));
+        if ((UFDTobj.Chunks[c] == NULL) || (UFDTobj.Used[c] == NULL))
+        {
+            free(UFDTobj.Chunks[c]);
+            free(UFDTobj.Used[c]);
+            UFDTobj.Chunks[c] = NULL;
+            UFDTobj.Used[c] = NULL;
+            pthread_mutex_unlock(&UFDTobj.Lock);
+            return -1;
+        }
+        __atomic_store_n(&UFDTobj.ChunkCount, c + 1, __ATOMIC_RELEASE);
+    }
+
+    for (j = 0; j < FDCHUNKSIZE / 64; j++)
+        if (~(UFDTobj.Used[c][j]) != 0)
+            break;
+
+    bit = __builtin_ctzll(~(UFDTobj.Used[c][j]));
+    UFDTobj.Used[c][j] = UFDTobj.Used[c][j] | (1ULL << bit);
+    slot = c * FDCHUNKSIZE + j * 64 + bit;
+
+    for (j = 0; j < FDCHUNKSIZE / 64; j++)
+        if (~(UFDTobj.Used[c][j]) != 0)
+            break;
+    if (j == FDCHUNKSIZE / 64)
+        UFDTobj.Full[c / 64] = UFDTobj.Full[c / 64] | (1ULL << (c % 64));
+
+    entry = &(UFDTobj.Chunks[c][slot % FDCHUNKSIZE]);
+    ptrfiletable->fd = ((long long)entry->Generation << FDINDEXBITS) | slot;
+    __atomic_store_n(&entry->ptrfiletable, ptrfiletable, __ATOMIC_RELEASE);
+    (UFDTobj.OpenCount)++;
+    pthread_mutex_unlock(&UFDTobj.Lock);
+
+    ptrfiletable->nextopen = NULL;
+    if (ptrfiletable->ptrinode->OpenList == NULL)
+    {
+        ptrfiletable->prevopen = ptrfiletable;
+        ptrfiletable->ptrinode->OpenList = ptrfiletable;
+    }
+    else
+    {
+        ptrfiletable->prevopen = ptrfiletable->ptrinode->OpenList->prevopen;
+        ptrfiletable->prevopen->nextopen = ptrfiletable;
+        ptrfiletable->ptrinode->OpenList->prevopen = ptrfiletable;
+    }
+
+    return ptrfiletable->fd;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReleaseFD
+//    Description   : Returns a descriptor slot to the table, unlinks and frees its file table
+//                    entry, and bumps the slot generation so the old descriptor goes stale.
+//                    The caller holds the descriptor's stripe and the inode lock exclusively.
+//    Input         : long long fd - Valid file descriptor.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ReleaseFD(long long fd)
+{
+    int slot = fd & FDINDEXMASK;
+    int c = slot / FDCHUNKSIZE, j = (slot % FDCHUNKSIZE) / 64;
+    PUFDT entry = &(UFDTobj.Chunks[c][slot % FDCHUNKSIZE]);
+    PFILETABLE ft = entry->ptrfiletable;
+    PFILETABLE first = ft->ptrinode->OpenList;
+
+    if (ft == first)
+        ft->ptrinode->OpenList = ft->nextopen;
+    else
+        ft->prevopen->nextopen = ft->nextopen;
+
+    if (ft->nextopen != NULL)
+        ft->nextopen->prevopen = ft->prevopen;
+    else if (ft != first)
+        first->prevopen = ft->prevopen;
+
+    SlabFree(&FILETABLESLAB, ft);
+    __atomic_store_n(&entry->ptrfiletable, (PFILETABLE)NULL, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&UFDTobj.Lock);
+    (entry->Generation)++;
+    UFDTobj.Used[c][j] = UFDTobj.Used[c][j] & ~(1ULL << (slot % 64));
+    UFDTobj.Full[c / 64] = UFDTobj.Full[c / 64] & ~(1ULL << (c % 64));
+    (UFDTobj.OpenCount)--;
+    pthread_mutex_unlock(&UFDTobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : GetFDFromName
+//    Description   : Retrieves the oldest open file descriptor for a file given its name.
+//    Input         : char* name - Name of the file.
+//    Output        : long long - File descriptor if found, or -1 if not found.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long GetFDFromName(char *name)
+{
+    long long fd = -1;
+    PINODE temp = NULL;
+
+    pthread_rwlock_rdlock(&NAMEINDEXobj.Lock);
+    temp = Get_Inode(name);
+    if (temp != NULL)
+    {
+        pthread_rwlock_rdlock(&temp->Lock);
+        if (temp->OpenList != NULL)
+            fd = temp->OpenList->fd;
+        pthread_rwlock_unlock(&temp->Lock);
+    }
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+
+    return fd;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CreateDILB
+//    Description   : Creates the Disk Inode List Block (DILB). Inodes are not allocated up
+//                    front: the inode columns grow in chunks and inode objects are created on
+//                    first use.
+//    Input         : int maxinodes  - Most inodes the file system may hold.
+//    Output        : int           - 0 on success, or -1 on failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int CreateDILB(int maxinodes)
+{
+    if (InitialiseInodeColumns(maxinodes) == -1)
+        return -1;
+
+    printf("DILB created successfully\n");
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InitialiseSuperBlock
+//    Description   : Initializes the descriptor table and creates the shared locks. The inode
+//                    capacity is set up later, by CreateDILB or MountImage.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InitialiseSuperBlock()
+{
+    int i = 0;
+
+    memset(&UFDTobj, 0, sizeof(UFDTobj));
+    pthread_mutex_init(&UFDTobj.Lock, NULL);
+    for (i = 0; i < FDLOCKSTRIPES; i++)
+        pthread_mutex_init(&UFDTobj.Stripes[i].Lock, NULL);
+
+    pthread_mutex_init(&BLOCKPOOLobj.Lock, NULL);
+    pthread_mutex_init(&INODECOLUMNSobj.Lock, NULL);
+    pthread_rwlock_init(&NAMEINDEXobj.Lock, NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FormatImage
+//    Description   : Lays out a new, empty image in a freshly created image file. The file is
+//                    extended with ftruncate, so untouched sections take no disk space.
+//    Input         : int fd          - Descriptor of the empty image file.
+//                    long long size  - Requested image size in bytes.
+//                    int maxinodes   - Inodes to lay out, or 0 for one per IMAGEBYTESPERINODE.
+//    Output        : int            - 0 on success, or -1 if the image could not be created.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int FormatImage(int fd, long long size, int maxinodes)
+{
+    int capacity = 0;
+    int slots = NAMEINDEXSIZE;
+    long long offset = BLOCKSIZE;
+    IMAGEHEADER hdr;
+
+    if (maxinodes == 0)
+        maxinodes = (int)((size / IMAGEBYTESPERINODE < IMAGEMININODES) ? IMAGEMININODES :
+                          (size / IMAGEBYTESPERINODE > INODELIMIT) ? INODELIMIT : size / IMAGEBYTESPERINODE);
+    capacity = ((maxinodes + 1) + FINDBATCH - 1) / FINDBATCH * FINDBATCH;
+    while (slots < capacity * 2)
+        slots = slots * 2;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.Magic, IMAGEMAGIC, 8);
+    hdr.Version = IMAGEVERSION;
+    hdr.BlockSize = BLOCKSIZE;
+    hdr.MaxInodes = maxinodes;
+    hdr.Capacity = capacity;
+    hdr.FreeInode = maxinodes;
+    hdr.NextInode = 1;
+    hdr.NameIndexSize = slots;
+    hdr.NameFilterSize = slots * NAMEFILTERPERSLOT;
+    hdr.Clean = 1;
+
+    hdr.FileTypeOffset = offset;
+    offset = offset + (long long)capacity * sizeof(int);
+    hdr.FileActualSizeOffset = offset;
+    offset = offset + (long long)capacity * sizeof(long long);
+    hdr.PermissionOffset = offset;
+    offset = offset + (long long)capacity * sizeof(int);
+    hdr.LinkCountOffset = offset;
+    offset = offset + (long long)capacity * sizeof(int);
+    hdr.ParentOffset = offset;
+    offset = offset + (long long)capacity * sizeof(int);
+    hdr.FirstChildOffset = offset;
+    offset = offset + (long long)capacity * sizeof(int);
+    hdr.NextSiblingOffset = offset;
+    offset = offset + (long long)capacity * sizeof(int);
+    hdr.PrevSiblingOffset = offset;
+    offset = offset + (long long)capacity * sizeof(int);
+    hdr.MapHeadOffset = offset;
+    offset = offset + (long long)capacity * sizeof(unsigned int);
+    hdr.NextFreeOffset = offset;
+    offset = offset + (long long)capacity * sizeof(int);
+    hdr.FileNameOffset = offset;
+    offset = offset + (long long)capacity * NAMELENGTH;
+    hdr.NameSlotsOffset = offset;
+    offset = offset + (long long)slots * sizeof(NAMESLOT);
+    hdr.NameFilterOffset = offset;
+    offset = offset + hdr.NameFilterSize;
+    hdr.DataOffset = (offset + BLOCKSIZE - 1) / BLOCKSIZE * BLOCKSIZE;
+
+    if (size < hdr.DataOffset + BLOCKSIZE)
+        return -1;
+
+    hdr.DataBlocks = (unsigned int)((size - hdr.DataOffset) / BLOCKSIZE);
+    hdr.NextBlock = 1;
+    hdr.ImageSize = hdr.DataOffset + (long long)hdr.DataBlocks * BLOCKSIZE;
+
+    if (ftruncate(fd, hdr.ImageSize) == -1)
+        return -1;
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        return -1;
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : MountImage
+//    Description   : Opens (creating and formatting if needed) a file system image and maps it.
+//                    Only the header is validated; the inode columns, name index and data blocks
+//                    are used in place from the mapping and fault in lazily on first access, so
+//                    mounting takes the same time whatever the image size.
+//    Input         : char* path      - Path of the image file.
+//                    long long size  - Size to format a new image with.
+//                    int maxinodes   - Inodes to format a new image with, 0 for the default.
+//    Output        : int            - 0 on success, or error code:
+//                                      -1: Image file could not be opened or created
+//                                      -2: Not a valid image
+//                                      -3: Memory allocation failure
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int MountImage(char *path, long long size, int maxinodes)
+{
+    int fd = 0;
+    char *base = NULL;
+    struct stat st;
+    PIMAGEHEADER hdr = NULL;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        return -1;
+
+    if ((fstat(fd, &st) == -1) || ((st.st_size == 0) && ((FormatImage(fd, size, maxinodes) == -1) || (fstat(fd, &st) == -1))))
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size < BLOCKSIZE)
+    {
+        close(fd);
+        return -2;
+    }
+
+    base = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+
+    hdr = (PIMAGEHEADER)base;
+    if ((memcmp(hdr->Magic, IMAGEMAGIC, 8) != 0) || (hdr->Version != IMAGEVERSION) ||
+        (hdr->BlockSize != BLOCKSIZE) || (hdr->ImageSize != st.st_size) ||
+        (hdr->MaxInodes <= 0) || (hdr->MaxInodes > INODELIMIT) || (hdr->Capacity <= hdr->MaxInodes) ||
+        (hdr->Capacity % FINDBATCH != 0) || (hdr->NextInode < 1) || (hdr->NextInode > hdr->MaxInodes + 1) ||
+        (hdr->FreeInodeHead < 0) || (hdr->FreeInodeHead >= hdr->NextInode) ||
+        (hdr->DataOffset + (long long)hdr->DataBlocks * BLOCKSIZE != hdr->ImageSize) ||
+        (hdr->NextBlock == 0) || (hdr->NextBlock > hdr->DataBlocks + 1) ||
+        (hdr->NameFilterSize <= 0) || ((hdr->NameFilterSize & (hdr->NameFilterSize - 1)) != 0))
+    {
+        munmap(base, st.st_size);
+        close(fd);
+        return -2;
+    }
+
+    INODECOLUMNSobj.Inode = (PINODE *)calloc(hdr->Capacity, sizeof(PINODE));
+    if (INODECOLUMNSobj.Inode == NULL)
+    {
+        munmap(base, st.st_size);
+        close(fd);
+        return -3;
+    }
+
+    if (hdr->Clean == 0)
+        printf("WARNING : Image was not unmounted cleanly\n");
+    IMAGEobj.Dirty = (hdr->Clean == 0);
+    hdr->Clean = 0;
+
+    IMAGEobj.fd = fd;
+    IMAGEobj.Base = base;
+    IMAGEobj.Header = hdr;
+    IMAGEobj.Data = base + hdr->DataOffset;
+
+    INODECOLUMNSobj.FileType = (int *)(base + hdr->FileTypeOffset);
+    INODECOLUMNSobj.FileActualSize = (long long *)(base + hdr->FileActualSizeOffset);
+    INODECOLUMNSobj.Permission = (int *)(base + hdr->PermissionOffset);
+    INODECOLUMNSobj.LinkCount = (int *)(base + hdr->LinkCountOffset);
+    INODECOLUMNSobj.Parent = (int *)(base + hdr->ParentOffset);
+    INODECOLUMNSobj.FirstChild = (int *)(base + hdr->FirstChildOffset);
+    INODECOLUMNSobj.NextSibling = (int *)(base + hdr->NextSiblingOffset);
+    INODECOLUMNSobj.PrevSibling = (int *)(base + hdr->PrevSiblingOffset);
+    INODECOLUMNSobj.MapHead = (unsigned int *)(base + hdr->MapHeadOffset);
+    INODECOLUMNSobj.FileName = base + hdr->FileNameOffset;
+    INODECOLUMNSobj.NextFree = (int *)(base + hdr->NextFreeOffset);
+
+    NAMEINDEXobj.Slots = (PNAMESLOT)(base + hdr->NameSlotsOffset);
+    NAMEINDEXobj.Filter = (unsigned char *)(base + hdr->NameFilterOffset);
+    NAMEINDEXobj.FilterSize = hdr->NameFilterSize;
+    NAMEINDEXobj.Size = hdr->NameIndexSize;
+    NAMEINDEXobj.Used = hdr->NameIndexUsed;
+    NAMEINDEXobj.Deleted = hdr->NameIndexDeleted;
+    NAMEINDEXobj.Fixed = 1;
+
+    SUPERBLOCKobj.MaxInodes = hdr->MaxInodes;
+    SUPERBLOCKobj.Capacity = hdr->Capacity;
+    SUPERBLOCKobj.NextInode = hdr->NextInode;
+    SUPERBLOCKobj.FreeHead = hdr->FreeInodeHead;
+    SUPERBLOCKobj.FreeInode = hdr->FreeInode;
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : SyncImage
+//    Description   : Copies the in-memory counters into the image header and flushes every dirty
+//                    page of the mapping to the image file with msync.
+//    Input         : None
+//    Output        : int - 0 on success, -1 if msync failed, or -2 if no image is mounted.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int SyncImage()
+{
+    if (IMAGEobj.Base == NULL)
+        return -2;
+
+    IMAGEobj.Header->FreeInode = __atomic_load_n(&SUPERBLOCKobj.FreeInode, __ATOMIC_RELAXED);
+    IMAGEobj.Header->NextInode = SUPERBLOCKobj.NextInode;
+    IMAGEobj.Header->FreeInodeHead = SUPERBLOCKobj.FreeHead;
+    IMAGEobj.Header->NameIndexUsed = NAMEINDEXobj.Used;
+    IMAGEobj.Header->NameIndexDeleted = NAMEINDEXobj.Deleted;
+
+    if (msync(IMAGEobj.Base, IMAGEobj.Header->ImageSize, MS_SYNC) == -1)
+        return -1;
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InitialiseFileInode
+//    Description   : Turns a free inode into a new, empty regular file or directory, links it
+//                    into its directory and indexes its name. The file starts with no open
+//                    descriptor; whoever opens one counts the reference.
+//    Input         : PINODE temp     - Free inode.
+//                    int parent      - Directory to hold the entry, 0 for the root.
+//                    char* name      - Name of the entry.
+//                    int type        - REGULAR or DIRECTORY.
+//                    int permission  - Permission settings (1: Read, 2: Write, 3: Read+Write).
+//    Output        : int            - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int InitialiseFileInode(PINODE temp, int parent, char *name, int type, int permission)
+{
+    strcpy(temp->FileName, name);
+    INODE_PARENT(temp) = parent;
+    if (NameIndexInsert(temp) == -1)
+    {
+        INODE_PARENT(temp) = 0;
+        return -1;
+    }
+
+    TakeFreeInode(temp->InodeNumber);
+    __atomic_fetch_sub(&SUPERBLOCKobj.FreeInode, 1, __ATOMIC_RELAXED);
+    (INODECOLUMNSobj.FileActualSize[parent])++;
+
+    INODE_TYPE(temp) = type;
+    temp->ReferenceCount = 0;
+    INODE_LINKCOUNT(temp) = 1;
+    temp->FileSize = MAXFILESIZE;
+    INODE_SIZE(temp) = 0;
+    temp->AppendEnd = 0;
+    INODE_PERMISSION(temp) = permission;
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReleaseFileInode
+//    Description   : Deletes a file: drops its name, frees its blocks, closes every descriptor
+//                    open on it and returns the inode to the free pool.
+//    Input         : PINODE temp - Inode of the file.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ReleaseFileInode(PINODE temp)
+{
+    NameIndexRemove(temp);
+    (INODECOLUMNSobj.FileActualSize[INODE_PARENT(temp)])--;
+    INODE_PARENT(temp) = 0;
+    INODE_TYPE(temp) = 0;
+    FreeFileBlocks(temp);
+    INODE_SIZE(temp) = 0;
+    temp->AppendEnd = 0;
+
+    while (temp->OpenList != NULL)
+        ReleaseFD(temp->OpenList->fd);
+    temp->ReferenceCount = 0;
+    PutFreeInode(temp->InodeNumber);
+    __atomic_fetch_add(&SUPERBLOCKobj.FreeInode, 1, __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : WriteInodeData
+//    Description   : Copies data into a file at the given offset, allocating blocks as needed,
+//                    and extends the file size if the data ends past it. Shared blocks are copied
+//                    first, and every block filled up to its end is deduplicated.
+//    Input         : PINODE inode      - Inode of the file.
+//                    long long offset  - Byte offset to write at.
+//                    char* arr         - Data to write.
+//                    int isize         - Number of bytes to write.
+//    Output        : int              - Number of bytes written (less than isize only when no
+//                                        block could be allocated or made resident).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int WriteInodeData(PINODE inode, long long offset, char *arr, int isize)
+{
+    int done = 0, chunk = 0, inblock = 0, fresh = 0;
+    PBLOCK block = NULL;
+    char *data = NULL;
+
+    while (done < isize)
+    {
+        inblock = (int)(offset % BLOCKSIZE);
+        chunk = BLOCKSIZE - inblock;
+        if (chunk > isize - done)
+            chunk = isize - done;
+
+        fresh = (GetFileBlock(inode, offset / BLOCKSIZE, 0) == NULL);
+        block = GetFileBlock(inode, offset / BLOCKSIZE, 1);
+        if (block != NULL)
+            block = UnshareBlock(inode, offset / BLOCKSIZE);
+        if ((block == NULL) || ((data = PinBlock(block, 1)) == NULL))
+            break;
+
+        if (fresh && chunk != BLOCKSIZE)
+        {
+            memset(data, 0, inblock);
+            memset(data + inblock + chunk, 0, BLOCKSIZE - inblock - chunk);
+        }
+        memcpy(data + inblock, arr + done, chunk);
+        UnpinBlock(block);
+        if (inblock + chunk == BLOCKSIZE)
+            DedupBlock(inode, offset / BLOCKSIZE);
+
+        done = done + chunk;
+        offset = offset + chunk;
+    }
+
+    if (offset > INODE_SIZE(inode))
+        INODE_SIZE(inode) = offset;
+
+    return done;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AppendReady
+//    Description   : Tells whether a range can be appended to under the shared inode lock: every
+//                    block it touches must already be allocated, private and not compressed, so
+//                    copying into it leaves the block map alone.
+//    Input         : PINODE inode      - Inode of the file.
+//                    long long offset  - Start of the range.
+//                    int isize         - Bytes in the range.
+//    Output        : int              - 1 if the range is ready, 0 if blocks must be prepared.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int AppendReady(PINODE inode, long long offset, int isize)
+{
+    long long blockno = 0;
+    PBLOCK block = NULL;
+
+    for (blockno = offset / BLOCKSIZE; blockno * BLOCKSIZE < offset + isize; blockno++)
+    {
+        block = GetFileBlock(inode, blockno, 0);
+        if ((block == NULL) || (block->Packed != NULL) || (__atomic_load_n(&block->Shares, __ATOMIC_ACQUIRE) != 0))
+            return 0;
+    }
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PrepareAppend
+//    Description   : Makes the blocks of a range ready for appenders: missing blocks are
+//                    allocated and zeroed, shared blocks copied and compressed blocks unpacked.
+//                    Without an image, APPENDAHEAD further blocks are allocated so that the next
+//                    appends need not come back here. The caller holds the inode lock
+//                    exclusively.
+//    Input         : PINODE inode      - Inode of the file.
+//                    long long offset  - Start of the range, the end of the file.
+//                    int isize         - Bytes in the range.
+//    Output        : int              - 0 on success, or -1 if a block could not be allocated
+//                                        or made resident.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PrepareAppend(PINODE inode, long long offset, int isize)
+{
+    long long blockno = 0, last = (offset + isize - 1) / BLOCKSIZE;
+    int fresh = 0;
+    PBLOCK block = NULL;
+    char *data = NULL;
+
+    if (IMAGEobj.Base == NULL)
+        last = last + APPENDAHEAD;
+    if (last >= MAXFILESIZE / BLOCKSIZE)
+        last = MAXFILESIZE / BLOCKSIZE - 1;
+
+    for (blockno = offset / BLOCKSIZE; blockno <= last; blockno++)
+    {
+        fresh = (GetFileBlock(inode, blockno, 0) == NULL);
+        block = GetFileBlock(inode, blockno, 1);
+        if (block != NULL)
+            block = UnshareBlock(inode, blockno);
+        if ((block == NULL) || ((data = PinBlock(block, 1)) == NULL))
+            return -1;
+        if (fresh)
+            memset(data, 0, BLOCKSIZE);
+        UnpinBlock(block);
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TrimAppendAhead
+//    Description   : Frees the blocks PrepareAppend allocated past the end of the file, so a
+//                    closed log does not keep its lookahead. The caller holds the inode lock
+//                    exclusively, so every reserved append has reached the size.
+//    Input         : PINODE inode - Inode of the file.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TrimAppendAhead(PINODE inode)
+{
+    long long blockno = 0;
+    PBLOCK block = NULL;
+
+    if (IMAGEobj.Base != NULL)
+        return;
+
+    for (blockno = NextFileBlock(inode, (INODE_SIZE(inode) + BLOCKSIZE - 1) / BLOCKSIZE); blockno != -1;
+         blockno = NextFileBlock(inode, blockno + 1))
+    {
+        block = GetFileBlock(inode, blockno, 0);
+        *BlockSlot(inode, blockno, 0) = NULL;
+        FreeBlock(block);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AppendInodeData
+//    Description   : Copies data into space reserved by an appender. The blocks were made
+//                    ready by PrepareAppend, so this only needs the shared inode lock and runs
+//                    in parallel with other appenders and readers. The size is not changed.
+//    Input         : PINODE inode      - Inode of the file.
+//                    long long offset  - Byte offset to copy to.
+//                    char* arr         - Data to copy.
+//                    int isize         - Number of bytes to copy.
+//    Output        : int              - Number of bytes copied (less than isize only when a
+//                                        block could not be made resident).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int AppendInodeData(PINODE inode, long long offset, char *arr, int isize)
+{
+    int done = 0, chunk = 0, inblock = 0;
+    PBLOCK block = NULL;
+    char *data = NULL;
+
+    while (done < isize)
+    {
+        inblock = (int)(offset % BLOCKSIZE);
+        chunk = BLOCKSIZE - inblock;
+        if (chunk > isize - done)
+            chunk = isize - done;
+
+        block = GetFileBlock(inode, offset / BLOCKSIZE, 0);
+        if ((block == NULL) || ((data = PinBlock(block, 1)) == NULL))
+            break;
+        memcpy(data + inblock, arr + done, chunk);
+        UnpinBlock(block);
+
+        done = done + chunk;
+        offset = offset + chunk;
+    }
+
+    return done;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : JournalChecksum
+//    Description   : Computes the FNV-1a checksum of a journal record and its payload.
+//    Input         : PJOURNALRECORD rec  - Record header (its Checksum field is ignored).
+//                    char* payload       - rec->Length bytes of payload.
+//    Output        : unsigned int       - Checksum of the record.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int JournalChecksum(PJOURNALRECORD rec, char *payload)
+{
+    JOURNALRECORD copy = *rec;
+    unsigned int hash = 2166136261u;
+    unsigned char *p = (unsigned char *)&copy;
+    int i = 0;
+
+    copy.Checksum = 0;
+    for (i = 0; i < (int)sizeof(copy); i++)
+        hash = (hash ^ p[i]) * 16777619u;
+
+    p = (unsigned char *)payload;
+    for (i = 0; i < rec->Length; i++)
+        hash = (hash ^ p[i]) * 16777619u;
+
+    return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : JournalCommit
+//    Description   : Group commit. Swaps the record buffer with the spare buffer so appends can
+//                    carry on, then writes every gathered record to the journal with one write
+//                    and makes it durable with one fdatasync.
+//    Input         : None
+//    Output        : int - 0 on success, or -1 if the journal could not be written.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int JournalCommit()
+{
+    char *buffer = NULL;
+    size_t used = 0, capacity = 0, off = 0;
+    ssize_t n = 0;
+    int ret = 0;
+
+    pthread_mutex_lock(&JOURNALobj.CommitLock);
+
+    pthread_mutex_lock(&JOURNALobj.Lock);
+    buffer = JOURNALobj.Buffer;
+    capacity = JOURNALobj.Capacity;
+    used = JOURNALobj.Used;
+    JOURNALobj.Buffer = JOURNALobj.Spare;
+    JOURNALobj.Capacity = JOURNALobj.SpareCapacity;
+    JOURNALobj.Spare = buffer;
+    JOURNALobj.SpareCapacity = capacity;
+    JOURNALobj.Used = 0;
+    JOURNALobj.Pending = 0;
+    pthread_mutex_unlock(&JOURNALobj.Lock);
+
+    while (off < used)
+    {
+        n = write(JOURNALobj.fd, buffer + off, used - off);
+        if (n <= 0)
+        {
+            ret = -1;
+            break;
+        }
+        off = off + n;
+    }
+
+    if ((used != 0) && (ret == 0) && (fdatasync(JOURNALobj.fd) == -1))
+        ret = -1;
+
+    if (used != 0)
+    {
+        __atomic_store_n(&JOURNALobj.Size, JOURNALobj.Size + (long long)off, __ATOMIC_RELAXED);
+        (JOURNALobj.Commits)++;
+    }
+
+    pthread_mutex_unlock(&JOURNALobj.CommitLock);
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : JournalFlusher
+//    Description   : Flusher thread. Commits pending records every JOURNAL::Interval
+//                    milliseconds, so a record is durable at most one interval after it was
+//                    appended even when the batch never fills.
+//    Input         : void* arg - Unused.
+//    Output        : void*    - Always NULL.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void *JournalFlusher(void *arg)
+{
+    struct timespec until;
+
+    (void)arg;
+    pthread_mutex_lock(&JOURNALobj.Lock);
+    while (JOURNALobj.Running)
+    {
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec = until.tv_nsec + (long)JOURNALobj.Interval * 1000000L;
+        until.tv_sec = until.tv_sec + until.tv_nsec / 1000000000L;
+        until.tv_nsec = until.tv_nsec % 1000000000L;
+        pthread_cond_timedwait(&JOURNALobj.Wakeup, &JOURNALobj.Lock, &until);
+
+        if (JOURNALobj.Pending != 0)
+        {
+            pthread_mutex_unlock(&JOURNALobj.Lock);
+            JournalCommit();
+            pthread_mutex_lock(&JOURNALobj.Lock);
+        }
+    }
+    pthread_mutex_unlock(&JOURNALobj.Lock);
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : JournalCheckpoint
+//    Description   : Flushes the image so that every journaled change is contained in it,
+//                    records the last contained sequence number in the header and empties the
+//                    journal. Holding ApplyLock exclusively waits out changes that have been
+//                    journaled but not yet applied. Without a journal this is a plain image sync.
+//    Input         : None
+//    Output        : int - 0 on success, -1 if the image or journal could not be flushed, or
+//                          -2 if no image is mounted.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int JournalCheckpoint()
+{
+    int ret = 0;
+
+    if (IMAGEobj.Base == NULL)
+        return -2;
+
+    if (JOURNALobj.Enabled == 0)
+        return SyncImage();
+
+    pthread_rwlock_wrlock(&JOURNALobj.ApplyLock);
+    if (JournalCommit() == -1)
+    {
+        pthread_rwlock_unlock(&JOURNALobj.ApplyLock);
+        return -1;
+    }
+
+    pthread_mutex_lock(&JOURNALobj.CommitLock);
+    ret = SyncImage();
+    if (ret == 0)
+    {
+        IMAGEobj.Header->CheckpointLSN = JOURNALobj.NextLSN - 1;
+        if ((msync(IMAGEobj.Base, BLOCKSIZE, MS_SYNC) == -1) || (ftruncate(JOURNALobj.fd, 0) == -1))
+            ret = -1;
+        else
+        {
+            __atomic_store_n(&JOURNALobj.Size, 0LL, __ATOMIC_RELAXED);
+            (JOURNALobj.Checkpoints)++;
+        }
+    }
+    pthread_mutex_unlock(&JOURNALobj.CommitLock);
+    pthread_rwlock_unlock(&JOURNALobj.ApplyLock);
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : JournalBegin
+//    Description   : Starts a change that will be journaled. A journal that has grown past
+//                    JOURNALCHECKPOINTSIZE is checkpointed first. Must be called before any
+//                    other lock is taken and paired with JournalEnd once the change is applied.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void JournalBegin()
+{
+    if (JOURNALobj.Enabled == 0)
+        return;
+
+    if (__atomic_load_n(&JOURNALobj.Size, __ATOMIC_RELAXED) > JOURNALCHECKPOINTSIZE)
+        JournalCheckpoint();
+
+    pthread_rwlock_rdlock(&JOURNALobj.ApplyLock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : JournalEnd
+//    Description   : Ends a change started with JournalBegin.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void JournalEnd()
+{
+    if (JOURNALobj.Enabled != 0)
+        pthread_rwlock_unlock(&JOURNALobj.ApplyLock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : JournalAppend
+//    Description   : Journals a change before it is applied. The record joins the current
+//                    group and is committed once BatchSize records are pending or the flusher
+//                    timer fires. Called between JournalBegin and JournalEnd.
+//    Input         : int type          - Record type (JR_...).
+//                    int ino           - Inode number the change applies to.
+//                    int parent        - Directory of a created entry, else 0.
+//                    long long offset  - Write offset, new size or permission.
+//                    char* payload     - Name or data, NULL if length is 0.
+//                    int length        - Payload bytes.
+//    Output        : int              - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int JournalAppend(int type, int ino, int parent, long long offset, char *payload, int length)
+{
+    JOURNALRECORD rec;
+    size_t need = sizeof(JOURNALRECORD) + length;
+    char *buffer = NULL;
+    int commit = 0;
+
+    if (JOURNALobj.Enabled == 0)
+        return 0;
+
+    pthread_mutex_lock(&JOURNALobj.Lock);
+    while ((JOURNALobj.Used != 0) && (JOURNALobj.Used + need > JOURNALobj.Capacity))
+    {
+        pthread_mutex_unlock(&JOURNALobj.Lock);
+        JournalCommit();
+        pthread_mutex_lock(&JOURNALobj.Lock);
+    }
+
+    if (need > JOURNALobj.Capacity)
+    {
+        buffer = (char *)realloc(JOURNALobj.Buffer, need);
+        if (buffer == NULL)
+        {
+            pthread_mutex_unlock(&JOURNALobj.Lock);
+            return -1;
+        }
+        JOURNALobj.Buffer = buffer;
+        JOURNALobj.Capacity = need;
+    }
+
+    rec.Magic = JOURNALMAGIC;
+    rec.LSN = (JOURNALobj.NextLSN)++;
+    rec.Offset = offset;
+    rec.Type = type;
+    rec.InodeNumber = ino;
+    rec.Length = length;
+    rec.Parent = parent;
+    rec.Checksum = JournalChecksum(&rec, payload);
+
+    memcpy(JOURNALobj.Buffer + JOURNALobj.Used, &rec, sizeof(rec));
+    if (length != 0)
+        memcpy(JOURNALobj.Buffer + JOURNALobj.Used + sizeof(rec), payload, length);
+    JOURNALobj.Used = JOURNALobj.Used + need;
+    (JOURNALobj.Pending)++;
+    (JOURNALobj.Records)++;
+    commit = (JOURNALobj.Pending >= JOURNALobj.BatchSize);
+    pthread_mutex_unlock(&JOURNALobj.Lock);
+
+    if (commit)
+        JournalCommit();
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReplayJournalRecord
+//    Description   : Re-applies one journaled change. Every record sets state rather than
+//                    adjusting it, so replaying a change the image already contains is harmless
+//                    and replaying the whole journal in order always ends in the same state.
+//    Input         : PJOURNALRECORD rec  - Record header.
+//                    char* payload       - Record payload.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ReplayJournalRecord(PJOURNALRECORD rec, char *payload)
+{
+    PINODE temp = NULL, other = NULL;
+
+    if ((rec->InodeNumber <= 0) || (rec->InodeNumber > SUPERBLOCKobj.MaxInodes))
+        return;
+
+    temp = InodeFromNumber(rec->InodeNumber);
+    if (temp == NULL)
+        return;
+
+    if ((rec->Type == JR_CREATE) || (rec->Type == JR_MKDIR))
+    {
+        if ((rec->Length <= 0) || (rec->Length > NAMELENGTH) || (payload[rec->Length - 1] != '\0'))
+            return;
+        if ((rec->Parent < 0) || (rec->Parent > SUPERBLOCKobj.MaxInodes) || (rec->Parent == rec->InodeNumber) ||
+            ((rec->Parent != 0) && (INODECOLUMNSobj.FileType[rec->Parent] != DIRECTORY)))
+            return;
+
+        other = NameIndexLookup(rec->Parent, payload);
+        if ((other != NULL) && (other != temp))
+            ReleaseFileInode(other);
+        if (INODE_TYPE(temp) != 0)
+            ReleaseFileInode(temp);
+        InitialiseFileInode(temp, rec->Parent, payload, (rec->Type == JR_MKDIR) ? DIRECTORY : REGULAR, (int)rec->Offset);
+    }
+    else if (INODE_TYPE(temp) == 0)
+    {
+        return;
+    }
+    else if (rec->Type == JR_REMOVE)
+    {
+        ReleaseFileInode(temp);
+    }
+    else if (rec->Type == JR_WRITE)
+    {
+        WriteInodeData(temp, rec->Offset, payload, rec->Length);
+    }
+    else if (rec->Type == JR_TRUNCATE)
+    {
+        FreeFileBlocks(temp);
+        INODE_SIZE(temp) = 0;
+        temp->AppendEnd = 0;
+    }
+    else if (rec->Type == JR_SETSIZE)
+    {
+        if (rec->Offset > INODE_SIZE(temp))
+            INODE_SIZE(temp) = rec->Offset;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReplayJournal
+//    Description   : Reads the journal sequentially and re-applies every record newer than the
+//                    image's last checkpoint. Replay stops at the first torn or corrupt record,
+//                    which can only be the tail of a commit that never completed.
+//    Input         : None
+//    Output        : int - Number of records replayed, or -1 if the journal could not be read.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ReplayJournal()
+{
+    struct stat st;
+    char *base = NULL;
+    long long pos = 0;
+    int count = 0;
+    JOURNALRECORD rec;
+
+    if (fstat(JOURNALobj.fd, &st) == -1)
+        return -1;
+    if (st.st_size == 0)
+        return 0;
+
+    base = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, JOURNALobj.fd, 0);
+    if (base == MAP_FAILED)
+        return -1;
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    while (pos + (long long)sizeof(rec) <= st.st_size)
+    {
+        memcpy(&rec, base + pos, sizeof(rec));
+        if ((rec.Magic != JOURNALMAGIC) || (rec.Length < 0) ||
+            (pos + (long long)sizeof(rec) + rec.Length > st.st_size) ||
+            (JournalChecksum(&rec, base + pos + sizeof(rec)) != rec.Checksum))
+            break;
+
+        if (rec.LSN > IMAGEobj.Header->CheckpointLSN)
+        {
+            ReplayJournalRecord(&rec, base + pos + sizeof(rec));
+            count++;
+        }
+        if (rec.LSN >= JOURNALobj.NextLSN)
+            JOURNALobj.NextLSN = rec.LSN + 1;
+
+        pos = pos + sizeof(rec) + rec.Length;
+    }
+
+    munmap(base, st.st_size);
+    JOURNALobj.Size = st.st_size;
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RebuildNamespace
+//    Description   : Recomputes every directory's entry count and rebuilds the directory entry
+//                    index and entry lists from the Parent and FileName columns. Entries whose directory is gone
+//                    are moved to the root, and the free inode list is rebuilt. Used after a
+//                    crash, when neither the counts nor the index can be trusted to match the
+//                    columns.
+//    Input         : None
+//    Output        : int - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RebuildNamespace()
+{
+    int ino = 0, parent = 0;
+
+    INODECOLUMNSobj.FileActualSize[0] = 0;
+    for (ino = 1; ino <= SUPERBLOCKobj.MaxInodes; ino++)
+        if (INODECOLUMNSobj.FileType[ino] == DIRECTORY)
+            INODECOLUMNSobj.FileActualSize[ino] = 0;
+    memset(INODECOLUMNSobj.FirstChild, 0, (size_t)SUPERBLOCKobj.Capacity * sizeof(int));
+    memset(INODECOLUMNSobj.NextSibling, 0, (size_t)SUPERBLOCKobj.Capacity * sizeof(int));
+    memset(INODECOLUMNSobj.PrevSibling, 0, (size_t)SUPERBLOCKobj.Capacity * sizeof(int));
+
+    for (ino = 1; ino <= SUPERBLOCKobj.MaxInodes; ino++)
+    {
+        if (INODECOLUMNSobj.FileType[ino] == 0)
+            continue;
+
+        parent = INODECOLUMNSobj.Parent[ino];
+        if ((parent < 0) || (parent > SUPERBLOCKobj.MaxInodes) || (parent == ino) ||
+            ((parent != 0) && (INODECOLUMNSobj.FileType[parent] != DIRECTORY)))
+            INODECOLUMNSobj.Parent[ino] = parent = 0;
+        (INODECOLUMNSobj.FileActualSize[parent])++;
+    }
+
+    memset(NAMEINDEXobj.Slots, 0, (size_t)NAMEINDEXobj.Size * sizeof(NAMESLOT));
+    memset(NAMEINDEXobj.Filter, 0, NAMEINDEXobj.FilterSize);
+    NAMEINDEXobj.Used = 0;
+    NAMEINDEXobj.Deleted = 0;
+    for (ino = 1; ino <= SUPERBLOCKobj.MaxInodes; ino++)
+    {
+        if (INODECOLUMNSobj.FileType[ino] == 0)
+            continue;
+        INODECOLUMNSobj.FileName[(size_t)ino * NAMELENGTH + NAMELENGTH - 1] = '\0';
+        if ((InodeFromNumber(ino) == NULL) || (NameIndexInsert(INODECOLUMNSobj.Inode[ino]) == -1))
+            return -1;
+    }
+    RebuildInodeFreeList();
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RecoverImage
+//    Description   : Rebuilds the allocation state of an image that was not unmounted cleanly,
+//                    since its pages may have reached the disk in any order. The free block
+//                    chain is rebuilt from the blocks the files actually reference, and the free
+//                    inode count and namespace from the inode columns. Only runs after a crash.
+//    Input         : None
+//    Output        : int - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RecoverImage()
+{
+    PIMAGEHEADER hdr = IMAGEobj.Header;
+    unsigned char *used = NULL;
+    unsigned int *map = NULL;
+    unsigned int mapno = 0, top = 0, b = 0;
+    long long blocks = 0, index = 0;
+    int ino = 0, i = 0;
+
+    used = (unsigned char *)calloc(hdr->DataBlocks / 8 + 1, 1);
+    if (used == NULL)
+        return -1;
+
+    SUPERBLOCKobj.FreeInode = 0;
+    for (ino = 1; ino <= SUPERBLOCKobj.MaxInodes; ino++)
+    {
+        if (INODECOLUMNSobj.FileType[ino] == 0)
+        {
+            (SUPERBLOCKobj.FreeInode)++;
+            continue;
+        }
+        if (INODECOLUMNSobj.FileType[ino] == DIRECTORY)
+            continue;
+
+        blocks = (INODECOLUMNSobj.FileActualSize[ino] + BLOCKSIZE - 1) / BLOCKSIZE;
+        index = 0;
+        for (mapno = INODECOLUMNSobj.MapHead[ino]; (mapno != 0) && (mapno <= hdr->DataBlocks); mapno = map[0])
+        {
+            if (used[mapno / 8] & (1 << (mapno % 8)))
+                break;
+            used[mapno / 8] = used[mapno / 8] | (1 << (mapno % 8));
+            if (mapno > top)
+                top = mapno;
+
+            map = (unsigned int *)IMAGEBLOCK(mapno);
+            for (i = 0; (i < MAPENTRIES) && (index < blocks); i++, index++)
+            {
+                b = map[1 + i];
+                if ((b == 0) || (b > hdr->DataBlocks))
+                    continue;
+                used[b / 8] = used[b / 8] | (1 << (b % 8));
+                if (b > top)
+                    top = b;
+            }
+        }
+    }
+
+    hdr->NextBlock = top + 1;
+    hdr->FreeBlockHead = 0;
+    hdr->FreeBlockCount = 0;
+    for (b = top; b >= 1; b--)
+        if ((used[b / 8] & (1 << (b % 8))) == 0)
+            FreeImageBlockNumber(b);
+    free(used);
+
+    return RebuildNamespace();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : OpenJournal
+//    Description   : Opens the journal kept next to the image (<image>.journal). After an
+//                    unclean shutdown the image is recovered and the journal replayed; replay
+//                    recreates entries one by one, so the namespace is rebuilt once more
+//                    afterwards. The result is checkpointed before any new change is journaled.
+//                    Then starts the flusher thread.
+//    Input         : char* path     - Path of the image file.
+//                    int interval   - Milliseconds between timed commits, 0 for none.
+//                    int batch      - Pending records that force a commit.
+//    Output        : int           - Number of records replayed, or error code:
+//                                      -1: Journal could not be opened, read or checkpointed
+//                                      -2: Memory allocation failure
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int OpenJournal(char *path, int interval, int batch)
+{
+    char *name = NULL;
+    int replayed = 0;
+
+    name = (char *)malloc(strlen(path) + 9);
+    if (name == NULL)
+        return -2;
+    sprintf(name, "%s.journal", path);
+    JOURNALobj.fd = open(name, O_RDWR | O_CREAT | O_APPEND, 0644);
+    free(name);
+    if (JOURNALobj.fd == -1)
+        return -1;
+
+    JOURNALobj.Buffer = (char *)malloc(JOURNALBUFFERSIZE);
+    JOURNALobj.Spare = (char *)malloc(JOURNALBUFFERSIZE);
+    if ((JOURNALobj.Buffer == NULL) || (JOURNALobj.Spare == NULL))
+        return -2;
+    JOURNALobj.Capacity = JOURNALBUFFERSIZE;
+    JOURNALobj.SpareCapacity = JOURNALBUFFERSIZE;
+    JOURNALobj.Interval = (interval < 0) ? 0 : interval;
+    JOURNALobj.BatchSize = (batch < 1) ? 1 : batch;
+    JOURNALobj.NextLSN = IMAGEobj.Header->CheckpointLSN + 1;
+
+    if ((IMAGEobj.Dirty) && (RecoverImage() == -1))
+        return -2;
+
+    replayed = ReplayJournal();
+    if (replayed == -1)
+        return -1;
+    if ((replayed > 0) && (RebuildNamespace() == -1))
+        return -2;
+
+    JOURNALobj.Enabled = 1;
+    if (((IMAGEobj.Dirty) || (JOURNALobj.Size != 0)) && (JournalCheckpoint() != 0))
+        return -1;
+    IMAGEobj.Dirty = 0;
+
+    if (JOURNALobj.Interval != 0)
+    {
+        JOURNALobj.Running = 1;
+        if (pthread_create(&JOURNALobj.Flusher, NULL, JournalFlusher, NULL) != 0)
+            JOURNALobj.Running = 0;
+    }
+    return replayed;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CloseJournal
+//    Description   : Stops the flusher thread, checkpoints the image and closes the journal.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseJournal()
+{
+    if (JOURNALobj.fd == -1)
+        return;
+
+    if (JOURNALobj.Running)
+    {
+        pthread_mutex_lock(&JOURNALobj.Lock);
+        JOURNALobj.Running = 0;
+        pthread_cond_signal(&JOURNALobj.Wakeup);
+        pthread_mutex_unlock(&JOURNALobj.Lock);
+        pthread_join(JOURNALobj.Flusher, NULL);
+    }
+
+    if (JOURNALobj.Enabled)
+        JournalCheckpoint();
+    JOURNALobj.Enabled = 0;
+
+    close(JOURNALobj.fd);
+    JOURNALobj.fd = -1;
+    free(JOURNALobj.Buffer);
+    free(JOURNALobj.Spare);
+    JOURNALobj.Buffer = NULL;
+    JOURNALobj.Spare = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : journalstat
+//    Description   : Displays journal activity since the image was mounted.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void journalstat()
+{
+    pthread_mutex_lock(&JOURNALobj.Lock);
+    printf("-------------------------------------------------------------------\n");
+    printf("Records\t\tCommits\t\tCheckpoints\tPending\t\tBytes\n");
+    printf("%lld\t\t%lld\t\t%lld\t\t%d\t\t%lld\n", JOURNALobj.Records, JOURNALobj.Commits, JOURNALobj.Checkpoints,
+           JOURNALobj.Pending, JOURNALobj.Size + (long long)JOURNALobj.Used);
+    printf("Next LSN : %lld\tCheckpoint LSN : %lld\n", JOURNALobj.NextLSN, IMAGEobj.Header->CheckpointLSN);
+    printf("Commit interval : %d ms\tBatch size : %d\n", JOURNALobj.Interval, JOURNALobj.BatchSize);
+    printf("-------------------------------------------------------------------\n");
+    pthread_mutex_unlock(&JOURNALobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : UnmountImage
+//    Description   : Checkpoints and closes the journal, then marks the image clean, flushes it
+//                    and unmaps it.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void UnmountImage()
+{
+    long long size = 0;
+
+    if (IMAGEobj.Base == NULL)
+        return;
+
+    CloseJournal();
+
+    size = IMAGEobj.Header->ImageSize;
+    IMAGEobj.Header->Clean = 1;
+    SyncImage();
+
+    munmap(IMAGEobj.Base, size);
+    close(IMAGEobj.fd);
+    IMAGEobj.Base = NULL;
+    IMAGEobj.Header = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CreateFile
+//    Description   : Creates a new file with the specified path and permissions.
+//    Input         : char* name      - Path of the file to create.
+//                    int permission  - Permission settings (1: Read, 2: Write, 3: Read+Write).
+//    Output        : long long      - File descriptor on success, or error code:
+//                                      -1: Invalid parameters
+//                                      -2: No available inodes
+//                                      -3: File already exists
+//                                      -4: Memory allocation failure
+//                                      -5: Descriptor table is full
+//                                      -6: No such directory
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long CreateFile(char *name, int permission)
+{
+    char buffer[PATHLENGTH];
+    char *leaf = NULL;
+    int i = 0, parent = 0;
+    long long fd = 0;
+    long long start = NowNanoseconds();
+    PINODE temp = NULL;
+    PFILETABLE ft = NULL;
+
+    if ((name == NULL) || (permission == 0) || (permission > 3) || (strlen(name) >= PATHLENGTH))
+        return PerfRecord(PERF_CREATE, start, -1, -1, 0, 0, 0);
+
+    ft = (PFILETABLE)SlabAlloc(&FILETABLESLAB);
+    if (ft == NULL)
+        return PerfRecord(PERF_CREATE, start, -4, -1, 0, 0, 0);
+
+    JournalBegin();
+    pthread_rwlock_wrlock(&NAMEINDEXobj.Lock);
+
+    if ((fd = ResolveParent(name, buffer, &parent, &leaf)) != 0)
+        fd = (fd == -1) ? -1 : -6;
+    else if (__atomic_load_n(&SUPERBLOCKobj.FreeInode, __ATOMIC_RELAXED) == 0)
+        fd = -2;
+    else if (NameIndexFind(parent, leaf) != 0)
+        fd = -3;
+    else if (((i = NextFreeInode()) == 0) || ((temp = InodeFromNumber(i)) == NULL))
+        fd = -4;
+
+    if (fd == 0)
+    {
+        ft->count = 1;
+        ft->mode = permission;
+        ft->Append = 0;
+        ft->readoffset = 0;
+        ft->writeoffset = 0;
+        ft->ptrinode = temp;
+        ft->NextRead = 0;
+        ft->ReadaheadEnd = 0;
+        ft->Window = 0;
+
+        pthread_rwlock_wrlock(&temp->Lock);
+        if ((JournalAppend(JR_CREATE, i, parent, permission, leaf, strlen(leaf) + 1) == -1) ||
+            (InitialiseFileInode(temp, parent, leaf, REGULAR, permission) == -1))
+        {
+            JournalAppend(JR_REMOVE, i, 0, 0, NULL, 0);
+            fd = -4;
+        }
+        else if ((fd = AllocateFD(ft)) == -1)
+        {
+            JournalAppend(JR_REMOVE, i, 0, 0, NULL, 0);
+            ReleaseFileInode(temp);
+            fd = -5;
+        }
+        else
+            (temp->ReferenceCount)++;
+        pthread_rwlock_unlock(&temp->Lock);
+    }
+
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+    JournalEnd();
+
+    if (fd < 0)
+        SlabFree(&FILETABLESLAB, ft);
+
+    return PerfRecord(PERF_CREATE, start, fd, fd, (fd < 0) ? 0 : i, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : rm_File
+//    Description   : Removes a file and frees its resources, including any descriptors still open
+//                    on it. The name is dropped from the name index.
+//    Input         : char* name - Path of the file to remove.
+//    Output        : int       - 0 on success, or error code:
+//                                 -1: File not found
+//                                 -2: File is pinned by a FILEVIEW
+//                                 -3: File is a directory
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int rm_File(char *name)
+{
+    int ret = 0, ino = 0;
+    long long fd = 0, start = NowNanoseconds();
+    PINODE temp = NULL;
+
+    JournalBegin();
+    pthread_rwlock_wrlock(&NAMEINDEXobj.Lock);
+
+    temp = Get_Inode(name);
+    if (temp == NULL)
+        ret = -1;
+    else if (INODE_TYPE(temp) == DIRECTORY)
+        ret = -3;
+    else if (__atomic_load_n(&temp->PinCount, __ATOMIC_ACQUIRE) != 0)
+        ret = -2;
+    if (temp != NULL)
+        ino = temp->InodeNumber;
+
+    while ((ret == 0) && (INODE_LINKCOUNT(temp) == 1))
+    {
+        pthread_rwlock_rdlock(&temp->Lock);
+        fd = (temp->OpenList == NULL) ? -1 : temp->OpenList->fd;
+        pthread_rwlock_unlock(&temp->Lock);
+        if (fd == -1)
+            break;
+
+        if (AcquireFileTable(fd) != NULL)
+        {
+            pthread_rwlock_wrlock(&temp->Lock);
+            ReleaseFD(fd);
+            pthread_rwlock_unlock(&temp->Lock);
+            ReleaseFileTable(fd);
+        }
+    }
+
+    if (ret == 0)
+    {
+        pthread_rwlock_wrlock(&temp->Lock);
+        (INODE_LINKCOUNT(temp))--;
+
+        if (INODE_LINKCOUNT(temp) == 0)
+        {
+            JournalAppend(JR_REMOVE, temp->InodeNumber, 0, 0, NULL, 0);
+            ReleaseFileInode(temp);
+        }
+        pthread_rwlock_unlock(&temp->Lock);
+    }
+
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+    JournalEnd();
+    return PerfRecord(PERF_RM, start, ret, -1, ino, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : MakeDirectory
+//    Description   : Creates a new, empty directory.
+//    Input         : char* name  - Path of the directory to create.
+//    Output        : int        - 0 on success, or error code:
+//                                  -1: Invalid parameters
+//                                  -2: No available inodes
+//                                  -3: File already exists
+//                                  -4: Memory allocation failure
+//                                  -5: No such directory
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int MakeDirectory(char *name)
+{
+    char buffer[PATHLENGTH];
+    char *leaf = NULL;
+    int i = 0, ret = 0, parent = 0;
+    PINODE temp = NULL;
+
+    if ((name == NULL) || (strlen(name) >= PATHLENGTH))
+        return -1;
+
+    JournalBegin();
+    pthread_rwlock_wrlock(&NAMEINDEXobj.Lock);
+
+    if ((ret = ResolveParent(name, buffer, &parent, &leaf)) != 0)
+        ret = (ret == -1) ? -1 : -5;
+    else if (__atomic_load_n(&SUPERBLOCKobj.FreeInode, __ATOMIC_RELAXED) == 0)
+        ret = -2;
+    else if (NameIndexFind(parent, leaf) != 0)
+        ret = -3;
+    else if (((i = NextFreeInode()) == 0) || ((temp = InodeFromNumber(i)) == NULL))
+        ret = -4;
+
+    if (ret == 0)
+    {
+        pthread_rwlock_wrlock(&temp->Lock);
+        if ((JournalAppend(JR_MKDIR, i, parent, READ + WRITE, leaf, strlen(leaf) + 1) == -1) ||
+            (InitialiseFileInode(temp, parent, leaf, DIRECTORY, READ + WRITE) == -1))
+        {
+            JournalAppend(JR_REMOVE, i, 0, 0, NULL, 0);
+            ret = -4;
+        }
+        pthread_rwlock_unlock(&temp->Lock);
+    }
+
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+    JournalEnd();
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RemoveDirectory
+//    Description   : Removes an empty directory.
+//    Input         : char* name  - Path of the directory to remove.
+//    Output        : int        - 0 on success, or error code:
+//                                  -1: Directory not found
+//                                  -2: Not a directory
+//                                  -3: Directory is not empty
+//                                  -4: Directory is the root or the current directory
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RemoveDirectory(char *name)
+{
+    int ino = 0, ret = 0;
+    PINODE temp = NULL;
+
+    JournalBegin();
+    pthread_rwlock_wrlock(&NAMEINDEXobj.Lock);
+
+    ino = ResolvePath(name);
+    if (ino < 0)
+        ret = -1;
+    else if ((ino == 0) || (ino == NAMEINDEXobj.Cwd))
+        ret = -4;
+    else if (INODECOLUMNSobj.FileType[ino] != DIRECTORY)
+        ret = -2;
+    else if (INODECOLUMNSobj.FileActualSize[ino] != 0)
+        ret = -3;
+    else if ((temp = InodeFromNumber(ino)) == NULL)
+        ret = -1;
+
+    if (ret == 0)
+    {
+        pthread_rwlock_wrlock(&temp->Lock);
+        JournalAppend(JR_REMOVE, ino, 0, 0, NULL, 0);
+        INODE_LINKCOUNT(temp) = 0;
+        ReleaseFileInode(temp);
+        pthread_rwlock_unlock(&temp->Lock);
+    }
+
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+    JournalEnd();
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ChangeDirectory
+//    Description   : Changes the current directory, against which relative paths resolve.
+//    Input         : char* name  - Path of the new current directory.
+//    Output        : int        - 0 on success, or error code:
+//                                  -1: Directory not found
+//                                  -2: Not a directory
+//                                  -3: Path of the directory is too long
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ChangeDirectory(char *name)
+{
+    char path[PATHLENGTH];
+    int ino = 0, ret = 0;
+
+    pthread_rwlock_wrlock(&NAMEINDEXobj.Lock);
+
+    ino = ResolvePath(name);
+    if (ino < 0)
+        ret = -1;
+    else if ((ino != 0) && (INODECOLUMNSobj.FileType[ino] != DIRECTORY))
+        ret = -2;
+    else if (InodePath(ino, path) == -1)
+        ret = -3;
+    else
+    {
+        NAMEINDEXobj.Cwd = ino;
+        strcpy(NAMEINDEXobj.CwdPath, path);
+    }
+
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : pwd
+//    Description   : Displays the absolute path of the current directory.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void pwd()
+{
+    pthread_rwlock_rdlock(&NAMEINDEXobj.Lock);
+    printf("%s\n", (NAMEINDEXobj.CwdPath[0] == '\0') ? "/" : NAMEINDEXobj.CwdPath);
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AddInode
+//    Description   : Creates an empty file or directory without opening it. Called with
+//                    NAMEINDEX::Lock held exclusively, after the name has been checked.
+//    Input         : int parent      - Directory to hold the entry.
+//                    char* name      - Name of the entry.
+//                    int type        - REGULAR or DIRECTORY.
+//                    int permission  - Permission settings (1: Read, 2: Write, 3: Read+Write).
+//    Output        : PINODE         - New inode, or NULL if there is no free inode or memory.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PINODE AddInode(int parent, char *name, int type, int permission)
+{
+    int i = 0, ret = 0;
+    PINODE temp = NULL;
+
+    if (((i = NextFreeInode()) == 0) || ((temp = InodeFromNumber(i)) == NULL))
+        return NULL;
+
+    pthread_rwlock_wrlock(&temp->Lock);
+    ret = InitialiseFileInode(temp, parent, name, type, permission);
+    pthread_rwlock_unlock(&temp->Lock);
+
+    return (ret == 0) ? temp : NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CloneFile
+//    Description   : Creates a copy of a file that shares all of its data blocks, so it takes
+//                    the same time whatever the file size. The copy gets the permissions of
+//                    the original. Not available with a mounted image.
+//    Input         : char* src  - Path of the file to copy.
+//                    char* dst  - Path of the new file.
+//    Output        : int       - 0 on success, or error code:
+//                                 -1: Invalid parameters
+//                                 -2: Source file not found
+//                                 -3: Source is a directory
+//                                 -4: No available inodes
+//                                 -5: Destination already exists
+//                                 -6: No such directory
+//                                 -7: Memory allocation failure
+//                                 -8: A mounted image is in use
+//                                 -9: Source is memory mapped
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int CloneFile(char *src, char *dst)
+{
+    char buffer[PATHLENGTH];
+    char *leaf = NULL;
+    int ret = 0, parent = 0;
+    PINODE from = NULL, temp = NULL;
+
+    if ((src == NULL) || (dst == NULL) || (strlen(dst) >= PATHLENGTH))
+        return -1;
+    if (IMAGEobj.Base != NULL)
+        return -8;
+
+    pthread_rwlock_wrlock(&NAMEINDEXobj.Lock);
+
+    from = Get_Inode(src);
+    if (from == NULL)
+        ret = -2;
+    else if (INODE_TYPE(from) == DIRECTORY)
+        ret = -3;
+    else if ((ret = ResolveParent(dst, buffer, &parent, &leaf)) != 0)
+        ret = (ret == -1) ? -1 : -6;
+    else if (__atomic_load_n(&SUPERBLOCKobj.FreeInode, __ATOMIC_RELAXED) == 0)
+        ret = -4;
+    else if (NameIndexFind(parent, leaf) != 0)
+        ret = -5;
+    else if ((temp = AddInode(parent, leaf, REGULAR, INODE_PERMISSION(from))) == NULL)
+        ret = -7;
+
+    if (ret == 0)
+    {
+        pthread_rwlock_wrlock(&from->Lock);
+        pthread_rwlock_wrlock(&temp->Lock);
+        if (__atomic_load_n(&from->MapCount, __ATOMIC_ACQUIRE) != 0)
+            ret = -9;
+        else if (ShareFileBlocks(from, temp) == -1)
+            ret = -7;
+        if (ret != 0)
+            ReleaseFileInode(temp);
+        pthread_rwlock_unlock(&temp->Lock);
+        pthread_rwlock_unlock(&from->Lock);
+    }
+
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InSnapshot
+//    Description   : Tells whether an inode is the snapshot directory or lies below it.
+//                    Called with NAMEINDEX::Lock held.
+//    Input         : int ino   - Inode number.
+//                    int root  - Inode number of SNAPSHOTROOT, 0 if it does not exist.
+//    Output        : int      - 1 if the inode belongs to the snapshots, else 0.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int InSnapshot(int ino, int root)
+{
+    if (root == 0)
+        return 0;
+
+    while (ino != 0)
+    {
+        if (ino == root)
+            return 1;
+        ino = INODECOLUMNSobj.Parent[ino];
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TakeSnapshot
+//    Description   : Captures the whole file system as /SNAPSHOTROOT/name: every directory is
+//                    recreated and every file cloned, sharing its blocks. The namespace and
+//                    every file are locked exclusively while the copy is made, so it shows one
+//                    point in time with no append half done. Earlier snapshots are not included.
+//    Input         : char* name  - Name of the snapshot.
+//    Output        : int        - 0 on success, or error code:
+//                                  -1: Invalid name
+//                                  -2: Not enough free inodes
+//                                  -3: Snapshot already exists
+//                                  -4: Memory allocation failure
+//                                  -5: A mounted image is in use
+//                                  -6: A file is memory mapped
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int TakeSnapshot(char *name)
+{
+    int ino = 0, root = 0, count = 0, made = 0, progress = 1, ret = 0, limit = 0;
+    int *map = NULL;
+    PINODE temp = NULL, copy = NULL;
+    PINODE *order = NULL;
+
+    if ((name == NULL) || (name[0] == '\0') || (strchr(name, '/') != NULL) || (strlen(name) >= NAMELENGTH) ||
+        (strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+        return -1;
+    if (IMAGEobj.Base != NULL)
+        return -5;
+
+    pthread_rwlock_wrlock(&NAMEINDEXobj.Lock);
+
+    root = NameIndexFind(0, (char *)SNAPSHOTROOT);
+    limit = SUPERBLOCKobj.NextInode;
+    for (ino = 1; ino < limit; ino++)
+        if ((INODECOLUMNSobj.FileType[ino] != 0) && (InSnapshot(ino, root) == 0))
+            count++;
+
+    map = (int *)calloc(limit, sizeof(int));
+    order = (PINODE *)malloc((count + 1) * sizeof(PINODE));
+    if ((map == NULL) || (order == NULL))
+        ret = -4;
+    else if (__atomic_load_n(&SUPERBLOCKobj.FreeInode, __ATOMIC_RELAXED) < count + 1 + (root == 0))
+        ret = -2;
+    else if ((root != 0) && (NameIndexFind(root, name) != 0))
+        ret = -3;
+
+    if ((ret == 0) && (root == 0))
+    {
+        temp = AddInode(0, (char *)SNAPSHOTROOT, DIRECTORY, READ + WRITE);
+        if (temp == NULL)
+            ret = -4;
+        else
+            root = temp->InodeNumber;
+    }
+    if ((ret == 0) && ((temp = AddInode(root, name, DIRECTORY, READ + WRITE)) == NULL))
+        ret = -4;
+
+    if (ret != 0)
+    {
+        pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+        free(map);
+        free(order);
+        return ret;
+    }
+    map[0] = temp->InodeNumber;
+    order[made++] = temp;
+
+    for (ino = 1; ino < limit; ino++)
+        if ((INODECOLUMNSobj.FileType[ino] == REGULAR) && (InSnapshot(ino, root) == 0))
+            pthread_rwlock_wrlock(&INODECOLUMNSobj.Inode[ino]->Lock);
+
+    // A mapped file's blocks must stay private to it
+    for (ino = 1; ino < limit; ino++)
+        if ((INODECOLUMNSobj.FileType[ino] == REGULAR) && (InSnapshot(ino, root) == 0) &&
+            (__atomic_load_n(&INODECOLUMNSobj.Inode[ino]->MapCount, __ATOMIC_ACQUIRE) != 0))
+            ret = -6;
+
+    while ((ret == 0) && (progress != 0))
+    {
+        progress = 0;
+        for (ino = 1; (ret == 0) && (ino < limit); ino++)
+        {
+            if ((INODECOLUMNSobj.FileType[ino] == 0) || (map[ino] != 0) || (InSnapshot(ino, root) != 0) ||
+                (map[INODECOLUMNSobj.Parent[ino]] == 0))
+                continue;
+
+            temp = INODECOLUMNSobj.Inode[ino];
+            copy = AddInode(map[INODECOLUMNSobj.Parent[ino]], temp->FileName, INODE_TYPE(temp), INODE_PERMISSION(temp));
+            if (copy == NULL)
+            {
+                ret = -4;
+                break;
+            }
+            map[ino] = copy->InodeNumber;
+            order[made++] = copy;
+            progress = 1;
+
+            if (INODE_TYPE(temp) == REGULAR)
+            {
+                pthread_rwlock_wrlock(&copy->Lock);
+                if (ShareFileBlocks(temp, copy) == -1)
+                    ret = -4;
+                pthread_rwlock_unlock(&copy->Lock);
+            }
+        }
+    }
+
+    for (ino = 1; ino < limit; ino++)
+        if ((INODECOLUMNSobj.FileType[ino] == REGULAR) && (InSnapshot(ino, root) == 0))
+            pthread_rwlock_unlock(&INODECOLUMNSobj.Inode[ino]->Lock);
+
+    while ((ret != 0) && (made > 0))
+    {
+        copy = order[--made];
+        pthread_rwlock_wrlock(&copy->Lock);
+        ReleaseFileInode(copy);
+        pthread_rwlock_unlock(&copy->Lock);
+    }
+
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+    free(map);
+    free(order);
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CheckReadAccess
+//    Description   : Checks that a file table entry may be read at an offset.
+//    Input         : PFILETABLE ft     - File table entry, or NULL if the descriptor is not open.
+//                    long long offset  - Offset the read starts at.
+//    Output        : int              - 0 if the read may proceed, or the ReadFile error code.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int CheckReadAccess(PFILETABLE ft, long long offset)
+{
+    if (ft == NULL)
+        return -1;
+
+    if (ft->mode != READ && ft->mode != READ + WRITE)
+        return -2;
+
+    if (INODE_PERMISSION(ft->ptrinode) != READ && INODE_PERMISSION(ft->ptrinode) != READ + WRITE)
+        return -2;
+
+    if (offset >= INODE_COMMITTED(ft->ptrinode))
+        return -3;
+
+    if (INODE_TYPE(ft->ptrinode) != REGULAR)
+        return -4;
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReadAhead
+//    Description   : Detects sequential reading on an open file and prefetches its evicted
+//                    blocks ahead of the reader. The window starts at twice the read size (at
+//                    least READAHEADMIN blocks) and doubles each time the reader gets within
+//                    half a window of the prefetched range, up to READAHEADMAX blocks or a
+//                    quarter of the budget; any other read resets it. Only active under a
+//                    memory budget. Called with the inode lock held, after the read.
+//    Input         : PFILETABLE ft    - Open file, readoffset already advanced past the read.
+//                    long long start  - Offset the read started at.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ReadAhead(PFILETABLE ft, long long start)
+{
+    long long end = ft->readoffset, from = 0, limit = 0, blockno = 0, size = 0;
+    long long most = (TIERobj.Frames / 4 < READAHEADMAX) ? TIERobj.Frames / 4 : READAHEADMAX;
+    PBLOCK block = NULL;
+
+    if (TIERobj.Frames == 0)
+        return;
+
+    if (start != ft->NextRead)
+    {
+        ft->NextRead = end;
+        ft->ReadaheadEnd = end;
+        ft->Window = 0;
+        return;
+    }
+
+    ft->NextRead = end;
+    if (ft->Window == 0)
+        ft->Window = (int)((end - start + BLOCKSIZE - 1) / BLOCKSIZE * 2);
+    if (ft->Window < READAHEADMIN)
+        ft->Window = READAHEADMIN;
+    if (ft->Window > most)
+        ft->Window = (int)most;
+    if (end + (long long)ft->Window * BLOCKSIZE / 2 < ft->ReadaheadEnd)
+        return;
+
+    from = (ft->ReadaheadEnd > end) ? ft->ReadaheadEnd : end;
+    limit = end + (long long)ft->Window * BLOCKSIZE;
+    size = INODE_COMMITTED(ft->ptrinode);
+    if (limit > size)
+        limit = size;
+
+    for (blockno = from / BLOCKSIZE; blockno * BLOCKSIZE < limit; blockno++)
+    {
+        block = GetFileBlock(ft->ptrinode, blockno, 0);
+        if (block != NULL)
+            PrefetchBlock(block);
+    }
+
+    ft->ReadaheadEnd = limit;
+    if (ft->Window * 2 <= most)
+        ft->Window = ft->Window * 2;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : IovecLength
+//    Description   : Adds up the lengths of an iovec array.
+//    Input         : const struct iovec* iov - Buffers.
+//                    int iovcnt              - Number of buffers (at most IOVMAX).
+//    Output        : int                    - Total length, or -1 if the array is invalid or
+//                                              the total does not fit in an int.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int IovecLength(const struct iovec *iov, int iovcnt)
+{
+    long long total = 0;
+    int i = 0;
+
+    if ((iov == NULL) || (iovcnt < 0) || (iovcnt > IOVMAX))
+        return -1;
+
+    for (i = 0; i < iovcnt; i++)
+    {
+        if ((iov[i].iov_base == NULL) && (iov[i].iov_len != 0))
+            return -1;
+        total = total + (long long)iov[i].iov_len;
+        if (total > 0x7FFFFFFF)
+            return -1;
+    }
+    return (int)total;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReadInodeData
+//    Description   : Copies data out of a file into a list of buffers, filling each buffer
+//                    before moving to the next. Ranges that were never written read as zeros.
+//                    The caller holds the inode lock.
+//    Input         : PINODE inode            - Inode of the file.
+//                    long long offset        - Byte offset to read at.
+//                    const struct iovec* iov - Buffers to fill.
+//                    int size                - Number of bytes to read (at most the total
+//                                              length of iov, and within the file).
+//    Output        : int                    - Number of bytes read (less than size only when
+//                                              evicted data could not be read back).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ReadInodeData(PINODE inode, long long offset, const struct iovec *iov, int size)
+{
+    int done = 0, chunk = 0, inblock = 0;
+    size_t used = 0;
+    PBLOCK block = NULL;
+    char *data = NULL, *to = NULL;
+
+    while (done < size)
+    {
+        while (used == iov->iov_len)
+        {
+            iov++;
+            used = 0;
+        }
+
+        inblock = (int)(offset % BLOCKSIZE);
+        chunk = BLOCKSIZE - inblock;
+        if (chunk > size - done)
+            chunk = size - done;
+        if ((size_t)chunk > iov->iov_len - used)
+            chunk = (int)(iov->iov_len - used);
+        to = (char *)iov->iov_base + used;
+
+        block = GetFileBlock(inode, offset / BLOCKSIZE, 0);
+        if (block == NULL)
+            memset(to, 0, chunk);
+        else if ((data = PinBlock(block, 0)) == NULL)
+            break;
+        else
+        {
+            memcpy(to, data + inblock, chunk);
+            UnpinBlock(block);
+        }
+
+        done = done + chunk;
+        used = used + chunk;
+        offset = offset + chunk;
+    }
+    return done;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReadvFile
+//    Description   : Scatter read: reads data from a file into a list of buffers in one call.
+//                    With an offset of -1 the read starts at, and advances, the descriptor's
+//                    read offset. With any other offset the descriptor offset is left alone
+//                    and its stripe is released as soon as the inode is locked, so positional
+//                    readers of one descriptor run in parallel.
+//    Input         : long long fd            - File descriptor of the file.
+//                    const struct iovec* iov - Buffers to fill, in order.
+//                    int iovcnt              - Number of buffers (at most IOVMAX).
+//                    long long offset        - Offset to read at, or -1 for the read offset.
+//    Output        : int                    - Number of bytes read on success (may be less
+//                                              than requested at the end of the file), or
+//                                              the ReadFile error codes; -1 also for an
+//                                              invalid iovec array or offset.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ReadvFile(long long fd, const struct iovec *iov, int iovcnt, long long offset)
+{
+    int read_size = 0, done = 0, ino = 0, total = IovecLength(iov, iovcnt);
+    long long start = 0, size = 0, entry = NowNanoseconds();
+    PINODE inode = NULL;
+    PFILETABLE ft = NULL;
+
+    if ((total == -1) || (offset < -1))
+        return PerfRecord(PERF_READ, entry, -1, fd, 0, offset, 0);
+
+    ft = AcquireFileTable(fd);
+    if (ft == NULL)
+        return PerfRecord(PERF_READ, entry, -1, fd, 0, offset, total);
+
+    inode = ft->ptrinode;
+    ino = inode->InodeNumber;
+    pthread_rwlock_rdlock(&inode->Lock);
+    start = (offset == -1) ? ft->readoffset : offset;
+    read_size = CheckReadAccess(ft, start);
+    if (offset != -1)
+    {
+        ReleaseFileTable(fd);
+        ft = NULL;
+    }
+
+    if (read_size == 0)
+    {
+        read_size = total;
+        size = INODE_COMMITTED(inode);
+        if (size - start < read_size)
+            read_size = (int)(size - start);
+
+        done = ReadInodeData(inode, start, iov, read_size);
+        if (done < read_size)
+            read_size = (done == 0) ? -5 : done;
+        if (ft != NULL)
+        {
+            ft->readoffset = start + done;
+            ReadAhead(ft, start);
+        }
+    }
+    pthread_rwlock_unlock(&inode->Lock);
+    if (ft != NULL)
+        ReleaseFileTable(fd);
+
+    return PerfRecord(PERF_READ, entry, read_size, fd, ino, start, total);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReadFile
+//    Description   : Reads data from a file into a buffer at the descriptor's read offset,
+//                    block by block. Ranges that were never written read back as zeros.
+//    Input         : long long fd - File descriptor of the file.
+//                    char* arr    - Buffer to store the read data.
+//                    int isize    - Number of bytes to read.
+//    Output        : int         - Number of bytes read on success (may be less than isize at
+//                                   the end of the file), or error code:
+//                                   -1: File not open
+//                                   -2: Permission denied
+//                                   -3: End of file reached
+//                                   -4: Not a regular file
+//                                   -5: Evicted data could not be read back
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ReadFile(long long fd, char *arr, int isize)
+{
+    struct iovec iov;
+
+    iov.iov_base = arr;
+    iov.iov_len = (isize < 0) ? 0 : isize;
+    return ReadvFile(fd, &iov, 1, -1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PreadFile
+//    Description   : Reads data from a file at a given offset without using or moving the
+//                    descriptor's read offset.
+//    Input         : long long fd      - File descriptor of the file.
+//                    char* arr         - Buffer to store the read data.
+//                    int isize         - Number of bytes to read.
+//                    long long offset  - Offset to read at.
+//    Output        : int              - Number of bytes read, or the ReadFile error codes (-1
+//                                        also for a negative offset).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PreadFile(long long fd, char *arr, int isize, long long offset)
+{
+    struct iovec iov;
+
+    iov.iov_base = arr;
+    iov.iov_len = (isize < 0) ? 0 : isize;
+    return ReadvFile(fd, &iov, 1, (offset < 0) ? -2 : offset);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReadFileView
+//    Description   : Zero copy read. Instead of copying, fills a FILEVIEW with read-only segments
+//                    that point into the file's blocks and advances the read offset past them.
+//                    At most FILEVIEWSEGMENTS blocks are mapped per call, so callers loop until
+//                    they have consumed isize bytes. The inode stays pinned, and cannot be
+//                    truncated or removed, until ReleaseFileView is called.
+//    Input         : long long fd    - File descriptor of the file.
+//                    int isize       - Number of bytes wanted.
+//                    PFILEVIEW view  - Receives the borrowed segments.
+//    Output        : int            - Number of bytes mapped on success, or the same error codes
+//                                      as ReadFile; -1 also for a byte count that is not
+//                                      positive. The inode is pinned only if a segment was
+//                                      mapped.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ReadFileView(long long fd, int isize, PFILEVIEW view)
+{
+    int read_size = 0, chunk = 0, inblock = 0, failed = 0, ino = 0;
+    long long start = 0, size = 0, entry = NowNanoseconds();
+    PBLOCK block = NULL;
+    char *data = NULL;
+    PFILETABLE ft = AcquireFileTable(fd);
+
+    view->Count = 0;
+    view->Length = 0;
+    view->ptrinode = NULL;
+
+    if (isize <= 0)
+    {
+        if (ft != NULL)
+            ReleaseFileTable(fd);
+        return PerfRecord(PERF_READ, entry, -1, fd, 0, 0, isize);
+    }
+    if (ft == NULL)
+        return PerfRecord(PERF_READ, entry, -1, fd, 0, 0, isize);
+
+    ino = ft->ptrinode->InodeNumber;
+    pthread_rwlock_rdlock(&ft->ptrinode->Lock);
+    read_size = CheckReadAccess(ft, ft->readoffset);
+    if (read_size == 0)
+    {
+        read_size = isize;
+        size = INODE_COMMITTED(ft->ptrinode);
+        if (size - (ft->readoffset) < read_size)
+            read_size = (int)(size - (ft->readoffset));
+
+        start = ft->readoffset;
+        while ((view->Length < read_size) && (view->Count < FILEVIEWSEGMENTS))
+        {
+            inblock = (int)(ft->readoffset % BLOCKSIZE);
+            chunk = BLOCKSIZE - inblock;
+            if (chunk > read_size - view->Length)
+                chunk = read_size - view->Length;
+
+            block = GetFileBlock(ft->ptrinode, ft->readoffset / BLOCKSIZE, 0);
+            if ((block != NULL) && ((data = PinBlock(block, 0)) == NULL))
+            {
+                failed = 1;
+                break;
+            }
+            view->Segments[view->Count].iov_base = (block == NULL) ? (void *)ZeroBlock : (void *)(data + inblock);
+            view->Segments[view->Count].iov_len = chunk;
+            view->Blocks[view->Count] = block;
+            (view->Count)++;
+
+            view->Length = view->Length + chunk;
+            ft->readoffset = ft->readoffset + chunk;
+        }
+
+        if (failed && (view->Count == 0))
+            read_size = -5;
+        else
+        {
+            if (view->Count > 0)
+            {
+                view->ptrinode = ft->ptrinode;
+                __atomic_fetch_add(&ft->ptrinode->PinCount, 1, __ATOMIC_ACQ_REL);
+            }
+            read_size = view->Length;
+        }
+        ReadAhead(ft, start);
+    }
+    pthread_rwlock_unlock(&ft->ptrinode->Lock);
+    ReleaseFileTable(fd);
+
+    return PerfRecord(PERF_READ, entry, read_size, fd, ino, start, isize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReleaseFileView
+//    Description   : Returns a view obtained from ReadFileView and unpins its inode and blocks.
+//                    The view's segments must not be used afterwards.
+//    Input         : PFILEVIEW view - View to release.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ReleaseFileView(PFILEVIEW view)
+{
+    int i = 0;
+
+    if (view->ptrinode == NULL)
+        return;
+
+    for (i = 0; i < view->Count; i++)
+        if (view->Blocks[i] != NULL)
+            UnpinBlock(view->Blocks[i]);
+
+    __atomic_fetch_sub(&view->ptrinode->PinCount, 1, __ATOMIC_ACQ_REL);
+    view->ptrinode = NULL;
+    view->Count = 0;
+    view->Length = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : MapFault
+//    Description   : SIGSEGV handler of writable mappings. A store to a read-only page of a
+//                    mapping marks the page dirty and makes it writable, so the store is
+//                    retried and succeeds. Other faults go to the handler that was installed
+//                    before; a default action is restored and the fault retried so that it
+//                    takes effect.
+//    Input         : int sig           - Signal number.
+//                    siginfo_t* info   - Fault address.
+//                    void* context     - Interrupted context.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void MapFault(int sig, siginfo_t *info, void *context)
+{
+    char *addr = (char *)info->si_addr;
+    long long page = 0;
+    int i = 0;
+    PFILEMAP map = NULL;
+
+    __atomic_fetch_add(&MAPTABLEobj.Active, 1, __ATOMIC_SEQ_CST);
+    for (i = 0; i < MAXFILEMAPS; i++)
+    {
+        map = __atomic_load_n(&MAPTABLEobj.Maps[i], __ATOMIC_SEQ_CST);
+        if ((map == NULL) || (addr < map->Address) || (addr >= map->Address + map->Pages * BLOCKSIZE))
+            continue;
+
+        // Open the page before marking it, so a sync in between leaves it either read-only
+        // or marked, never writable and clean
+        page = (addr - map->Address) / BLOCKSIZE;
+        mprotect(map->Address + page * BLOCKSIZE, BLOCKSIZE, PROT_READ | PROT_WRITE);
+        __atomic_fetch_or(&map->Dirty[page / 64], 1ULL << (page % 64), __ATOMIC_SEQ_CST);
+        __atomic_fetch_sub(&MAPTABLEobj.Active, 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+    __atomic_fetch_sub(&MAPTABLEobj.Active, 1, __ATOMIC_SEQ_CST);
+
+    if (MAPTABLEobj.Previous.sa_flags & SA_SIGINFO)
+        MAPTABLEobj.Previous.sa_sigaction(sig, info, context);
+    else if ((MAPTABLEobj.Previous.sa_handler == SIG_DFL) || (MAPTABLEobj.Previous.sa_handler == SIG_IGN))
+        sigaction(SIGSEGV, &MAPTABLEobj.Previous, NULL);
+    else
+        MAPTABLEobj.Previous.sa_handler(sig);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RegisterFileMap
+//    Description   : Enters a writable mapping in MAPTABLE, installing MapFault on first use.
+//    Input         : PFILEMAP map - Writable mapping.
+//    Output        : int         - 0 on success, or -1 if every slot is taken or the handler
+//                                  could not be installed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RegisterFileMap(PFILEMAP map)
+{
+    struct sigaction sa;
+    int i = 0;
+
+    pthread_mutex_lock(&MAPTABLEobj.Lock);
+    if (MAPTABLEobj.Installed == 0)
+    {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = MapFault;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGSEGV, &sa, &MAPTABLEobj.Previous) == -1)
+        {
+            pthread_mutex_unlock(&MAPTABLEobj.Lock);
+            return -1;
+        }
+        MAPTABLEobj.Installed = 1;
+    }
+
+    for (i = 0; i < MAXFILEMAPS; i++)
+        if (MAPTABLEobj.Maps[i] == NULL)
+            break;
+    if (i < MAXFILEMAPS)
+    {
+        map->Slot = i;
+        __atomic_store_n(&MAPTABLEobj.Maps[i], map, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&MAPTABLEobj.Lock);
+
+    return (i < MAXFILEMAPS) ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : UnregisterFileMap
+//    Description   : Removes a writable mapping from MAPTABLE, then waits until no MapFault
+//                    call that may still hold a pointer to it is running, so that the mapping
+//                    can be freed.
+//    Input         : PFILEMAP map - Registered mapping.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void UnregisterFileMap(PFILEMAP map)
+{
+    if (map->Slot == -1)
+        return;
+
+    pthread_mutex_lock(&MAPTABLEobj.Lock);
+    __atomic_store_n(&MAPTABLEobj.Maps[map->Slot], (PFILEMAP)NULL, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&MAPTABLEobj.Lock);
+    map->Slot = -1;
+
+    while (__atomic_load_n(&MAPTABLEobj.Active, __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : BlockBacking
+//    Description   : Finds the file and offset holding a resident block's data, so that the
+//                    block can be mapped: the image, the tier arena or the block pool.
+//    Input         : PBLOCK block    - Pinned block.
+//                    off_t* offset   - Receives the offset of the data in the file.
+//    Output        : int            - File descriptor, or -1 if the data is not in a mappable
+//                                      file.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int BlockBacking(PBLOCK block, off_t *offset)
+{
+    if (block->BlockNo != 0)
+    {
+        *offset = block->Data - IMAGEobj.Base;
+        return IMAGEobj.fd;
+    }
+    if ((TIERobj.Frames != 0) && (block->Data >= TIERobj.Arena) &&
+        (block->Data < TIERobj.Arena + TIERobj.Frames * BLOCKSIZE))
+    {
+        *offset = block->Data - TIERobj.Arena;
+        return TIERobj.ArenaFd;
+    }
+    if ((BLOCKPOOLobj.Base != NULL) && (block->Data >= BLOCKPOOLobj.Base) &&
+        (block->Data < BLOCKPOOLobj.Base + BLOCKPOOLobj.TotalBlocks * BLOCKSIZE))
+    {
+        *offset = block->Data - BLOCKPOOLobj.Base;
+        return BLOCKPOOLobj.fd;
+    }
+    return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ReleaseFileMap
+//    Description   : Unpins the blocks and inode of a mapping and frees its arrays. The address
+//                    range must already be unmapped.
+//    Input         : PFILEMAP map - Mapping to release.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ReleaseFileMap(PFILEMAP map)
+{
+    long long i = 0;
+
+    for (i = 0; i < map->Pages; i++)
+        if (map->Blocks[i] != NULL)
+            UnpinBlock(map->Blocks[i]);
+
+    __atomic_fetch_sub(&map->ptrinode->MapCount, 1, __ATOMIC_ACQ_REL);
+    __atomic_fetch_sub(&map->ptrinode->PinCount, 1, __ATOMIC_ACQ_REL);
+    free(map->Blocks);
+    free(map->Dirty);
+    map->Blocks = NULL;
+    map->Dirty = NULL;
+    map->ptrinode = NULL;
+    map->Address = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : MapFile
+//    Description   : Maps a range of a file into memory, like mmap. The file's blocks are made
+//                    resident and pinned, and mapped at consecutive addresses straight from
+//                    the storage holding them, so loads and stores reach the file data without
+//                    copying. A writable mapping allocates the holes of the range and takes its
+//                    blocks private first; stores through it are tracked per page and handed
+//                    to the journal by SyncFileMap. Holes of a read-only mapping read as zeros
+//                    and keep doing so if the file is later written there. While mapped, the
+//                    file cannot be truncated, removed, cloned or snapshotted. The mapping
+//                    stays valid after the descriptor is closed, until UnmapFile.
+//    Input         : long long fd      - File descriptor of the file.
+//                    long long offset  - Start of the range, a multiple of BLOCKSIZE.
+//                    long long length  - Bytes to map; the range must lie inside the file.
+//                    int protection    - READ, or READ+WRITE.
+//                    PFILEMAP map      - Receives the mapping.
+//    Output        : int              - 0 on success, or error code:
+//                                        -1: Invalid parameters or descriptor not open
+//                                        -2: Permission denied
+//                                        -3: Range goes past the end of the file
+//                                        -4: Not a regular file
+//                                        -5: Memory allocation or mapping failure
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int MapFile(long long fd, long long offset, long long length, int protection, PFILEMAP map)
+{
+    long long i = 0, run = 0;
+    int ret = 0, backing = -1, fresh = 0;
+    off_t at = 0, next = 0;
+    PBLOCK block = NULL;
+    PINODE inode = NULL;
+    PFILETABLE ft = NULL;
+    char *data = NULL;
+
+    memset(map, 0, sizeof(FILEMAP));
+    map->Slot = -1;
+    if ((offset < 0) || (offset % BLOCKSIZE != 0) || (length <= 0) || (length > MAXFILESIZE) ||
+        ((protection != READ) && (protection != READ + WRITE)) || (sysconf(_SC_PAGESIZE) != BLOCKSIZE))
+        return -1;
+
+    ft = AcquireFileTable(fd);
+    if (ft == NULL)
+        return -1;
+    inode = ft->ptrinode;
+    pthread_rwlock_wrlock(&inode->Lock);
+
+    if (((ft->mode & protection) != protection) || ((INODE_PERMISSION(inode) & protection) != protection))
+        ret = -2;
+    else if (INODE_TYPE(inode) != REGULAR)
+        ret = -4;
+    else if (offset + length > INODE_SIZE(inode))
+        ret = -3;
+    ReleaseFileTable(fd);
+
+    if (ret == 0)
+    {
+        map->Offset = offset;
+        map->Length = length;
+        map->Pages = (length + BLOCKSIZE - 1) / BLOCKSIZE;
+        map->Protection = protection;
+        map->ptrinode = inode;
+        map->Blocks = (PBLOCK *)calloc(map->Pages, sizeof(PBLOCK));
+        map->Dirty = (unsigned long long *)calloc((map->Pages + 63) / 64, sizeof(unsigned long long));
+        map->Address = (char *)mmap(NULL, map->Pages * BLOCKSIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ((map->Blocks == NULL) || (map->Dirty == NULL) || (map->Address == MAP_FAILED))
+        {
+            if (map->Address != MAP_FAILED)
+                munmap(map->Address, map->Pages * BLOCKSIZE);
+            free(map->Blocks);
+            free(map->Dirty);
+            pthread_rwlock_unlock(&inode->Lock);
+            return -5;
+        }
+    }
+    else
+    {
+        pthread_rwlock_unlock(&inode->Lock);
+        return ret;
+    }
+
+    __atomic_fetch_add(&inode->PinCount, 1, __ATOMIC_ACQ_REL);
+    __atomic_fetch_add(&inode->MapCount, 1, __ATOMIC_ACQ_REL);
+
+    for (i = 0; (ret == 0) && (i < map->Pages); i++)
+    {
+        fresh = (GetFileBlock(inode, offset / BLOCKSIZE + i, 0) == NULL);
+        if (fresh && (protection == READ))
+            continue;
+
+        block = GetFileBlock(inode, offset / BLOCKSIZE + i, 1);
+        if (block != NULL)
+            block = UnshareBlock(inode, offset / BLOCKSIZE + i);
+        if ((block == NULL) || ((data = PinBlock(block, 1)) == NULL))
+        {
+            ret = -5;
+            break;
+        }
+        if (fresh)
+            memset(data, 0, BLOCKSIZE);
+        map->Blocks[i] = block;
+    }
+
+    // Map runs of blocks that lie next to each other in the same file with one call. Writable
+    // mappings start read-only too, so that the first store to each page is seen
+    for (i = 0; (ret == 0) && (i < map->Pages); i = i + run)
+    {
+        run = 1;
+        if (map->Blocks[i] == NULL)
+        {
+            if (mprotect(map->Address + i * BLOCKSIZE, BLOCKSIZE, PROT_READ) == -1)
+                ret = -5;
+            continue;
+        }
+
+        backing = BlockBacking(map->Blocks[i], &at);
+        while ((i + run < map->Pages) && (map->Blocks[i + run] != NULL) &&
+               (BlockBacking(map->Blocks[i + run], &next) == backing) && (next == at + run * BLOCKSIZE))
+            run++;
+        if ((backing == -1) ||
+            (mmap(map->Address + i * BLOCKSIZE, run * BLOCKSIZE, PROT_READ, MAP_SHARED | MAP_FIXED, backing, at) == MAP_FAILED))
+            ret = -5;
+    }
+
+    if ((ret == 0) && (protection == READ + WRITE) && (RegisterFileMap(map) == -1))
+        ret = -5;
+    pthread_rwlock_unlock(&inode->Lock);
+
+    if (ret != 0)
+    {
+        munmap(map->Address, map->Pages * BLOCKSIZE);
+        ReleaseFileMap(map);
+    }
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : SyncFileMap
+//    Description   : Hands the pages written through a mapping since the last sync to the
+//                    journal, so only changed pages are persisted or replicated. Each page is
+//                    made read-only again before it is copied. Other threads may keep storing
+//                    through the mapping meanwhile: a store that lands before the page is
+//                    protected is in the copy, and a later one faults and marks the page dirty
+//                    for the next sync. The data itself is already in the file;
+//                    with an image it reaches the disk with the image's own write back.
+//    Input         : PFILEMAP map - Mapping created by MapFile.
+//    Output        : int         - Number of dirty pages flushed, or -1 on failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int SyncFileMap(PFILEMAP map)
+{
+    unsigned long long bits = 0;
+    long long word = 0, page = 0, size = 0, at = 0;
+    int count = 0, length = 0;
+
+    if (map->ptrinode == NULL)
+        return -1;
+    if (map->Protection != READ + WRITE)
+        return 0;
+
+    JournalBegin();
+    pthread_rwlock_rdlock(&map->ptrinode->Lock);
+    size = INODE_COMMITTED(map->ptrinode);
+
+    for (word = 0; (count != -1) && (word < (map->Pages + 63) / 64); word++)
+    {
+        bits = __atomic_exchange_n(&map->Dirty[word], 0ULL, __ATOMIC_SEQ_CST);
+        for (page = word * 64; (count != -1) && (bits != 0); page++, bits = bits >> 1)
+        {
+            if ((bits & 1) == 0)
+                continue;
+
+            mprotect(map->Address + page * BLOCKSIZE, BLOCKSIZE, PROT_READ);
+            at = map->Offset + page * BLOCKSIZE;
+            length = (int)(((size - at) < BLOCKSIZE) ? (size - at) : BLOCKSIZE);
+            if ((length > 0) &&
+                (JournalAppend(JR_WRITE, map->ptrinode->InodeNumber, 0, at, map->Address + page * BLOCKSIZE, length) == -1))
+                count = -1;
+            else
+                count++;
+        }
+    }
+
+    pthread_rwlock_unlock(&map->ptrinode->Lock);
+    JournalEnd();
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : UnmapFile
+//    Description   : Syncs a writable mapping, then removes the mapping and unpins the file.
+//                    The mapped addresses must not be used afterwards.
+//    Input         : PFILEMAP map - Mapping created by MapFile.
+//    Output        : int         - Number of dirty pages flushed, or -1 on failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int UnmapFile(PFILEMAP map)
+{
+    int ret = 0;
+
+    if (map->ptrinode == NULL)
+        return -1;
+
+    ret = SyncFileMap(map);
+    UnregisterFileMap(map);
+    munmap(map->Address, map->Pages * BLOCKSIZE);
+    ReleaseFileMap(map);
+
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AppendvFile
+//    Description   : Gather write to the end of a file through an APPEND descriptor. The space
+//                    is reserved with a compare-and-swap on the inode's AppendEnd under the
+//                    shared inode lock, so appenders copy their records in parallel; only
+//                    allocating blocks takes the lock exclusively. The size is then advanced
+//                    over the record in reservation order, so readers, which stop at the size,
+//                    never see a record that is still being copied. Called with the
+//                    descriptor's stripe held, which is released once the space is reserved.
+//    Input         : long long fd            - File descriptor of the file.
+//                    PFILETABLE ft           - Its file table entry.
+//                    const struct iovec* iov - Buffers to write, in order.
+//                    int iovcnt              - Number of buffers.
+//                    int total               - Bytes in all buffers.
+//                    long long* at           - Receives the offset the record was written at.
+//    Output        : int                    - Number of bytes written, or the WriteFile error
+//                                              codes. After a short write the rest of the
+//                                              record reads as zeros.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int AppendvFile(long long fd, PFILETABLE ft, const struct iovec *iov, int iovcnt, int total, long long *at)
+{
+    int done = 0, written = 0, i = 0, ret = 0;
+    long long end = 0, size = 0, base = 0;
+    PINODE inode = ft->ptrinode;
+
+    pthread_rwlock_rdlock(&inode->Lock);
+    if (((ft->mode) != WRITE) && ((ft->mode) != READ + WRITE))
+        ret = -1;
+    else if (((INODE_PERMISSION(inode)) != WRITE) && ((INODE_PERMISSION(inode)) != READ + WRITE))
+        ret = -1;
+    else if ((INODE_TYPE(inode)) != REGULAR)
+        ret = -3;
+
+    while (ret == 0)
+    {
+        end = __atomic_load_n(&inode->AppendEnd, __ATOMIC_ACQUIRE);
+        size = INODE_COMMITTED(inode);
+        base = (end > size) ? end : size;
+        if (base + total > MAXFILESIZE)
+        {
+            ret = -2;
+        }
+        else if (AppendReady(inode, base, total))
+        {
+            if (__atomic_compare_exchange_n(&inode->AppendEnd, &end, base + total, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                break;
+        }
+        else
+        {
+            // Every reservation is published before its appender drops the shared lock, so
+            // the size is the end of the file while the lock is held exclusively
+            pthread_rwlock_unlock(&inode->Lock);
+            pthread_rwlock_wrlock(&inode->Lock);
+            if ((INODE_SIZE(inode) + total <= MAXFILESIZE) && (PrepareAppend(inode, INODE_SIZE(inode), total) == -1))
+                ret = -2;
+            pthread_rwlock_unlock(&inode->Lock);
+            pthread_rwlock_rdlock(&inode->Lock);
+        }
+    }
+
+    *at = base;
+    if (ret == 0)
+        (ft->writeoffset) = base + total;
+    ReleaseFileTable(fd);
+    if (ret != 0)
+    {
+        pthread_rwlock_unlock(&inode->Lock);
+        return ret;
+    }
+
+    for (i = 0; i < iovcnt; i++)
+    {
+        if (iov[i].iov_len == 0)
+            continue;
+        if (JournalAppend(JR_WRITE, inode->InodeNumber, 0, base + done, (char *)iov[i].iov_base, (int)iov[i].iov_len) == -1)
+            break;
+        written = AppendInodeData(inode, base + done, (char *)iov[i].iov_base, (int)iov[i].iov_len);
+        done = done + written;
+        if (written < (int)iov[i].iov_len)
+            break;
+    }
+
+    while (INODE_COMMITTED(inode) != base)
+        sched_yield();
+    __atomic_store_n(&INODE_SIZE(inode), base + total, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&inode->Lock);
+
+    return ((done == 0) && (total != 0)) ? -2 : done;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : WritevFile
+//    Description   : Gather write: writes a list of buffers to a file in one call, as one
+//                    contiguous range, allocating blocks as the write crosses into them. With
+//                    an offset of -1 the write starts at, and advances, the descriptor's write
+//                    offset, or goes to the end of the file through an APPEND descriptor; with
+//                    any other offset the descriptor offset is left alone. Each buffer is
+//                    journaled as its own record, all in one commit group.
+//    Input         : long long fd            - File descriptor of the file.
+//                    const struct iovec* iov - Buffers to write, in order.
+//                    int iovcnt              - Number of buffers (at most IOVMAX).
+//                    long long offset        - Offset to write at, or -1 for the write offset.
+//    Output        : int                    - Number of bytes written on success, or the
+//                                              WriteFile error codes; -1 also for an invalid
+//                                              iovec array or offset.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int WritevFile(long long fd, const struct iovec *iov, int iovcnt, long long offset)
+{
+    int done = 0, written = 0, ino = 0, i = 0, total = IovecLength(iov, iovcnt);
+    long long start = NowNanoseconds(), at = 0;
+    PINODE inode = NULL;
+    PFILETABLE ft = NULL;
+
+    if ((total == -1) || (offset < -1))
+        return PerfRecord(PERF_WRITE, start, -1, fd, 0, offset, 0);
+
+    JournalBegin();
+    ft = AcquireFileTable(fd);
+    if (ft == NULL)
+    {
+        JournalEnd();
+        return PerfRecord(PERF_WRITE, start, -1, fd, 0, offset, total);
+    }
+    inode = ft->ptrinode;
+    ino = inode->InodeNumber;
+    if ((offset == -1) && (ft->Append != 0))
+    {
+        done = AppendvFile(fd, ft, iov, iovcnt, total, &at);
+        JournalEnd();
+        return PerfRecord(PERF_WRITE, start, done, fd, ino, at, total);
+    }
+
+    pthread_rwlock_wrlock(&inode->Lock);
+    at = (offset == -1) ? ft->writeoffset : offset;
+
+    if (((ft->mode) != WRITE) && ((ft->mode) != READ + WRITE))
+        done = -1;
+    else if (((INODE_PERMISSION(inode)) != WRITE) && ((INODE_PERMISSION(inode)) != READ + WRITE))
+        done = -1;
+    else if (at + total > MAXFILESIZE)
+        done = -2;
+    else if ((INODE_TYPE(inode)) != REGULAR)
+        done = -3;
+
+    if (offset != -1)
+    {
+        ReleaseFileTable(fd);
+        ft = NULL;
+    }
+
+    for (i = 0; (done >= 0) && (i < iovcnt); i++)
+    {
+        if (iov[i].iov_len == 0)
+            continue;
+        if (JournalAppend(JR_WRITE, ino, 0, at + done, (char *)iov[i].iov_base, (int)iov[i].iov_len) == -1)
+            break;
+        written = WriteInodeData(inode, at + done, (char *)iov[i].iov_base, (int)iov[i].iov_len);
+        done = done + written;
+        if (written < (int)iov[i].iov_len)
+            break;
+    }
+
+    if (done >= 0)
+    {
+        if (ft != NULL)
+            (ft->writeoffset) = at + done;
+        if ((done == 0) && (total != 0))
+            done = -2;
+    }
+
+    pthread_rwlock_unlock(&inode->Lock);
+    if (ft != NULL)
+        ReleaseFileTable(fd);
+    JournalEnd();
+
+    return PerfRecord(PERF_WRITE, start, done, fd, ino, at, total);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : WriteFile
+//    Description   : Writes data to a file from a buffer at the descriptor's write offset,
+//                    allocating blocks from the block pool as the write crosses into them.
+//    Input         : long long fd - File descriptor of the file.
+//                    char* arr    - Buffer containing the data to write.
+//                    int isize    - Number of bytes to write.
+//    Output        : int         - Number of bytes written on success, or error code:
+//                                   -1: Permission denied or descriptor not open
+//                                   -2: Insufficient memory
+//                                   -3: Not a regular file
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int WriteFile(long long fd, char *arr, int isize)
+{
+    struct iovec iov;
+
+    iov.iov_base = arr;
+    iov.iov_len = (isize < 0) ? 0 : isize;
+    return WritevFile(fd, &iov, 1, -1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : PwriteFile
+//    Description   : Writes data to a file at a given offset without using or moving the
+//                    descriptor's write offset.
+//    Input         : long long fd      - File descriptor of the file.
+//                    char* arr         - Buffer containing the data to write.
+//                    int isize         - Number of bytes to write.
+//                    long long offset  - Offset to write at.
+//    Output        : int              - Number of bytes written, or the WriteFile error codes
+//                                        (-1 also for a negative offset).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PwriteFile(long long fd, char *arr, int isize, long long offset)
+{
+    struct iovec iov;
+
+    iov.iov_base = arr;
+    iov.iov_len = (isize < 0) ? 0 : isize;
+    return WritevFile(fd, &iov, 1, (offset < 0) ? -2 : offset);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : OpenFile
+//    Description   : Opens an existing file for reading or writing.
+//    Input         : char* name  - Path of the file to open.
+//                    int mode    - Mode to open the file in (READ, WRITE, or READ+WRITE), plus
+//                                  APPEND with WRITE to make every write go to the end of the
+//                                  file.
+//    Output        : long long  - File descriptor on success, or error code:
+//                                  -1: Invalid parameters
+//                                  -2: File not found
+//                                  -3: Permission denied
+//                                  -4: Descriptor table is full
+//                                  -5: File is a directory
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long OpenFile(char *name, int mode)
+{
+    int ino = 0;
+    long long fd = 0, start = NowNanoseconds();
+    PINODE temp = NULL;
+    PFILETABLE ft = NULL;
+
+    if ((name == NULL) || ((mode & (READ + WRITE)) == 0) || ((mode & ~(READ + WRITE + APPEND)) != 0) ||
+        (((mode & APPEND) != 0) && ((mode & WRITE) == 0)))
+        return PerfRecord(PERF_OPEN, start, -1, -1, 0, 0, 0);
+
+    ft = (PFILETABLE)SlabAlloc(&FILETABLESLAB);
+    if (ft == NULL)
+        return PerfRecord(PERF_OPEN, start, -1, -1, 0, 0, 0);
+
+    pthread_rwlock_rdlock(&NAMEINDEXobj.Lock);
+    temp = Get_Inode(name);
+    if (temp != NULL)
+        ino = temp->InodeNumber;
+    if (temp == NULL)
+        fd = -2;
+    else if (INODE_TYPE(temp) == DIRECTORY)
+        fd = -5;
+    else if (INODE_PERMISSION(temp) < (mode & (READ + WRITE)))
+        fd = -3;
+    else
+    {
+        ft->count = 1;
+        ft->mode = mode & (READ + WRITE);
+        ft->Append = ((mode & APPEND) != 0);
+        ft->readoffset = 0;
+        ft->writeoffset = 0;
+        ft->ptrinode = temp;
+        ft->NextRead = 0;
+        ft->ReadaheadEnd = 0;
+        ft->Window = 0;
+
+        pthread_rwlock_wrlock(&temp->Lock);
+        fd = AllocateFD(ft);
+        if (fd == -1)
+            fd = -4;
+        else
+            (ft->ptrinode->ReferenceCount)++;
+        pthread_rwlock_unlock(&temp->Lock);
+    }
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+
+    if (fd < 0)
+        SlabFree(&FILETABLESLAB, ft);
+
+    return PerfRecord(PERF_OPEN, start, fd, fd, ino, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CloseFileByName
+//    Description   : Closes a specific file by its descriptor and releases the descriptor.
+//                    Closing an APPEND descriptor frees the blocks allocated ahead of the end.
+//    Input         : long long fd - File descriptor of the file to close.
+//    Output        : int         - 0 on success, or -1 if the descriptor is not open.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int CloseFileByName(long long fd)
+{
+    long long start = NowNanoseconds();
+    int ino = 0;
+    PINODE temp = NULL;
+    PFILETABLE ft = AcquireFileTable(fd);
+
+    if (ft == NULL)
+        return PerfRecord(PERF_CLOSE, start, -1, fd, 0, 0, 0);
+
+    temp = ft->ptrinode;
+    ino = temp->InodeNumber;
+    pthread_rwlock_wrlock(&temp->Lock);
+    (temp->ReferenceCount)--;
+    if (ft->Append != 0)
+        TrimAppendAhead(temp);
+    ReleaseFD(fd);
+    pthread_rwlock_unlock(&temp->Lock);
+    ReleaseFileTable(fd);
+
+    return PerfRecord(PERF_CLOSE, start, 0, fd, ino, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CloseFileByName
+//    Description   : Closes a specific file by its name (its oldest open descriptor).
+//    Input         : char* name  - Name of the file to close.
+//    Output        : int        - 0 on success, or -1 if the file is not found.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int CloseFileByName(char *name)
+{
+    long long i = 0;
+    i = GetFDFromName(name);
+    if (i == -1)
+        return -1;
+
+    return CloseFileByName(i);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CloseAllFile
+//    Description   : Closes all currently open files by walking the allocated slot bitmaps.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseAllFile()
+{
+    int c = 0, j = 0, slot = 0;
+    long long fd = 0;
+    unsigned long long used = 0;
+    PUFDT entry = NULL;
+
+    for (c = 0; c < __atomic_load_n(&UFDTobj.ChunkCount, __ATOMIC_ACQUIRE); c++)
+    {
+        for (j = 0; j < FDCHUNKSIZE / 64; j++)
+        {
+            pthread_mutex_lock(&UFDTobj.Lock);
+            used = UFDTobj.Used[c][j];
+            pthread_mutex_unlock(&UFDTobj.Lock);
+
+            while (used != 0)
+            {
+                slot = c * FDCHUNKSIZE + j * 64 + __builtin_ctzll(used);
+                used = used & (used - 1);
+
+                entry = &(UFDTobj.Chunks[c][slot % FDCHUNKSIZE]);
+                pthread_mutex_lock(&UFDTobj.Stripes[slot % FDLOCKSTRIPES].Lock);
+                fd = ((long long)entry->Generation << FDINDEXBITS) | slot;
+                pthread_mutex_unlock(&UFDTobj.Stripes[slot % FDLOCKSTRIPES].Lock);
+                CloseFileByName(fd);
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : SeekDataHole
+//    Description   : Finds the next data or hole offset of a file, like SEEK_DATA and SEEK_HOLE.
+//                    Holes are tracked per block, and the end of the file counts as a hole.
+//    Input         : PINODE inode     - Inode of the file, locked by the caller.
+//                    long long offset - Offset to search from.
+//                    int from         - DATA or HOLE.
+//    Output        : long long       - Offset found, or -1 if offset is at or past the end of
+//                                       the file, or no data follows it.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long SeekDataHole(PINODE inode, long long offset, int from)
+{
+    long long blockno = 0, size = INODE_COMMITTED(inode);
+
+    if ((offset < 0) || (offset >= size))
+        return -1;
+
+    if (from == DATA)
+    {
+        blockno = NextFileBlock(inode, offset / BLOCKSIZE);
+        if ((blockno == -1) || (blockno * BLOCKSIZE >= size))
+            return -1;
+        return (blockno * BLOCKSIZE > offset) ? blockno * BLOCKSIZE : offset;
+    }
+
+    for (blockno = offset / BLOCKSIZE; GetFileBlock(inode, blockno, 0) != NULL; blockno++)
+        ;
+    if (blockno * BLOCKSIZE <= offset)
+        return offset;
+    return (blockno * BLOCKSIZE < size) ? blockno * BLOCKSIZE : size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : LseekFileLocked
+//    Description   : Changes the file offset of a file table entry. The caller holds the
+//                    descriptor's stripe and the inode lock (exclusively in WRITE mode, where
+//                    seeking past the end extends the file, leaving a hole).
+//    Input         : PFILETABLE ft  - File table entry.
+//                    long long size - Offset value.
+//                    int from       - Reference point (START, CURRENT, END), or DATA / HOLE to
+//                                     move to the next data or hole at or after offset size.
+//    Output        : int           - 0 on success, -1 if the new offset is out of range, or -2
+//                                     if there is no data or hole at or after size.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int LseekFileLocked(PFILETABLE ft, long long size, int from)
+{
+    long long offset = 0, end = 0;
+
+    if ((from == DATA) || (from == HOLE))
+    {
+        offset = SeekDataHole(ft->ptrinode, size, from);
+        if (offset == -1)
+            return -2;
+        if (ft->mode == WRITE)
+            (ft->writeoffset) = offset;
+        else
+            (ft->readoffset) = offset;
+        return 0;
+    }
+
+    if ((ft->mode == READ) || (ft->mode == READ + WRITE))
+    {
+        if (from == CURRENT)
+        {
+            if (((ft->readoffset) + size) > INODE_COMMITTED(ft->ptrinode))
+                return -1;
+            if (((ft->readoffset) + size) < 0)
+                return -1;
+            (ft->readoffset) = (ft->readoffset) + size;
+        }
+        else if (from == START)
+        {
+            if (size > INODE_COMMITTED(ft->ptrinode))
+                return -1;
+            if (size < 0)
+                return -1;
+            (ft->readoffset) = size;
+        }
+        else if (from == END)
+        {
+            end = INODE_COMMITTED(ft->ptrinode);
+            if (end + size > MAXFILESIZE)
+                return -1;
+            if ((end + size) < 0)
+                return -1;
+            (ft->readoffset) = end + size;
+        }
+    }
+    else if (ft->mode == WRITE)
+    {
+        if (from == CURRENT)
+        {
+            if (((ft->writeoffset) + size) > MAXFILESIZE)
+                return -1;
+            if (((ft->writeoffset) + size) < 0)
+                return -1;
+            if (((ft->writeoffset) + size) > (INODE_SIZE(ft->ptrinode)))
+            {
+                JournalAppend(JR_SETSIZE, ft->ptrinode->InodeNumber, 0, (ft->writeoffset) + size, NULL, 0);
+                (INODE_SIZE(ft->ptrinode)) = (ft->writeoffset) + size;
+            }
+            (ft->writeoffset) = (ft->writeoffset) + size;
+        }
+        else if (from == START)
+        {
+            if (size > MAXFILESIZE)
+                return -1;
+            if (size < 0)
+                return -1;
+            if (size > (INODE_SIZE(ft->ptrinode)))
+            {
+                JournalAppend(JR_SETSIZE, ft->ptrinode->InodeNumber, 0, size, NULL, 0);
+                (INODE_SIZE(ft->ptrinode)) = size;
+            }
+            (ft->writeoffset) = size;
+        }
+        else if (from == END)
+        {
+            if ((INODE_SIZE(ft->ptrinode)) + size > MAXFILESIZE)
+                return -1;
+            if (((INODE_SIZE(ft->ptrinode)) + size) < 0)
+                return -1;
+            (ft->writeoffset) = (INODE_SIZE(ft->ptrinode)) + size;
+        }
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : LseekFile
+//    Description   : Changes the file offset for reading or writing operations.
+//    Input         : long long fd - File descriptor of the file.
+//                    long long size - Offset value.
+//                    int from     - Reference point (START, CURRENT, END, DATA or HOLE).
+//    Output        : int         - 0 on success, or error code:
+//                                   -1: Invalid parameters
+//                                   -2: No data or hole at or after the offset (DATA, HOLE)
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int LseekFile(long long fd, long long size, int from)
+{
+    int ret = 0, ino = 0;
+    long long start = NowNanoseconds();
+    PFILETABLE ft = NULL;
+
+    if ((fd < 0) || (from < START) || (from > HOLE))
+        return PerfRecord(PERF_LSEEK, start, -1, fd, 0, size, 0);
+
+    JournalBegin();
+    ft = AcquireFileTable(fd);
+    if (ft == NULL)
+    {
+        JournalEnd();
+        return PerfRecord(PERF_LSEEK, start, -1, fd, 0, size, 0);
+    }
+
+    ino = ft->ptrinode->InodeNumber;
+    if (ft->mode == WRITE)
+        pthread_rwlock_wrlock(&ft->ptrinode->Lock);
+    else
+        pthread_rwlock_rdlock(&ft->ptrinode->Lock);
+    ret = LseekFileLocked(ft, size, from);
+    pthread_rwlock_unlock(&ft->ptrinode->Lock);
+
+    ReleaseFileTable(fd);
+    JournalEnd();
+    return PerfRecord(PERF_LSEEK, start, ret, fd, ino, size, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : TellFile
+//    Description   : Returns the current file offset of a descriptor: the write offset in WRITE
+//                    mode, otherwise the read offset.
+//    Input         : long long fd - File descriptor of the file.
+//    Output        : long long   - File offset, or -1 if the descriptor is not valid.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long TellFile(long long fd)
+{
+    long long offset = 0;
+    PFILETABLE ft = NULL;
+
+    if (fd < 0)
+        return -1;
+
+    ft = AcquireFileTable(fd);
+    if (ft == NULL)
+        return -1;
+    offset = (ft->mode == WRITE) ? ft->writeoffset : ft->readoffset;
+    ReleaseFileTable(fd);
+
+    return offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ls_file
+//    Description   : Lists the entries of a directory, including their metadata. Names of
+//                    subdirectories end with '/', and their size is their number of entries.
+//                    Only the directory's own entry list is walked, in creation order.
+//    Input         : char* path - Path of the directory, NULL for the current directory.
+//    Output        : int       - 0 on success, or error code:
+//                                 -1: Directory not found
+//                                 -2: Not a directory
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ls_file(char *path)
+{
+    int i = 0, dir = 0;
+
+    pthread_rwlock_rdlock(&NAMEINDEXobj.Lock);
+    dir = (path == NULL) ? NAMEINDEXobj.Cwd : ResolvePath(path);
+    if ((dir < 0) || ((dir != 0) && (INODECOLUMNSobj.FileType[dir] != DIRECTORY)))
+    {
+        pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+        return (dir < 0) ? -1 : -2;
+    }
+
+    if (INODECOLUMNSobj.FileActualSize[dir] == 0)
+    {
+        pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+        printf("Error : There are no files\n");
+        return 0;
+    }
+
+    printf("\nFile Name\tInode number\tFile size\tLink count\n");
+    printf("-------------------------------------------------------------------\n");
+    for (i = INODECOLUMNSobj.FirstChild[dir]; i != 0; i = INODECOLUMNSobj.NextSibling[i])
+    {
+        printf("%s%s\t\t%d\t\t%lld\t\t%d\n", INODECOLUMNSobj.FileName + (size_t)i * NAMELENGTH,
+               (INODECOLUMNSobj.FileType[i] == DIRECTORY) ? "/" : "", i,
+               INODECOLUMNSobj.FileActualSize[i], INODECOLUMNSobj.LinkCount[i]);
+    }
+    printf("-------------------------------------------------------------------\n");
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : dcachestat
+//    Description   : Displays the occupancy and hit counters of the path cache.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void dcachestat()
+{
+    long long hits = __atomic_load_n(&DCACHEobj.Hits, __ATOMIC_RELAXED);
+    long long negative = __atomic_load_n(&DCACHEobj.NegativeHits, __ATOMIC_RELAXED);
+    long long misses = __atomic_load_n(&DCACHEobj.Misses, __ATOMIC_RELAXED);
+    long long total = hits + negative + misses;
+
+    printf("\n---------------------- Path cache ----------------------\n");
+    printf("Entries : %d of %d\n", __atomic_load_n(&DCACHEobj.Count, __ATOMIC_RELAXED), DCACHESIZE);
+    printf("Hits : %lld\n", hits);
+    printf("Negative hits : %lld\n", negative);
+    printf("Misses : %lld\n", misses);
+    printf("Invalidations : %lld\n", __atomic_load_n(&DCACHEobj.Invalidations, __ATOMIC_RELAXED));
+    printf("Hit ratio : %.1f%%\n", (total == 0) ? 0.0 : 100.0 * (hits + negative) / total);
+    printf("--------------------------------------------------------\n\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ParseFindPredicate
+//    Description   : Parses one find condition of the form <field><op><value>, where field is
+//                    size, perm, type or links and op is <, <=, =, !=, >= or >.
+//    Input         : char* str             - Condition text.
+//                    PFINDPREDICATE pred   - Parsed condition.
+//    Output        : int                  - 0 on success, or -1 if the condition is malformed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ParseFindPredicate(char *str, PFINDPREDICATE pred)
+{
+    char *op = str, *end = NULL;
+
+    while ((*op >= 'a') && (*op <= 'z'))
+        op++;
+
+    if ((op - str == 4) && (strncmp(str, "size", 4) == 0))
+        pred->Field = FIND_SIZE;
+    else if ((op - str == 4) && (strncmp(str, "perm", 4) == 0))
+        pred->Field = FIND_PERM;
+    else if ((op - str == 4) && (strncmp(str, "type", 4) == 0))
+        pred->Field = FIND_TYPE;
+    else if ((op - str == 5) && (strncmp(str, "links", 5) == 0))
+        pred->Field = FIND_LINKS;
+    else
+        return -1;
+
+    if (strncmp(op, "<=", 2) == 0)
+        pred->Op = FIND_LE;
+    else if (strncmp(op, ">=", 2) == 0)
+        pred->Op = FIND_GE;
+    else if (strncmp(op, "!=", 2) == 0)
+        pred->Op = FIND_NE;
+    else if (*op == '<')
+        pred->Op = FIND_LT;
+    else if (*op == '>')
+        pred->Op = FIND_GT;
+    else if (*op == '=')
+        pred->Op = FIND_EQ;
+    else
+        return -1;
+
+    op = op + (((pred->Op == FIND_LE) || (pred->Op == FIND_GE) || (pred->Op == FIND_NE)) ? 2 : 1);
+    pred->Value = strtoll(op, &end, 10);
+    if ((end == op) || (*end != '\0'))
+        return -1;
+
+    return 0;
+}
+
+typedef int FINDMASK __attribute__((vector_size(FINDBATCH * sizeof(int))));
+typedef long long FINDWIDE __attribute__((vector_size(FINDBATCH / 2 * sizeof(long long))));
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FindCompareInt
+//    Description   : Compares FINDBATCH consecutive entries of an int column with a value using
+//                    vector instructions, and clears the lanes of the mask that do not match.
+//    Input         : int* column     - First entry of the batch.
+//                    int op          - Comparison operator.
+//                    int value       - Value compared against.
+//                    FINDMASK* mask  - Lane mask, all ones where the inode still matches.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FindCompareInt(int *column, int op, int value, FINDMASK *mask)
+{
+    FINDMASK v, x;
+
+    memcpy(&v, column, sizeof(v));
+    x = v - v + value;
+
+    if (op == FIND_LT)
+        *mask = *mask & (v < x);
+    else if (op == FIND_LE)
+        *mask = *mask & (v <= x);
+    else if (op == FIND_EQ)
+        *mask = *mask & (v == x);
+    else if (op == FIND_NE)
+        *mask = *mask & (v != x);
+    else if (op == FIND_GE)
+        *mask = *mask & (v >= x);
+    else
+        *mask = *mask & (v > x);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FindCompareWide
+//    Description   : Compares FINDBATCH consecutive entries of a 64-bit column with a value,
+//                    two vectors at a time, narrows the result to int lanes and clears the lanes
+//                    of the mask that do not match.
+//    Input         : long long* column - First entry of the batch.
+//                    int op            - Comparison operator.
+//                    long long value   - Value compared against.
+//                    FINDMASK* mask    - Lane mask, all ones where the inode still matches.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FindCompareWide(long long *column, int op, long long value, FINDMASK *mask)
+{
+    int i = 0;
+    FINDWIDE v[2], x, r[2];
+
+    memcpy(v, column, sizeof(v));
+    x = v[0] - v[0] + value;
+
+    for (i = 0; i < 2; i++)
+    {
+        if (op == FIND_LT)
+            r[i] = v[i] < x;
+        else if (op == FIND_LE)
+            r[i] = v[i] <= x;
+        else if (op == FIND_EQ)
+            r[i] = v[i] == x;
+        else if (op == FIND_NE)
+            r[i] = v[i] != x;
+        else if (op == FIND_GE)
+            r[i] = v[i] >= x;
+        else
+            r[i] = v[i] > x;
+    }
+
+    for (i = 0; i < FINDBATCH; i++)
+        (*mask)[i] = (*mask)[i] & (int)r[i / (FINDBATCH / 2)][i % (FINDBATCH / 2)];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FindLimit
+//    Description   : Returns how many inode column entries a find scans: every inode in use,
+//                    rounded up to whole FINDBATCH batches. Called with NAMEINDEX::Lock held.
+//    Input         : None
+//    Output        : int - Number of entries to scan.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int FindLimit()
+{
+    return (SUPERBLOCKobj.NextInode + FINDBATCH - 1) / FINDBATCH * FINDBATCH;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FindInodes
+//    Description   : Evaluates a conjunction of conditions over the inode columns, FINDBATCH
+//                    inodes at a time, and collects the numbers of the matching inodes. Only
+//                    the inodes below NextInode, rounded up to FINDBATCH, are scanned.
+//    Input         : PFINDPREDICATE preds - Conditions, all of which must hold.
+//                    int count            - Number of conditions.
+//                    int* result          - Receives matching inode numbers (FindLimit entries).
+//    Output        : int                 - Number of matching inodes.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int FindInodes(PFINDPREDICATE preds, int count, int *result)
+{
+    int i = 0, j = 0, k = 0, matches = 0, limit = FindLimit();
+    FINDMASK mask;
+
+    for (i = 0; i < limit; i = i + FINDBATCH)
+    {
+        memset(&mask, 0xFF, sizeof(mask));
+        FindCompareInt(INODECOLUMNSobj.FileType + i, FIND_NE, 0, &mask);
+
+        for (k = 0; k < count; k++)
+        {
+            if (preds[k].Field == FIND_SIZE)
+                FindCompareWide(INODECOLUMNSobj.FileActualSize + i, preds[k].Op, preds[k].Value, &mask);
+            else if (preds[k].Field == FIND_PERM)
+                FindCompareInt(INODECOLUMNSobj.Permission + i, preds[k].Op, (int)preds[k].Value, &mask);
+            else if (preds[k].Field == FIND_TYPE)
+                FindCompareInt(INODECOLUMNSobj.FileType + i, preds[k].Op, (int)preds[k].Value, &mask);
+            else
+                FindCompareInt(INODECOLUMNSobj.LinkCount + i, preds[k].Op, (int)preds[k].Value, &mask);
+        }
+
+        for (j = 0; j < FINDBATCH; j++)
+            if (mask[j] != 0)
+                result[matches++] = i + j;
+    }
+    return matches;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : find_file
+//    Description   : Lists the files that satisfy every given condition.
+//    Input         : int argc     - Number of conditions.
+//                    char** argv  - Condition strings, for example size>1000 perm=3.
+//    Output        : int         - Number of matching files, or error code:
+//                                   -1: Malformed condition
+//                                   -2: Memory allocation failure
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int find_file(int argc, char **argv)
+{
+    char path[PATHLENGTH];
+    int i = 0, matches = 0;
+    int *result = NULL;
+    FINDPREDICATE preds[FINDMAXPREDICATES];
+
+    for (i = 0; i < argc && i < FINDMAXPREDICATES; i++)
+        if (ParseFindPredicate(argv[i], &preds[i]) == -1)
+            return -1;
+
+    pthread_rwlock_rdlock(&NAMEINDEXobj.Lock);
+    result = (int *)malloc(FindLimit() * sizeof(int));
+    if (result == NULL)
+    {
+        pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+        return -2;
+    }
+    matches = FindInodes(preds, i, result);
+
+    printf("\nFile Name\tInode number\tFile size\tPermission\tLink count\n");
+    printf("-------------------------------------------------------------------\n");
+    for (i = 0; i < matches; i++)
+    {
+        if (InodePath(result[i], path) == -1)
+            strcpy(path, INODECOLUMNSobj.FileName + (size_t)result[i] * NAMELENGTH);
+        printf("%s\t\t%d\t\t%lld\t\t%d\t\t%d\n", path, result[i],
+               INODECOLUMNSobj.FileActualSize[result[i]], INODECOLUMNSobj.Permission[result[i]], INODECOLUMNSobj.LinkCount[result[i]]);
+    }
+    printf("-------------------------------------------------------------------\n");
+    printf("%d file(s) matched\n", matches);
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+
+    free(result);
+    return matches;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FillFileStat
+//    Description   : Copies the metadata of an inode into a FILESTAT. The caller holds the inode
+//                    lock; blocks shared with other files may still be compressed meanwhile, so
+//                    their state is read under TIER::Lock.
+//    Input         : PINODE temp     - Inode of the file.
+//                    PFILESTAT st    - Receives the metadata.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FillFileStat(PINODE temp, PFILESTAT st)
+{
+    long long i = 0;
+    PBLOCK block = NULL;
+
+    memset(st, 0, sizeof(FILESTAT));
+    strncpy(st->FileName, temp->FileName, NAMELENGTH - 1);
+    st->InodeNumber = temp->InodeNumber;
+    st->FileType = INODE_TYPE(temp);
+    st->FileSize = temp->FileSize;
+    st->FileActualSize = INODE_COMMITTED(temp);
+    st->LinkCount = INODE_LINKCOUNT(temp);
+    st->ReferenceCount = temp->ReferenceCount;
+    st->Permission = INODE_PERMISSION(temp);
+
+    if (TIERobj.Compress != 0)
+        pthread_mutex_lock(&TIERobj.Lock);
+    for (i = NextFileBlock(temp, 0); i != -1; i = NextFileBlock(temp, i + 1))
+    {
+        block = GetFileBlock(temp, i, 0);
+        st->AllocatedSize = st->AllocatedSize + BLOCKSIZE;
+        st->PhysicalSize = st->PhysicalSize + ((block->Packed != NULL) ? block->PackedSize : BLOCKSIZE);
+    }
+    if (TIERobj.Compress != 0)
+        pthread_mutex_unlock(&TIERobj.Lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : FstatFile
+//    Description   : Retrieves the metadata of a file based on its file descriptor.
+//    Input         : long long fd  - File descriptor of the file.
+//                    PFILESTAT st  - Receives the metadata.
+//    Output        : int          - 0 on success, or error code:
+//                                    -1: Invalid file descriptor
+//                                    -2: File not found
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int FstatFile(long long fd, PFILESTAT st)
+{
+    PFILETABLE ft = NULL;
+
+    if (fd < 0)
+        return -1;
+
+    ft = AcquireFileTable(fd);
+    if (ft == NULL)
+        return -2;
+
+    pthread_rwlock_rdlock(&ft->ptrinode->Lock);
+    FillFileStat(ft->ptrinode, st);
+    pthread_rwlock_unlock(&ft->ptrinode->Lock);
+    ReleaseFileTable(fd);
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : StatFile
+//    Description   : Retrieves the metadata of a file based on its path.
+//    Input         : char* name    - Path of the file; "/" gives the root directory.
+//                    PFILESTAT st  - Receives the metadata.
+//    Output        : int          - 0 on success, or error code:
+//                                    -1: Invalid parameters
+//                                    -2: File not found
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int StatFile(char *name, PFILESTAT st)
+{
+    PINODE temp = NULL;
+    int ino = 0;
+
+    if (name == NULL)
+        return -1;
+
+    pthread_rwlock_rdlock(&NAMEINDEXobj.Lock);
+    ino = ResolvePath(name);
+    temp = (ino > 0) ? InodeFromNumber(ino) : NULL;
+    if (temp != NULL)
+    {
+        pthread_rwlock_rdlock(&temp->Lock);
+        FillFileStat(temp, st);
+        pthread_rwlock_unlock(&temp->Lock);
+    }
+    else if (ino == 0)
+    {
+        memset(st, 0, sizeof(FILESTAT));
+        strcpy(st->FileName, "/");
+        st->FileType = DIRECTORY;
+        st->FileActualSize = INODECOLUMNSobj.FileActualSize[0];
+        st->LinkCount = 1;
+        st->Permission = READ + WRITE;
+    }
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+
+    return ((temp == NULL) && (ino != 0)) ? -2 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : DisplayFileStat
+//    Description   : Prints file metadata in the stat/fstat format.
+//    Input         : PFILESTAT st - Metadata to print.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DisplayFileStat(PFILESTAT st)
+{
+    printf("\n---------------Statistical Information about file-------------\n");
+    printf("File name : %s\n", st->FileName);
+    printf("Inode Number %d\n", st->InodeNumber);
+    printf("File type : %s\n", (st->FileType == DIRECTORY) ? "Directory" : "Regular");
+    printf("File size : %lld\n", st->FileSize);
+    printf("Actual File size : %lld\n", st->FileActualSize);
+    if (st->FileType == REGULAR)
+    {
+        printf("Allocated size : %lld\n", st->AllocatedSize);
+        printf("Physical size : %lld\n", st->PhysicalSize);
+    }
+    printf("Link count : %d\n", st->LinkCount);
+    printf("Reference count : %d\n", st->ReferenceCount);
+
+    if (st->Permission == 1)
+        printf("File Permission : Read only\n");
+    else if (st->Permission == 2)
+        printf("File Permission : Write\n");
+    else if (st->Permission == 3)
+        printf("File Permission : Read & Write\n");
+    printf("--------------------------------------------------------------\n\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : fstat_file
+//    Description   : Displays metadata for a file based on its file descriptor.
+//    Input         : long long fd - File descriptor of the file.
+//    Output        : int         - 0 on success, or error code:
+//                                   -1: Invalid file descriptor
+//                                   -2: File not found
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int fstat_file(long long fd)
+{
+    FILESTAT st;
+    int ret = FstatFile(fd, &st);
+
+    if (ret == 0)
+        DisplayFileStat(&st);
+
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : stat_file
+//    Description   : Displays metadata for a file based on its name.
+//    Input         : char* name  - Name of the file.
+//    Output        : int        - 0 on success, or error code:
+//                                  -1: File not found
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int stat_file(char *name)
+{
+    FILESTAT st;
+    int ret = StatFile(name, &st);
+
+    if (ret == 0)
+        DisplayFileStat(&st);
+
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : truncate_File
+//    Description   : Removes all data from a specified file.
+//    Input         : char* name  - Name of the file to truncate.
+//    Output        : int        - 0 on success, or error code:
+//                                  -1: File not found
+//                                  -2: File is pinned by a FILEVIEW
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int truncate_File(char *name)
+{
+    int ret = 0, ino = 0;
+    long long fd = 0, start = NowNanoseconds();
+    PFILETABLE ft = NULL;
+
+    JournalBegin();
+    fd = GetFDFromName(name);
+    ft = AcquireFileTable(fd);
+    if (ft == NULL)
+    {
+        JournalEnd();
+        return PerfRecord(PERF_TRUNCATE, start, -1, fd, 0, 0, 0);
+    }
+
+    pthread_rwlock_wrlock(&ft->ptrinode->Lock);
+    ino = ft->ptrinode->InodeNumber;
+    if (__atomic_load_n(&ft->ptrinode->PinCount, __ATOMIC_ACQUIRE) != 0)
+        ret = -2;
+    else
+    {
+        JournalAppend(JR_TRUNCATE, ft->ptrinode->InodeNumber, 0, 0, NULL, 0);
+        FreeFileBlocks(ft->ptrinode);
+        ft->readoffset = 0;
+        ft->writeoffset = 0;
+        ft->NextRead = 0;
+        ft->ReadaheadEnd = 0;
+        ft->Window = 0;
+        INODE_SIZE(ft->ptrinode) = 0;
+        ft->ptrinode->AppendEnd = 0;
+    }
+    pthread_rwlock_unlock(&ft->ptrinode->Lock);
+
+    ReleaseFileTable(fd);
+    JournalEnd();
+    return PerfRecord(PERF_TRUNCATE, start, ret, fd, ino, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : compress_File
+//    Description   : Compresses every block of a file right away, whether cold or not.
+//                    Blocks that do not shrink to ZMAXPACKED bytes stay plain.
+//    Input         : char* name  - Path of the file.
+//    Output        : int        - Number of blocks compressed, or error code:
+//                                  -1: File not found
+//                                  -2: Is a directory
+//                                  -3: File is pinned by a FILEVIEW
+//                                  -4: Compression is not enabled
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int compress_File(char *name)
+{
+    PINODE temp = NULL;
+    int ino = 0, ret = 0;
+
+    if (TIERobj.Compress == 0)
+        return -4;
+
+    pthread_rwlock_rdlock(&NAMEINDEXobj.Lock);
+    ino = ResolvePath(name);
+    temp = (ino > 0) ? InodeFromNumber(ino) : NULL;
+    if (temp == NULL)
+    {
+        pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+        return (ino == 0) ? -2 : -1;
+    }
+    if (INODE_TYPE(temp) == DIRECTORY)
+    {
+        pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+        return -2;
+    }
+
+    pthread_rwlock_wrlock(&temp->Lock);
+    pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+    if (__atomic_load_n(&temp->PinCount, __ATOMIC_ACQUIRE) != 0)
+        ret = -3;
+    else
+        ret = PackFile(temp, 1);
+    pthread_rwlock_unlock(&temp->Lock);
+
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : Compressor
+//    Description   : Background compression thread. Every period it sweeps all regular files
+//                    and compresses the blocks not accessed since the previous sweep. A file
+//                    that is busy is skipped until the next sweep rather than waited for.
+//    Input         : void* arg - Pointer to the period in seconds.
+//    Output        : void*    - Never returns.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void *Compressor(void *arg)
+{
+    int period = *(int *)arg, ino = 0;
+    PINODE temp = NULL;
+
+    while (1)
+    {
+        sleep(period);
+
+        for (ino = 1; ino < __atomic_load_n(&SUPERBLOCKobj.NextInode, __ATOMIC_ACQUIRE); ino++)
+        {
+            pthread_rwlock_rdlock(&NAMEINDEXobj.Lock);
+            temp = (INODECOLUMNSobj.FileType[ino] == REGULAR) ? InodeFromNumber(ino) : NULL;
+            if ((temp != NULL) && (pthread_rwlock_trywrlock(&temp->Lock) != 0))
+                temp = NULL;
+            pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+
+            if (temp != NULL)
+            {
+                PackFile(temp, 0);
+                pthread_rwlock_unlock(&temp->Lock);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : StressWorker
+//    Description   : Body of one stress test thread. In the read phase it repeatedly reads and
+//                    verifies the whole shared file through its own descriptor. In the mixed
+//                    phase it creates, writes, reopens, reads back and removes a private file,
+//                    and reads part of the shared file in between.
+//    Input         : void* arg  - PSTRESSWORKER of this thread.
+//    Output        : void*     - Always NULL.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void *StressWorker(void *arg)
+{
+    PSTRESSWORKER worker = (PSTRESSWORKER)arg;
+    char name[NAMELENGTH];
+    char *data = NULL, *check = NULL;
+    int i = 0, k = 0;
+    long long fd = 0, rfd = 0, shared = 0;
+
+    data = (char *)malloc(STRESSSHAREDSIZE);
+    check = (char *)malloc(STRESSSHAREDSIZE);
+    if ((data == NULL) || (check == NULL))
+    {
+        free(data);
+        free(check);
+        (worker->Errors)++;
+        return NULL;
+    }
+
+    for (k = 0; k < STRESSSHAREDSIZE; k++)
+        check[k] = (char)(k % 251);
+
+    if (worker->Phase == STRESS_READ)
+    {
+        shared = OpenFile((char *)"stress_shared", READ);
+        for (i = 0; (shared >= 0) && (i < worker->Iterations); i++)
+        {
+            if ((LseekFile(shared, 0, START) != 0) || (ReadFile(shared, data, STRESSSHAREDSIZE) != STRESSSHAREDSIZE) ||
+                (memcmp(data, check, STRESSSHAREDSIZE) != 0))
+                (worker->Errors)++;
+            worker->Operations = worker->Operations + 2;
+        }
+        if ((shared < 0) || (CloseFileByName(shared) != 0))
+            (worker->Errors)++;
+    }
+    else
+    {
+        sprintf(name, "stress_%d", worker->Id);
+        for (i = 0; i < worker->Iterations; i++)
+        {
+            for (k = 0; k < STRESSWRITESIZE * STRESSWRITES; k++)
+                data[k] = (char)(worker->Id * 31 + i + k);
+
+            fd = CreateFile(name, READ + WRITE);
+            for (k = 0; (fd >= 0) && (k < STRESSWRITES); k++)
+                if (WriteFile(fd, data + k * STRESSWRITESIZE, STRESSWRITESIZE) != STRESSWRITESIZE)
+                    (worker->Errors)++;
+
+            rfd = OpenFile(name, READ);
+            if ((fd < 0) || (rfd < 0) || (ReadFile(rfd, data + STRESSWRITESIZE * STRESSWRITES, STRESSWRITESIZE * STRESSWRITES) != STRESSWRITESIZE * STRESSWRITES) ||
+                (memcmp(data, data + STRESSWRITESIZE * STRESSWRITES, STRESSWRITESIZE * STRESSWRITES) != 0))
+                (worker->Errors)++;
+
+            shared = OpenFile((char *)"stress_shared", READ);
+            if ((shared < 0) || (LseekFile(shared, (i * STRESSWRITESIZE) % STRESSSHAREDSIZE, START) != 0) ||
+                (ReadFile(shared, data, STRESSWRITESIZE) != STRESSWRITESIZE) ||
+                (memcmp(data, check + (i * STRESSWRITESIZE) % STRESSSHAREDSIZE, STRESSWRITESIZE) != 0))
+                (worker->Errors)++;
+
+            if ((CloseFileByName(shared) != 0) || (CloseFileByName(rfd) != 0) || (rm_File(name) != 0))
+                (worker->Errors)++;
+
+            worker->Operations = worker->Operations + STRESSWRITES + 10;
+        }
+    }
+
+    free(data);
+    free(check);
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : StressRun
+//    Description   : Runs one stress test phase on the given number of threads and prints its
+//                    throughput.
+//    Input         : int phase       - STRESS_READ or STRESS_MIXED.
+//                    int threads     - Number of worker threads.
+//                    int iterations  - Loop count of every worker.
+//    Output        : double         - Operations per second, or -1 if a thread could not be
+//                                      started.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+double StressRun(int phase, int threads, int iterations)
+{
+    STRESSWORKER workers[STRESSMAXTHREADS];
+    struct timespec start, stop;
+    long long operations = 0, errors = 0;
+    double seconds = 0;
+    int i = 0, started = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < threads; i++)
+    {
+        workers[i].Id = i;
+        workers[i].Phase = phase;
+        workers[i].Iterations = iterations;
+        workers[i].Operations = 0;
+        workers[i].Errors = 0;
+        if (pthread_create(&workers[i].Thread, NULL, StressWorker, &workers[i]) != 0)
+            break;
+        started++;
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(workers[i].Thread, NULL);
+        operations = operations + workers[i].Operations;
+        errors = errors + workers[i].Errors;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (started != threads)
+        return -1;
+
+    seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-10s\t%d\t%lld\t\t%.3f\t\t%.0f\t\t%lld\n", (phase == STRESS_READ) ? "read" : "mixed",
+           threads, operations, seconds, operations / seconds, errors);
+
+    return operations / seconds;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : stress_test
+//    Description   : Multithreaded stress test of the core API. Measures shared-file read
+//                    throughput with one thread and with all threads, then runs the mixed
+//                    create/write/read/remove workload on all threads, verifying every byte
+//                    read. Finally checks that no inode or descriptor was leaked.
+//    Input         : int threads     - Number of worker threads (1 to STRESSMAXTHREADS).
+//                    int iterations  - Loop count of every worker.
+//    Output        : int            - 0 on success, or error code:
+//                                      -1: Incorrect parameters
+//                                      -2: Not enough free inodes
+//                                      -3: Shared test file could not be created
+//                                      -4: Thread creation failure
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int stress_test(int threads, int iterations)
+{
+    char *data = NULL;
+    int i = 0, freeinodes = 0, opencount = 0;
+    long long fd = 0;
+    double single = 0, multi = 0;
+
+    if ((threads < 1) || (threads > STRESSMAXTHREADS) || (iterations < 1))
+        return -1;
+
+    freeinodes = __atomic_load_n(&SUPERBLOCKobj.FreeInode, __ATOMIC_RELAXED);
+    if (freeinodes < threads + 1)
+        return -2;
+
+    data = (char *)malloc(STRESSSHAREDSIZE);
+    if (data == NULL)
+        return -3;
+    for (i = 0; i < STRESSSHAREDSIZE; i++)
+        data[i] = (char)(i % 251);
+
+    fd = CreateFile((char *)"stress_shared", READ + WRITE);
+    if ((fd < 0) || (WriteFile(fd, data, STRESSSHAREDSIZE) != STRESSSHAREDSIZE))
+    {
+        free(data);
+        if (fd >= 0)
+            rm_File((char *)"stress_shared");
+        return -3;
+    }
+    free(data);
+    CloseFileByName(fd);
+    opencount = UFDTobj.OpenCount;
+
+    printf("\nPhase\t\tThreads\tOperations\tSeconds\t\tOps/sec\t\tErrors\n");
+    printf("-------------------------------------------------------------------------------\n");
+    single = StressRun(STRESS_READ, 1, iterations);
+    multi = (single < 0) ? -1 : StressRun(STRESS_READ, threads, iterations);
+    if ((multi < 0) || (StressRun(STRESS_MIXED, threads, iterations) < 0))
+    {
+        rm_File((char *)"stress_shared");
+        return -4;
+    }
+    printf("-------------------------------------------------------------------------------\n");
+    printf("Read speedup with %d threads : %.2fx\n", threads, multi / single);
+
+    rm_File((char *)"stress_shared");
+    printf("Free inodes : %d before, %d after\n", freeinodes, __atomic_load_n(&SUPERBLOCKobj.FreeInode, __ATOMIC_RELAXED));
+    printf("Open descriptors : %d before, %d after\n", opencount, UFDTobj.OpenCount);
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RaiseFileLimit
+//    Description   : Raises the open file limit of the process to its hard limit, so the server
+//                    and load generator can hold thousands of sockets.
+//    Input         : None
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RaiseFileLimit()
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ServerSignal
+//    Description   : SIGINT/SIGTERM handler of the server; asks every event loop to stop.
+//    Input         : int sig - Signal number.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ServerSignal(int sig)
+{
+    (void)sig;
+    ServerStop = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : GrowBuffer
+//    Description   : Makes sure a connection buffer can hold at least need bytes, doubling it.
+//    Input         : char** buffer     - Buffer to grow.
+//                    size_t* capacity  - Its current size, updated.
+//                    size_t need       - Bytes required.
+//    Output        : int              - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GrowBuffer(char **buffer, size_t *capacity, size_t need)
+{
+    size_t size = (*capacity == 0) ? SERVERREADSIZE : *capacity;
+    char *newbuf = NULL;
+
+    if (need <= *capacity)
+        return 0;
+
+    while (size < need)
+        size = size * 2;
+
+    newbuf = (char *)realloc(*buffer, size);
+    if (newbuf == NULL)
+        return -1;
+
+    *buffer = newbuf;
+    *capacity = size;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ConnectionAddFd
+//    Description   : Gives a global descriptor the lowest free local descriptor of a connection.
+//    Input         : PCONNECTION c  - Connection.
+//                    long long fd   - Global descriptor.
+//    Output        : int           - Local descriptor, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ConnectionAddFd(PCONNECTION c, long long fd)
+{
+    int i = 0, size = 0;
+    long long *fds = NULL;
+
+    for (i = 0; i < c->FdCapacity; i++)
+    {
+        if (c->Fds[i] == -1)
+        {
+            c->Fds[i] = fd;
+            return i;
+        }
+    }
+
+    size = (c->FdCapacity == 0) ? 8 : c->FdCapacity * 2;
+    fds = (long long *)realloc(c->Fds, size * sizeof(long long));
+    if (fds == NULL)
+        return -1;
+
+    for (i = c->FdCapacity; i < size; i++)
+        fds[i] = -1;
+    c->Fds = fds;
+    i = c->FdCapacity;
+    c->FdCapacity = size;
+
+    c->Fds[i] = fd;
+    return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ConnectionGetFd
+//    Description   : Translates a connection local descriptor to the global one.
+//    Input         : PCONNECTION c  - Connection.
+//                    int local      - Local descriptor.
+//    Output        : long long     - Global descriptor, or -1 if the local one is not open.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long ConnectionGetFd(PCONNECTION c, int local)
+{
+    if ((local < 0) || (local >= c->FdCapacity))
+        return -1;
+
+    return c->Fds[local];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RequestName
+//    Description   : Returns the file path carried by a request, checking that it is NUL
+//                    terminated and short enough.
+//    Input         : PWIREHEADER req  - Request header.
+//                    char* payload    - Request payload.
+//    Output        : char*           - File path, or NULL if the payload is not a valid path.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+char *RequestName(PWIREHEADER req, char *payload)
+{
+    if ((req->Length == 0) || (req->Length > PATHLENGTH) || (payload[req->Length - 1] != '\0'))
+        return NULL;
+
+    return payload;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ServeRequest
+//    Description   : Executes one request against the file system and appends its response to
+//                    the connection's output buffer. File data of OP_READ and OP_PREAD is read
+//                    straight into the output buffer and file data of OP_WRITE and OP_PWRITE is
+//                    written straight from the input buffer.
+//    Input         : PCONNECTION c     - Connection the request came from.
+//                    PWIREHEADER req   - Request header.
+//                    char* payload     - Request payload (req->Length bytes).
+//    Output        : int              - 0 on success, or -1 on memory allocation failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ServeRequest(PCONNECTION c, PWIREHEADER req, char *payload)
+{
+    WIREHEADER resp;
+    FILESTAT st;
+    char *name = NULL;
+    int ret = -1, count = 0;
+    long long fd = -1;
+
+    count = ((req->Op == OP_READ) || (req->Op == OP_PREAD)) ? req->Arg : 0;
+    if ((count < 0) || (count > SERVERMAXPAYLOAD))
+        count = SERVERMAXPAYLOAD;
+    if (GrowBuffer(&c->Out, &c->OutCapacity, c->OutUsed + sizeof(WIREHEADER) + count + sizeof(FILESTAT)) == -1)
+        return -1;
+
+    memset(&resp, 0, sizeof(resp));
+    resp.Tag = req->Tag;
+    resp.Op = req->Op;
+    resp.Fd = req->Fd;
+
+    if ((req->Op == OP_CREATE) || (req->Op == OP_OPEN) || (req->Op == OP_STAT) ||
+        (req->Op == OP_RM) || (req->Op == OP_TRUNCATE))
+    {
+        name = RequestName(req, payload);
+        if (name == NULL)
+            req->Op = 0;
+    }
+    else
+    {
+        fd = ConnectionGetFd(c, req->Fd);
+    }
+
+    if ((req->Op == OP_CREATE) || (req->Op == OP_OPEN))
+    {
+        fd = (req->Op == OP_CREATE) ? CreateFile(name, req->Arg) : OpenFile(name, req->Arg);
+        ret = (int)fd;
+        if (fd >= 0)
+        {
+            ret = ConnectionAddFd(c, fd);
+            if (ret == -1)
+            {
+                CloseFileByName(fd);
+                ret = -4;
+            }
+        }
+    }
+    else if (req->Op == OP_CLOSE)
+    {
+        ret = CloseFileByName(fd);
+        if (ret == 0)
+            c->Fds[req->Fd] = -1;
+    }
+    else if ((req->Op == OP_READ) || (req->Op == OP_PREAD))
+    {
+        if (req->Op == OP_READ)
+            ret = ReadFile(fd, c->Out + c->OutUsed + sizeof(WIREHEADER), count);
+        else
+            ret = PreadFile(fd, c->Out + c->OutUsed + sizeof(WIREHEADER), count, req->Offset);
+        if (ret > 0)
+            resp.Length = ret;
+    }
+    else if (req->Op == OP_WRITE)
+    {
+        ret = WriteFile(fd, payload, req->Length);
+    }
+    else if (req->Op == OP_PWRITE)
+    {
+        ret = PwriteFile(fd, payload, req->Length, req->Offset);
+    }
+    else if (req->Op == OP_LSEEK)
+    {
+        ret = LseekFile(fd, req->Offset, req->Arg);
+    }
+    else if ((req->Op == OP_STAT) || (req->Op == OP_FSTAT))
+    {
+        ret = (req->Op == OP_STAT) ? StatFile(name, &st) : FstatFile(fd, &st);
+        if (ret == 0)
+        {
+            memcpy(c->Out + c->OutUsed + sizeof(WIREHEADER), &st, sizeof(st));
+            resp.Length = sizeof(st);
+        }
+    }
+    else if (req->Op == OP_RM)
+    {
+        ret = rm_File(name);
+    }
+    else if (req->Op == OP_TRUNCATE)
+    {
+        ret = truncate_File(name);
+    }
+
+    resp.Arg = ret;
+    memcpy(c->Out + c->OutUsed, &resp, sizeof(resp));
+    c->OutUsed = c->OutUsed + sizeof(resp) + resp.Length;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ServeConnection
+//    Description   : Handles an event on a client connection: serves every complete request in
+//                    the input buffer, sends responses, and reads more requests until the
+//                    socket is drained. Reading pauses while more than SERVEROUTLIMIT bytes of
+//                    responses are waiting for a slow client.
+//    Input         : PCONNECTION c   - Connection.
+//                    int readable    - Non zero if the socket has data to read.
+//    Output        : int            - Number of requests served, or -1 if the connection has to
+//                                     be closed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ServeConnection(PCONNECTION c, int readable)
+{
+    WIREHEADER req;
+    struct epoll_event ev;
+    size_t pos = 0;
+    ssize_t n = 0;
+    int served = 0;
+    unsigned int events = 0;
+
+    while (1)
+    {
+        pos = 0;
+        while ((c->InUsed - pos >= sizeof(WIREHEADER)) && (c->OutUsed - c->OutSent <= SERVEROUTLIMIT))
+        {
+            memcpy(&req, c->In + pos, sizeof(req));
+            if (req.Length > SERVERMAXPAYLOAD)
+                return -1;
+            if (c->InUsed - pos < sizeof(WIREHEADER) + req.Length)
+                break;
+
+            if (ServeRequest(c, &req, c->In + pos + sizeof(WIREHEADER)) == -1)
+                return -1;
+            pos = pos + sizeof(WIREHEADER) + req.Length;
+            served++;
+        }
+        if (pos != 0)
+        {
+            memmove(c->In, c->In + pos, c->InUsed - pos);
+            c->InUsed = c->InUsed - pos;
+        }
+
+        while (c->OutSent < c->OutUsed)
+        {
+            n = send(c->Socket, c->Out + c->OutSent, c->OutUsed - c->OutSent, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                    break;
+                return -1;
+            }
+            c->OutSent = c->OutSent + n;
+        }
+        if (c->OutSent == c->OutUsed)
+        {
+            c->OutSent = 0;
+            c->OutUsed = 0;
+        }
+
+        if ((readable == 0) || (c->OutUsed - c->OutSent > SERVEROUTLIMIT))
+            break;
+
+        if (c->InUsed >= sizeof(WIREHEADER))
+        {
+            memcpy(&req, c->In, sizeof(req));
+            if (GrowBuffer(&c->In, &c->InCapacity, sizeof(WIREHEADER) + req.Length) == -1)
+                return -1;
+        }
+        if (GrowBuffer(&c->In, &c->InCapacity, c->InUsed + 1) == -1)
+            return -1;
+
+        n = recv(c->Socket, c->In + c->InUsed, c->InCapacity - c->InUsed, 0);
+        if (n == 0)
+            return -1;
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                break;
+            return -1;
+        }
+        c->InUsed = c->InUsed + n;
+    }
+
+    events = 0;
+    if (c->OutUsed - c->OutSent <= SERVEROUTLIMIT)
+        events = events | EPOLLIN;
+    if (c->OutUsed != c->OutSent)
+        events = events | EPOLLOUT;
+
+    if (events != c->Events)
+    {
+        ev.events = events;
+        ev.data.ptr = c;
+        if (epoll_ctl(c->Epoll, EPOLL_CTL_MOD, c->Socket, &ev) == -1)
+            return -1;
+        c->Events = events;
+    }
+    return served;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CloseConnection
+//    Description   : Closes every descriptor the client left open, unlinks the connection from
+//                    its event loop and frees it.
+//    Input         : PSERVERLOOP loop  - Event loop of the connection.
+//                    PCONNECTION c     - Connection to close.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseConnection(PSERVERLOOP loop, PCONNECTION c)
+{
+    int i = 0;
+
+    for (i = 0; i < c->FdCapacity; i++)
+        if (c->Fds[i] != -1)
+            CloseFileByName(c->Fds[i]);
+
+    if (c->prev == NULL)
+        loop->Connections = c->next;
+    else
+        c->prev->next = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+
+    close(c->Socket);
+    free(c->In);
+    free(c->Out);
+    free(c->Fds);
+    free(c);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : AcceptConnections
+//    Description   : Accepts every pending client and adds it to the event loop.
+//    Input         : PSERVERLOOP loop - Event loop accepting the clients.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void AcceptConnections(PSERVERLOOP loop)
+{
+    int sock = 0;
+    PCONNECTION c = NULL;
+    struct epoll_event ev;
+
+    while ((sock = accept4(loop->Listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        c = (PCONNECTION)calloc(1, sizeof(CONNECTION));
+        if (c == NULL)
+        {
+            close(sock);
+            continue;
+        }
+        c->Socket = sock;
+        c->Epoll = loop->Epoll;
+        c->Events = EPOLLIN;
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(loop->Epoll, EPOLL_CTL_ADD, sock, &ev) == -1)
+        {
+            close(sock);
+            free(c);
+            continue;
+        }
+
+        c->next = loop->Connections;
+        if (loop->Connections != NULL)
+            loop->Connections->prev = c;
+        loop->Connections = c;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ServerLoop
+//    Description   : Event loop thread of the server.
+//    Input         : void* arg - PSERVERLOOP of this thread.
+//    Output        : void*    - Always NULL.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void *ServerLoop(void *arg)
+{
+    PSERVERLOOP loop = (PSERVERLOOP)arg;
+    struct epoll_event events[SERVEREVENTS];
+    PCONNECTION c = NULL;
+    int i = 0, n = 0, served = 0;
+
+    while (ServerStop == 0)
+    {
+        n = epoll_wait(loop->Epoll, events, SERVEREVENTS, 200);
+        for (i = 0; i < n; i++)
+        {
+            c = (PCONNECTION)events[i].data.ptr;
+            if (c == NULL)
+            {
+                AcceptConnections(loop);
+                continue;
+            }
+
+            served = ServeConnection(c, (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0);
+            if (served == -1)
+                CloseConnection(loop, c);
+            else
+                loop->Requests = loop->Requests + served;
+        }
+    }
+
+    while (loop->Connections != NULL)
+        CloseConnection(loop, loop->Connections);
+
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RunServer
+//    Description   : Serves the file system to local clients on a Unix domain socket until
+//                    SIGINT or SIGTERM, with one epoll event loop per CPU.
+//    Input         : char* path - Path of the socket.
+//    Output        : int       - 0 on success, or error code:
+//                                 -1: Socket could not be created
+//                                 -2: Event loop could not be started
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunServer(char *path)
+{
+    SERVERLOOP loops[SERVERMAXLOOPS];
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    long long requests = 0;
+    int listener = 0, count = 0, started = 0, i = 0;
+
+    count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1)
+        count = 1;
+    if (count > SERVERMAXLOOPS)
+        count = SERVERMAXLOOPS;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    RaiseFileLimit();
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, ServerSignal);
+    signal(SIGTERM, ServerSignal);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener == -1)
+        return -1;
+
+    unlink(path);
+    if ((bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1) || (listen(listener, SOMAXCONN) == -1))
+    {
+        close(listener);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        loops[i].Listener = listener;
+        loops[i].Connections = NULL;
+        loops[i].Requests = 0;
+        loops[i].Epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (loops[i].Epoll == -1)
+            break;
+
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = NULL;
+        if ((epoll_ctl(loops[i].Epoll, EPOLL_CTL_ADD, listener, &ev) == -1) ||
+            (pthread_create(&loops[i].Thread, NULL, ServerLoop, &loops[i]) != 0))
+        {
+            close(loops[i].Epoll);
+            break;
+        }
+        started++;
+    }
+
+    if (started == 0)
+    {
+        close(listener);
+        unlink(path);
+        return -2;
+    }
+
+    printf("Serving on %s with %d event loop(s), press Ctrl+C to stop\n", path, started);
+    fflush(stdout);
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(loops[i].Thread, NULL);
+        close(loops[i].Epoll);
+        requests = requests + loops[i].Requests;
+    }
+
+    close(listener);
+    unlink(path);
+    printf("Server stopped after %lld requests\n", requests);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ClientRequest
+//    Description   : Sends one request on a blocking connection and waits for its response.
+//                    Used by the load generator to set up and remove its test file.
+//    Input         : int sock         - Connected socket.
+//                    int op           - OP_... operation.
+//                    int fd           - Remote descriptor.
+//                    int arg          - Operation argument.
+//                    char* payload    - Payload to send, may be NULL.
+//                    int length       - Payload bytes.
+//    Output        : int             - Result of the request, or -100 if the connection failed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ClientRequest(int sock, int op, int fd, int arg, char *payload, int length)
+{
+    WIREHEADER hdr;
+    char discard[LOADREADSIZE];
+    unsigned int left = 0;
+    ssize_t n = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.Length = length;
+    hdr.Op = op;
+    hdr.Fd = fd;
+    hdr.Arg = arg;
+
+    if ((send(sock, &hdr, sizeof(hdr), MSG_NOSIGNAL) != sizeof(hdr)) ||
+        ((length != 0) && (send(sock, payload, length, MSG_NOSIGNAL) != length)) ||
+        (recv(sock, &hdr, sizeof(hdr), MSG_WAITALL) != sizeof(hdr)))
+        return -100;
+
+    for (left = hdr.Length; left != 0; left = left - n)
+    {
+        n = recv(sock, discard, (left < sizeof(discard)) ? left : sizeof(discard), 0);
+        if (n <= 0)
+            return -100;
+    }
+    return hdr.Arg;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ConnectServer
+//    Description   : Opens a blocking connection to the server.
+//    Input         : char* path - Path of the server socket.
+//    Output        : int       - Connected socket, or -1 on failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ConnectServer(char *path)
+{
+    struct sockaddr_un addr;
+    int sock = 0;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        return -1;
+
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : LoadQueue
+//    Description   : Queues the next request of a simulated client: an OP_OPEN of the test
+//                    file first, then alternating OP_LSEEK to the start and OP_READ of
+//                    LOADREADSIZE bytes.
+//    Input         : PLOADCLIENT lc  - Client.
+//                    long long now   - Current time (ns), recorded as the send time.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void LoadQueue(PLOADCLIENT lc, long long now)
+{
+    WIREHEADER hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.Tag = lc->Sent;
+    hdr.Fd = lc->Fd;
+
+    if (lc->Sent == 0)
+    {
+        hdr.Op = OP_OPEN;
+        hdr.Arg = READ;
+        hdr.Length = sizeof("loadgen");
+    }
+    else if (lc->Sent % 2 == 1)
+    {
+        hdr.Op = OP_LSEEK;
+        hdr.Arg = START;
+        hdr.Offset = 0;
+    }
+    else
+    {
+        hdr.Op = OP_READ;
+        hdr.Arg = LOADREADSIZE;
+    }
+
+    memcpy(lc->Out + lc->OutUsed, &hdr, sizeof(hdr));
+    lc->OutUsed = lc->OutUsed + sizeof(hdr);
+    if (hdr.Length != 0)
+    {
+        memcpy(lc->Out + lc->OutUsed, "loadgen", hdr.Length);
+        lc->OutUsed = lc->OutUsed + hdr.Length;
+    }
+
+    lc->SendTime[lc->Sent % LOADMAXDEPTH] = now;
+    (lc->Sent)++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : CompareLatency
+//    Description   : qsort comparator for latency samples.
+//    Input         : const void* a, b - Samples to compare.
+//    Output        : int              - Negative, zero or positive.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int CompareLatency(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RunLoadGenerator
+//    Description   : Load generator client. Creates a test file on the server, then drives
+//                    many concurrent connections from one epoll loop, each keeping up to depth
+//                    pipelined requests in flight, and reports throughput and latency
+//                    percentiles. The test file is removed afterwards.
+//    Input         : char* path     - Path of the server socket.
+//                    int clients    - Number of concurrent connections.
+//                    int requests   - Requests per connection.
+//                    int depth      - Requests each connection keeps in flight.
+//    Output        : int           - 0 on success, or error code:
+//                                     -1: Incorrect parameters
+//                                     -2: Server not reachable
+//                                     -3: Memory allocation failure
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunLoadGenerator(char *path, int clients, int requests, int depth)
+{
+    PLOADCLIENT lcs = NULL, lc = NULL;
+    long long *latency = NULL;
+    long long start = 0, now = 0, samples = 0, errors = 0;
+    struct epoll_event ev, events[SERVEREVENTS];
+    char data[4096];
+    WIREHEADER hdr;
+    size_t pos = 0;
+    ssize_t n = 0;
+    int ready = 0;
+    int epfd = 0, sock = 0, created = 0, finished = 0, i = 0, j = 0, fd = 0, ret = 0;
+    size_t insize = 0, outsize = 0;
+
+    if ((clients < 1) || (requests < 2) || (depth < 1) || (depth > LOADMAXDEPTH))
+        return -1;
+
+    RaiseFileLimit();
+    signal(SIGPIPE, SIG_IGN);
+
+    sock = ConnectServer(path);
+    if (sock == -1)
+        return -2;
+    for (i = 0; i < (int)sizeof(data); i++)
+        data[i] = (char)i;
+    fd = ClientRequest(sock, OP_CREATE, 0, READ + WRITE, (char *)"loadgen", sizeof("loadgen"));
+    if (fd >= 0)
+    {
+        created = 1;
+        ClientRequest(sock, OP_WRITE, fd, 0, data, sizeof(data));
+        ClientRequest(sock, OP_CLOSE, fd, 0, NULL, 0);
+    }
+
+    insize = (size_t)LOADMAXDEPTH * (sizeof(WIREHEADER) + LOADREADSIZE + sizeof(FILESTAT));
+    outsize = (size_t)LOADMAXDEPTH * (sizeof(WIREHEADER) + NAMELENGTH);
+    lcs = (PLOADCLIENT)calloc(clients, sizeof(LOADCLIENT));
+    latency = (long long *)malloc((size_t)clients * requests * sizeof(long long));
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if ((lcs == NULL) || (latency == NULL) || (epfd == -1))
+        ret = -3;
+
+    for (i = 0; (ret == 0) && (i < clients); i++)
+    {
+        lc = &lcs[i];
+        lc->Fd = -1;
+        lc->In = (char *)malloc(insize);
+        lc->Out = (char *)malloc(outsize);
+        lc->Socket = ConnectServer(path);
+        if ((lc->In == NULL) || (lc->Out == NULL))
+            ret = -3;
+        else if (lc->Socket == -1)
+            ret = -2;
+        else
+        {
+            fcntl(lc->Socket, F_SETFL, fcntl(lc->Socket, F_GETFL) | O_NONBLOCK);
+            ev.events = EPOLLIN | EPOLLOUT;
+            ev.data.ptr = lc;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, lc->Socket, &ev);
+        }
+    }
+
+    start = NowNanoseconds();
+    for (i = 0; (ret == 0) && (i < clients); i++)
+        LoadQueue(&lcs[i], start);
+
+    while ((ret == 0) && (finished < clients))
+    {
+        ready = epoll_wait(epfd, events, SERVEREVENTS, 1000);
+        for (i = 0; i < ready; i++)
+        {
+            lc = (PLOADCLIENT)events[i].data.ptr;
+
+            while (lc->OutSent < lc->OutUsed)
+            {
+                n = send(lc->Socket, lc->Out + lc->OutSent, lc->OutUsed - lc->OutSent, MSG_NOSIGNAL);
+                if (n <= 0)
+                    break;
+                lc->OutSent = lc->OutSent + n;
+            }
+            if (lc->OutSent == lc->OutUsed)
+                lc->OutSent = lc->OutUsed = 0;
+
+            n = recv(lc->Socket, lc->In + lc->InUsed, insize - lc->InUsed, 0);
+            if (n == 0)
+            {
+                ret = -2;
+                break;
+            }
+            if (n > 0)
+                lc->InUsed = lc->InUsed + n;
+
+            now = NowNanoseconds();
+            pos = 0;
+            while (lc->InUsed - pos >= sizeof(WIREHEADER))
+            {
+                memcpy(&hdr, lc->In + pos, sizeof(hdr));
+                if (lc->InUsed - pos < sizeof(WIREHEADER) + hdr.Length)
+                    break;
+                pos = pos + sizeof(WIREHEADER) + hdr.Length;
+
+                latency[samples++] = now - lc->SendTime[hdr.Tag % LOADMAXDEPTH];
+                if (hdr.Arg < 0)
+                    errors++;
+                (lc->Done)++;
+                if (hdr.Op == OP_OPEN)
+                {
+                    lc->Fd = hdr.Arg;
+                    if (hdr.Arg < 0)
+                        lc->Done = requests;
+                }
+                if (lc->Done == requests)
+                    finished++;
+            }
+            memmove(lc->In, lc->In + pos, lc->InUsed - pos);
+            lc->InUsed = lc->InUsed - pos;
+
+            for (j = lc->Sent - lc->Done; (lc->Fd >= 0) && (j < depth) && (lc->Sent < requests); j++)
+                LoadQueue(lc, now);
+
+            ev.events = (lc->OutSent < lc->OutUsed) ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+            ev.data.ptr = lc;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, lc->Socket, &ev);
+        }
+        if ((ready < 0) && (errno != EINTR))
+            break;
+    }
+    now = NowNanoseconds();
+
+    if ((ret == 0) && (samples != 0))
+    {
+        qsort(latency, samples, sizeof(long long), CompareLatency);
+        printf("Clients : %d\tRequests per client : %d\tPipeline depth : %d\n", clients, requests, depth);
+        printf("Requests : %lld\tErrors : %lld\tSeconds : %.3f\tRequests/sec : %.0f\n", samples, errors,
+               (now - start) / 1e9, samples / ((now - start) / 1e9));
+        printf("Latency (us) : p50 %.1f\tp99 %.1f\tp999 %.1f\tmax %.1f\n", latency[samples / 2] / 1e3,
+               latency[samples * 99 / 100] / 1e3, latency[samples * 999 / 1000] / 1e3, latency[samples - 1] / 1e3);
+    }
+
+    for (i = 0; (lcs != NULL) && (i < clients); i++)
+    {
+        if (lcs[i].Socket > 0)
+            close(lcs[i].Socket);
+        free(lcs[i].In);
+        free(lcs[i].Out);
+    }
+    if (created)
+        ClientRequest(sock, OP_RM, 0, 0, (char *)"loadgen", sizeof("loadgen"));
+    close(sock);
+    if (epfd != -1)
+        close(epfd);
+    free(lcs);
+    free(latency);
+
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : BenchWorker
+//    Description   : Thread body of the microbenchmark. Runs the worker's phase over its own
+//                    files and records the latency of every measured call. Positioning of
+//                    reads and writes and the data stamps are done outside the measured region.
+//                    In the append phase all workers append to the first file of worker 0, each
+//                    through its own APPEND descriptor, as many bytes as the write phase wrote.
+//    Input         : void* arg - PBENCHWORKER of the thread.
+//    Output        : void*    - Always NULL.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void *BenchWorker(void *arg)
+{
+    PBENCHWORKER w = (PBENCHWORKER)arg;
+    long long start = 0, offset = 0, stamp = 0;
+    int i = 0, j = 0, f = 0, count = 0, ret = 0;
+
+    count = ((w->Phase == BENCH_CREATE) || (w->Phase == BENCH_OPEN) || (w->Phase == BENCH_CLOSE) ||
+             (w->Phase == BENCH_RM)) ? w->Files : w->Ops;
+    if (w->Phase == BENCH_APPEND)
+        count = w->Files * w->Slots;
+    w->Samples = count;
+    w->Errors = 0;
+
+    if (w->Phase == BENCH_APPEND)
+        w->WriteFds[0] = OpenFile((char *)"bench_0_0", WRITE + APPEND);
+    if (w->Phase == BENCH_WRITE)
+    {
+        for (f = 0; f < w->Files; f++)
+            w->WriteFds[f] = OpenFile(w->Names + f * NAMELENGTH, WRITE);
+    }
+    if (w->Phase == BENCH_RM)
+    {
+        for (f = 0; f < w->Files; f++)
+        {
+            if (w->Fds[f] >= 0)
+                CloseFileByName(w->Fds[f]);
+            w->Fds[f] = -1;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (w->Random != 0)
+        {
+            f = rand_r(&w->Seed) % w->Files;
+            offset = (long long)(rand_r(&w->Seed) % w->Slots) * w->IoSize;
+        }
+        else
+        {
+            f = i % w->Files;
+            offset = (long long)((i / w->Files) % w->Slots) * w->IoSize;
+        }
+
+        switch (w->Phase)
+        {
+        case BENCH_CREATE:
+            start = NowNanoseconds();
+            w->Fds[i] = CreateFile(w->Names + i * NAMELENGTH, READ + WRITE);
+            ret = (w->Fds[i] < 0) ? -1 : 0;
+            break;
+
+        case BENCH_WRITE:
+            // Stamp every block so deduplication does not fold the writes together
+            for (j = 0; j + (int)sizeof(stamp) <= w->IoSize; j = j + BLOCKSIZE)
+            {
+                stamp = ((long long)w->Id << 40) + (long long)i * (BENCHMAXIOSIZE / BLOCKSIZE) + j / BLOCKSIZE;
+                memcpy(w->Buffer + j, &stamp, sizeof(stamp));
+            }
+            LseekFile(w->WriteFds[f], offset, START);
+            start = NowNanoseconds();
+            ret = (WriteFile(w->WriteFds[f], w->Buffer, w->IoSize) == w->IoSize) ? 0 : -1;
+            break;
+
+        case BENCH_LSEEK:
+            start = NowNanoseconds();
+            ret = LseekFile(w->Fds[f], offset, START);
+            break;
+
+        case BENCH_READ:
+            LseekFile(w->Fds[f], offset, START);
+            start = NowNanoseconds();
+            ret = (ReadFile(w->Fds[f], w->Buffer, w->IoSize) == w->IoSize) ? 0 : -1;
+            break;
+
+        case BENCH_APPEND:
+            start = NowNanoseconds();
+            ret = (WriteFile(w->WriteFds[0], w->Buffer, w->IoSize) == w->IoSize) ? 0 : -1;
+            break;
+
+        case BENCH_LOOKUP:
+            start = NowNanoseconds();
+            pthread_rwlock_rdlock(&NAMEINDEXobj.Lock);
+            ret = (Get_Inode(w->Names + f * NAMELENGTH) == NULL) ? -1 : 0;
+            pthread_rwlock_unlock(&NAMEINDEXobj.Lock);
+            break;
+
+        case BENCH_OPEN:
+            start = NowNanoseconds();
+            w->OpenFds[i] = OpenFile(w->Names + i * NAMELENGTH, READ);
+            ret = (w->OpenFds[i] < 0) ? -1 : 0;
+            break;
+
+        case BENCH_CLOSE:
+            start = NowNanoseconds();
+            ret = CloseFileByName(w->OpenFds[i]);
+            break;
+
+        case BENCH_RM:
+            start = NowNanoseconds();
+            ret = rm_File(w->Names + i * NAMELENGTH);
+            break;
+        }
+        w->Latency[i] = NowNanoseconds() - start;
+        if (ret < 0)
+            w->Errors++;
+    }
+
+    // Every file ends up Slots * IoSize long, so reads and seeks of later phases stay in range
+    if (w->Phase == BENCH_WRITE)
+    {
+        for (f = 0; f < w->Files; f++)
+        {
+            if (w->WriteFds[f] < 0)
+                continue;
+            LseekFile(w->WriteFds[f], (long long)w->Slots * w->IoSize, START);
+            CloseFileByName(w->WriteFds[f]);
+            w->WriteFds[f] = -1;
+        }
+    }
+    if (w->Phase == BENCH_APPEND)
+    {
+        if (w->WriteFds[0] >= 0)
+            CloseFileByName(w->WriteFds[0]);
+        w->WriteFds[0] = -1;
+    }
+    if (w->Phase == BENCH_CLOSE)
+    {
+        for (f = 0; f < w->Files; f++)
+            w->OpenFds[f] = -1;
+    }
+
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : BenchPhase
+//    Description   : Runs one benchmark phase on all workers and appends its result object to
+//                    the JSON output: throughput over the wall time of the phase and latency
+//                    percentiles over the calls of all threads.
+//    Input         : PBENCHWORKER workers - Prepared workers.
+//                    int threads          - Number of workers.
+//                    int phase            - BENCH_CREATE to BENCH_RM.
+//                    long long* latency   - Room for the samples of all workers.
+//                    FILE* out            - JSON output.
+//                    int first            - 1 for the first result of the output.
+//    Output        : int                 - 0 on success, or -1 if a thread could not be
+//                                           started.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int BenchPhase(PBENCHWORKER workers, int threads, int phase, long long *latency, FILE *out, int first)
+{
+    const char *names[BENCHPHASES] = {"create", "write", "lseek", "read", "append", "lookup", "open", "close", "rm"};
+    long long start = 0, stop = 0, samples = 0, errors = 0;
+    double seconds = 0;
+    int i = 0, started = 0;
+
+    start = NowNanoseconds();
+    for (i = 0; i < threads; i++)
+    {
+        workers[i].Phase = phase;
+        if (pthread_create(&workers[i].Thread, NULL, BenchWorker, &workers[i]) != 0)
+            break;
+        started++;
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(workers[i].Thread, NULL);
+        memcpy(latency + samples, workers[i].Latency, workers[i].Samples * sizeof(long long));
+        samples = samples + workers[i].Samples;
+        errors = errors + workers[i].Errors;
+    }
+    stop = NowNanoseconds();
+
+    if ((started != threads) || (samples == 0))
+        return -1;
+
+    qsort(latency, samples, sizeof(long long), CompareLatency);
+    seconds = (stop - start) / 1e9;
+    fprintf(out, "%s    {\"op\": \"%s\", \"pattern\": \"%s\", \"threads\": %d, \"files\": %d, \"io_size\": %d, "
+                 "\"ops\": %lld, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+                 "\"p999_us\": %.3f, \"max_us\": %.3f, \"errors\": %lld}",
+            (first != 0) ? "" : ",\n", names[phase], (workers[0].Random != 0) ? "rand" : "seq", threads,
+            workers[0].Files, workers[0].IoSize, samples, seconds, samples / seconds, latency[samples / 2] / 1e3,
+            latency[samples * 99 / 100] / 1e3, latency[samples * 999 / 1000] / 1e3, latency[samples - 1] / 1e3,
+            errors);
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ParseBenchList
+//    Description   : Parses a comma separated benchmark parameter list.
+//    Input         : char* list      - List text.
+//                    int* values     - Receives up to BENCHMAXLIST values.
+//                    int patterns    - 1 if the entries are seq or rand (stored as 0 or 1),
+//                                      0 if they are positive numbers.
+//    Output        : int            - Number of values, or -1 if the list is malformed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ParseBenchList(char *list, int *values, int patterns)
+{
+    char copy[SHELLLINESIZE];
+    char *token = NULL, *save = NULL, *end = NULL;
+    int count = 0;
+    long value = 0;
+
+    if (strlen(list) >= sizeof(copy))
+        return -1;
+    strcpy(copy, list);
+
+    for (token = strtok_r(copy, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save))
+    {
+        if (count == BENCHMAXLIST)
+            return -1;
+
+        if (patterns != 0)
+        {
+            if (strcmp(token, "seq") == 0)
+                value = 0;
+            else if (strcmp(token, "rand") == 0)
+                value = 1;
+            else
+                return -1;
+        }
+        else
+        {
+            value = strtol(token, &end, 10);
+            if ((*end != '\0') || (value < 1) || (value > BENCHMAXIOSIZE))
+                return -1;
+        }
+        values[count++] = (int)value;
+    }
+
+    return (count == 0) ? -1 : count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RunBenchmark
+//    Description   : Microbenchmark of the core file operations. For every combination of
+//                    thread count, files per thread, I/O size and access pattern, runs the
+//                    create, write, lseek, read, append, lookup, open, close and rm phases
+//                    against the file system API directly and writes throughput and latency
+//                    percentiles of each phase as JSON. All benchmark files are removed
+//                    afterwards.
+//    Input         : char* output    - Path of the JSON output file.
+//                    char* threads   - Thread counts, comma separated.
+//                    char* files     - Files per thread, comma separated.
+//                    char* sizes     - I/O sizes in bytes, comma separated.
+//                    char* patterns  - Access patterns (seq, rand), comma separated.
+//                    int ops         - Calls per thread of the write, lseek, read and lookup
+//                                      phases.
+//    Output        : int            - Number of results on success, or error code:
+//                                      -1: Incorrect parameters
+//                                      -2: Not enough free inodes
+//                                      -3: Output file could not be created
+//                                      -4: Memory allocation failure
+//                                      -5: Thread creation failure
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunBenchmark(char *output, char *threads, char *files, char *sizes, char *patterns, int ops)
+{
+    int tlist[BENCHMAXLIST], klist[BENCHMAXLIST], olist[BENCHMAXLIST], plist[BENCHMAXLIST];
+    int tcount = 0, kcount = 0, ocount = 0, pcount = 0;
+    int maxthreads = 0, maxfiles = 0, maxsize = 0, samples = 0;
+    int t = 0, k = 0, o = 0, p = 0, i = 0, f = 0, phase = 0, results = 0, ret = 0;
+    BENCHWORKER workers[BENCHMAXTHREADS];
+    PBENCHWORKER w = NULL;
+    long long *latency = NULL;
+    FILE *out = NULL;
+
+    tcount = ParseBenchList(threads, tlist, 0);
+    kcount = ParseBenchList(files, klist, 0);
+    ocount = ParseBenchList(sizes, olist, 0);
+    pcount = ParseBenchList(patterns, plist, 1);
+    if ((tcount < 0) || (kcount < 0) || (ocount < 0) || (pcount < 0) || (ops < 1))
+        return -1;
+
+    for (i = 0; i < tcount; i++)
+        maxthreads = (tlist[i] > maxthreads) ? tlist[i] : maxthreads;
+    for (i = 0; i < kcount; i++)
+        maxfiles = (klist[i] > maxfiles) ? klist[i] : maxfiles;
+    for (i = 0; i < ocount; i++)
+        maxsize = (olist[i] > maxsize) ? olist[i] : maxsize;
+    if (maxthreads > BENCHMAXTHREADS)
+        return -1;
+    if ((long long)maxthreads * maxfiles > __atomic_load_n(&SUPERBLOCKobj.FreeInode, __ATOMIC_RELAXED))
+        return -2;
+
+    samples = (ops > maxfiles) ? ops : maxfiles;
+    memset(workers, 0, sizeof(workers));
+    latency = (long long *)malloc((size_t)maxthreads * samples * sizeof(long long));
+    for (i = 0; (i < maxthreads) && (latency != NULL); i++)
+    {
+        w = &workers[i];
+        w->Names = (char *)malloc((size_t)maxfiles * NAMELENGTH);
+        w->Fds = (long long *)malloc(maxfiles * sizeof(long long));
+        w->WriteFds = (long long *)malloc(maxfiles * sizeof(long long));
+        w->OpenFds = (long long *)malloc(maxfiles * sizeof(long long));
+        w->Buffer = (char *)malloc(maxsize);
+        w->Latency = (long long *)malloc((size_t)samples * sizeof(long long));
+        if ((w->Names == NULL) || (w->Fds == NULL) || (w->WriteFds == NULL) || (w->OpenFds == NULL) ||
+            (w->Buffer == NULL) || (w->Latency == NULL))
+            break;
+    }
+
+    if (i != maxthreads)
+        ret = -4;
+    else
+    {
+        out = fopen(output, "w");
+        if (out == NULL)
+            ret = -3;
+    }
+
+    if (ret == 0)
+        fprintf(out, "{\n  \"benchmark\": \"cvfs\",\n  \"ops_per_thread\": %d,\n  \"results\": [\n", ops);
+
+    for (t = 0; (t < tcount) && (ret == 0); t++)
+    {
+        for (k = 0; (k < kcount) && (ret == 0); k++)
+        {
+            for (o = 0; (o < ocount) && (ret == 0); o++)
+            {
+                for (p = 0; (p < pcount) && (ret == 0); p++)
+                {
+                    for (i = 0; i < tlist[t]; i++)
+                    {
+                        w = &workers[i];
+                        w->Id = i;
+                        w->Files = klist[k];
+                        w->IoSize = olist[o];
+                        w->Random = plist[p];
+                        w->Ops = ops;
+                        w->Slots = ops / klist[k];
+                        if (w->Slots > BENCHMAXFILEBYTES / olist[o])
+                            w->Slots = BENCHMAXFILEBYTES / olist[o];
+                        if (w->Slots < 1)
+                            w->Slots = 1;
+                        w->Seed = (unsigned int)(i + 1) * 2654435761u;
+                        for (f = 0; f < klist[k]; f++)
+                        {
+                            snprintf(w->Names + f * NAMELENGTH, NAMELENGTH, "bench_%d_%d", i, f);
+                            w->Fds[f] = -1;
+                            w->WriteFds[f] = -1;
+                            w->OpenFds[f] = -1;
+                        }
+                        for (f = 0; f < olist[o]; f++)
+                            w->Buffer[f] = (char)('a' + (i + f) % 26);
+                    }
+
+                    for (phase = 0; phase < BENCHPHASES; phase++)
+                    {
+                        if (BenchPhase(workers, tlist[t], phase, latency, out, results == 0) != 0)
+                        {
+                            ret = -5;
+                            break;
+                        }
+                        results++;
+                    }
+
+                    // A failed configuration still removes whatever files its workers created
+                    if (ret != 0)
+                    {
+                        for (i = 0; i < tlist[t]; i++)
+                        {
+                            workers[i].Phase = BENCH_RM;
+                            BenchWorker(&workers[i]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (out != NULL)
+    {
+        fprintf(out, "\n  ]\n}\n");
+        fclose(out);
+    }
+    for (i = 0; i < maxthreads; i++)
+    {
+        free(workers[i].Names);
+        free(workers[i].Fds);
+        free(workers[i].WriteFds);
+        free(workers[i].OpenFds);
+        free(workers[i].Buffer);
+        free(workers[i].Latency);
+    }
+    free(latency);
+
+    return (ret == 0) ? results : ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingExecute
+//    Description   : Runs one submission entry against the file system.
+//    Input         : PVFSSQE sqe - Entry to run.
+//    Output        : long long  - Return value of the operation, or -EINVAL if the entry is
+//                                 malformed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long RingExecute(PVFSSQE sqe)
+{
+    if (((sqe->Op == OP_CREATE) || (sqe->Op == OP_OPEN) || (sqe->Op == OP_STAT) || (sqe->Op == OP_RM) ||
+         (sqe->Op == OP_TRUNCATE)) && (sqe->Name == NULL))
+        return -EINVAL;
+
+    if (((sqe->Op == OP_READ) || (sqe->Op == OP_WRITE) || (sqe->Op == OP_PREAD) || (sqe->Op == OP_PWRITE) ||
+         (sqe->Op == OP_STAT) || (sqe->Op == OP_FSTAT)) &&
+        ((sqe->Buffer == NULL) || (sqe->Length < 0)))
+        return -EINVAL;
+
+    switch (sqe->Op)
+    {
+    case OP_CREATE:
+        return CreateFile(sqe->Name, sqe->Arg);
+    case OP_OPEN:
+        return OpenFile(sqe->Name, sqe->Arg);
+    case OP_CLOSE:
+        return CloseFileByName(sqe->Fd);
+    case OP_READ:
+        return ReadFile(sqe->Fd, sqe->Buffer, sqe->Length);
+    case OP_WRITE:
+        return WriteFile(sqe->Fd, sqe->Buffer, sqe->Length);
+    case OP_LSEEK:
+        return LseekFile(sqe->Fd, sqe->Offset, sqe->Arg);
+    case OP_STAT:
+        return StatFile(sqe->Name, (PFILESTAT)sqe->Buffer);
+    case OP_FSTAT:
+        return FstatFile(sqe->Fd, (PFILESTAT)sqe->Buffer);
+    case OP_RM:
+        return rm_File(sqe->Name);
+    case OP_TRUNCATE:
+        return truncate_File(sqe->Name);
+    case OP_PREAD:
+        return PreadFile(sqe->Fd, sqe->Buffer, sqe->Length, sqe->Offset);
+    case OP_PWRITE:
+        return PwriteFile(sqe->Fd, sqe->Buffer, sqe->Length, sqe->Offset);
+    }
+
+    return -EINVAL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingComplete
+//    Description   : Posts the results of a worker's batch to the completion ring with one
+//                    lock round trip, waiting for the caller to reap if the ring is full, and
+//                    signals the eventfd.
+//    Input         : PVFSRING ring  - Ring.
+//                    PVFSCQE done   - Completions to post.
+//                    int count      - Number of completions.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RingComplete(PVFSRING ring, PVFSCQE done, int count)
+{
+    unsigned long long one = 1;
+    int i = 0;
+
+    pthread_mutex_lock(&ring->CqLock);
+    for (i = 0; i < count; i++)
+    {
+        while ((ring->CqTail - ring->CqHead == ring->CqEntries) && (ring->Stop == 0))
+            pthread_cond_wait(&ring->CqSpace, &ring->CqLock);
+
+        if (ring->CqTail - ring->CqHead < ring->CqEntries)
+        {
+            ring->Cq[ring->CqTail & (ring->CqEntries - 1)] = done[i];
+            ring->CqTail = ring->CqTail + 1;
+        }
+    }
+    ring->Inflight = ring->Inflight - count;
+    ring->Completed = ring->Completed + count;
+    pthread_cond_broadcast(&ring->CqReady);
+    pthread_mutex_unlock(&ring->CqLock);
+
+    if (ring->EventFd != -1)
+        write(ring->EventFd, &one, sizeof(one));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingWorker
+//    Description   : Worker thread of a ring. Takes up to RINGWORKERBATCH entries per lock round
+//                    trip, never splitting a linked chain, and runs them in order. Within a
+//                    chain, SQE_CHAINFD entries use the descriptor the chain opened last; a
+//                    failed SQE_LINK entry cancels the rest of the chain, a failed
+//                    SQE_HARDLINK entry does not.
+//    Input         : void* arg - PVFSRING of the worker.
+//    Output        : void*    - Always NULL.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void *RingWorker(void *arg)
+{
+    PVFSRING ring = (PVFSRING)arg;
+    VFSSQE batch[RINGWORKERBATCH + RINGMAXCHAIN];
+    VFSCQE done[RINGWORKERBATCH + RINGMAXCHAIN];
+    int count = 0, i = 0, broken = 0;
+    long long fd = -1;
+
+    while (1)
+    {
+        pthread_mutex_lock(&ring->SqLock);
+        while ((ring->Stop == 0) && (ring->SqHead == ring->SqTail))
+            pthread_cond_wait(&ring->SqReady, &ring->SqLock);
+
+        if (ring->SqHead == ring->SqTail)
+        {
+            pthread_mutex_unlock(&ring->SqLock);
+            break;
+        }
+
+        count = 0;
+        while ((ring->SqHead != ring->SqTail) &&
+               ((count < RINGWORKERBATCH) || (batch[count - 1].Flags & (SQE_LINK | SQE_HARDLINK))))
+        {
+            batch[count] = ring->Sq[ring->SqHead & (ring->SqEntries - 1)];
+            count++;
+            __atomic_store_n(&ring->SqHead, ring->SqHead + 1, __ATOMIC_RELEASE);
+        }
+        if (ring->SqHead != ring->SqTail)
+            pthread_cond_signal(&ring->SqReady);
+        pthread_mutex_unlock(&ring->SqLock);
+
+        fd = -1;
+        broken = 0;
+        for (i = 0; i < count; i++)
+        {
+            done[i].UserData = batch[i].UserData;
+            if (broken)
+            {
+                done[i].Result = -ECANCELED;
+            }
+            else
+            {
+                if (batch[i].Flags & SQE_CHAINFD)
+                    batch[i].Fd = fd;
+
+                done[i].Result = RingExecute(&batch[i]);
+                if (((batch[i].Op == OP_CREATE) || (batch[i].Op == OP_OPEN)) && (done[i].Result >= 0))
+                    fd = done[i].Result;
+                if ((done[i].Result < 0) && (batch[i].Flags & SQE_LINK))
+                    broken = 1;
+            }
+
+            if ((batch[i].Flags & (SQE_LINK | SQE_HARDLINK)) == 0)
+            {
+                fd = -1;
+                broken = 0;
+            }
+        }
+
+        RingComplete(ring, done, count);
+    }
+
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingDestroy
+//    Description   : Stops the workers of a ring once they have run every submitted entry and
+//                    releases the ring. Completions nobody reaps are dropped.
+//    Input         : PVFSRING ring - Ring to destroy.
+//    Output        : None
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RingDestroy(PVFSRING ring)
+{
+    int i = 0;
+
+    pthread_mutex_lock(&ring->SqLock);
+    pthread_mutex_lock(&ring->CqLock);
+    ring->Stop = 1;
+    pthread_cond_broadcast(&ring->CqSpace);
+    pthread_mutex_unlock(&ring->CqLock);
+    pthread_cond_broadcast(&ring->SqReady);
+    pthread_mutex_unlock(&ring->SqLock);
+
+    for (i = 0; i < ring->Workers; i++)
+        pthread_join(ring->Threads[i], NULL);
+
+    if (ring->EventFd != -1)
+        close(ring->EventFd);
+    pthread_mutex_destroy(&ring->SqLock);
+    pthread_cond_destroy(&ring->SqReady);
+    pthread_mutex_destroy(&ring->CqLock);
+    pthread_cond_destroy(&ring->CqReady);
+    pthread_cond_destroy(&ring->CqSpace);
+    free(ring->Sq);
+    free(ring->Cq);
+    ring->Sq = NULL;
+    ring->Cq = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingCreate
+//    Description   : Creates a submission/completion ring served by a pool of worker threads.
+//    Input         : PVFSRING ring     - Ring to initialise.
+//                    int entries       - Submission ring size, a power of two.
+//                    int workers       - Number of worker threads.
+//                    int notify        - Non zero to signal completions on ring->EventFd.
+//    Output        : int              - 0 on success, or error code:
+//                                         -1: Incorrect parameters
+//                                         -2: Memory allocation failure
+//                                         -3: Worker threads could not be started
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RingCreate(PVFSRING ring, int entries, int workers, int notify)
+{
+    if ((entries < 1) || (entries > RINGMAXENTRIES) || ((entries & (entries - 1)) != 0) || (workers < 1) ||
+        (workers > RINGMAXWORKERS))
+        return -1;
+
+    memset(ring, 0, sizeof(VFSRING));
+    ring->SqEntries = entries;
+    ring->CqEntries = entries * 2;
+    ring->Sq = (PVFSSQE)calloc(ring->SqEntries, sizeof(VFSSQE));
+    ring->Cq = (PVFSCQE)calloc(ring->CqEntries, sizeof(VFSCQE));
+    ring->EventFd = notify ? eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK) : -1;
+    if ((ring->Sq == NULL) || (ring->Cq == NULL) || (notify && (ring->EventFd == -1)))
+    {
+        if (ring->EventFd != -1)
+            close(ring->EventFd);
+        free(ring->Sq);
+        free(ring->Cq);
+        return -2;
+    }
+
+    pthread_mutex_init(&ring->SqLock, NULL);
+    pthread_cond_init(&ring->SqReady, NULL);
+    pthread_mutex_init(&ring->CqLock, NULL);
+    pthread_cond_init(&ring->CqReady, NULL);
+    pthread_cond_init(&ring->CqSpace, NULL);
+
+    for (ring->Workers = 0; ring->Workers < workers; ring->Workers++)
+    {
+        if (pthread_create(&ring->Threads[ring->Workers], NULL, RingWorker, ring) != 0)
+        {
+            RingDestroy(ring);
+            return -3;
+        }
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingGetSqe
+//    Description   : Returns the next free submission entry, cleared. The entry is queued by the
+//                    next RingSubmit. Only one thread may submit to a ring.
+//    Input         : PVFSRING ring - Ring.
+//    Output        : PVFSSQE      - Entry, or NULL if the submission ring is full.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+PVFSSQE RingGetSqe(PVFSRING ring)
+{
+    PVFSSQE sqe = NULL;
+
+    if (ring->SqPending - __atomic_load_n(&ring->SqHead, __ATOMIC_ACQUIRE) == ring->SqEntries)
+        return NULL;
+
+    sqe = &ring->Sq[ring->SqPending & (ring->SqEntries - 1)];
+    memset(sqe, 0, sizeof(VFSSQE));
+    ring->SqPending = ring->SqPending + 1;
+    return sqe;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingSpace
+//    Description   : Returns how many submission entries RingGetSqe can still hand out.
+//    Input         : PVFSRING ring - Ring.
+//    Output        : int          - Number of free entries.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RingSpace(PVFSRING ring)
+{
+    return ring->SqEntries - (ring->SqPending - __atomic_load_n(&ring->SqHead, __ATOMIC_ACQUIRE));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingSubmit
+//    Description   : Hands every entry filled since the last call to the workers with one lock
+//                    round trip. A chain never continues past the end of a submission.
+//    Input         : PVFSRING ring - Ring.
+//    Output        : int          - Number of entries submitted, or -1 if a chain is longer than
+//                                   RINGMAXCHAIN (the entries are then discarded).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RingSubmit(PVFSRING ring)
+{
+    unsigned int i = 0, count = ring->SqPending - ring->SqTail;
+    int chain = 0;
+    PVFSSQE sqe = NULL;
+
+    if (count == 0)
+        return 0;
+
+    for (i = ring->SqTail; i != ring->SqPending; i++)
+    {
+        sqe = &ring->Sq[i & (ring->SqEntries - 1)];
+        chain = (sqe->Flags & (SQE_LINK | SQE_HARDLINK)) ? chain + 1 : 0;
+        if (chain >= RINGMAXCHAIN)
+        {
+            ring->SqPending = ring->SqTail;
+            return -1;
+        }
+    }
+    sqe->Flags = sqe->Flags & ~(SQE_LINK | SQE_HARDLINK);
+
+    pthread_mutex_lock(&ring->CqLock);
+    ring->Inflight = ring->Inflight + count;
+    ring->Submitted = ring->Submitted + count;
+    pthread_mutex_unlock(&ring->CqLock);
+
+    pthread_mutex_lock(&ring->SqLock);
+    ring->SqTail = ring->SqPending;
+    if (count > RINGWORKERBATCH)
+        pthread_cond_broadcast(&ring->SqReady);
+    else
+        pthread_cond_signal(&ring->SqReady);
+    pthread_mutex_unlock(&ring->SqLock);
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingReap
+//    Description   : Copies completions out of the completion ring. With wait 0 it only polls;
+//                    otherwise it blocks until wait completions are available or nothing is
+//                    in flight any more.
+//    Input         : PVFSRING ring   - Ring.
+//                    PVFSCQE cqes    - Receives the completions.
+//                    int max         - Capacity of cqes.
+//                    int wait        - Completions to wait for.
+//    Output        : int            - Number of completions copied.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RingReap(PVFSRING ring, PVFSCQE cqes, int max, int wait)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&ring->CqLock);
+    while (((int)(ring->CqTail - ring->CqHead) < wait) && (ring->Inflight > 0))
+        pthread_cond_wait(&ring->CqReady, &ring->CqLock);
+
+    while ((count < max) && (ring->CqHead != ring->CqTail))
+    {
+        cqes[count] = ring->Cq[ring->CqHead & (ring->CqEntries - 1)];
+        ring->CqHead = ring->CqHead + 1;
+        count++;
+    }
+    if (count != 0)
+        pthread_cond_broadcast(&ring->CqSpace);
+    pthread_mutex_unlock(&ring->CqLock);
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingTestReap
+//    Description   : Waits on the ring's eventfd, reaps every completion available and counts
+//                    failed ones and short reads or writes. The low two bits of UserData
+//                    give the position of the entry in its chain.
+//    Input         : PVFSRING ring       - Ring.
+//                    long long* errors   - Incremented per failed completion.
+//    Output        : int                - Number of completions reaped.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RingTestReap(PVFSRING ring, long long *errors)
+{
+    VFSCQE cqes[RINGTESTENTRIES];
+    struct pollfd pfd;
+    unsigned long long value = 0;
+    int count = 0, i = 0;
+
+    pfd.fd = ring->EventFd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, 100);
+    read(ring->EventFd, &value, sizeof(value));
+
+    count = RingReap(ring, cqes, RINGTESTENTRIES, 0);
+    for (i = 0; i < count; i++)
+    {
+        if ((cqes[i].Result < 0) ||
+            ((((cqes[i].UserData & 3) == 1) || ((cqes[i].UserData & 3) == 2)) && (cqes[i].Result != RINGTESTSIZE)))
+            (*errors)++;
+    }
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RingTestPhase
+//    Description   : Runs one phase of the ring test over every file and waits for it to
+//                    finish: 0 queues create→write→close chains, 1 open→read→close chains,
+//                    2 removes the files.
+//    Input         : PVFSRING ring      - Ring.
+//                    int phase          - Phase to run.
+//                    int files          - Number of files.
+//                    char* names        - File names, NAMELENGTH bytes each.
+//                    char* buffers      - Read buffers, RINGTESTSIZE bytes per file.
+//                    char* data         - Data written to every file.
+//                    long long* errors  - Incremented per failed operation.
+//    Output        : long long         - Number of operations run.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+long long RingTestPhase(PVFSRING ring, int phase, int files, char *names, char *buffers, char *data,
+                        long long *errors)
+{
+    PVFSSQE sqe = NULL;
+    long long queued = 0, reaped = 0;
+    int i = 0;
+
+    for (i = 0; i < files; i++)
+    {
+        while (RingSpace(ring) < 3)
+        {
+            RingSubmit(ring);
+            reaped = reaped + RingTestReap(ring, errors);
+        }
+
+        sqe = RingGetSqe(ring);
+        sqe->Name = names + (size_t)i * NAMELENGTH;
+        sqe->UserData = ((unsigned long long)i << 2) | 0;
+        if (phase == 2)
+        {
+            sqe->Op = OP_RM;
+            queued++;
+            continue;
+        }
+        sqe->Op = (phase == 0) ? OP_CREATE : OP_OPEN;
+        sqe->Arg = (phase == 0) ? READ + WRITE : READ;
+        sqe->Flags = SQE_LINK;
+
+        sqe = RingGetSqe(ring);
+        sqe->Op = (phase == 0) ? OP_WRITE : OP_READ;
+        sqe->Buffer = (phase == 0) ? data : buffers + (size_t)i * RINGTESTSIZE;
+        sqe->Length = RINGTESTSIZE;
+        sqe->Flags = SQE_HARDLINK | SQE_CHAINFD;
+        sqe->UserData = ((unsigned long long)i << 2) | ((phase == 0) ? 1 : 2);
+
+        sqe = RingGetSqe(ring);
+        sqe->Op = OP_CLOSE;
+        sqe->Flags = SQE_CHAINFD;
+        sqe->UserData = ((unsigned long long)i << 2) | 3;
+        queued = queued + 3;
+    }
+
+    RingSubmit(ring);
+    while (reaped < queued)
+        reaped = reaped + RingTestReap(ring, errors);
+
+    return queued;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ring_test
+//    Description   : Exercises the ring API: for each round, creates and writes files through
+//                    linked chains, reads them back and checks their contents, then removes
+//                    them, reaping completions through the eventfd. The same operations are then
+//                    run synchronously for comparison.
+//    Input         : int files    - Number of files.
+//                    int rounds   - Number of rounds.
+//                    int workers  - Number of ring worker threads.
+//    Output        : int         - 0 on success, or error code:
+//                                   -1: Incorrect parameters
+//                                   -2: Not enough free inodes
+//                                   -3: Memory allocation failure
+//                                   -4: Ring could not be created
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ring_test(int files, int rounds, int workers)
+{
+    VFSRING ring;
+    char *names = NULL, *buffers = NULL, *data = NULL;
+    long long ops = 0, errors = 0, mismatches = 0, start = 0, ringtime = 0, synctime = 0, syncerrors = 0;
+    int i = 0, r = 0, opencount = UFDTobj.OpenCount;
+    long long fd = 0;
+
+    if ((files < 1) || (rounds < 1) || (workers < 1) || (workers > RINGMAXWORKERS))
+        return -1;
+
+    if (__atomic_load_n(&SUPERBLOCKobj.FreeInode, __ATOMIC_RELAXED) < files)
+        return -2;
+
+    names = (char *)calloc(files, NAMELENGTH);
+    buffers = (char *)malloc((size_t)files * RINGTESTSIZE);
+    data = (char *)malloc(RINGTESTSIZE);
+    if ((names == NULL) || (buffers == NULL) || (data == NULL))
+    {
+        free(names);
+        free(buffers);
+        free(data);
+        return -3;
+    }
+    for (i = 0; i < files; i++)
+        snprintf(names + (size_t)i * NAMELENGTH, NAMELENGTH, "ring_%d", i);
+    for (i = 0; i < RINGTESTSIZE; i++)
+        data[i] = (char)(i % 251);
+
+    if (RingCreate(&ring, RINGTESTENTRIES, workers, 1) != 0)
+    {
+        free(names);
+        free(buffers);
+        free(data);
+        return -4;
+    }
+
+    start = NowNanoseconds();
+    for (r = 0; r < rounds; r++)
+    {
+        memset(buffers, 0, (size_t)files * RINGTESTSIZE);
+        ops = ops + RingTestPhase(&ring, 0, files, names, buffers, data, &errors);
+        ops = ops + RingTestPhase(&ring, 1, files, names, buffers, data, &errors);
+        for (i = 0; i < files; i++)
+            if (memcmp(buffers + (size_t)i * RINGTESTSIZE, data, RINGTESTSIZE) != 0)
+                mismatches++;
+        ops = ops + RingTestPhase(&ring, 2, files, names, buffers, data, &errors);
+    }
+    ringtime = NowNanoseconds() - start;
+    RingDestroy(&ring);
+
+    start = NowNanoseconds();
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < files; i++)
+        {
+            fd = CreateFile(names + (size_t)i * NAMELENGTH, READ + WRITE);
+            if ((fd < 0) || (WriteFile(fd, data, RINGTESTSIZE) != RINGTESTSIZE) || (CloseFileByName(fd) != 0))
+                syncerrors++;
+        }
+        for (i = 0; i < files; i++)
+        {
+            fd = OpenFile(names + (size_t)i * NAMELENGTH, READ);
+            if ((fd < 0) || (ReadFile(fd, buffers + (size_t)i * RINGTESTSIZE, RINGTESTSIZE) != RINGTESTSIZE) ||
+                (CloseFileByName(fd) != 0))
+                syncerrors++;
+        }
+        for (i = 0; i < files; i++)
+            if (rm_File(names + (size_t)i * NAMELENGTH) != 0)
+                syncerrors++;
+    }
+    synctime = NowNanoseconds() - start;
+
+    printf("\nMode\tWorkers\tOperations\tSeconds\t\tOps/sec\t\tErrors\n");
+    printf("-------------------------------------------------------------------------------\n");
+    printf("ring\t%d\t%lld\t\t%.3f\t\t%.0f\t\t%lld\n", workers, ops, ringtime / 1e9, ops / (ringtime / 1e9), errors);
+    printf("sync\t1\t%lld\t\t%.3f\t\t%.0f\t\t%lld\n", ops, synctime / 1e9, ops / (synctime / 1e9), syncerrors);
+    printf("-------------------------------------------------------------------------------\n");
+    printf("Contents mismatched : %lld\n", mismatches);
+    printf("Open descriptors : %d before, %d after\n", opencount, UFDTobj.OpenCount);
+
+    free(names);
+    free(buffers);
+    free(data);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : HashCommand
+//    Description   : Seeded FNV-1a hash of a command word, folded to a COMMANDTABLE slot.
+//    Input         : unsigned int seed  - Seed chosen by InitialiseCommandTable.
+//                    char* word         - Command word.
+//                    int length         - Length of the word.
+//    Output        : int               - Slot in COMMANDTABLEobj.Slots.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int HashCommand(unsigned int seed, char *word, int length)
+{
+    unsigned int hash = 2166136261u ^ seed;
+    int i = 0;
+
+    for (i = 0; i < length; i++)
+    {
+        hash = hash ^ (unsigned char)word[i];
+        hash = hash * 16777619u;
+    }
+
+    return (hash ^ (hash >> 15)) & (COMMANDSLOTS - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : InitialiseCommandTable
+//    Description   : Builds a perfect hash of the shell commands by searching for a seed under
+//                    which no two commands share a slot, so that dispatching a command costs
+//                    one hash and one comparison. Also checks that no command takes more
+//                    arguments than the COMMANDMAXARGS entries ParseCommand fills.
+//    Input         : None
+//    Output        : int - 0 on success, or -1 if a command takes too many arguments or no
+//                          collision free seed was found.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int InitialiseCommandTable()
+{
+    unsigned int seed = 0;
+    int i = 0, slot = 0, count = sizeof(Commands) / sizeof(Commands[0]);
+
+    for (i = 0; i < count; i++)
+        if ((Commands[i].MaxArgs > COMMANDMAXARGS) || (Commands[i].MinArgs > Commands[i].MaxArgs))
+            return -1;
+
+    for (seed = 0; seed < 65536; seed++)
+    {
+        memset(COMMANDTABLEobj.Slots, 0, sizeof(COMMANDTABLEobj.Slots));
+
+        for (i = 0; i < count; i++)
+        {
+            slot = HashCommand(seed, (char *)Commands[i].Name, Commands[i].Length);
+            if (COMMANDTABLEobj.Slots[slot] != NULL)
+                break;
+            COMMANDTABLEobj.Slots[slot] = &Commands[i];
+        }
+
+        if (i == count)
+        {
+            COMMANDTABLEobj.Seed = seed;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : NextToken
+//    Description   : Returns the next blank separated word of a NUL terminated line. The word
+//                    is terminated in place, so tokenizing never copies or allocates.
+//    Input         : char** cursor  - Position in the line, advanced past the word and one
+//                                     separator.
+//                    int* length    - Receives the length of the word.
+//    Output        : char*         - Word, or NULL at the end of the line.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+char *NextToken(char **cursor, int *length)
+{
+    char *p = *cursor, *word = NULL;
+
+    while ((*p == ' ') || (*p == '\t'))
+        p++;
+    if (*p == '\0')
+    {
+        *cursor = p;
+        return NULL;
+    }
+
+    word = p;
+    while ((*p != '\0') && (*p != ' ') && (*p != '\t'))
+        p++;
+    *length = p - word;
+
+    if (*p != '\0')
+    {
+        *p = '\0';
+        p++;
+    }
+    *cursor = p;
+    return word;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ParseCommand
+//    Description   : Splits a shell line into its command and arguments and looks the command
+//                    up in the perfect hash. For write, the text after the file name is
+//                    returned untouched as the inline payload.
+//    Input         : char* line       - NUL terminated line, tokenized in place.
+//                    PCOMMAND* cmd    - Receives the command.
+//                    char** args      - Receives up to COMMANDMAXARGS arguments.
+//                    int* argc        - Receives the number of arguments.
+//                    char** payload   - Receives the inline payload of write or pwrite, or NULL.
+//    Output        : int             - 0 on success, 1 for a blank line, or error code:
+//                                        -1: Command not found
+//                                        -2: Incorrect number of parameters
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ParseCommand(char *line, PCOMMAND *cmd, char **args, int *argc, char **payload)
+{
+    char *cursor = line, *word = NULL;
+    int length = 0, i = 0;
+    PCOMMAND entry = NULL;
+
+    *payload = NULL;
+    word = NextToken(&cursor, &length);
+    if (word == NULL)
+        return 1;
+
+    entry = COMMANDTABLEobj.Slots[HashCommand(COMMANDTABLEobj.Seed, word, length)];
+    if ((entry == NULL) || (entry->Length != length) || (memcmp(entry->Name, word, length) != 0))
+        return -1;
+
+    for (i = 0; i < entry->MaxArgs; i++)
+    {
+        args[i] = NextToken(&cursor, &length);
+        if (args[i] == NULL)
+            break;
+    }
+
+    if ((entry->Id == CMD_WRITE) || (entry->Id == CMD_PWRITE))
+    {
+        if (*cursor != '\0')
+            *payload = cursor;
+    }
+    else if (NextToken(&cursor, &length) != NULL)
+    {
+        return -2;
+    }
+
+    if (i < entry->MinArgs)
+        return -2;
+
+    *cmd = entry;
+    *argc = i;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : ExecuteCommand
+//    Description   : Runs one parsed shell command and reports its errors.
+//    Input         : PCOMMAND cmd    - Command.
+//                    char** args     - Its arguments.
+//                    int argc        - Number of arguments.
+//                    char* payload   - Data of write or pwrite, or NULL.
+//                    int length      - Bytes of payload.
+//                    int verbose     - Non zero to also report successful commands.
+//    Output        : int            - 0 on success, -1 if the command failed, or 1 on exit.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ExecuteCommand(PCOMMAND cmd, char **args, int argc, char *payload, int length, int verbose)
+{
+    int ret = 0, remaining = 0, done = 0;
+    long long fd = 0;
+    char *buffer = NULL;
+    FILEVIEW view;
+    FILEMAP map;
+
+    switch (cmd->Id)
+    {
+    case CMD_FIND:
+        ret = find_file(argc, args);
+        if (ret == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (ret == -2)
+            printf("ERROR : Memory allocation failure\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_LS:
+        ret = ls_file((argc == 0) ? NULL : args[0]);
+        if (ret == -1)
+            printf("ERROR : There is no such directory\n");
+        if (ret == -2)
+            printf("ERROR : Not a directory\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_PWD:
+        pwd();
+        return 0;
+
+    case CMD_DCACHE:
+        dcachestat();
+        return 0;
+
+    case CMD_TIERSTAT:
+        if ((TIERobj.Frames == 0) && (TIERobj.Compress == 0))
+        {
+            printf("ERROR : No memory budget or compression is set\n");
+            return -1;
+        }
+        tierstat();
+        return 0;
+
+    case CMD_SNAPSHOT:
+        ret = TakeSnapshot(args[0]);
+        if (ret == -1)
+            printf("ERROR : Invalid snapshot name\n");
+        if (ret == -2)
+            printf("ERROR : There are not enough free inodes\n");
+        if (ret == -3)
+            printf("ERROR : Snapshot already exists\n");
+        if (ret == -4)
+            printf("ERROR : Memory allocation failure\n");
+        if (ret == -5)
+            printf("ERROR : Not supported on a mounted image\n");
+        if (ret == -6)
+            printf("ERROR : A file is memory mapped\n");
+        if ((ret == 0) && verbose)
+            printf("Snapshot /%s/%s taken\n", SNAPSHOTROOT, args[0]);
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_CLONE:
+        ret = CloneFile(args[0], args[1]);
+        if (ret == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (ret == -2)
+            printf("ERROR : There is no such file\n");
+        if (ret == -3)
+            printf("ERROR : Is a directory\n");
+        if (ret == -4)
+            printf("ERROR : There is no inodes\n");
+        if (ret == -5)
+            printf("ERROR : File already exists\n");
+        if (ret == -6)
+            printf("ERROR : There is no such directory\n");
+        if (ret == -7)
+            printf("ERROR : Memory allocation failure\n");
+        if (ret == -8)
+            printf("ERROR : Not supported on a mounted image\n");
+        if (ret == -9)
+            printf("ERROR : File is memory mapped\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_DEDUPSTAT:
+        dedupstat();
+        return 0;
+
+    case CMD_TRACE:
+        if ((argc == 1) && (strcmp(args[0], "start") == 0))
+        {
+            TraceStart();
+            printf("Tracing started\n");
+            return 0;
+        }
+        if ((argc == 1) && (strcmp(args[0], "stop") == 0))
+        {
+            TraceStop();
+            printf("Tracing stopped\n");
+            return 0;
+        }
+        if ((argc != 2) || (strcmp(args[0], "dump") != 0))
+        {
+            printf("ERROR : Incorrect parameters\n");
+            return -1;
+        }
+        ret = TraceDump(args[1]);
+        if (ret == -1)
+            printf("ERROR : Unable to create %s\n", args[1]);
+        if (ret == -2)
+            printf("ERROR : Tracing was never started\n");
+        if (ret >= 0)
+            printf("%d events written to %s\n", ret, args[1]);
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_PERFSTAT:
+        if (argc == 0)
+            ret = perfstat(0);
+        else if (strcmp(args[0], "json") == 0)
+            ret = perfstat(1);
+        else if (strcmp(args[0], "reset") == 0)
+        {
+            PerfReset();
+            printf("Operation counters reset\n");
+        }
+        else
+        {
+            printf("ERROR : Incorrect parameters\n");
+            return -1;
+        }
+        if (ret == -1)
+            printf("ERROR : Memory allocation failure\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_COMPRESS:
+        ret = compress_File(args[0]);
+        if (ret == -1)
+            printf("ERROR : There is no such file\n");
+        if (ret == -2)
+            printf("ERROR : Is a directory\n");
+        if (ret == -3)
+            printf("ERROR : File is busy\n");
+        if (ret == -4)
+            printf("ERROR : Compression is not enabled\n");
+        if ((ret >= 0) && verbose)
+            printf("%d blocks compressed\n", ret);
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_MKDIR:
+        ret = MakeDirectory(args[0]);
+        if (ret == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (ret == -2)
+            printf("ERROR : There is no inodes\n");
+        if (ret == -3)
+            printf("ERROR : File already exists\n");
+        if (ret == -4)
+            printf("ERROR : Memory allocation failure\n");
+        if (ret == -5)
+            printf("ERROR : There is no such directory\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_RMDIR:
+        ret = RemoveDirectory(args[0]);
+        if (ret == -1)
+            printf("ERROR : There is no such directory\n");
+        if (ret == -2)
+            printf("ERROR : Not a directory\n");
+        if (ret == -3)
+            printf("ERROR : Directory not empty\n");
+        if (ret == -4)
+            printf("ERROR : Directory is busy\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_CD:
+        ret = ChangeDirectory(args[0]);
+        if (ret == -1)
+            printf("ERROR : There is no such directory\n");
+        if (ret == -2)
+            printf("ERROR : Not a directory\n");
+        if (ret == -3)
+            printf("ERROR : Path too long\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_CLOSEALL:
+        CloseAllFile();
+        if (verbose)
+            printf("All files closed successfully\n");
+        return 0;
+
+    case CMD_CLEAR:
+        system("clear");
+        return 0;
+
+    case CMD_HELP:
+        DisplayHelp();
+        return 0;
+
+    case CMD_SLABSTAT:
+        slabstat();
+        return 0;
+
+    case CMD_JOURNAL:
+        if (JOURNALobj.Enabled == 0)
+        {
+            printf("ERROR : No image is mounted\n");
+            return -1;
+        }
+        journalstat();
+        return 0;
+
+    case CMD_SYNC:
+        ret = JournalCheckpoint();
+        if (ret == -1)
+            printf("ERROR : Unable to flush image\n");
+        if (ret == -2)
+            printf("ERROR : No image is mounted\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_EXIT:
+        if (verbose)
+            printf("Terminating the Virtual File System\n");
+        return 1;
+
+    case CMD_STAT:
+        ret = stat_file(args[0]);
+        if (ret == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (ret == -2)
+            printf("ERROR : There is no such file\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_FSTAT:
+        ret = fstat_file(atoi(args[0]));
+        if (ret == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (ret == -2)
+            printf("ERROR : There is no such file\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_CLOSE:
+        ret = CloseFileByName(args[0]);
+        if (ret == -1)
+            printf("ERROR : There is no such file\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_RM:
+        ret = rm_File(args[0]);
+        if (ret == -1)
+            printf("ERROR : There is no such file\n");
+        if (ret == -2)
+            printf("ERROR : File is busy\n");
+        if (ret == -3)
+            printf("ERROR : Is a directory\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_MAN:
+        man(args[0]);
+        return 0;
+
+    case CMD_WRITE:
+        fd = GetFDFromName(args[0]);
+        if ((fd == -1) || (payload == NULL) || (length == 0))
+        {
+            printf("ERROR : Incorrect parameter\n");
+            return -1;
+        }
+        ret = WriteFile(fd, payload, length);
+        if (ret == -1)
+            printf("ERROR : Permission denied\n");
+        if (ret == -2)
+            printf("ERROR : There is no sufficient memory to write\n");
+        if (ret == -3)
+            printf("ERROR : It is not a regular file\n");
+        return (ret < 0) ? -1 : 0;
 
-    if (temp == NULL)
-        return -2;
+    case CMD_TRUNCATE:
+        ret = truncate_File(args[0]);
+        if (ret == -1)
+            printf("ERROR : Incorrect parameter\n");
+        if (ret == -2)
+            printf("ERROR : File is busy\n");
+        return (ret < 0) ? -1 : 0;
 
-    printf("\n---------------Statistical Information about file-------------\n");
-    printf("File name : %s\n", temp->FileName);
-    printf("Inode Number %d\n", temp->InodeNumber);
-    printf("File size : %d\n", temp->FileSize);
-    printf("Actual File size : %d\n", temp->FileActualSize);
-    printf("Link count : %d\n", temp->LinkCount);
-    printf("Reference count : %d\n", temp->ReferenceCount);
-
-    if (temp->permission == 1)
-        printf("File Permission : Read only\n");
-    else if (temp->permission == 2)
-        printf("File Permission : Write\n");
-    else if (temp->permission == 3)
-        printf("File Permission : Read & Write\n");
-    printf("--------------------------------------------------------------\n\n");
+    case CMD_STRESS:
+        ret = stress_test(atoi(args[0]), atoi(args[1]));
+        if (ret == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (ret == -2)
+            printf("ERROR : Not enough free inodes\n");
+        if (ret == -3)
+            printf("ERROR : Unable to create stress_shared\n");
+        if (ret == -4)
+            printf("ERROR : Unable to start stress threads\n");
+        return (ret < 0) ? -1 : 0;
 
-    return 0;
+    case CMD_RING:
+        ret = ring_test(atoi(args[0]), atoi(args[1]), atoi(args[2]));
+        if (ret == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (ret == -2)
+            printf("ERROR : Not enough free inodes\n");
+        if (ret == -3)
+            printf("ERROR : Memory allocation failure\n");
+        if (ret == -4)
+            printf("ERROR : Unable to start ring workers\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_CREATE:
+        fd = CreateFile(args[0], atoi(args[1]));
+        if ((fd >= 0) && verbose)
+            printf("File is successfully created with file descriptor : %lld\n", fd);
+        if (fd == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (fd == -2)
+            printf("ERROR : There is no inodes\n");
+        if (fd == -3)
+            printf("ERROR : File already exists\n");
+        if (fd == -4)
+            printf("ERROR : Memory allocation failure\n");
+        if (fd == -5)
+            printf("ERROR : Too many open files\n");
+        if (fd == -6)
+            printf("ERROR : There is no such directory\n");
+        return (fd < 0) ? -1 : 0;
+
+    case CMD_OPEN:
+        fd = OpenFile(args[0], atoi(args[1]));
+        if ((fd >= 0) && verbose)
+            printf("File is successfully opened with file descriptor : %lld\n", fd);
+        if (fd == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (fd == -2)
+            printf("ERROR : File not present\n");
+        if (fd == -3)
+            printf("ERROR : Permission denied\n");
+        if (fd == -4)
+            printf("ERROR : Too many open files\n");
+        if (fd == -5)
+            printf("ERROR : Is a directory\n");
+        return (fd < 0) ? -1 : 0;
+
+    case CMD_READ:
+        fd = GetFDFromName(args[0]);
+        if (fd == -1)
+        {
+            printf("ERROR : File not present\n");
+            return -1;
+        }
+        remaining = atoi(args[1]);
+        if (remaining <= 0)
+        {
+            printf("ERROR : Incorrect parameter\n");
+            return -1;
+        }
+        fflush(stdout);
+        do
+        {
+            ret = ReadFileView(fd, remaining - done, &view);
+            if (ret > 0)
+            {
+                writev(1, view.Segments, view.Count);
+                done = done + ret;
+                ReleaseFileView(&view);
+            }
+        } while ((ret > 0) && (done < remaining));
+
+        if (done > 0)
+            return 0;
+
+        if (ret == -1)
+            printf("ERROR : File not existing\n");
+        if (ret == -2)
+            printf("ERROR : Permission denied\n");
+        if (ret == -3)
+            printf("ERROR : Reached at end of file\n");
+        if (ret == -4)
+            printf("ERROR : It is not a regular file\n");
+        if (ret == -5)
+            printf("ERROR : Unable to read evicted data back\n");
+        if (ret == 0)
+            printf("ERROR : File empty\n");
+        return -1;
+
+    case CMD_PREAD:
+        fd = GetFDFromName(args[0]);
+        remaining = atoi(args[2]);
+        if ((fd == -1) || (atoll(args[1]) < 0) || (remaining <= 0))
+        {
+            printf("ERROR : Incorrect parameter\n");
+            return -1;
+        }
+        buffer = (char *)malloc(remaining);
+        if (buffer == NULL)
+        {
+            printf("ERROR : Memory allocation failure\n");
+            return -1;
+        }
+        ret = PreadFile(fd, buffer, remaining, atoll(args[1]));
+        if (ret > 0)
+        {
+            fflush(stdout);
+            write(1, buffer, ret);
+        }
+        free(buffer);
+
+        if (ret == -1)
+            printf("ERROR : File not existing\n");
+        if (ret == -2)
+            printf("ERROR : Permission denied\n");
+        if (ret == -3)
+            printf("ERROR : Reached at end of file\n");
+        if (ret == -4)
+            printf("ERROR : It is not a regular file\n");
+        if (ret == -5)
+            printf("ERROR : Unable to read evicted data back\n");
+        return (ret > 0) ? 0 : -1;
+
+    case CMD_PWRITE:
+        fd = GetFDFromName(args[0]);
+        if ((fd == -1) || (atoll(args[1]) < 0) || (payload == NULL) || (length == 0))
+        {
+            printf("ERROR : Incorrect parameter\n");
+            return -1;
+        }
+        ret = PwriteFile(fd, payload, length, atoll(args[1]));
+        if (ret == -1)
+            printf("ERROR : Permission denied\n");
+        if (ret == -2)
+            printf("ERROR : There is no sufficient memory to write\n");
+        if (ret == -3)
+            printf("ERROR : It is not a regular file\n");
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_MMAP:
+        fd = GetFDFromName(args[0]);
+        if ((fd == -1) || (atoll(args[2]) <= 0) || ((argc == 4) && ((long long)strlen(args[3]) > atoll(args[2]))))
+        {
+            printf("ERROR : Incorrect parameter\n");
+            return -1;
+        }
+        ret = MapFile(fd, atoll(args[1]), atoll(args[2]), (argc == 4) ? READ + WRITE : READ, &map);
+        if (ret == -1)
+            printf("ERROR : Incorrect parameter\n");
+        if (ret == -2)
+            printf("ERROR : Permission denied\n");
+        if (ret == -3)
+            printf("ERROR : Range goes past the end of file\n");
+        if (ret == -4)
+            printf("ERROR : It is not a regular file\n");
+        if (ret == -5)
+            printf("ERROR : Unable to map the file\n");
+        if (ret < 0)
+            return -1;
+
+        if (argc == 4)
+            memcpy(map.Address, args[3], strlen(args[3]));
+        else
+        {
+            fflush(stdout);
+            write(1, map.Address, map.Length);
+        }
+        ret = UnmapFile(&map);
+        if (ret == -1)
+            printf("ERROR : Unable to journal the written pages\n");
+        if ((ret >= 0) && (argc == 4) && verbose)
+            printf("Dirty pages flushed : %d\n", ret);
+        return (ret < 0) ? -1 : 0;
+
+    case CMD_LSEEK:
+        fd = GetFDFromName(args[0]);
+        if (fd == -1)
+        {
+            printf("ERROR : Incorrect parameter\n");
+            return -1;
+        }
+        ret = LseekFile(fd, atoll(args[1]), atoi(args[2]));
+        if (ret == -1)
+        {
+            printf("ERROR : Unable to perform lseek\n");
+            return -1;
+        }
+        if (ret == -2)
+        {
+            printf("ERROR : No data or hole at or after that offset\n");
+            return -1;
+        }
+        if ((atoi(args[2]) == DATA) || (atoi(args[2]) == HOLE))
+            printf("Offset : %lld\n", TellFile(fd));
+        return 0;
+    }
+
+    return -1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : truncate_File
-//    Description   : Removes all data from a specified file.
-//    Input         : char* name  - Name of the file to truncate.
-//    Output        : int        - 0 on success, or -1 if the file is not found.
+//    Function Name : ReportParseError
+//    Description   : Prints the error of a line ParseCommand rejected.
+//    Input         : int ret - Error code returned by ParseCommand.
+//    Output        : None
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int truncate_File(char *name)
+void ReportParseError(int ret)
 {
-    int fd = GetFDFromName(name);
-    if (fd == -1)
-        return -1;
-
-    memset(UFDTArr[fd].ptrfiletable->ptrinode->Buffer, 0, 1024);
-    UFDTArr[fd].ptrfiletable->readoffset = 0;
-    UFDTArr[fd].ptrfiletable->writeoffset = 0;
-    UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize = 0;
-    return 0;
+    if (ret == -1)
+        printf("\nERROR : Command not found !!!\n");
+    if (ret == -2)
+        printf("ERROR : Incorrect parameters\n");
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//    Function Name : main
-//    Description   : Entry point for the CVFS
-//    Input         : None
-//    Output        : int - Exit status (0 for success).
+//    Function Name : NextLine
+//    Description   : Returns the next line of a script buffer, NUL terminated in place and
+//                    without its line ending.
+//    Input         : char** cursor  - Position in the buffer, advanced to the next line.
+//                    char* end      - End of the buffer (which holds a NUL at end).
+//    Output        : char*         - Line, or NULL at the end of the buffer.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-int main()
+char *NextLine(char **cursor, char *end)
 {
-    char *ptr = NULL;
-    int ret = 0, fd = 0, count = 0;
-    char command[4][80], str[80], arr[1024];
+    char *line = *cursor, *nl = NULL;
 
-    InitialiseSuperBlock();
-    CreateDILB();
+    if (line >= end)
+        return NULL;
 
-    while (1)
-    {
-        fflush(stdin);
-        strcpy(str, "");
+    nl = (char *)memchr(line, '\n', end - line);
+    if (nl == NULL)
+        nl = end;
 
-        printf("\nVFS : > ");
+    *nl = '\0';
+    if ((nl > line) && (nl[-1] == '\r'))
+        nl[-1] = '\0';
+
+    *cursor = nl + 1;
+    return line;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : LoadScript
+//    Description   : Makes a whole script writable in memory with a NUL after its last byte.
+//                    Regular files are mapped privately over an anonymous mapping one page
+//                    larger, so the terminator needs no copy; pipes are read into a buffer.
+//    Input         : int fd         - Descriptor of the script.
+//                    size_t* size   - Receives the script size.
+//                    size_t* mapped - Receives the mapping length, or 0 if the buffer was
+//                                     allocated with malloc.
+//    Output        : char*         - Script, or NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
-        fgets(str, 80, stdin);
-        count = sscanf(str, "%s %s %s %s", command[0], command[1], command[2], command[3]);
+char *LoadScript(int fd, size_t *size, size_t *mapped)
+{
+    struct stat st;
+    size_t page = sysconf(_SC_PAGESIZE), capacity = 0, used = 0;
+    char *buffer = NULL, *newbuf = NULL;
+    ssize_t n = 0;
+
+    if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode))
+    {
+        *size = st.st_size;
+        *mapped = (*size / page + 1) * page;
+        buffer = (char *)mmap(NULL, *mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED)
+            return NULL;
 
-        if (count == 1)
+        if ((*size != 0) &&
+            (mmap(buffer, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED))
         {
-            if (strcmp(command[0], "ls") == 0)
-            {
-                ls_file();
-                continue;
-            }
-            else if (strcmp(command[0], "closeall") == 0)
-            {
-                CloseAllFile();
-                printf("All files closed successfully\n");
-                continue;
-            }
-            else if (strcmp(command[0], "clear") == 0)
-            {
-                system("clear");
-                continue;
-            }
-            else if (strcmp(command[0], "help") == 0)
-            {
-                DisplayHelp();
-                continue;
-            }
-            else if (strcmp(command[0], "exit") == 0)
-            {
-                printf("Terminating the Virtual File System\n");
-                break;
-            }
-            else
-            {
-                printf("\nERROR : Command not found !!!\n");
-                continue;
-            }
+            munmap(buffer, *mapped);
+            return NULL;
         }
-        else if (count == 2)
+        madvise(buffer, *size, MADV_SEQUENTIAL);
+        return buffer;
+    }
+
+    *mapped = 0;
+    while (1)
+    {
+        if (capacity - used < SCRIPTREADSIZE + 1)
         {
-            if (strcmp(command[0], "stat") == 0)
-            {
-                ret = stat_file(command[1]);
-                if (ret == -1)
-                    printf("ERROR : Incorrect parameters\n");
-                if (ret == -2)
-                    printf("ERROR : There is no such file\n");
-                continue;
-            }
-            else if (strcmp(command[0], "fstat") == 0)
-            {
-                ret = fstat_file(atoi(command[1]));
-                if (ret == -1)
-                    printf("ERROR : Incorrect parameters\n");
-                if (ret == -2)
-                    printf("ERROR : There is no such file\n");
-                continue;
-            }
-            else if (strcmp(command[0], "close") == 0)
-            {
-                ret = CloseFileByName(command[1]);
-                if (ret == -1)
-                    printf("ERROR : There is no such file\n");
-                continue;
-            }
-            else if (strcmp(command[0], "rm") == 0)
-            {
-                ret = rm_File(command[1]);
-                if (ret == -1)
-                    printf("ERROR : There is no such file\n");
-                continue;
-            }
-            else if (strcmp(command[0], "man") == 0)
+            capacity = (capacity == 0) ? SCRIPTREADSIZE * 4 : capacity * 2;
+            newbuf = (char *)realloc(buffer, capacity);
+            if (newbuf == NULL)
             {
-                man(command[1]);
-                continue;
+                free(buffer);
+                return NULL;
             }
-            else if (strcmp(command[0], "write") == 0)
-            {
-                fd = GetFDFromName(command[1]);
-                if (fd == -1)
-                {
-                    printf("ERROR : Incorrect parameter\n");
-                    continue;
-                }
-                printf("Enter the data : \n");
-                scanf("%[^\n]", arr);
+            buffer = newbuf;
+        }
 
-                ret = strlen(arr);
-                if (ret == 0)
-                {
-                    printf("ERROR : Incorrect parameter\n");
-                    continue;
-                }
-                ret = WriteFile(fd, arr, ret);
-                if (ret == -1)
-                    printf("ERROR : Permission denied\n");
-                if (ret == -2)
-                    printf("ERROR : There is no sufficient memory to write\n");
-                if (ret == -3)
-                    printf("ERROR : It is not a regular file\n");
-            }
-            else if (strcmp(command[0], "truncate") == 0)
-            {
-                ret = truncate_File(command[1]);
-                if (ret == -1)
-                    printf("ERROR : Incorrect parameter\n");
-            }
-            else
-            {
-                printf("\nERROR : Command not found !!!\n");
-                continue;
-            }
+        n = read(fd, buffer + used, SCRIPTREADSIZE);
+        if (n > 0)
+            used = used + n;
+        else if (n == 0)
+            break;
+        else if (errno != EINTR)
+        {
+            free(buffer);
+            return NULL;
         }
-        else if (count == 3)
+    }
+
+    buffer[used] = '\0';
+    *size = used;
+    return buffer;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : RunScript
+//    Description   : Runs a script of shell commands without prompting or reporting successful
+//                    commands. Blank lines and lines starting with # are skipped. The data of
+//                    write is the rest of its line, the next line if there is none, or, when
+//                    given as #Length, exactly Length raw bytes following the line.
+//    Input         : char* path - Script file, or "-" for the standard input.
+//    Output        : int       - Number of failed commands, or error code:
+//                                 -1: Script could not be opened or read
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunScript(char *path)
+{
+    char *buffer = NULL, *cursor = NULL, *end = NULL, *line = NULL, *payload = NULL, *digits = NULL;
+    char *args[COMMANDMAXARGS];
+    PCOMMAND cmd = NULL;
+    size_t size = 0, mapped = 0;
+    long long lineno = 0, commands = 0, failed = 0, start = 0, elapsed = 0;
+    int fd = 0, ret = 0, argc = 0, length = 0;
+
+    fd = (strcmp(path, "-") == 0) ? 0 : open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    buffer = LoadScript(fd, &size, &mapped);
+    if (fd != 0)
+        close(fd);
+    if (buffer == NULL)
+        return -1;
+
+    setvbuf(stdout, NULL, _IOFBF, SCRIPTREADSIZE);
+    start = NowNanoseconds();
+
+    cursor = buffer;
+    end = buffer + size;
+    while ((line = NextLine(&cursor, end)) != NULL)
+    {
+        lineno++;
+        if (line[0] == '#')
+            continue;
+
+        ret = ParseCommand(line, &cmd, args, &argc, &payload);
+        if (ret == 1)
+            continue;
+
+        commands++;
+        if (ret < 0)
         {
-            if (strcmp(command[0], "create") == 0)
-            {
-                ret = CreateFile(command[1], atoi(command[2]));
-                if (ret >= 0)
-                    printf("File is successfully created with file descriptor : %d\n", ret);
-                if (ret == -1)
-                    printf("ERROR : Incorrect parameters\n");
-                if (ret == -2)
-                    printf("ERROR : There is no inodes\n");
-                if (ret == -3)
-                    printf("ERROR : File already exists\n");
-                if (ret == -4)
-                    printf("ERROR : Memory allocation failure\n");
-                continue;
-            }
-            else if (strcmp(command[0], "open") == 0)
-            {
-                ret = OpenFile(command[1], atoi(command[2]));
-                if (ret >= 0)
-                    printf("File is successfully opened with file descriptor : %d\n", ret);
-                if (ret == -1)
-                    printf("ERROR : Incorrect parameters\n");
-                if (ret == -2)
-                    printf("ERROR : File not present\n");
-                if (ret == -3)
-                    printf("ERROR : Permission denied\n");
-                continue;
-            }
-            else if (strcmp(command[0], "read") == 0)
-            {
-                fd = GetFDFromName(command[1]);
-                if (fd == -1)
-                {
-                    printf("ERROR : File not present\n");
-                    continue;
-                }
-                ptr = (char *)malloc(sizeof(atoi(command[2])) + 1);
-                if (ptr == NULL)
-                {
-                    printf("ERROR : Memory allocation failure\n");
-                    continue;
-                }
-                ret = ReadFile(fd, ptr, atoi(command[2]));
-                if (ret == -1)
-                    printf("ERROR : File not existing\n");
-                if (ret == -2)
-                    printf("ERROR : Permission denied\n");
-                if (ret == -3)
-                    printf("ERROR : Reached at end of file\n");
-                if (ret == -4)
-                    printf("ERROR : It is not a regular file\n");
-                if (ret == 0)
-                    printf("ERROR : File empty\n");
-                if (ret > 0)
-                {
-                    write(2, ptr, ret);
-                }
-                continue;
-            }
-            else
-            {
-                printf("\nERROR : Command not found !!!\n");
-                continue;
-            }
+            ReportParseError(ret);
+            printf("ERROR : at line %lld of %s\n", lineno, path);
+            failed++;
+            continue;
         }
-        else if (count == 4)
+
+        length = 0;
+        if (((cmd->Id == CMD_WRITE) || (cmd->Id == CMD_PWRITE)) && (payload == NULL))
+        {
+            payload = NextLine(&cursor, end);
+            lineno++;
+        }
+        else if (((cmd->Id == CMD_WRITE) || (cmd->Id == CMD_PWRITE)) && (payload[0] == '#'))
         {
-            if (strcmp(command[0], "lseek") == 0)
+            for (digits = payload + 1; (*digits >= '0') && (*digits <= '9'); digits++)
+                ;
+            if ((digits != payload + 1) && (*digits == '\0'))
             {
-                fd = GetFDFromName(command[1]);
-                if (fd == -1)
+                length = atoi(payload + 1);
+                payload = cursor;
+                if ((length <= 0) || (cursor > end) || (length > end - cursor))
                 {
-                    printf("ERROR : Incorrect parameter\n");
-                    continue;
+                    payload = NULL;
+                    length = 0;
                 }
-                ret = LseekFile(fd, atoi(command[2]), atoi(command[3]));
-                if (ret == -1)
+                else
                 {
-                    printf("ERROR : Unable to perform lseek\n");
+                    cursor = cursor + length;
                 }
             }
-            else
-            {
-                printf("\nERROR : Command not found !!!\n");
-                continue;
-            }
         }
+        if ((payload != NULL) && (length == 0))
+            length = strlen(payload);
+
+        ret = ExecuteCommand(cmd, args, argc, payload, length, 0);
+        if (ret == 1)
+            break;
+        if (ret == -1)
+        {
+            printf("ERROR : at line %lld of %s\n", lineno, path);
+            failed++;
+        }
+    }
+
+    elapsed = NowNanoseconds() - start;
+    fflush(stdout);
+    fprintf(stderr, "Script %s : %lld commands, %lld failed, %.3f seconds (%.0f commands/sec)\n", path, commands,
+            failed, elapsed / 1e9, (elapsed > 0) ? commands / (elapsed / 1e9) : 0.0);
+
+    if (mapped != 0)
+        munmap(buffer, mapped);
+    else
+        free(buffer);
+
+    return (int)((failed > 0x7FFFFFFF) ? 0x7FFFFFFF : failed);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//    Function Name : main
+//    Description   : Entry point for the CVFS
+//    Input         : None
+//    Output        : int - Exit status (0 for success).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    int ret = 0, count = 0, i = 0;
+    int interval = JOURNALDEFAULTINTERVAL, batch = JOURNALDEFAULTBATCH;
+    int clients = LOADDEFAULTCLIENTS, requests = -1, depth = LOADDEFAULTDEPTH;
+    int compress = -1;
+    long long size = IMAGEDEFAULTSIZE, budget = 0, inodes = 0;
+    pthread_t compressor;
+    char *image = NULL, *server = NULL, *generate = NULL, *script = NULL, *payload = NULL;
+    char *bench = NULL, *benchthreads = (char *)"1,4", *benchfiles = (char *)"4";
+    char *benchsizes = (char *)"4096", *benchpatterns = (char *)"seq,rand";
+    char str[SHELLLINESIZE], arr[SHELLLINESIZE];
+    char *args[COMMANDMAXARGS];
+    PCOMMAND cmd = NULL;
+
+    if (InitialiseCommandTable() == -1)
+    {
+        printf("ERROR : Unable to build the command table\n");
+        return 1;
+    }
+    InitialiseSlabs();
+    InitialisePerf();
+    InitialiseTrace();
+    InitialiseSuperBlock();
+
+    for (i = 1; i + 1 < argc; i = i + 2)
+    {
+        if (strcmp(argv[i], "-i") == 0)
+            image = argv[i + 1];
+        else if (strcmp(argv[i], "-s") == 0)
+            size = atoll(argv[i + 1]) * 1024 * 1024;
+        else if (strcmp(argv[i], "-c") == 0)
+            interval = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-b") == 0)
+            batch = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-m") == 0)
+            budget = atoll(argv[i + 1]);
+        else if (strcmp(argv[i], "-N") == 0)
+            inodes = atoll(argv[i + 1]);
+        else if (strcmp(argv[i], "-z") == 0)
+            compress = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-f") == 0)
+            script = argv[i + 1];
+        else if (strcmp(argv[i], "-l") == 0)
+            server = argv[i + 1];
+        else if (strcmp(argv[i], "-g") == 0)
+            generate = argv[i + 1];
+        else if (strcmp(argv[i], "-n") == 0)
+            clients = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-r") == 0)
+            requests = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-d") == 0)
+            depth = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-B") == 0)
+            bench = argv[i + 1];
+        else if (strcmp(argv[i], "-t") == 0)
+            benchthreads = argv[i + 1];
+        else if (strcmp(argv[i], "-k") == 0)
+            benchfiles = argv[i + 1];
+        else if (strcmp(argv[i], "-o") == 0)
+            benchsizes = argv[i + 1];
+        else if (strcmp(argv[i], "-p") == 0)
+            benchpatterns = argv[i + 1];
         else
+            break;
+    }
+    if ((i != argc) || ((image != NULL) && ((budget != 0) || (compress != -1))) || (compress < -1) ||
+        (inodes < 0) || (inodes > INODELIMIT) ||
+        ((bench != NULL) && ((script != NULL) || (server != NULL) || (generate != NULL))))
+    {
+        printf("Usage : %s [-i Image [-s SizeInMB] [-c CommitIntervalMs] [-b CommitBatch] | [-m BudgetMB] [-z Seconds]] [-N MaxInodes] [-f Script|-] [-l Socket]\n", argv[0]);
+        printf("        %s -g Socket [-n Clients] [-r RequestsPerClient] [-d PipelineDepth]\n", argv[0]);
+        printf("        %s -B Output [-t Threads,...] [-k FilesPerThread,...] [-o IoSize,...] [-p seq|rand,...] [-r OpsPerThread] [-i Image | -m BudgetMB] [-z Seconds] [-N MaxInodes]\n", argv[0]);
+        return 1;
+    }
+
+    if (generate != NULL)
+    {
+        ret = RunLoadGenerator(generate, clients, (requests == -1) ? LOADDEFAULTREQUESTS : requests, depth);
+        if (ret == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (ret == -2)
+            printf("ERROR : Unable to connect to %s\n", generate);
+        if (ret == -3)
+            printf("ERROR : Memory allocation failure\n");
+        return (ret == 0) ? 0 : 1;
+    }
+
+    if (image != NULL)
+    {
+        ret = MountImage(image, size, (int)inodes);
+        if (ret == -1)
+            printf("ERROR : Unable to open image %s\n", image);
+        if (ret == -2)
+            printf("ERROR : %s is not a valid image\n", image);
+        if (ret == -3)
+            printf("ERROR : Memory allocation failure\n");
+        if (ret != 0)
+            return 1;
+
+        ret = OpenJournal(image, interval, batch);
+        if (ret == -1)
+            printf("ERROR : Unable to open or replay journal %s.journal\n", image);
+        if (ret == -2)
+            printf("ERROR : Memory allocation failure\n");
+        if (ret < 0)
+            return 1;
+        if (ret > 0)
+            printf("Replayed %d journal records\n", ret);
+        printf("Image %s mounted successfully\n", image);
+    }
+    else
+    {
+        if (budget != 0)
         {
+            ret = InitialiseTier(budget);
+            if (ret == -1)
+                printf("ERROR : Memory budget must be at least %d KB\n", TIERMINFRAMES * BLOCKSIZE / 1024);
+            if (ret == -2)
+                printf("ERROR : Memory allocation failure\n");
+            if (ret == -3)
+                printf("ERROR : Unable to create the backing file\n");
+            if (ret != 0)
+                return 1;
+        }
+        if ((compress != -1) && (InitialiseCompression() == -1))
+        {
+            printf("ERROR : Memory allocation failure\n");
+            return 1;
+        }
+        InitialiseNameIndex();
+        if (CreateDILB((inodes == 0) ? DEFAULTMAXINODES : (int)inodes) == -1)
+        {
+            printf("ERROR : Unable to reserve the inode table\n");
+            return 1;
+        }
+        if ((compress > 0) && (pthread_create(&compressor, NULL, Compressor, &compress) == 0))
+            pthread_detach(compressor);
+    }
+
+    if (bench != NULL)
+    {
+        ret = RunBenchmark(bench, benchthreads, benchfiles, benchsizes, benchpatterns,
+                           (requests == -1) ? BENCHDEFAULTOPS : requests);
+        if (ret == -1)
+            printf("ERROR : Incorrect parameters\n");
+        if (ret == -2)
+            printf("ERROR : Not enough free inodes for threads x files per thread\n");
+        if (ret == -3)
+            printf("ERROR : Unable to create %s\n", bench);
+        if (ret == -4)
+            printf("ERROR : Memory allocation failure\n");
+        if (ret == -5)
+            printf("ERROR : Unable to start the benchmark threads\n");
+        if (ret > 0)
+            printf("%d benchmark results written to %s\n", ret, bench);
+        UnmountImage();
+        return (ret > 0) ? 0 : 1;
+    }
+
+    if (script != NULL)
+    {
+        ret = RunScript(script);
+        if (ret == -1)
+            printf("ERROR : Unable to read script %s\n", script);
+        if ((ret != 0) || (server == NULL))
+        {
+            UnmountImage();
+            return (ret == 0) ? 0 : 1;
+        }
+    }
+
+    if (server != NULL)
+    {
+        ret = RunServer(server);
+        if (ret == -1)
+            printf("ERROR : Unable to listen on %s\n", server);
+        if (ret == -2)
+            printf("ERROR : Unable to start the event loops\n");
+        if (image != NULL)
+            UnmountImage();
+        return (ret == 0) ? 0 : 1;
+    }
+
+    while (1)
+    {
+        printf("\nVFS : > ");
+        fflush(stdout);
+
+        if (fgets(str, SHELLLINESIZE, stdin) == NULL)
+            break;
+        str[strcspn(str, "\r\n")] = '\0';
+
+        ret = ParseCommand(str, &cmd, args, &count, &payload);
+        if (ret == 1)
             continue;
+        if (ret < 0)
+        {
+            ReportParseError(ret);
+            continue;
+        }
+
+        if (((cmd->Id == CMD_WRITE) || (cmd->Id == CMD_PWRITE)) && (payload == NULL))
+        {
+            printf("Enter the data : \n");
+            if (fgets(arr, SHELLLINESIZE, stdin) == NULL)
+                break;
+            arr[strcspn(arr, "\r\n")] = '\0';
+            payload = arr;
         }
+
+        if (ExecuteCommand(cmd, args, count, payload, (payload == NULL) ? 0 : strlen(payload), 1) == 1)
+            break;
     }
+    UnmountImage();
     return 0;
 }